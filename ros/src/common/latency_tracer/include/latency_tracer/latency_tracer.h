@@ -0,0 +1,114 @@
+/*
+ *  Copyright (c) 2018, Nagoya University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of Autoware nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef LATENCY_TRACER_H
+#define LATENCY_TRACER_H
+
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <ros/ros.h>
+
+#include <autoware_msgs/LatencyTrace.h>
+
+namespace latency_tracer
+{
+/*
+ * Records when a node receives, processes and publishes each message, keyed by the
+ * header stamp of the sensor message the data originates from. Every traced message
+ * is published on /latency_trace and optionally appended to a CSV file. Aggregated
+ * numbers are published on /diagnostics about once per second.
+ *
+ * Queue wait is measured against the publish time reported by an upstream node for
+ * the same stamp, so chaining points_downsampler -> ndt_matching shows where the
+ * time between points_raw and ndt_pose goes. The upstream record normally arrives
+ * after this node has published, so traces with an upstream are emitted once it does.
+ *
+ * Private parameters:
+ *   latency_trace          enable tracing (default: false)
+ *   latency_trace_upstream name of the upstream node, e.g. /voxel_grid_filter (default: none)
+ *   latency_trace_file     CSV file to append records to (default: none)
+ *   latency_trace_budget   end-to-end latency above which diagnostics warn [ms] (default: 100)
+ */
+class LatencyTracer
+{
+public:
+  LatencyTracer(ros::NodeHandle& nh, ros::NodeHandle& private_nh);
+  ~LatencyTracer();
+
+  void receive(const ros::Time& stamp);
+  void process(const ros::Time& stamp);
+  void publish(const ros::Time& stamp);
+
+  bool isEnabled() const
+  {
+    return enabled_;
+  }
+
+private:
+  struct Statistics
+  {
+    int count;
+    double latency_sum, latency_max;
+    double process_time_sum, process_time_max;
+    double publish_time_sum, publish_time_max;
+    int queue_wait_count;
+    double queue_wait_sum, queue_wait_max;
+  };
+
+  void upstreamCallback(const autoware_msgs::LatencyTrace::ConstPtr& msg);
+  void record(const autoware_msgs::LatencyTrace& trace);  // Statistics and CSV, with mutex_ held
+  void emit(const std::vector<autoware_msgs::LatencyTrace>& traces);
+  void publishDiagnostics();
+  void resetStatistics();
+
+  bool enabled_;
+  std::string node_name_;
+  std::string upstream_;
+  double budget_;
+
+  ros::Publisher trace_pub_;
+  ros::Publisher diagnostics_pub_;
+  ros::Subscriber upstream_sub_;
+  std::ofstream ofs_;
+
+  std::mutex mutex_;
+  std::map<ros::Time, autoware_msgs::LatencyTrace> pending_;  // Received but not yet published
+  std::map<ros::Time, autoware_msgs::LatencyTrace> awaiting_upstream_;  // Published, waiting for the upstream record
+  std::map<ros::Time, ros::Time> upstream_publish_;  // Upstream records that arrived first, publish time per stamp
+  Statistics statistics_;
+  ros::WallTime last_diagnostics_;
+};
+}  // namespace latency_tracer
+
+#endif  // LATENCY_TRACER_H
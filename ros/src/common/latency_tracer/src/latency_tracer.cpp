@@ -0,0 +1,341 @@
+/*
+ *  Copyright (c) 2018, Nagoya University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of Autoware nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "latency_tracer/latency_tracer.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <diagnostic_msgs/DiagnosticArray.h>
+
+namespace latency_tracer
+{
+// Bounds for the bookkeeping maps, in messages. Anything older is certainly stale.
+static const size_t MAX_PENDING = 100;
+static const size_t MAX_UPSTREAM = 1000;
+
+static double toMilliseconds(const ros::Duration& d)
+{
+  return d.toSec() * 1000.0;
+}
+
+LatencyTracer::LatencyTracer(ros::NodeHandle& nh, ros::NodeHandle& private_nh)
+  : enabled_(false), node_name_(ros::this_node::getName()), budget_(100.0)
+{
+  private_nh.param<bool>("latency_trace", enabled_, false);
+  if (!enabled_)
+  {
+    return;
+  }
+
+  std::string filename;
+  private_nh.param<std::string>("latency_trace_upstream", upstream_, "");
+  private_nh.param<std::string>("latency_trace_file", filename, "");
+  private_nh.param<double>("latency_trace_budget", budget_, 100.0);
+
+  trace_pub_ = nh.advertise<autoware_msgs::LatencyTrace>("/latency_trace", 100);
+  diagnostics_pub_ = nh.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 10);
+  if (!upstream_.empty())
+  {
+    upstream_sub_ = nh.subscribe("/latency_trace", 100, &LatencyTracer::upstreamCallback, this);
+  }
+
+  if (!filename.empty())
+  {
+    ofs_.open(filename.c_str(), std::ios::app);
+    if (!ofs_)
+    {
+      ROS_ERROR("Could not open %s.", filename.c_str());
+    }
+    else
+    {
+      ofs_ << "stamp,node,receive,process,publish,queue_wait[ms],process_time[ms],publish_time[ms],latency[ms]" << std::endl;
+    }
+  }
+
+  resetStatistics();
+  last_diagnostics_ = ros::WallTime::now();
+}
+
+LatencyTracer::~LatencyTracer()
+{
+  if (ofs_.is_open())
+  {
+    ofs_.close();
+  }
+}
+
+void LatencyTracer::receive(const ros::Time& stamp)
+{
+  if (!enabled_)
+  {
+    return;
+  }
+
+  ros::Time now = ros::Time::now();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  autoware_msgs::LatencyTrace& trace = pending_[stamp];
+  trace.header.stamp = stamp;
+  trace.node = node_name_;
+  trace.receive = now;
+  trace.process = now;
+
+  while (pending_.size() > MAX_PENDING)
+  {
+    pending_.erase(pending_.begin());
+  }
+}
+
+void LatencyTracer::process(const ros::Time& stamp)
+{
+  if (!enabled_)
+  {
+    return;
+  }
+
+  ros::Time now = ros::Time::now();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::map<ros::Time, autoware_msgs::LatencyTrace>::iterator it = pending_.find(stamp);
+  if (it != pending_.end())
+  {
+    it->second.process = now;
+  }
+}
+
+void LatencyTracer::publish(const ros::Time& stamp)
+{
+  if (!enabled_)
+  {
+    return;
+  }
+
+  ros::Time now = ros::Time::now();
+  std::vector<autoware_msgs::LatencyTrace> finished;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  std::map<ros::Time, autoware_msgs::LatencyTrace>::iterator it = pending_.find(stamp);
+  if (it == pending_.end())
+  {
+    return;
+  }
+
+  autoware_msgs::LatencyTrace trace = it->second;
+  pending_.erase(it);
+
+  trace.publish = now;
+  if (trace.process == trace.receive)
+  {
+    trace.process = now;
+  }
+  trace.process_time = toMilliseconds(trace.process - trace.receive);
+  trace.publish_time = toMilliseconds(trace.publish - trace.process);
+  trace.latency = toMilliseconds(trace.publish - stamp);
+
+  if (upstream_.empty())
+  {
+    trace.queue_wait = toMilliseconds(trace.receive - stamp);
+    finished.push_back(trace);
+  }
+  else
+  {
+    // The upstream node publishes its trace after its data, so its record usually arrives
+    // after this one is done. The trace waits for it in upstreamCallback.
+    std::map<ros::Time, ros::Time>::iterator upstream = upstream_publish_.find(stamp);
+    if (upstream != upstream_publish_.end())
+    {
+      trace.queue_wait = toMilliseconds(trace.receive - upstream->second);
+      upstream_publish_.erase(upstream);
+      finished.push_back(trace);
+    }
+    else
+    {
+      awaiting_upstream_[stamp] = trace;
+      while (awaiting_upstream_.size() > MAX_PENDING)
+      {
+        awaiting_upstream_.begin()->second.queue_wait = -1.0;
+        finished.push_back(awaiting_upstream_.begin()->second);
+        awaiting_upstream_.erase(awaiting_upstream_.begin());
+      }
+    }
+  }
+
+  for (size_t i = 0; i < finished.size(); i++)
+  {
+    record(finished[i]);
+  }
+  lock.unlock();
+
+  emit(finished);
+}
+
+void LatencyTracer::upstreamCallback(const autoware_msgs::LatencyTrace::ConstPtr& msg)
+{
+  if (msg->node != upstream_)
+  {
+    return;
+  }
+
+  std::vector<autoware_msgs::LatencyTrace> finished;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  std::map<ros::Time, autoware_msgs::LatencyTrace>::iterator it = awaiting_upstream_.find(msg->header.stamp);
+  if (it != awaiting_upstream_.end())
+  {
+    it->second.queue_wait = toMilliseconds(it->second.receive - msg->publish);
+    finished.push_back(it->second);
+    awaiting_upstream_.erase(it);
+    record(finished.back());
+  }
+  else
+  {
+    upstream_publish_[msg->header.stamp] = msg->publish;
+    while (upstream_publish_.size() > MAX_UPSTREAM)
+    {
+      upstream_publish_.erase(upstream_publish_.begin());
+    }
+  }
+  lock.unlock();
+
+  emit(finished);
+}
+
+void LatencyTracer::record(const autoware_msgs::LatencyTrace& trace)
+{
+  statistics_.count++;
+  statistics_.latency_sum += trace.latency;
+  statistics_.latency_max = std::max(statistics_.latency_max, trace.latency);
+  statistics_.process_time_sum += trace.process_time;
+  statistics_.process_time_max = std::max(statistics_.process_time_max, trace.process_time);
+  statistics_.publish_time_sum += trace.publish_time;
+  statistics_.publish_time_max = std::max(statistics_.publish_time_max, trace.publish_time);
+  if (trace.queue_wait >= 0.0)
+  {
+    statistics_.queue_wait_count++;
+    statistics_.queue_wait_sum += trace.queue_wait;
+    statistics_.queue_wait_max = std::max(statistics_.queue_wait_max, trace.queue_wait);
+  }
+
+  if (ofs_.is_open())
+  {
+    ofs_ << trace.header.stamp << "," << trace.node << "," << trace.receive << "," << trace.process << ","
+         << trace.publish << "," << trace.queue_wait << "," << trace.process_time << "," << trace.publish_time << ","
+         << trace.latency << std::endl;
+  }
+}
+
+void LatencyTracer::emit(const std::vector<autoware_msgs::LatencyTrace>& traces)
+{
+  for (size_t i = 0; i < traces.size(); i++)
+  {
+    trace_pub_.publish(traces[i]);
+  }
+
+  bool publish_diagnostics;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    publish_diagnostics = (ros::WallTime::now() - last_diagnostics_).toSec() >= 1.0;
+  }
+  if (publish_diagnostics)
+  {
+    publishDiagnostics();
+  }
+}
+
+void LatencyTracer::publishDiagnostics()
+{
+  diagnostic_msgs::DiagnosticStatus status;
+  status.name = "latency_trace: " + node_name_;
+  status.hardware_id = node_name_;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (statistics_.count == 0)
+    {
+      return;
+    }
+
+    double latency_mean = statistics_.latency_sum / statistics_.count;
+    double process_time_mean = statistics_.process_time_sum / statistics_.count;
+    double publish_time_mean = statistics_.publish_time_sum / statistics_.count;
+    double queue_wait_mean =
+        (statistics_.queue_wait_count > 0) ? statistics_.queue_wait_sum / statistics_.queue_wait_count : -1.0;
+
+    if (statistics_.latency_max > budget_)
+    {
+      status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+      status.message = "Latency exceeds budget";
+    }
+    else
+    {
+      status.level = diagnostic_msgs::DiagnosticStatus::OK;
+      status.message = "OK";
+    }
+
+    const std::pair<std::string, double> values[] = {
+      std::make_pair("messages", static_cast<double>(statistics_.count)),
+      std::make_pair("latency_mean[ms]", latency_mean),
+      std::make_pair("latency_max[ms]", statistics_.latency_max),
+      std::make_pair("process_time_mean[ms]", process_time_mean),
+      std::make_pair("process_time_max[ms]", statistics_.process_time_max),
+      std::make_pair("publish_time_mean[ms]", publish_time_mean),
+      std::make_pair("publish_time_max[ms]", statistics_.publish_time_max),
+      std::make_pair("queue_wait_mean[ms]", queue_wait_mean),
+      std::make_pair("queue_wait_max[ms]", statistics_.queue_wait_max),
+    };
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+    {
+      diagnostic_msgs::KeyValue kv;
+      kv.key = values[i].first;
+      kv.value = std::to_string(values[i].second);
+      status.values.push_back(kv);
+    }
+
+    resetStatistics();
+    last_diagnostics_ = ros::WallTime::now();
+  }
+
+  diagnostic_msgs::DiagnosticArray array;
+  array.header.stamp = ros::Time::now();
+  array.status.push_back(status);
+  diagnostics_pub_.publish(array);
+}
+
+void LatencyTracer::resetStatistics()
+{
+  statistics_.count = 0;
+  statistics_.latency_sum = statistics_.latency_max = 0.0;
+  statistics_.process_time_sum = statistics_.process_time_max = 0.0;
+  statistics_.publish_time_sum = statistics_.publish_time_max = 0.0;
+  statistics_.queue_wait_count = 0;
+  statistics_.queue_wait_sum = statistics_.queue_wait_max = 0.0;
+}
+}  // namespace latency_tracer
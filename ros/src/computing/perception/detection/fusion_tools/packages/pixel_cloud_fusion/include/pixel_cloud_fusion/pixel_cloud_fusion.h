@@ -43,6 +43,8 @@
 #include <vector>
 #include <unordered_map>
 #include <chrono>
+#include <cstddef>
+#include <cstring>
 
 #include <ros/ros.h>
 #include <tf/tf.h>
@@ -71,6 +73,8 @@
 
 #include <Eigen/Eigen>
 
+#include <points_image/points_projection.hpp>
+
 namespace std {
 	template <>
 	class hash< cv::Point >{
@@ -94,6 +98,8 @@ class RosPixelCloudFusionApp
 	cv::Size                            image_size_;
 	cv::Mat                             camera_instrinsics_;
 	cv::Mat                             distortion_coefficients_;
+	cv::Mat                             undistort_map1_;
+	cv::Mat                             undistort_map2_;
 	cv::Mat                             current_frame_;
 
 	std::string 						image_frame_id_;
@@ -103,7 +109,11 @@ class RosPixelCloudFusionApp
 	bool                                camera_lidar_tf_ok_;
 
 	float                               fx_, fy_, cx_, cy_;
-	pcl::PointCloud<pcl::PointXYZRGB>   colored_cloud_;
+	pcl::PointCloud<pcl::PointXYZ>      in_cloud_;
+	sensor_msgs::PointCloud2            fused_cloud_msg_;
+	PointsProjection                    projection_;
+	bool                                projection_ok_;
+	cv::Size                            projection_size_;
 
 	typedef
 	message_filters::sync_policies::ApproximateTime<sensor_msgs::PointCloud2, sensor_msgs::Image> SyncPolicyT;
@@ -112,8 +122,6 @@ class RosPixelCloudFusionApp
 	ros::Subscriber                     image_subscriber_;
 	message_filters::Synchronizer<SyncPolicyT>              *cloud_synchronizer_;
 
-	pcl::PointXYZ TransformPoint(const pcl::PointXYZ &in_point, const tf::StampedTransform &in_transform);
-
 	void ImageCallback(const sensor_msgs::Image::ConstPtr &in_image_msg);
 
 	void CloudCallback(const sensor_msgs::PointCloud2::ConstPtr &in_cloud_msg);
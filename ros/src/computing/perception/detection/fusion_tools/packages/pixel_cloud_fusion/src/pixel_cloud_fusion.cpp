@@ -37,14 +37,6 @@
 
 #include "pixel_cloud_fusion/pixel_cloud_fusion.h"
 
-pcl::PointXYZ
-RosPixelCloudFusionApp::TransformPoint(const pcl::PointXYZ &in_point, const tf::StampedTransform &in_transform)
-{
-	tf::Vector3 tf_point(in_point.x, in_point.y, in_point.z);
-	tf::Vector3 tf_point_t = in_transform * tf_point;
-	return pcl::PointXYZ(tf_point_t.x(), tf_point_t.y(), tf_point_t.z());
-}
-
 void RosPixelCloudFusionApp::ImageCallback(const sensor_msgs::Image::ConstPtr &in_image_msg)
 {
 	if (!camera_info_ok_)
@@ -55,11 +47,16 @@ void RosPixelCloudFusionApp::ImageCallback(const sensor_msgs::Image::ConstPtr &i
 	if (processing_)
 		return;
 
-	cv_bridge::CvImagePtr cv_image = cv_bridge::toCvCopy(in_image_msg, "bgr8");
-	cv::Mat in_image = cv_image->image;
+	cv_bridge::CvImageConstPtr cv_image = cv_bridge::toCvShare(in_image_msg, "bgr8");
+	const cv::Mat &in_image = cv_image->image;
 
-	cv::Mat undistorted_image;
-	cv::undistort(in_image, current_frame_, camera_instrinsics_, distortion_coefficients_);
+	//same as cv::undistort, but the maps only depend on the intrinsics and are built once
+	if (undistort_map1_.empty() || undistort_map1_.size() != in_image.size())
+	{
+		cv::initUndistortRectifyMap(camera_instrinsics_, distortion_coefficients_, cv::Mat(), camera_instrinsics_,
+		                            in_image.size(), CV_16SC2, undistort_map1_, undistort_map2_);
+	}
+	cv::remap(in_image, current_frame_, undistort_map1_, undistort_map2_, cv::INTER_LINEAR, cv::BORDER_CONSTANT);
 
 	image_frame_id_ = in_image_msg->header.frame_id;
 	image_size_.height = current_frame_.rows;
@@ -84,56 +81,113 @@ void RosPixelCloudFusionApp::CloudCallback(const sensor_msgs::PointCloud2::Const
 		return;
 	}
 
-	pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud(new pcl::PointCloud<pcl::PointXYZ>);
-	pcl::PointCloud<pcl::PointXYZRGB>::Ptr out_cloud(new pcl::PointCloud<pcl::PointXYZRGB>);
-	pcl::fromROSMsg(*in_cloud_msg, *in_cloud);
-	std::unordered_map<cv::Point, pcl::PointXYZ> projection_map;
-
-	std::vector<pcl::PointXYZ> cam_cloud(in_cloud->points.size());
-	for (size_t i = 0; i < in_cloud->points.size(); i++)
+	//the projection only depends on the extrinsics and intrinsics, set it up again only when they change
+	if (!projection_ok_ || projection_size_ != image_size_)
 	{
-		cam_cloud[i] = TransformPoint(in_cloud->points[i], camera_lidar_tf_);
-		int u = int(cam_cloud[i].x * fx_ / cam_cloud[i].z + cx_);
-		int v = int(cam_cloud[i].y * fy_ / cam_cloud[i].z + cy_);
-		if ((u >= 0) && (u < image_size_.width)
-			&& (v >= 0) && (v < image_size_.height)
-			&& cam_cloud[i].z > 0
-				)
+		//the image is already undistorted, project with the rectified intrinsics only
+		float lidar_to_camera[12];
+		const tf::Matrix3x3 &basis = camera_lidar_tf_.getBasis();
+		const tf::Vector3 &origin = camera_lidar_tf_.getOrigin();
+		for (int row = 0; row < 3; row++)
 		{
-			projection_map.insert(std::pair<cv::Point, pcl::PointXYZ>(cv::Point(u, v), in_cloud->points[i]));
+			for (int col = 0; col < 3; col++)
+			{
+				lidar_to_camera[row * 4 + col] = basis[row][col];
+			}
+			lidar_to_camera[row * 4 + 3] = origin[row];
 		}
+		cv::Mat camera_matrix = (cv::Mat_<double>(3, 3) << fx_, 0, cx_, 0, fy_, cy_, 0, 0, 1);
+		projection_.setCamera(lidar_to_camera, camera_matrix, cv::Mat::zeros(1, 5, CV_64F), image_size_);
+		projection_.setMinDepth(0.f);
+		projection_size_ = image_size_;
+		projection_ok_ = true;
+	}
+
+	//neither path below may read past the data of an inconsistent message
+	const size_t row_size = static_cast<size_t>(in_cloud_msg->width) * in_cloud_msg->point_step;
+	if (in_cloud_msg->row_step < row_size ||
+	    in_cloud_msg->data.size() < static_cast<size_t>(in_cloud_msg->row_step) * in_cloud_msg->height)
+	{
+		ROS_WARN("[%s] Dropping a cloud whose data is smaller than its size.", __APP_NAME__);
+		return;
 	}
 
-	out_cloud->points.clear();
+	//project straight from the message when it holds packed float x, y, z in dense rows, from a converted copy otherwise
+	int x_offset = -1, y_offset = -1, z_offset = -1;
+	for (size_t i = 0; i < in_cloud_msg->fields.size(); i++)
+	{
+		const sensor_msgs::PointField &field = in_cloud_msg->fields[i];
+		if (field.datatype != sensor_msgs::PointField::FLOAT32)
+			continue;
+		if (field.name == "x")
+			x_offset = field.offset;
+		else if (field.name == "y")
+			y_offset = field.offset;
+		else if (field.name == "z")
+			z_offset = field.offset;
+	}
+	const uint8_t *points;
+	size_t point_step, num_points;
+	if (x_offset >= 0 && y_offset == x_offset + 4 && z_offset == x_offset + 8 && !in_cloud_msg->is_bigendian &&
+	    x_offset + 3 * sizeof(float) <= in_cloud_msg->point_step && in_cloud_msg->row_step == row_size)
+	{
+		points = in_cloud_msg->data.data() + x_offset;
+		point_step = in_cloud_msg->point_step;
+		num_points = in_cloud_msg->width * in_cloud_msg->height;
+	}
+	else
+	{
+		pcl::fromROSMsg(*in_cloud_msg, in_cloud_);
+		points = reinterpret_cast<const uint8_t *>(in_cloud_.points.data());
+		point_step = sizeof(pcl::PointXYZ);
+		num_points = in_cloud_.points.size();
+	}
+	projection_.project(points, num_points, point_step);
 
-#pragma omp for
-	for (int row = 0; row < image_size_.height; row++)
+	//nearest point of every hit pixel, written as pcl::PointXYZRGB into the reused message
+	const std::vector<int32_t> &hit_pixels = projection_.hitPixels();
+	const std::vector<int32_t> &nearest = projection_.nearest();
+	const size_t fused_point_step = sizeof(pcl::PointXYZRGB);
+	if (fused_cloud_msg_.fields.empty())
 	{
-		for (int col = 0; col < image_size_.width; col++)
+		const char *names[4] = {"x", "y", "z", "rgb"};
+		const uint32_t offsets[4] = {offsetof(pcl::PointXYZRGB, x), offsetof(pcl::PointXYZRGB, y),
+		                             offsetof(pcl::PointXYZRGB, z), offsetof(pcl::PointXYZRGB, rgb)};
+		fused_cloud_msg_.fields.resize(4);
+		for (int i = 0; i < 4; i++)
 		{
-			std::unordered_map<cv::Point, pcl::PointXYZ>::const_iterator iterator_3d_2d;
-			pcl::PointXYZ corresponding_3d_point;
-			pcl::PointXYZRGB colored_3d_point;
-			iterator_3d_2d = projection_map.find(cv::Point(col, row));
-			if (iterator_3d_2d != projection_map.end())
-			{
-				corresponding_3d_point = iterator_3d_2d->second;
-				cv::Vec3b rgb_pixel = current_frame_.at<cv::Vec3b>(row, col);
-				colored_3d_point.x = corresponding_3d_point.x;
-				colored_3d_point.y = corresponding_3d_point.y;
-				colored_3d_point.z = corresponding_3d_point.z;
-				colored_3d_point.r = rgb_pixel[2];
-				colored_3d_point.g = rgb_pixel[1];
-				colored_3d_point.b = rgb_pixel[0];
-				out_cloud->points.push_back(colored_3d_point);
-			}
+			fused_cloud_msg_.fields[i].name = names[i];
+			fused_cloud_msg_.fields[i].offset = offsets[i];
+			fused_cloud_msg_.fields[i].datatype = sensor_msgs::PointField::FLOAT32;
+			fused_cloud_msg_.fields[i].count = 1;
 		}
+		fused_cloud_msg_.height = 1;
+		fused_cloud_msg_.is_bigendian = false;
+		fused_cloud_msg_.is_dense = true;
+		fused_cloud_msg_.point_step = fused_point_step;
+	}
+	fused_cloud_msg_.header = in_cloud_msg->header;
+	fused_cloud_msg_.width = hit_pixels.size();
+	fused_cloud_msg_.row_step = fused_point_step * hit_pixels.size();
+	fused_cloud_msg_.data.resize(fused_cloud_msg_.row_step);
+
+#pragma omp parallel for
+	for (int k = 0; k < static_cast<int>(hit_pixels.size()); k++)
+	{
+		const int32_t pixel = hit_pixels[k];
+		const float *corresponding_3d_point = reinterpret_cast<const float *>(points + nearest[pixel] * point_step);
+		cv::Vec3b rgb_pixel = current_frame_.at<cv::Vec3b>(pixel / image_size_.width, pixel % image_size_.width);
+		pcl::PointXYZRGB colored_3d_point;
+		colored_3d_point.x = corresponding_3d_point[0];
+		colored_3d_point.y = corresponding_3d_point[1];
+		colored_3d_point.z = corresponding_3d_point[2];
+		colored_3d_point.r = rgb_pixel[2];
+		colored_3d_point.g = rgb_pixel[1];
+		colored_3d_point.b = rgb_pixel[0];
+		memcpy(&fused_cloud_msg_.data[k * fused_point_step], &colored_3d_point, fused_point_step);
 	}
 	// Publish PC
-	sensor_msgs::PointCloud2 cloud_msg;
-	pcl::toROSMsg(*out_cloud, cloud_msg);
-	cloud_msg.header = in_cloud_msg->header;
-	publisher_fused_cloud_.publish(cloud_msg);
+	publisher_fused_cloud_.publish(fused_cloud_msg_);
 }
 
 void RosPixelCloudFusionApp::IntrinsicsCallback(const sensor_msgs::CameraInfo &in_message)
@@ -161,6 +215,10 @@ void RosPixelCloudFusionApp::IntrinsicsCallback(const sensor_msgs::CameraInfo &i
 	cx_ = static_cast<float>(in_message.P[2]);
 	cy_ = static_cast<float>(in_message.P[6]);
 
+	undistort_map1_.release();
+	undistort_map2_.release();
+	projection_ok_ = false;
+
 	intrinsics_subscriber_.shutdown();
 	camera_info_ok_ = true;
 	ROS_INFO("[%s] CameraIntrinsics obtained.", __APP_NAME__);
@@ -176,6 +234,7 @@ RosPixelCloudFusionApp::FindTransform(const std::string &in_target_frame, const
 	{
 		transform_listener_->lookupTransform(in_target_frame, in_source_frame, ros::Time(0), transform);
 		camera_lidar_tf_ok_ = true;
+		projection_ok_ = false;
 		ROS_INFO("[%s] Camera-Lidar TF obtained", __APP_NAME__);
 	}
 	catch (tf::TransformException ex)
@@ -255,5 +314,6 @@ RosPixelCloudFusionApp::RosPixelCloudFusionApp()
 	camera_lidar_tf_ok_ = false;
 	camera_info_ok_ = false;
 	processing_ = false;
+	projection_ok_ = false;
 	image_frame_id_ = "";
 }
\ No newline at end of file
@@ -0,0 +1,72 @@
+#ifndef GRID_EUCLIDEAN_H_
+#define GRID_EUCLIDEAN_H_
+
+#include <cstddef>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+/*
+ * Distance banded Euclidean clustering on 2D occupancy grids.
+ *
+ * Points are assigned to distance bands as in segmentByDistance, rasterized on
+ * the XY plane into one grid per band whose cell size is the clustering
+ * threshold of the band, and clusters are the 8-connected components of the
+ * occupied cells, found with union-find. Two points closer than the threshold
+ * always end up in the same cluster; points up to two cells apart may also be
+ * joined, which is the price of skipping the kd-tree radius queries.
+ * All buffers are kept between scans.
+ */
+class GridEuclideanCluster {
+public:
+	typedef struct {
+		int band;
+		std::vector<int> points_in_cluster;
+	} GClusterIndex;
+
+	GridEuclideanCluster();
+
+	/* \brief Sets the distance bands
+	 * \param[in] in_distances 	Upper distance of every band but the last one, ascending
+	 * \param[in] in_thresholds Clustering threshold (grid cell size) of every band, one more than in_distances
+	 */
+	void setBands(const std::vector<double>& in_distances, const std::vector<double>& in_thresholds);
+	void setMinClusterPts(int min_cluster_pts);
+	void setMaxClusterPts(int max_cluster_pts);
+
+	/* \brief Clusters the XY projection of the cloud. Output indices refer to in_cloud.
+	 */
+	void extractClusters(const pcl::PointCloud<pcl::PointXYZ>& in_cloud);
+
+	/* \brief Clusters of the last extraction, grouped by band in ascending order
+	 */
+	const std::vector<GClusterIndex>& getOutput() const;
+
+private:
+	struct Band {
+		double cell_size;
+		float min_x, min_y, max_x, max_y;
+		int width, height;
+		std::vector<int> points;			// indices of the points in the band
+		std::vector<int> point_cells;		// occupied cell slot of every point in points
+		std::vector<int> cell_slots;		// grid of occupied cell slots, -1 when empty
+		std::vector<int> occupied_cells;	// grid index of every occupied cell slot
+		std::vector<int> parents;			// union-find forest over the occupied cell slots
+		std::vector<int> component_sizes;
+		std::vector<int> component_clusters;
+	};
+
+	void clusterBand(Band& in_out_band, int in_band_index);
+	int findRoot(std::vector<int>& in_out_parents, int in_slot);
+
+	std::vector<double> distances_;
+	std::vector<Band> bands_;
+	int min_cluster_pts_;
+	int max_cluster_pts_;
+
+	std::vector<GClusterIndex> clusters_;
+	size_t cluster_num_;
+};
+
+#endif
@@ -130,6 +130,10 @@ void Cluster::SetCloud(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_origin_cloud
 	float min_y=std::numeric_limits<float>::max();float max_y=-std::numeric_limits<float>::max();
 	float min_z=std::numeric_limits<float>::max();float max_z=-std::numeric_limits<float>::max();
 	float average_x = 0, average_y = 0, average_z = 0;
+	//sums for the PCA, so it works from the indices without another copy of the cluster
+	double sum_x = 0, sum_y = 0, sum_z = 0;
+	double sum_xx = 0, sum_xy = 0, sum_xz = 0, sum_yy = 0, sum_yz = 0, sum_zz = 0;
+	current_cluster->points.reserve(in_cluster_indices.size());
 
 	for (auto pit = in_cluster_indices.begin(); pit != in_cluster_indices.end(); ++pit)
 	{
@@ -143,6 +147,9 @@ void Cluster::SetCloud(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_origin_cloud
 		p.b = in_b;
 
 		average_x+=p.x;		average_y+=p.y;		average_z+=p.z;
+		sum_x += p.x;		sum_y += p.y;		sum_z += p.z;
+		sum_xx += p.x*p.x;	sum_xy += p.x*p.y;	sum_xz += p.x*p.z;
+		sum_yy += p.y*p.y;	sum_yz += p.y*p.z;	sum_zz += p.z*p.z;
 		centroid_.x += p.x; centroid_.y += p.y;	centroid_.z += p.z;
 		current_cluster->points.push_back(p);
 
@@ -191,6 +198,7 @@ void Cluster::SetCloud(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_origin_cloud
 
 	{
 		std::vector<cv::Point2f> points;
+		points.reserve(current_cluster->points.size());
 		for (unsigned int i=0; i<current_cluster->points.size(); i++)
 		{
 			cv::Point2f pt;
@@ -259,16 +267,25 @@ void Cluster::SetCloud(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_origin_cloud
 	current_cluster->is_dense = true;
 
 	//Get EigenValues, eigenvectors
+	//same as pcl::PCA: eigen decomposition of the (unnormalized) scatter matrix, in descending order
 	if (current_cluster->points.size() > 0)
 	{
-		pcl::PCA<pcl::PointXYZ> current_cluster_pca;
-		pcl::PointCloud<pcl::PointXYZ>::Ptr current_cluster_mono (new pcl::PointCloud<pcl::PointXYZ>);
-
-		pcl::copyPointCloud<pcl::PointXYZRGB, pcl::PointXYZ>(*current_cluster, *current_cluster_mono);
-
-		current_cluster_pca.setInputCloud(current_cluster_mono);
-		eigen_vectors_ = current_cluster_pca.getEigenVectors();
-		eigen_values_ = current_cluster_pca.getEigenValues();
+		double n = current_cluster->points.size();
+		double mean_x = sum_x/n, mean_y = sum_y/n, mean_z = sum_z/n;
+		Eigen::Matrix3f scatter;
+		scatter(0, 0) = sum_xx - n*mean_x*mean_x;
+		scatter(0, 1) = scatter(1, 0) = sum_xy - n*mean_x*mean_y;
+		scatter(0, 2) = scatter(2, 0) = sum_xz - n*mean_x*mean_z;
+		scatter(1, 1) = sum_yy - n*mean_y*mean_y;
+		scatter(1, 2) = scatter(2, 1) = sum_yz - n*mean_y*mean_z;
+		scatter(2, 2) = sum_zz - n*mean_z*mean_z;
+
+		Eigen::SelfAdjointEigenSolver<Eigen::Matrix3f> eigen_solver(scatter);
+		for (int i = 0; i < 3; i++)
+		{
+			eigen_values_[i] = eigen_solver.eigenvalues()[2-i];
+			eigen_vectors_.col(i) = eigen_solver.eigenvectors().col(2-i);
+		}
 	}
 
 	valid_cluster_ = true;
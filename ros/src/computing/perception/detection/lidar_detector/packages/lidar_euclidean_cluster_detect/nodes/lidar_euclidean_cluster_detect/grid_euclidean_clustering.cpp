@@ -0,0 +1,199 @@
+#include "grid_euclidean_clustering.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Grids larger than this are coarsened, so that a stray far point cannot allocate a huge grid
+static const long long MAX_GRID_CELLS = 1LL << 22;
+
+GridEuclideanCluster::GridEuclideanCluster() :
+	min_cluster_pts_(1), max_cluster_pts_(std::numeric_limits<int>::max()), cluster_num_(0)
+{
+}
+
+void GridEuclideanCluster::setBands(const std::vector<double>& in_distances, const std::vector<double>& in_thresholds)
+{
+	distances_ = in_distances;
+	bands_.resize(in_thresholds.size());
+	for (size_t i = 0; i < bands_.size(); i++)
+	{
+		bands_[i].cell_size = in_thresholds[i];
+	}
+}
+
+void GridEuclideanCluster::setMinClusterPts(int min_cluster_pts)
+{
+	min_cluster_pts_ = min_cluster_pts;
+}
+
+void GridEuclideanCluster::setMaxClusterPts(int max_cluster_pts)
+{
+	max_cluster_pts_ = max_cluster_pts;
+}
+
+const std::vector<GridEuclideanCluster::GClusterIndex>& GridEuclideanCluster::getOutput() const
+{
+	return clusters_;
+}
+
+void GridEuclideanCluster::extractClusters(const pcl::PointCloud<pcl::PointXYZ>& in_cloud)
+{
+	cluster_num_ = 0;
+
+	for (size_t b = 0; b < bands_.size(); b++)
+	{
+		Band& band = bands_[b];
+		band.points.clear();
+		band.min_x = band.min_y = std::numeric_limits<float>::max();
+		band.max_x = band.max_y = -std::numeric_limits<float>::max();
+	}
+
+	// single pass: band and XY bounds of every point
+	const size_t last_band = bands_.empty() ? 0 : bands_.size() - 1;
+	for (size_t i = 0; i < in_cloud.points.size() && !bands_.empty(); i++)
+	{
+		const pcl::PointXYZ& point = in_cloud.points[i];
+		if (!std::isfinite(point.x) || !std::isfinite(point.y))
+			continue;
+
+		float origin_distance = sqrt(point.x * point.x + point.y * point.y);
+		size_t b = 0;
+		while (b < last_band && b < distances_.size() && origin_distance >= distances_[b])
+			b++;
+
+		Band& band = bands_[b];
+		band.points.push_back(i);
+		band.min_x = std::min(band.min_x, point.x);
+		band.min_y = std::min(band.min_y, point.y);
+		band.max_x = std::max(band.max_x, point.x);
+		band.max_y = std::max(band.max_y, point.y);
+	}
+
+	for (size_t b = 0; b < bands_.size(); b++)
+	{
+		Band& band = bands_[b];
+		if (band.points.empty())
+			continue;
+
+		// point_cells temporarily holds the grid index of every point
+		double cell_size = std::max(band.cell_size, 1e-3);
+		long long width, height;
+		for (;;)
+		{
+			width = static_cast<long long>((band.max_x - band.min_x) / cell_size) + 1;
+			height = static_cast<long long>((band.max_y - band.min_y) / cell_size) + 1;
+			if (width * height <= MAX_GRID_CELLS)
+				break;
+			cell_size *= 2.0;
+		}
+		band.width = width;
+		band.height = height;
+		if (band.cell_slots.size() < static_cast<size_t>(width * height))
+			band.cell_slots.resize(width * height, -1);
+
+		const float inverse_cell_size = 1.0 / cell_size;
+		band.point_cells.resize(band.points.size());
+		for (size_t i = 0; i < band.points.size(); i++)
+		{
+			const pcl::PointXYZ& point = in_cloud.points[band.points[i]];
+			int cell_x = std::min(static_cast<int>((point.x - band.min_x) * inverse_cell_size), band.width - 1);
+			int cell_y = std::min(static_cast<int>((point.y - band.min_y) * inverse_cell_size), band.height - 1);
+			band.point_cells[i] = cell_y * band.width + cell_x;
+		}
+
+		clusterBand(band, b);
+	}
+	clusters_.resize(cluster_num_);
+}
+
+int GridEuclideanCluster::findRoot(std::vector<int>& in_out_parents, int in_slot)
+{
+	while (in_out_parents[in_slot] != in_slot)
+	{
+		in_out_parents[in_slot] = in_out_parents[in_out_parents[in_slot]];
+		in_slot = in_out_parents[in_slot];
+	}
+	return in_slot;
+}
+
+void GridEuclideanCluster::clusterBand(Band& in_out_band, int in_band_index)
+{
+	Band& band = in_out_band;
+
+	// occupied cells, numbered in order of their first point
+	band.occupied_cells.clear();
+	for (size_t i = 0; i < band.points.size(); i++)
+	{
+		int cell = band.point_cells[i];
+		if (band.cell_slots[cell] < 0)
+		{
+			band.cell_slots[cell] = band.occupied_cells.size();
+			band.occupied_cells.push_back(cell);
+		}
+		band.point_cells[i] = band.cell_slots[cell];
+	}
+
+	// union of every occupied cell with its occupied 8-neighbours, half of them from each side
+	const int slots = band.occupied_cells.size();
+	band.parents.resize(slots);
+	for (int s = 0; s < slots; s++)
+		band.parents[s] = s;
+
+	const int neighbor_x[4] = { 1, -1, 0, 1 };
+	const int neighbor_y[4] = { 0, 1, 1, 1 };
+	for (int s = 0; s < slots; s++)
+	{
+		int cell_x = band.occupied_cells[s] % band.width;
+		int cell_y = band.occupied_cells[s] / band.width;
+		for (int n = 0; n < 4; n++)
+		{
+			int x = cell_x + neighbor_x[n];
+			int y = cell_y + neighbor_y[n];
+			if (x < 0 || x >= band.width || y >= band.height)
+				continue;
+			int neighbor_slot = band.cell_slots[y * band.width + x];
+			if (neighbor_slot < 0)
+				continue;
+			int root_a = findRoot(band.parents, s);
+			int root_b = findRoot(band.parents, neighbor_slot);
+			if (root_a != root_b)
+				band.parents[std::max(root_a, root_b)] = std::min(root_a, root_b);
+		}
+	}
+
+	// clear the grid for the next scan
+	for (int s = 0; s < slots; s++)
+		band.cell_slots[band.occupied_cells[s]] = -1;
+
+	// component sizes, then clusters in order of their first point
+	band.component_sizes.assign(slots, 0);
+	for (size_t i = 0; i < band.points.size(); i++)
+	{
+		int root = findRoot(band.parents, band.point_cells[i]);
+		band.point_cells[i] = root;
+		band.component_sizes[root]++;
+	}
+
+	band.component_clusters.assign(slots, -1);
+	for (size_t i = 0; i < band.points.size(); i++)
+	{
+		int root = band.point_cells[i];
+		int cluster = band.component_clusters[root];
+		if (cluster < 0)
+		{
+			int size = band.component_sizes[root];
+			if (size < min_cluster_pts_ || size > max_cluster_pts_)
+				continue;
+
+			cluster = cluster_num_++;
+			band.component_clusters[root] = cluster;
+			if (clusters_.size() < cluster_num_)
+				clusters_.resize(cluster_num_);
+			clusters_[cluster].band = in_band_index;
+			clusters_[cluster].points_in_cluster.clear();
+			clusters_[cluster].points_in_cluster.reserve(size);
+		}
+		clusters_[cluster].points_in_cluster.push_back(band.points[i]);
+	}
+}
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cstdint>
 #include <iostream>
 #include <vector>
 #include <string>
@@ -76,6 +78,7 @@
 
 
 #include "cluster.h"
+#include "grid_euclidean_clustering.h"
 
 #ifdef GPU_CLUSTERING
 	#include "gpu_euclidean_clustering.h"
@@ -135,6 +138,8 @@ static double       _remove_points_upto;
 static double       _cluster_merge_threshold;
 
 static bool         _use_gpu;
+static bool         _use_grid_clustering;
+static GridEuclideanCluster _grid_clustering;
 static std::chrono::system_clock::time_point _start, _end;
 
 std::vector<std::vector<geometry_msgs::Point>> _way_area_points;
@@ -365,6 +370,30 @@ void keepLanePoints(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud_ptr,
 	extract.filter(*out_cloud_ptr);
 }
 
+//Index list of a cluster and the cloud it refers to
+struct ClusterIndices
+{
+	pcl::PointCloud<pcl::PointXYZ>::Ptr cloud;
+	const std::vector<int>* indices;
+	int id;
+};
+
+//Creates the clusters, computing their geometry in parallel straight from the index lists
+std::vector<ClusterPtr> buildClusters(const std::vector<ClusterIndices>& in_cluster_indices)
+{
+	std::vector<ClusterPtr> clusters(in_cluster_indices.size());
+#pragma omp parallel for schedule(dynamic)
+	for (size_t i = 0; i < in_cluster_indices.size(); i++)
+	{
+		const ClusterIndices& current = in_cluster_indices[i];
+		const cv::Scalar& color = _colors[current.id % _colors.size()];
+		ClusterPtr cluster(new Cluster());
+		cluster->SetCloud(current.cloud, *current.indices, _velodyne_header, current.id, (int)color.val[0], (int)color.val[1], (int)color.val[2], "", _pose_estimation);
+		clusters[i] = cluster;
+	}
+	return clusters;
+}
+
 #ifdef GPU_CLUSTERING
 std::vector<ClusterPtr> clusterAndColorGpu(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud_ptr,
 											pcl::PointCloud<pcl::PointXYZRGB>::Ptr out_cloud_ptr,
@@ -404,16 +433,14 @@ std::vector<ClusterPtr> clusterAndColorGpu(const pcl::PointCloud<pcl::PointXYZ>:
 	gecl_cluster.extractClusters();
 	std::vector<GpuEuclideanCluster::GClusterIndex> cluster_indices = gecl_cluster.getOutput();
 
-	unsigned int k = 0;
-
-	for (auto it = cluster_indices.begin(); it != cluster_indices.end(); it++)
+	std::vector<ClusterIndices> clusters_to_build(cluster_indices.size());
+	for (size_t k = 0; k < cluster_indices.size(); k++)
 	{
-		ClusterPtr cluster(new Cluster());
-		cluster->SetCloud(in_cloud_ptr, it->points_in_cluster, _velodyne_header, k, (int)_colors[k].val[0], (int)_colors[k].val[1], (int)_colors[k].val[2], "", _pose_estimation);
-		clusters.push_back(cluster);
-
-		k++;
+		clusters_to_build[k].cloud = in_cloud_ptr;
+		clusters_to_build[k].indices = &cluster_indices[k].points_in_cluster;
+		clusters_to_build[k].id = k;
 	}
+	clusters = buildClusters(clusters_to_build);
 
 	free(tmp_x);
 	free(tmp_y);
@@ -423,10 +450,8 @@ std::vector<ClusterPtr> clusterAndColorGpu(const pcl::PointCloud<pcl::PointXYZ>:
 }
 #endif
 
-std::vector<ClusterPtr> clusterAndColor(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud_ptr,
-		pcl::PointCloud<pcl::PointXYZRGB>::Ptr out_cloud_ptr,
-		jsk_recognition_msgs::BoundingBoxArray& in_out_boundingbox_array,
-		autoware_msgs::centroids& in_out_centroids,
+void extractClusterIndices(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud_ptr,
+		std::vector<pcl::PointIndices>& out_cluster_indices,
 		double in_max_cluster_distance=0.5)
 {
 	pcl::search::KdTree<pcl::PointXYZ>::Ptr tree (new pcl::search::KdTree<pcl::PointXYZ>);
@@ -443,8 +468,6 @@ std::vector<ClusterPtr> clusterAndColor(const pcl::PointCloud<pcl::PointXYZ>::Pt
 	if (cloud_2d->points.size() > 0)
 		tree->setInputCloud (cloud_2d);
 
-	std::vector<pcl::PointIndices> cluster_indices;
-
 	//perform clustering on 2d cloud
 	pcl::EuclideanClusterExtraction<pcl::PointXYZ> ec;
 	ec.setClusterTolerance (in_max_cluster_distance); //
@@ -452,7 +475,7 @@ std::vector<ClusterPtr> clusterAndColor(const pcl::PointCloud<pcl::PointXYZ>::Pt
 	ec.setMaxClusterSize (_cluster_size_max);
 	ec.setSearchMethod(tree);
 	ec.setInputCloud (cloud_2d);
-	ec.extract (cluster_indices);
+	ec.extract (out_cluster_indices);
 	//use indices on 3d cloud
 
 	/*pcl::ConditionalEuclideanClustering<pcl::PointXYZ> cec (true);
@@ -462,47 +485,39 @@ std::vector<ClusterPtr> clusterAndColor(const pcl::PointCloud<pcl::PointXYZ>::Pt
 	cec.setMaxClusterSize (cluster_size_max);
 	cec.setClusterTolerance (_distance*2.0f);
 	cec.segment (cluster_indices);*/
+}
 
-	/////////////////////////////////
-	//---	3. Color clustered points
-	/////////////////////////////////
-	unsigned int k = 0;
-	//pcl::PointCloud<pcl::PointXYZRGB>::Ptr final_cluster (new pcl::PointCloud<pcl::PointXYZRGB>);
+std::vector<ClusterPtr> clusterAndColorGrid(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud_ptr,
+		pcl::PointCloud<pcl::PointXYZRGB>::Ptr out_cloud_ptr,
+		jsk_recognition_msgs::BoundingBoxArray& in_out_boundingbox_array,
+		autoware_msgs::centroids& in_out_centroids)
+{
+	//all the distance segments are clustered in a single pass, indices refer to in_cloud_ptr
+	_grid_clustering.extractClusters(*in_cloud_ptr);
+	const std::vector<GridEuclideanCluster::GClusterIndex>& cluster_indices = _grid_clustering.getOutput();
 
-	std::vector<ClusterPtr> clusters;
-	//pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud_cluster (new pcl::PointCloud<pcl::PointXYZRGB>);//coord + color cluster
-	for (auto it = cluster_indices.begin(); it != cluster_indices.end(); ++it)
+	std::vector<ClusterIndices> clusters_to_build(cluster_indices.size());
+	int k = 0;
+	for (size_t i = 0; i < cluster_indices.size(); i++)
 	{
-		ClusterPtr cluster(new Cluster());
-		cluster->SetCloud(in_cloud_ptr, it->indices, _velodyne_header, k, (int)_colors[k].val[0], (int)_colors[k].val[1], (int)_colors[k].val[2], "", _pose_estimation);
-		clusters.push_back(cluster);
-
-		k++;
+		//ids restart on every segment, as when the segments are clustered separately
+		if (i > 0 && cluster_indices[i].band != cluster_indices[i-1].band)
+			k = 0;
+		clusters_to_build[i].cloud = in_cloud_ptr;
+		clusters_to_build[i].indices = &cluster_indices[i].points_in_cluster;
+		clusters_to_build[i].id = k++;
 	}
-	//std::cout << "Clusters: " << k << std::endl;
-	return clusters;
-
+	return buildClusters(clusters_to_build);
 }
 
-void checkClusterMerge(size_t in_cluster_id, std::vector<ClusterPtr>& in_clusters, std::vector<bool>& in_out_visited_clusters, std::vector<size_t>& out_merge_indices, double in_merge_threshold)
+size_t findMergeRoot(std::vector<size_t>& in_out_parents, size_t in_cluster_id)
 {
-	//std::cout << "checkClusterMerge" << std::endl;
-	pcl::PointXYZ point_a = in_clusters[in_cluster_id]->GetCentroid();
-	for(size_t i=0; i< in_clusters.size(); i++)
+	while (in_out_parents[in_cluster_id] != in_cluster_id)
 	{
-		if (i != in_cluster_id && !in_out_visited_clusters[i])
-		{
-			pcl::PointXYZ point_b = in_clusters[i]->GetCentroid();
-			double distance = sqrt( pow(point_b.x - point_a.x,2) + pow(point_b.y - point_a.y,2) );
-			if (distance <= in_merge_threshold)
-			{
-				in_out_visited_clusters[i] = true;
-				out_merge_indices.push_back(i);
-				//std::cout << "Merging " << in_cluster_id << " with " << i << " dist:" << distance << std::endl;
-				checkClusterMerge(i, in_clusters, in_out_visited_clusters, out_merge_indices, in_merge_threshold);
-			}
-		}
+		in_out_parents[in_cluster_id] = in_out_parents[in_out_parents[in_cluster_id]];
+		in_cluster_id = in_out_parents[in_cluster_id];
 	}
+	return in_cluster_id;
 }
 
 void mergeClusters(const std::vector<ClusterPtr>& in_clusters, std::vector<ClusterPtr>& out_clusters, std::vector<size_t> in_merge_indices, const size_t& current_index, std::vector<bool>& in_out_merged_clusters)
@@ -527,27 +542,77 @@ void mergeClusters(const std::vector<ClusterPtr>& in_clusters, std::vector<Clust
 		pcl::copyPointCloud(sum_cloud, mono_cloud);
 		//std::cout << "mergedClusters " << sum_cloud.points.size() << " mono:" << mono_cloud.points.size() << std::endl;
 		//cluster->SetCloud(in_cloud_ptr, it->indices, _velodyne_header, k, (int)_colors[k].val[0], (int)_colors[k].val[1], (int)_colors[k].val[2], "", _pose_estimation);
-		merged_cluster->SetCloud(mono_cloud.makeShared(), indices, _velodyne_header, current_index,(int)_colors[current_index].val[0], (int)_colors[current_index].val[1], (int)_colors[current_index].val[2], "", _pose_estimation);
+		const cv::Scalar& color = _colors[current_index % _colors.size()];
+		merged_cluster->SetCloud(mono_cloud.makeShared(), indices, _velodyne_header, current_index,(int)color.val[0], (int)color.val[1], (int)color.val[2], "", _pose_estimation);
 		out_clusters.push_back(merged_cluster);
 	}
 }
 
 void checkAllForMerge(std::vector<ClusterPtr>& in_clusters, std::vector<ClusterPtr>& out_clusters, float in_merge_threshold)
 {
-	//std::cout << "checkAllForMerge" << std::endl;
-	std::vector<bool> visited_clusters(in_clusters.size(), false);
-	std::vector<bool> merged_clusters(in_clusters.size(), false);
-	size_t current_index=0;
-	for (size_t i = 0; i< in_clusters.size(); i++)
+	//clusters whose centroids are chained within in_merge_threshold are merged together.
+	//centroids are bucketed in a grid of in_merge_threshold cells, so only neighbouring cells are compared
+	const size_t clusters_num = in_clusters.size();
+	if (in_merge_threshold <= 0)
 	{
-		if (!visited_clusters[i])
+		out_clusters.insert(out_clusters.end(), in_clusters.begin(), in_clusters.end());
+		return;
+	}
+
+	std::vector<pcl::PointXYZ> centroids(clusters_num);
+	std::vector<std::pair<uint64_t, size_t> > cells(clusters_num);
+	std::vector<int> cells_x(clusters_num), cells_y(clusters_num);
+	for (size_t i = 0; i < clusters_num; i++)
+	{
+		centroids[i] = in_clusters[i]->GetCentroid();
+		cells_x[i] = floor(centroids[i].x / in_merge_threshold);
+		cells_y[i] = floor(centroids[i].y / in_merge_threshold);
+		cells[i] = std::make_pair(((uint64_t)(uint32_t)cells_x[i] << 32) | (uint32_t)cells_y[i], i);
+	}
+	std::sort(cells.begin(), cells.end());
+
+	std::vector<size_t> parents(clusters_num);
+	for (size_t i = 0; i < clusters_num; i++)
+		parents[i] = i;
+
+	for (size_t i = 0; i < clusters_num; i++)
+	{
+		for (int dx = -1; dx <= 1; dx++)
 		{
-			visited_clusters[i] = true;
-			std::vector<size_t> merge_indices;
-			checkClusterMerge(i, in_clusters, visited_clusters, merge_indices, in_merge_threshold);
-			mergeClusters(in_clusters, out_clusters, merge_indices, current_index++, merged_clusters);
+			for (int dy = -1; dy <= 1; dy++)
+			{
+				uint64_t cell = ((uint64_t)(uint32_t)(cells_x[i] + dx) << 32) | (uint32_t)(cells_y[i] + dy);
+				auto it = std::lower_bound(cells.begin(), cells.end(), std::make_pair(cell, (size_t)0));
+				for (; it != cells.end() && it->first == cell; ++it)
+				{
+					size_t j = it->second;
+					if (j <= i)
+						continue;
+					double distance = sqrt( pow(centroids[j].x - centroids[i].x,2) + pow(centroids[j].y - centroids[i].y,2) );
+					if (distance <= in_merge_threshold)
+					{
+						size_t root_i = findMergeRoot(parents, i);
+						size_t root_j = findMergeRoot(parents, j);
+						//the smallest index is the root, so components keep the order of their first cluster
+						if (root_i != root_j)
+							parents[std::max(root_i, root_j)] = std::min(root_i, root_j);
+					}
+				}
+			}
 		}
 	}
+
+	std::vector<std::vector<size_t> > merge_indices(clusters_num);
+	for (size_t i = 0; i < clusters_num; i++)
+		merge_indices[findMergeRoot(parents, i)].push_back(i);
+
+	std::vector<bool> merged_clusters(clusters_num, false);
+	size_t current_index=0;
+	for (size_t i = 0; i < clusters_num; i++)
+	{
+		if (merge_indices[i].size() > 1)
+			mergeClusters(in_clusters, out_clusters, merge_indices[i], current_index++, merged_clusters);
+	}
 	for(size_t i =0; i< in_clusters.size(); i++)
 	{
 		//check for clusters not merged, add them to the output
@@ -556,8 +621,6 @@ void checkAllForMerge(std::vector<ClusterPtr>& in_clusters, std::vector<ClusterP
 			out_clusters.push_back(in_clusters[i]);
 		}
 	}
-
-	//ClusterPtr cluster(new Cluster());
 }
 
 void segmentByDistance(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud_ptr,
@@ -577,61 +640,78 @@ void segmentByDistance(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud_ptr,
 	//3 => 45-60 d=2.1
 	//4 => >60   d=2.6
 
-	std::vector<pcl::PointCloud<pcl::PointXYZ>::Ptr> cloud_segments_array(5);
-
-	for(unsigned int i=0; i<cloud_segments_array.size(); i++)
+	std::vector <ClusterPtr> all_clusters;
+	if (_use_grid_clustering)
 	{
-		pcl::PointCloud<pcl::PointXYZ>::Ptr tmp_cloud(new pcl::PointCloud<pcl::PointXYZ>);
-		cloud_segments_array[i] = tmp_cloud;
+		all_clusters = clusterAndColorGrid(in_cloud_ptr, out_cloud_ptr, in_out_boundingbox_array, in_out_centroids);
 	}
-
-	for (unsigned int i=0; i<in_cloud_ptr->points.size(); i++)
+	else
 	{
-		pcl::PointXYZ current_point;
-		current_point.x = in_cloud_ptr->points[i].x;
-		current_point.y = in_cloud_ptr->points[i].y;
-		current_point.z = in_cloud_ptr->points[i].z;
+		std::vector<pcl::PointCloud<pcl::PointXYZ>::Ptr> cloud_segments_array(5);
 
-		float origin_distance = sqrt( pow(current_point.x,2) + pow(current_point.y,2) );
+		for(unsigned int i=0; i<cloud_segments_array.size(); i++)
+		{
+			pcl::PointCloud<pcl::PointXYZ>::Ptr tmp_cloud(new pcl::PointCloud<pcl::PointXYZ>);
+			cloud_segments_array[i] = tmp_cloud;
+		}
 
-		if 		(origin_distance < _clustering_distances[0] )	{cloud_segments_array[0]->points.push_back (current_point);}
-		else if(origin_distance < _clustering_distances[1])		{cloud_segments_array[1]->points.push_back (current_point);}
-		else if(origin_distance < _clustering_distances[2])		{cloud_segments_array[2]->points.push_back (current_point);}
-		else if(origin_distance < _clustering_distances[3])		{cloud_segments_array[3]->points.push_back (current_point);}
-		else													{cloud_segments_array[4]->points.push_back (current_point);}
-	}
+		for (unsigned int i=0; i<in_cloud_ptr->points.size(); i++)
+		{
+			pcl::PointXYZ current_point;
+			current_point.x = in_cloud_ptr->points[i].x;
+			current_point.y = in_cloud_ptr->points[i].y;
+			current_point.z = in_cloud_ptr->points[i].z;
+
+			float origin_distance = sqrt( pow(current_point.x,2) + pow(current_point.y,2) );
+
+			if 		(origin_distance < _clustering_distances[0] )	{cloud_segments_array[0]->points.push_back (current_point);}
+			else if(origin_distance < _clustering_distances[1])		{cloud_segments_array[1]->points.push_back (current_point);}
+			else if(origin_distance < _clustering_distances[2])		{cloud_segments_array[2]->points.push_back (current_point);}
+			else if(origin_distance < _clustering_distances[3])		{cloud_segments_array[3]->points.push_back (current_point);}
+			else													{cloud_segments_array[4]->points.push_back (current_point);}
+		}
 
-	std::vector <ClusterPtr> all_clusters;
-	for(unsigned int i=0; i<cloud_segments_array.size(); i++)
-	{
 #ifdef GPU_CLUSTERING
-    std::vector<ClusterPtr> local_clusters;
-		if (_use_gpu) {
-			local_clusters = clusterAndColorGpu(cloud_segments_array[i], out_cloud_ptr, in_out_boundingbox_array, in_out_centroids, _clustering_thresholds[i]);
-		} else {
-			local_clusters = clusterAndColor(cloud_segments_array[i], out_cloud_ptr, in_out_boundingbox_array, in_out_centroids, _clustering_thresholds[i]);
+		if (_use_gpu)
+		{
+			for(unsigned int i=0; i<cloud_segments_array.size(); i++)
+			{
+				std::vector<ClusterPtr> local_clusters = clusterAndColorGpu(cloud_segments_array[i], out_cloud_ptr, in_out_boundingbox_array, in_out_centroids, _clustering_thresholds[i]);
+				all_clusters.insert(all_clusters.end(), local_clusters.begin(), local_clusters.end());
+			}
 		}
-#else
-		std::vector<ClusterPtr> local_clusters = clusterAndColor(cloud_segments_array[i], out_cloud_ptr, in_out_boundingbox_array, in_out_centroids, _clustering_thresholds[i]);
+		else
 #endif
-		all_clusters.insert(all_clusters.end(), local_clusters.begin(), local_clusters.end());
+		{
+			//the segments are clustered concurrently, then the clusters of all of them are built in parallel
+			std::vector<std::vector<pcl::PointIndices> > segment_cluster_indices(cloud_segments_array.size());
+#pragma omp parallel for schedule(dynamic)
+			for(int i=0; i<(int)cloud_segments_array.size(); i++)
+			{
+				extractClusterIndices(cloud_segments_array[i], segment_cluster_indices[i], _clustering_thresholds[i]);
+			}
+
+			std::vector<ClusterIndices> clusters_to_build;
+			for(size_t i=0; i<segment_cluster_indices.size(); i++)
+			{
+				for (size_t k=0; k<segment_cluster_indices[i].size(); k++)
+				{
+					ClusterIndices current = { cloud_segments_array[i], &segment_cluster_indices[i][k].indices, (int)k };
+					clusters_to_build.push_back(current);
+				}
+			}
+			all_clusters = buildClusters(clusters_to_build);
+		}
 	}
 
 	//Clusters can be merged or checked in here
 	//....
 	//check for mergable clusters
-	std::vector<ClusterPtr> mid_clusters;
+	//merging follows chains of close centroids, so a single pass is enough
 	std::vector<ClusterPtr> final_clusters;
 
 	if (all_clusters.size() > 0)
-		checkAllForMerge(all_clusters, mid_clusters, _cluster_merge_threshold);
-	else
-		mid_clusters = all_clusters;
-
-	if (mid_clusters.size() > 0)
-			checkAllForMerge(mid_clusters, final_clusters, _cluster_merge_threshold);
-	else
-		final_clusters = mid_clusters;
+		checkAllForMerge(all_clusters, final_clusters, _cluster_merge_threshold);
 
 	tf::StampedTransform vectormap_transform;
 	if (_use_vector_map)
@@ -684,7 +764,7 @@ void segmentByDistance(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud_ptr,
 	in_out_pictogram_array.header = _velodyne_header;
 	for(unsigned int i=0; i<final_clusters.size(); i++)
 	{
-		*out_cloud_ptr = *out_cloud_ptr + *(final_clusters[i]->GetCloud());
+		*out_cloud_ptr += *(final_clusters[i]->GetCloud());
 
 		jsk_recognition_msgs::BoundingBox bounding_box = final_clusters[i]->GetBoundingBox();
 		geometry_msgs::PolygonStamped polygon = final_clusters[i]->GetPolygon();
@@ -1162,6 +1242,9 @@ int main (int argc, char** argv)
 	private_nh.param("use_gpu", _use_gpu, false);
 	ROS_INFO("use_gpu: %d", _use_gpu);
 
+	private_nh.param("use_grid_clustering", _use_grid_clustering, false);
+	ROS_INFO("use_grid_clustering: %d", _use_grid_clustering);
+
 	_velodyne_transform_available = false;
 
 	if (_clustering_distances.size()!=4)
@@ -1173,6 +1256,10 @@ int main (int argc, char** argv)
 		_clustering_thresholds = {0.5, 1.1, 1.6, 2.1, 2.6};//Nearest neighbor distance threshold for each segment
 	}
 
+	_grid_clustering.setBands(_clustering_distances, _clustering_thresholds);
+	_grid_clustering.setMinClusterPts(_cluster_size_min);
+	_grid_clustering.setMaxClusterPts(_cluster_size_max);
+
 	std::cout << "_clustering_thresholds: "; for (auto i = _clustering_thresholds.begin(); i != _clustering_thresholds.end(); ++i)  std::cout << *i << ' '; std::cout << std::endl;
 	std::cout << "_clustering_distances: ";for (auto i = _clustering_distances.begin(); i != _clustering_distances.end(); ++i)  std::cout << *i << ' '; std::cout <<std::endl;
 
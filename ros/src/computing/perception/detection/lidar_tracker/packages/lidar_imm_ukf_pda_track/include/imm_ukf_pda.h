@@ -3,6 +3,8 @@
 
 #include <ros/ros.h>
 
+#include <stdint.h>
+#include <utility>
 #include <vector>
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
@@ -42,6 +44,16 @@ private:
 
   double static_distance_thres_;
 
+  // gating grid over the cluster centroids
+  double gating_cell_size_;
+  std::vector<std::pair<uint64_t, int> > cluster_cells_;  // (cell key, cluster index), sorted
+
+  // per target results of the parallel gating, consumed by the association
+  std::vector<char> is_gated_;
+  std::vector<std::vector<int> > gated_clusters_;
+  std::vector<std::vector<double> > gated_nis_;
+  std::vector<std::vector<int> > associated_clusters_;
+
   double init_yaw_;
 
   // Tracking state paramas
@@ -66,10 +78,14 @@ private:
                                    autoware_msgs::CloudClusterArray& transformed_input);
   void transformPoseToLocal(jsk_recognition_msgs::BoundingBoxArray& jskbboxes_output,
                             autoware_msgs::DetectedObjectArray& detected_objects_output);
-  void findMaxZandS(const UKF &target, Eigen::VectorXd& max_det_z, Eigen::MatrixXd& max_det_s);
-  void measurementValidation(const autoware_msgs::CloudClusterArray& input, UKF& target, const bool second_init,
-                             const Eigen::VectorXd& max_det_z, const Eigen::MatrixXd& max_det_s,
-                             std::vector<autoware_msgs::CloudCluster>& cluster_vec, std::vector<bool>& matching_vec);
+  void findMaxZandS(const UKF &target, UKF::MeasVector& max_det_z, UKF::MeasCovariance& max_det_s);
+  void buildClusterGrid(const autoware_msgs::CloudClusterArray& input);
+  void gateMeasurements(const autoware_msgs::CloudClusterArray& input, const UKF::MeasVector& max_det_z,
+                        const UKF::MeasCovariance& max_det_s, std::vector<int>& gated_indices,
+                        std::vector<double>& gated_nis);
+  void measurementValidation(UKF& target, const bool second_init, const std::vector<int>& gated_indices,
+                             const std::vector<double>& gated_nis, std::vector<int>& associated_indices,
+                             std::vector<bool>& matching_vec);
   void filterPDA(UKF& target, const std::vector<autoware_msgs::CloudCluster>& cluster_vec,
                  std::vector<double>& lambda_vec);
   void getNearestEuclidCluster(const UKF& target, const std::vector<autoware_msgs::CloudCluster>& cluster_vec,
@@ -91,9 +107,12 @@ private:
 
   void updateTrackingNum(const std::vector<autoware_msgs::CloudCluster>& cluster_vec, UKF& target);
 
-  void probabilisticDataAssociation(const autoware_msgs::CloudClusterArray& input, const double dt, const double det_explode_param,
-                                    std::vector<bool>& matching_vec, std::vector<double>& lambda_vec, UKF& target,
-                                    bool& is_skip_target);
+  bool predictAndGate(const autoware_msgs::CloudClusterArray& input, const double dt, const double det_explode_param,
+                      const double cov_explode_param, UKF& target, std::vector<int>& gated_indices,
+                      std::vector<double>& gated_nis);
+  void probabilisticDataAssociation(const autoware_msgs::CloudClusterArray& input, const double dt,
+                                    const std::vector<int>& associated_indices, std::vector<double>& lambda_vec,
+                                    UKF& target, bool& is_skip_target);
   void makeNewTargets(const double timestamp, const autoware_msgs::CloudClusterArray& input, const std::vector<bool>& matching_vec);
 
   void staticClassification();
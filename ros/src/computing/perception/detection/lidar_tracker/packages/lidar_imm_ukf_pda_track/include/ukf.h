@@ -10,44 +10,87 @@
 
 #include <jsk_recognition_msgs/BoundingBox.h>
 
+/*
+ * Compile-time sized Eigen types of an unscented Kalman filter with N_X states, N_Z measured components
+ * and N_X + 2 augmented states (longitudinal and yaw acceleration noise).
+ * Storage is not aligned, so that filters can be kept by value in std::vector without an aligned allocator.
+ */
+template <int N_X, int N_Z>
+struct UkfTypes
+{
+  enum
+  {
+    STATE_DIM = N_X,
+    MEAS_DIM = N_Z,
+    AUG_DIM = N_X + 2,
+    SIGMA_NUM = 2 * (N_X + 2) + 1
+  };
+
+  typedef Eigen::Matrix<double, STATE_DIM, 1, Eigen::DontAlign> StateVector;
+  typedef Eigen::Matrix<double, STATE_DIM, STATE_DIM, Eigen::DontAlign> StateCovariance;
+  typedef Eigen::Matrix<double, AUG_DIM, 1, Eigen::DontAlign> AugStateVector;
+  typedef Eigen::Matrix<double, AUG_DIM, AUG_DIM, Eigen::DontAlign> AugStateCovariance;
+  typedef Eigen::Matrix<double, STATE_DIM, SIGMA_NUM, Eigen::DontAlign> SigmaPoints;
+  typedef Eigen::Matrix<double, AUG_DIM, SIGMA_NUM, Eigen::DontAlign> AugSigmaPoints;
+  typedef Eigen::Matrix<double, MEAS_DIM, SIGMA_NUM, Eigen::DontAlign> MeasSigmaPoints;
+  typedef Eigen::Matrix<double, SIGMA_NUM, 1, Eigen::DontAlign> SigmaWeights;
+  typedef Eigen::Matrix<double, MEAS_DIM, 1, Eigen::DontAlign> MeasVector;
+  typedef Eigen::Matrix<double, MEAS_DIM, MEAS_DIM, Eigen::DontAlign> MeasCovariance;
+  typedef Eigen::Matrix<double, STATE_DIM, MEAS_DIM, Eigen::DontAlign> KalmanGain;
+};
+
 class UKF
 {
 public:
+  // state: [pos1 pos2 vel_abs yaw_angle yaw_rate], lidar measurement: [pos1 pos2]
+  typedef UkfTypes<5, 2> Types;
+  typedef Types::StateVector StateVector;
+  typedef Types::StateCovariance StateCovariance;
+  typedef Types::AugStateVector AugStateVector;
+  typedef Types::AugStateCovariance AugStateCovariance;
+  typedef Types::SigmaPoints SigmaPoints;
+  typedef Types::AugSigmaPoints AugSigmaPoints;
+  typedef Types::MeasSigmaPoints MeasSigmaPoints;
+  typedef Types::SigmaWeights SigmaWeights;
+  typedef Types::MeasVector MeasVector;
+  typedef Types::MeasCovariance MeasCovariance;
+  typedef Types::KalmanGain KalmanGain;
+
   ///* initially set to false, set to true in first call of ProcessMeasurement
   bool is_initialized_;
 
   //    ///* state vector: [pos1 pos2 vel_abs yaw_angle yaw_rate] in SI units and rad
-  Eigen::MatrixXd x_merge_;
+  StateVector x_merge_;
 
   ///* state vector: [pos1 pos2 vel_abs yaw_angle yaw_rate] in SI units and rad
-  Eigen::MatrixXd x_cv_;
+  StateVector x_cv_;
 
   ///* state vector: [pos1 pos2 vel_abs yaw_angle yaw_rate] in SI units and rad
-  Eigen::MatrixXd x_ctrv_;
+  StateVector x_ctrv_;
 
   ///* state vector: [pos1 pos2 vel_abs yaw_angle yaw_rate] in SI units and rad
-  Eigen::MatrixXd x_rm_;
+  StateVector x_rm_;
 
   //    ///* state covariance matrix
-  Eigen::MatrixXd p_merge_;
+  StateCovariance p_merge_;
 
   ///* state covariance matrix
-  Eigen::MatrixXd p_cv_;
+  StateCovariance p_cv_;
 
   ///* state covariance matrix
-  Eigen::MatrixXd p_ctrv_;
+  StateCovariance p_ctrv_;
 
   ///* state covariance matrix
-  Eigen::MatrixXd p_rm_;
+  StateCovariance p_rm_;
 
   ///* predicted sigma points matrix
-  Eigen::MatrixXd x_sig_pred_cv_;
+  SigmaPoints x_sig_pred_cv_;
 
   ///* predicted sigma points matrix
-  Eigen::MatrixXd x_sig_pred_ctrv_;
+  SigmaPoints x_sig_pred_ctrv_;
 
   ///* predicted sigma points matrix
-  Eigen::MatrixXd x_sig_pred_rm_;
+  SigmaPoints x_sig_pred_rm_;
 
   ///* time when the state is true, in us
   long long time_;
@@ -72,7 +115,7 @@ public:
   double std_laspy_;
 
   ///* Weights of sigma points
-  Eigen::VectorXd weights_;
+  SigmaWeights weights_;
 
   ///* State dimension
   int n_x_;
@@ -119,17 +162,17 @@ public:
 
   std::vector<double> p3_;
 
-  Eigen::VectorXd z_pred_cv_;
-  Eigen::VectorXd z_pred_ctrv_;
-  Eigen::VectorXd z_pred_rm_;
+  MeasVector z_pred_cv_;
+  MeasVector z_pred_ctrv_;
+  MeasVector z_pred_rm_;
 
-  Eigen::MatrixXd s_cv_;
-  Eigen::MatrixXd s_ctrv_;
-  Eigen::MatrixXd s_rm_;
+  MeasCovariance s_cv_;
+  MeasCovariance s_ctrv_;
+  MeasCovariance s_rm_;
 
-  Eigen::MatrixXd k_cv_;
-  Eigen::MatrixXd k_ctrv_;
-  Eigen::MatrixXd k_rm_;
+  KalmanGain k_cv_;
+  KalmanGain k_ctrv_;
+  KalmanGain k_rm_;
 
   double pd_;
   double pg_;
@@ -153,7 +196,7 @@ public:
   std::vector<double> bb_area_history_;
 
   // for env classification
-  Eigen::VectorXd init_meas_;
+  MeasVector init_meas_;
   double dist_from_init_;
 
   std::vector<Eigen::VectorXd> local2local_;
@@ -163,6 +206,10 @@ public:
 
   int tracking_num_;
 
+  ///* augmented sigma points and measurement sigma points, reused by every prediction and update
+  AugSigmaPoints x_sig_aug_;
+  MeasSigmaPoints z_sig_;
+
   /**
    * Constructor
    */
@@ -170,7 +217,7 @@ public:
 
   void updateYawWithHighProb();
 
-  void initialize(const Eigen::VectorXd& z, const double timestamp);
+  void initialize(const MeasVector& z, const double timestamp);
 
   void updateModeProb(const std::vector<double>& lambda_vec);
 
@@ -185,13 +232,13 @@ public:
   void updateIMMUKF(const std::vector<double>& lambda_vec);
 
   void ctrv(const double p_x, const double p_y, const double v, const double yaw, const double yawd, const double nu_a,
-            const double nu_yawdd, const double delta_t, std::vector<double>& state);
+            const double nu_yawdd, const double delta_t, StateVector& state);
 
   void cv(const double p_x, const double p_y, const double v, const double yaw, const double yawd, const double nu_a,
-          const double nu_yawdd, const double delta_t, std::vector<double>& state);
+          const double nu_yawdd, const double delta_t, StateVector& state);
 
   void randomMotion(const double p_x, const double p_y, const double v, const double yaw, const double yawd,
-                    const double nu_a, const double nu_yawdd, const double delta_t, std::vector<double>& state);
+                    const double nu_a, const double nu_yawdd, const double delta_t, StateVector& state);
 
   void prediction(const double delta_t, const int model_ind);
 
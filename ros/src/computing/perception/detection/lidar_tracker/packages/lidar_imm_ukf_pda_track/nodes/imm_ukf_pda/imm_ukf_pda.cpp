@@ -1,6 +1,9 @@
 #include "ukf.h"
 #include "imm_ukf_pda.h"
 
+#include <algorithm>
+#include <cmath>
+
 enum TrackingState : int
 {
   Die = 0,     // No longer tracking
@@ -20,6 +23,7 @@ ImmUkfPda::ImmUkfPda()
   private_nh_.param<double>("detection_probability", detection_probability_, 0.9);
   private_nh_.param<double>("distance_thres", distance_thres_, 99);
   private_nh_.param<double>("static_distance_thres", static_distance_thres_, 3.0);
+  private_nh_.param<double>("gating_cell_size", gating_cell_size_, 2.0);
 
   init_ = false;
 
@@ -86,7 +90,7 @@ void ImmUkfPda::transformPoseToLocal(jsk_recognition_msgs::BoundingBoxArray& jsk
   }
 }
 
-void ImmUkfPda::findMaxZandS(const UKF& target, Eigen::VectorXd& max_det_z, Eigen::MatrixXd& max_det_s)
+void ImmUkfPda::findMaxZandS(const UKF& target, UKF::MeasVector& max_det_z, UKF::MeasCovariance& max_det_s)
 {
   double cv_det = target.s_cv_.determinant();
   double ctrv_det = target.s_ctrv_.determinant();
@@ -120,50 +124,127 @@ void ImmUkfPda::findMaxZandS(const UKF& target, Eigen::VectorXd& max_det_z, Eige
   }
 }
 
-void ImmUkfPda::measurementValidation(const autoware_msgs::CloudClusterArray &input, UKF& target, const bool second_init,
-                                      const Eigen::VectorXd &max_det_z, const Eigen::MatrixXd &max_det_s,
-                                      std::vector<autoware_msgs::CloudCluster>& cluster_vec,
-                                      std::vector<bool>& matching_vec)
+static uint64_t cellKey(const int cell_x, const int cell_y)
 {
-  int count = 0;
-  bool second_init_done = false;
-  double smallest_nis = std::numeric_limits<double>::max();
-  autoware_msgs::CloudCluster smallest_meas_cluster;
+  return (static_cast<uint64_t>(static_cast<uint32_t>(cell_x)) << 32) | static_cast<uint32_t>(cell_y);
+}
+
+void ImmUkfPda::buildClusterGrid(const autoware_msgs::CloudClusterArray& input)
+{
+  cluster_cells_.clear();
   for (size_t i = 0; i < input.clusters.size(); i++)
   {
     double x = input.clusters[i].bounding_box.pose.position.x;
     double y = input.clusters[i].bounding_box.pose.position.y;
-    Eigen::VectorXd meas = Eigen::VectorXd(2);
-    meas << x, y;
+    // a non finite centroid never passes the gate
+    if (!std::isfinite(x) || !std::isfinite(y))
+      continue;
+    // far away cells are clamped, gates reaching them check all the clusters anyway
+    const double max_cell_index = 1 << 30;
+    int cell_x = std::min(std::max(std::floor(x / gating_cell_size_), -max_cell_index), max_cell_index);
+    int cell_y = std::min(std::max(std::floor(y / gating_cell_size_), -max_cell_index), max_cell_index);
+    cluster_cells_.push_back(std::make_pair(cellKey(cell_x, cell_y), static_cast<int>(i)));
+  }
+  std::sort(cluster_cells_.begin(), cluster_cells_.end());
+}
+
+void ImmUkfPda::gateMeasurements(const autoware_msgs::CloudClusterArray& input, const UKF::MeasVector& max_det_z,
+                                 const UKF::MeasCovariance& max_det_s, std::vector<int>& gated_indices,
+                                 std::vector<double>& gated_nis)
+{
+  gated_indices.clear();
+  gated_nis.clear();
+
+  // every measurement inside the gate is within sqrt(gating_thres * largest eigenvalue of S) of the prediction
+  double half_trace = 0.5 * (max_det_s(0, 0) + max_det_s(1, 1));
+  double half_diff = 0.5 * (max_det_s(0, 0) - max_det_s(1, 1));
+  double off_diagonal = 0.5 * (max_det_s(0, 1) + max_det_s(1, 0));
+  double max_eigenvalue = half_trace + sqrt(half_diff * half_diff + off_diagonal * off_diagonal);
+  // (slightly enlarged, so that rounding cannot drop a measurement on the border of the gate)
+  double radius = 1.000001 * sqrt(gating_thres_ * std::max(max_eigenvalue, 0.0));
+
+  std::vector<int> candidates;
+  double min_cell_x = std::floor((max_det_z(0) - radius) / gating_cell_size_);
+  double max_cell_x = std::floor((max_det_z(0) + radius) / gating_cell_size_);
+  double min_cell_y = std::floor((max_det_z(1) - radius) / gating_cell_size_);
+  double max_cell_y = std::floor((max_det_z(1) + radius) / gating_cell_size_);
+  double cell_num = (max_cell_x - min_cell_x + 1) * (max_cell_y - min_cell_y + 1);
+  double max_cell_index = std::max(std::max(std::fabs(min_cell_x), std::fabs(max_cell_x)),
+                                   std::max(std::fabs(min_cell_y), std::fabs(max_cell_y)));
+  if (cell_num <= static_cast<double>(cluster_cells_.size()) && max_cell_index < (1 << 30))
+  {
+    for (int cell_x = min_cell_x; cell_x <= max_cell_x; cell_x++)
+    {
+      for (int cell_y = min_cell_y; cell_y <= max_cell_y; cell_y++)
+      {
+        std::vector<std::pair<uint64_t, int> >::const_iterator it = std::lower_bound(
+            cluster_cells_.begin(), cluster_cells_.end(), std::make_pair(cellKey(cell_x, cell_y), -1));
+        for (; it != cluster_cells_.end() && it->first == cellKey(cell_x, cell_y); ++it)
+          candidates.push_back(it->second);
+      }
+    }
+    // keep the input order of the clusters
+    std::sort(candidates.begin(), candidates.end());
+  }
+  else
+  {
+    // the gate covers more cells than there are clusters, or is not finite: check all of them
+    for (size_t i = 0; i < cluster_cells_.size(); i++)
+      candidates.push_back(cluster_cells_[i].second);
+    std::sort(candidates.begin(), candidates.end());
+  }
 
-    Eigen::VectorXd diff = meas - max_det_z;
-    double nis = diff.transpose() * max_det_s.inverse() * diff;
+  UKF::MeasCovariance max_det_s_inverse = max_det_s.inverse();
+  for (size_t i = 0; i < candidates.size(); i++)
+  {
+    const autoware_msgs::CloudCluster& cluster = input.clusters[candidates[i]];
+    UKF::MeasVector meas;
+    meas << cluster.bounding_box.pose.position.x, cluster.bounding_box.pose.position.y;
 
+    UKF::MeasVector diff = meas - max_det_z;
+    double nis = diff.transpose() * max_det_s_inverse * diff;
     if (nis < gating_thres_)
     {  // x^2 99% range
-      count++;
-      if (matching_vec[i] == false)
-        target.lifetime_++;
-      // pick one meas with smallest nis
-      if (second_init)
-      {
-        if (nis < smallest_nis)
-        {
-          smallest_nis = nis;
-          smallest_meas_cluster = input.clusters[i];
-          matching_vec[i] = true;
-          second_init_done = true;
-        }
-      }
-      else
+      gated_indices.push_back(candidates[i]);
+      gated_nis.push_back(nis);
+    }
+  }
+}
+
+void ImmUkfPda::measurementValidation(UKF& target, const bool second_init, const std::vector<int>& gated_indices,
+                                      const std::vector<double>& gated_nis, std::vector<int>& associated_indices,
+                                      std::vector<bool>& matching_vec)
+{
+  bool second_init_done = false;
+  double smallest_nis = std::numeric_limits<double>::max();
+  int smallest_meas_index = -1;
+  associated_indices.clear();
+  for (size_t k = 0; k < gated_indices.size(); k++)
+  {
+    int i = gated_indices[k];
+    double nis = gated_nis[k];
+
+    if (matching_vec[i] == false)
+      target.lifetime_++;
+    // pick one meas with smallest nis
+    if (second_init)
+    {
+      if (nis < smallest_nis)
       {
-        cluster_vec.push_back(input.clusters[i]);
+        smallest_nis = nis;
+        smallest_meas_index = i;
         matching_vec[i] = true;
+        second_init_done = true;
       }
     }
+    else
+    {
+      associated_indices.push_back(i);
+      matching_vec[i] = true;
+    }
   }
   if (second_init_done)
-    cluster_vec.push_back(smallest_meas_cluster);
+    associated_indices.push_back(smallest_meas_index);
 }
 
 void ImmUkfPda::filterPDA(UKF& target,
@@ -181,19 +262,19 @@ void ImmUkfPda::filterPDA(UKF& target,
   std::vector<double> e_ctrv_vec;
   std::vector<double> e_rm_vec;
 
-  std::vector<Eigen::VectorXd> diff_cv_vec;
-  std::vector<Eigen::VectorXd> diff_ctrv_vec;
-  std::vector<Eigen::VectorXd> diff_rm_vec;
+  std::vector<UKF::MeasVector> diff_cv_vec;
+  std::vector<UKF::MeasVector> diff_ctrv_vec;
+  std::vector<UKF::MeasVector> diff_rm_vec;
 
   for (size_t i = 0; i < num_meas; i++)
   {
-    Eigen::VectorXd meas_vec = Eigen::VectorXd(2);
+    UKF::MeasVector meas_vec;
     meas_vec(0) = cluster_vec[i].bounding_box.pose.position.x;
     meas_vec(1) = cluster_vec[i].bounding_box.pose.position.y;
 
-    Eigen::VectorXd diff_cv = meas_vec - target.z_pred_cv_;
-    Eigen::VectorXd diff_ctrv = meas_vec - target.z_pred_ctrv_;
-    Eigen::VectorXd diff_rm = meas_vec - target.z_pred_rm_;
+    UKF::MeasVector diff_cv = meas_vec - target.z_pred_cv_;
+    UKF::MeasVector diff_ctrv = meas_vec - target.z_pred_ctrv_;
+    UKF::MeasVector diff_rm = meas_vec - target.z_pred_rm_;
 
     diff_cv_vec.push_back(diff_cv);
     diff_ctrv_vec.push_back(diff_ctrv);
@@ -229,12 +310,12 @@ void ImmUkfPda::filterPDA(UKF& target,
     beta_ctrv.push_back(temp_ctrv);
     beta_rm.push_back(temp_rm);
   }
-  Eigen::VectorXd sigma_x_cv;
-  Eigen::VectorXd sigma_x_ctrv;
-  Eigen::VectorXd sigma_x_rm;
-  sigma_x_cv.setZero(2);
-  sigma_x_ctrv.setZero(2);
-  sigma_x_rm.setZero(2);
+  UKF::MeasVector sigma_x_cv;
+  UKF::MeasVector sigma_x_ctrv;
+  UKF::MeasVector sigma_x_rm;
+  sigma_x_cv.setZero();
+  sigma_x_ctrv.setZero();
+  sigma_x_rm.setZero();
 
   for (size_t i = 0; i < num_meas; i++)
   {
@@ -243,12 +324,12 @@ void ImmUkfPda::filterPDA(UKF& target,
     sigma_x_rm += beta_rm[i] * diff_rm_vec[i];
   }
 
-  Eigen::MatrixXd sigma_p_cv;
-  Eigen::MatrixXd sigma_p_ctrv;
-  Eigen::MatrixXd sigma_p_rm;
-  sigma_p_cv.setZero(2, 2);
-  sigma_p_ctrv.setZero(2, 2);
-  sigma_p_rm.setZero(2, 2);
+  UKF::MeasCovariance sigma_p_cv;
+  UKF::MeasCovariance sigma_p_ctrv;
+  UKF::MeasCovariance sigma_p_rm;
+  sigma_p_cv.setZero();
+  sigma_p_ctrv.setZero();
+  sigma_p_rm.setZero();
   for (size_t i = 0; i < num_meas; i++)
   {
     sigma_p_cv += (beta_cv[i] * diff_cv_vec[i] * diff_cv_vec[i].transpose() - sigma_x_cv * sigma_x_cv.transpose());
@@ -295,8 +376,8 @@ void ImmUkfPda::filterPDA(UKF& target,
     target.p_rm_ = target.p_rm_ - target.k_rm_ * target.s_rm_ * target.k_rm_.transpose();
   }
 
-  Eigen::VectorXd max_det_z;
-  Eigen::MatrixXd max_det_s;
+  UKF::MeasVector max_det_z;
+  UKF::MeasCovariance max_det_s;
 
   findMaxZandS(target, max_det_z, max_det_s);
   double Vk = M_PI * sqrt(gating_thres_ * max_det_s.determinant());
@@ -500,7 +581,7 @@ void ImmUkfPda::initTracker(const autoware_msgs::CloudClusterArray& input, doubl
   {
     double px = input.clusters[i].bounding_box.pose.position.x;
     double py = input.clusters[i].bounding_box.pose.position.y;
-    Eigen::VectorXd init_meas = Eigen::VectorXd(2);
+    UKF::MeasVector init_meas;
     init_meas << px, py;
 
     UKF ukf;
@@ -585,14 +666,27 @@ void ImmUkfPda::updateTrackingNum(const std::vector<autoware_msgs::CloudCluster>
   return;
 }
 
-void ImmUkfPda::probabilisticDataAssociation(const autoware_msgs::CloudClusterArray& input, const double dt,
-                                             const double det_explode_param, std::vector<bool>& matching_vec,
-                                             std::vector<double>& lambda_vec, UKF& target, bool& is_skip_target)
+bool ImmUkfPda::predictAndGate(const autoware_msgs::CloudClusterArray& input, const double dt,
+                               const double det_explode_param, const double cov_explode_param, UKF& target,
+                               std::vector<int>& gated_indices, std::vector<double>& gated_nis)
 {
-  Eigen::VectorXd max_det_z;
-  Eigen::MatrixXd max_det_s;
-  std::vector<autoware_msgs::CloudCluster> cluster_vec;
-  is_skip_target = false;
+  // reset is_vis_bb_ to false
+  target.is_vis_bb_ = false;
+
+  // todo: modify here. This skips irregular measurement and nan
+  if (target.tracking_num_ == TrackingState::Die)
+    return false;
+  // prevent ukf not to explode
+  if (target.p_merge_.determinant() > det_explode_param || target.p_merge_(4, 4) > cov_explode_param)
+  {
+    target.tracking_num_ = TrackingState::Die;
+    return false;
+  }
+  // immukf prediction step
+  target.predictionIMMUKF(dt);
+
+  UKF::MeasVector max_det_z;
+  UKF::MeasCovariance max_det_s;
   // find maxDetS associated with predZ
   findMaxZandS(target, max_det_z, max_det_s);
 
@@ -602,10 +696,24 @@ void ImmUkfPda::probabilisticDataAssociation(const autoware_msgs::CloudClusterAr
   if (std::isnan(det_s) || det_s > det_explode_param)
   {
     target.tracking_num_ = TrackingState::Die;
-    is_skip_target = true;
-    return;
+    return false;
   }
 
+  // measurement gating against the clusters around the predicted measurement
+  gateMeasurements(input, max_det_z, max_det_s, gated_indices, gated_nis);
+  return true;
+}
+
+void ImmUkfPda::probabilisticDataAssociation(const autoware_msgs::CloudClusterArray& input, const double dt,
+                                             const std::vector<int>& associated_indices,
+                                             std::vector<double>& lambda_vec, UKF& target, bool& is_skip_target)
+{
+  std::vector<autoware_msgs::CloudCluster> cluster_vec;
+  cluster_vec.reserve(associated_indices.size());
+  for (size_t i = 0; i < associated_indices.size(); i++)
+    cluster_vec.push_back(input.clusters[associated_indices[i]]);
+  is_skip_target = false;
+
   bool is_second_init;
   if (target.tracking_num_ == TrackingState::Init)
   {
@@ -616,9 +724,6 @@ void ImmUkfPda::probabilisticDataAssociation(const autoware_msgs::CloudClusterAr
     is_second_init = false;
   }
 
-  // measurement gating, get measVec, bboxVec, matchingVec through reference
-  measurementValidation(input, target, is_second_init, max_det_z, max_det_s, cluster_vec, matching_vec);
-
   // bounding box association if target is stable :plus, right angle correction if its needed
   // input: track number, bbox measurements, &target
   associateBB(cluster_vec, target);
@@ -651,7 +756,7 @@ void ImmUkfPda::makeNewTargets(const double timestamp, const autoware_msgs::Clou
       double px = input.clusters[i].bounding_box.pose.position.x;
       double py = input.clusters[i].bounding_box.pose.position.y;
 
-      Eigen::VectorXd init_meas = Eigen::VectorXd(2);
+      UKF::MeasVector init_meas;
       init_meas << px, py;
 
       UKF ukf;
@@ -753,26 +858,39 @@ void ImmUkfPda::tracker(const autoware_msgs::CloudClusterArray& input,
   std::vector<bool> matching_vec(input.clusters.size(), false);  // make 0 vector
 
   // start UKF process
-  for (size_t i = 0; i < targets_.size(); i++)
+  // prediction and gating of every target are independent of each other
+  const int target_num = targets_.size();
+  buildClusterGrid(input);
+  is_gated_.assign(target_num, false);
+  gated_clusters_.resize(target_num);
+  gated_nis_.resize(target_num);
+  associated_clusters_.resize(target_num);
+#pragma omp parallel for schedule(dynamic)
+  for (int i = 0; i < target_num; i++)
   {
-    // reset is_vis_bb_ to false
-    targets_[i].is_vis_bb_ = false;
+    is_gated_[i] = predictAndGate(input, dt, det_explode_param, cov_explode_param, targets_[i], gated_clusters_[i],
+                                  gated_nis_[i]);
+  }
 
-    // todo: modify here. This skips irregular measurement and nan
-    if (targets_[i].tracking_num_ == TrackingState::Die)
+  // measurement validation claims clusters in target order, so it stays serial to keep the result deterministic
+  for (int i = 0; i < target_num; i++)
+  {
+    if (!is_gated_[i])
       continue;
-    // prevent ukf not to explode
-    if (targets_[i].p_merge_.determinant() > det_explode_param || targets_[i].p_merge_(4, 4) > cov_explode_param)
-    {
-      targets_[i].tracking_num_ = TrackingState::Die;
+    bool is_second_init = targets_[i].tracking_num_ == TrackingState::Init;
+    measurementValidation(targets_[i], is_second_init, gated_clusters_[i], gated_nis_[i], associated_clusters_[i],
+                          matching_vec);
+  }
+
+#pragma omp parallel for schedule(dynamic)
+  for (int i = 0; i < target_num; i++)
+  {
+    if (!is_gated_[i])
       continue;
-    }
-    // immukf prediction step
-    targets_[i].predictionIMMUKF(dt);
 
     bool is_skip_target;
     std::vector<double> lambda_vec;
-    probabilisticDataAssociation(input, dt, det_explode_param, matching_vec, lambda_vec, targets_[i], is_skip_target);
+    probabilisticDataAssociation(input, dt, associated_clusters_[i], lambda_vec, targets_[i], is_skip_target);
     if (is_skip_target)
       continue;
 
@@ -8,28 +8,28 @@ UKF::UKF()
 {
 
   // initial state vector
-  x_merge_ = Eigen::MatrixXd(5, 1);
+  x_merge_.setZero();
 
   // initial state vector
-  x_cv_ = Eigen::MatrixXd(5, 1);
+  x_cv_.setZero();
 
   // initial state vector
-  x_ctrv_ = Eigen::MatrixXd(5, 1);
+  x_ctrv_.setZero();
 
   // initial state vector
-  x_rm_ = Eigen::MatrixXd(5, 1);
+  x_rm_.setZero();
 
   // initial covariance matrix
-  p_merge_ = Eigen::MatrixXd(5, 5);
+  p_merge_.setZero();
 
   // initial covariance matrix
-  p_cv_ = Eigen::MatrixXd(5, 5);
+  p_cv_.setZero();
 
   // initial covariance matrix
-  p_ctrv_ = Eigen::MatrixXd(5, 5);
+  p_ctrv_.setZero();
 
   // initial covariance matrix
-  p_rm_ = Eigen::MatrixXd(5, 5);
+  p_rm_.setZero();
 
   // Process noise standard deviation longitudinal acceleration in m/s^2
   std_a_cv_ = 2;
@@ -52,10 +52,10 @@ UKF::UKF()
   time_ = 0.0;
 
   // state dimension
-  n_x_ = 5;
+  n_x_ = Types::STATE_DIM;
 
   // Augmented state dimension
-  n_aug_ = 7;
+  n_aug_ = Types::AUG_DIM;
 
   // Sigma point spreading parameter
   lambda_ = 3 - n_x_;
@@ -64,16 +64,16 @@ UKF::UKF()
   lambda_aug_ = 3 - n_aug_;
 
   // predicted sigma points matrix
-  x_sig_pred_cv_ = Eigen::MatrixXd(n_x_, 2 * n_aug_ + 1);
+  x_sig_pred_cv_.setZero();
 
   // predicted sigma points matrix
-  x_sig_pred_ctrv_ = Eigen::MatrixXd(n_x_, 2 * n_aug_ + 1);
+  x_sig_pred_ctrv_.setZero();
 
   // predicted sigma points matrix
-  x_sig_pred_rm_ = Eigen::MatrixXd(n_x_, 2 * n_aug_ + 1);
+  x_sig_pred_rm_.setZero();
 
   // create vector for weights
-  weights_ = Eigen::VectorXd(2 * n_aug_ + 1);
+  weights_.setZero();
 
   count_ = 0;
   count_empty_ = 0;
@@ -111,17 +111,17 @@ UKF::UKF()
   mode_prob_ctrv_ = 0.33;
   mode_prob_rm_ = 0.33;
 
-  z_pred_cv_ = Eigen::VectorXd(2);
-  z_pred_ctrv_ = Eigen::VectorXd(2);
-  z_pred_rm_ = Eigen::VectorXd(2);
+  z_pred_cv_.setZero();
+  z_pred_ctrv_.setZero();
+  z_pred_rm_.setZero();
 
-  s_cv_ = Eigen::MatrixXd(2, 2);
-  s_ctrv_ = Eigen::MatrixXd(2, 2);
-  s_rm_ = Eigen::MatrixXd(2, 2);
+  s_cv_.setZero();
+  s_ctrv_.setZero();
+  s_rm_.setZero();
 
-  k_cv_ = Eigen::MatrixXd(2, 2);
-  k_ctrv_ = Eigen::MatrixXd(2, 2);
-  k_rm_ = Eigen::MatrixXd(2, 2);
+  k_cv_.setZero();
+  k_ctrv_.setZero();
+  k_rm_.setZero();
 
   // gamma_g_ = 9.21;
   pd_ = 0.9;
@@ -139,13 +139,17 @@ UKF::UKF()
   bb_area_ = 0;
 
   // for env classification
-  init_meas_ = Eigen::VectorXd(2);
+  init_meas_.setZero();
   dist_from_init_ = 0;
 
   x_merge_yaw_ = 0;
+
+  // sigma point workspaces
+  x_sig_aug_.setZero();
+  z_sig_.setZero();
 }
 
-void UKF::initialize(const Eigen::VectorXd& z, const double timestamp)
+void UKF::initialize(const MeasVector& z, const double timestamp)
 {
   // first measurement
   x_merge_ << 1, 1, 0, 0, 0.1;
@@ -272,12 +276,12 @@ void UKF::mixingProbability()
 
 void UKF::interaction()
 {
-  Eigen::MatrixXd x_pre_cv = x_cv_;
-  Eigen::MatrixXd x_pre_ctrv = x_ctrv_;
-  Eigen::MatrixXd x_pre_rm = x_rm_;
-  Eigen::MatrixXd p_pre_cv = p_cv_;
-  Eigen::MatrixXd p_pre_ctrv = p_ctrv_;
-  Eigen::MatrixXd p_pre_rm = p_rm_;
+  const StateVector x_pre_cv = x_cv_;
+  const StateVector x_pre_ctrv = x_ctrv_;
+  const StateVector x_pre_rm = x_rm_;
+  const StateCovariance p_pre_cv = p_cv_;
+  const StateCovariance p_pre_ctrv = p_ctrv_;
+  const StateCovariance p_pre_rm = p_rm_;
   x_cv_ = mode_match_prob_cv2cv_ * x_pre_cv + mode_match_prob_ctrv2cv_ * x_pre_ctrv + mode_match_prob_rm2cv_ * x_pre_rm;
   x_ctrv_ = mode_match_prob_cv2ctrv_ * x_pre_cv + mode_match_prob_ctrv2ctrv_ * x_pre_ctrv +
             mode_match_prob_rm2ctrv_ * x_pre_rm;
@@ -346,7 +350,7 @@ void UKF::updateIMMUKF(const std::vector<double>& lambda_vec)
 }
 
 void UKF::ctrv(const double p_x, const double p_y, const double v, const double yaw, const double yawd,
-               const double nu_a, const double nu_yawdd, const double delta_t, std::vector<double>& state)
+               const double nu_a, const double nu_yawdd, const double delta_t, StateVector& state)
 {
   // predicted state values
   double px_p, py_p;
@@ -374,15 +378,15 @@ void UKF::ctrv(const double p_x, const double p_y, const double v, const double
   yaw_p = yaw_p + 0.5 * nu_yawdd * delta_t * delta_t;
   yawd_p = yawd_p + nu_yawdd * delta_t;
 
-  state[0] = px_p;
-  state[1] = py_p;
-  state[2] = v_p;
-  state[3] = yaw_p;
-  state[4] = yawd_p;
+  state(0) = px_p;
+  state(1) = py_p;
+  state(2) = v_p;
+  state(3) = yaw_p;
+  state(4) = yawd_p;
 }
 
 void UKF::cv(const double p_x, const double p_y, const double v, const double yaw, const double yawd, const double nu_a,
-             const double nu_yawdd, const double delta_t, std::vector<double>& state)
+             const double nu_yawdd, const double delta_t, StateVector& state)
 {
   // predicted state values
   double px_p = p_x + v * cos(yaw) * delta_t;
@@ -402,15 +406,15 @@ void UKF::cv(const double p_x, const double p_y, const double v, const double ya
   yaw_p = yaw_p + 0.5 * nu_yawdd * delta_t * delta_t;
   yawd_p = yawd_p + nu_yawdd * delta_t;
 
-  state[0] = px_p;
-  state[1] = py_p;
-  state[2] = v_p;
-  state[3] = yaw_p;
-  state[4] = yawd_p;
+  state(0) = px_p;
+  state(1) = py_p;
+  state(2) = v_p;
+  state(3) = yaw_p;
+  state(4) = yawd_p;
 }
 
 void UKF::randomMotion(const double p_x, const double p_y, const double v, const double yaw, const double yawd,
-                       const double nu_a, const double nu_yawdd, const double delta_t, std::vector<double>& state)
+                       const double nu_a, const double nu_yawdd, const double delta_t, StateVector& state)
 {
   double px_p = p_x;
   double py_p = p_y;
@@ -419,11 +423,11 @@ void UKF::randomMotion(const double p_x, const double p_y, const double v, const
   double yaw_p = yaw;
   double yawd_p = yawd;
 
-  state[0] = px_p;
-  state[1] = py_p;
-  state[2] = v_p;
-  state[3] = yaw_p;
-  state[4] = yawd_p;
+  state(0) = px_p;
+  state(1) = py_p;
+  state(2) = v_p;
+  state(3) = yaw_p;
+  state(4) = yawd_p;
 }
 
 
@@ -432,31 +436,32 @@ void UKF::prediction(const double delta_t, const int model_ind)
   /*****************************************************************************
  *  Initialize model parameters
  ****************************************************************************/
+  // the model state is predicted in place
   double std_yawdd, std_a;
-  Eigen::MatrixXd x_(x_cv_.rows(), 1);
-  Eigen::MatrixXd p_(p_cv_.rows(), p_cv_.cols());
-  Eigen::MatrixXd x_sig_pred_(x_sig_pred_cv_.rows(), x_sig_pred_cv_.cols());
+  StateVector* x;
+  StateCovariance* p;
+  SigmaPoints* x_sig_pred;
   if (model_ind == 0)
   {
-    x_ = x_cv_.col(0);
-    p_ = p_cv_;
-    x_sig_pred_ = x_sig_pred_cv_;
+    x = &x_cv_;
+    p = &p_cv_;
+    x_sig_pred = &x_sig_pred_cv_;
     std_yawdd = std_cv_yawdd_;
     std_a = std_a_cv_;
   }
   else if (model_ind == 1)
   {
-    x_ = x_ctrv_.col(0);
-    p_ = p_ctrv_;
-    x_sig_pred_ = x_sig_pred_ctrv_;
+    x = &x_ctrv_;
+    p = &p_ctrv_;
+    x_sig_pred = &x_sig_pred_ctrv_;
     std_yawdd = std_ctrv_yawdd_;
     std_a = std_a_ctrv_;
   }
   else
   {
-    x_ = x_rm_.col(0);
-    p_ = p_rm_;
-    x_sig_pred_ = x_sig_pred_rm_;
+    x = &x_rm_;
+    p = &p_rm_;
+    x_sig_pred = &x_sig_pred_rm_;
     std_yawdd = std_rm_yawdd_;
     std_a = std_a_rm_;
   }
@@ -464,53 +469,47 @@ void UKF::prediction(const double delta_t, const int model_ind)
   /*****************************************************************************
   *  Augment Sigma Points
   ****************************************************************************/
-  // create augmented mean vector
-  Eigen::VectorXd x_aug = Eigen::VectorXd(n_aug_);
-
-  // create augmented state covariance
-  Eigen::MatrixXd p_aug = Eigen::MatrixXd(n_aug_, n_aug_);
-
-  // create sigma point matrix
-  Eigen::MatrixXd x_sig_aug = Eigen::MatrixXd(n_aug_, 2 * n_aug_ + 1);
-
   // create augmented mean state
-  x_aug.head(5) = x_;
+  AugStateVector x_aug;
+  x_aug.head<Types::STATE_DIM>() = *x;
   x_aug(5) = 0;
   x_aug(6) = 0;
 
   // create augmented covariance matrix
-  p_aug.fill(0.0);
-  p_aug.topLeftCorner(5, 5) = p_;
+  AugStateCovariance p_aug;
+  p_aug.setZero();
+  p_aug.topLeftCorner<Types::STATE_DIM, Types::STATE_DIM>() = *p;
   p_aug(5, 5) = std_a * std_a;
   p_aug(6, 6) = std_yawdd * std_yawdd;
 
   // create square root matrix
-  Eigen::MatrixXd L = p_aug.llt().matrixL();
+  const AugStateCovariance L = p_aug.llt().matrixL();
 
   // create augmented sigma points
-  x_sig_aug.col(0) = x_aug;
+  const double spread = sqrt(lambda_aug_ + n_aug_);
+  x_sig_aug_.col(0) = x_aug;
   for (int i = 0; i < n_aug_; i++)
   {
-    x_sig_aug.col(i + 1) = x_aug + sqrt(lambda_aug_ + n_aug_) * L.col(i);
-    x_sig_aug.col(i + 1 + n_aug_) = x_aug - sqrt(lambda_aug_ + n_aug_) * L.col(i);
+    x_sig_aug_.col(i + 1) = x_aug + spread * L.col(i);
+    x_sig_aug_.col(i + 1 + n_aug_) = x_aug - spread * L.col(i);
   }
 
   /*****************************************************************************
   *  Predict Sigma Points
   ****************************************************************************/
   // predict sigma points
-  for (int i = 0; i < 2 * n_aug_ + 1; i++)
+  StateVector state;
+  for (int i = 0; i < Types::SIGMA_NUM; i++)
   {
     // extract values for better readability
-    double p_x = x_sig_aug(0, i);
-    double p_y = x_sig_aug(1, i);
-    double v = x_sig_aug(2, i);
-    double yaw = x_sig_aug(3, i);
-    double yawd = x_sig_aug(4, i);
-    double nu_a = x_sig_aug(5, i);
-    double nu_yawdd = x_sig_aug(6, i);
-
-    std::vector<double> state(5);
+    double p_x = x_sig_aug_(0, i);
+    double p_y = x_sig_aug_(1, i);
+    double v = x_sig_aug_(2, i);
+    double yaw = x_sig_aug_(3, i);
+    double yawd = x_sig_aug_(4, i);
+    double nu_a = x_sig_aug_(5, i);
+    double nu_yawdd = x_sig_aug_(6, i);
+
     if (model_ind == 0)
       cv(p_x, p_y, v, yaw, yawd, nu_a, nu_yawdd, delta_t, state);
     else if (model_ind == 1)
@@ -519,61 +518,35 @@ void UKF::prediction(const double delta_t, const int model_ind)
       randomMotion(p_x, p_y, v, yaw, yawd, nu_a, nu_yawdd, delta_t, state);
 
     // write predicted sigma point into right column
-    x_sig_pred_(0, i) = state[0];
-    x_sig_pred_(1, i) = state[1];
-    x_sig_pred_(2, i) = state[2];
-    x_sig_pred_(3, i) = state[3];
-    x_sig_pred_(4, i) = state[4];
+    x_sig_pred->col(i) = state;
   }
 
   /*****************************************************************************
   *  Convert Predicted Sigma Points to Mean/Covariance
   ****************************************************************************/
   // predicted state mean
-  x_.fill(0.0);
-  for (int i = 0; i < 2 * n_aug_ + 1; i++)
+  x->setZero();
+  for (int i = 0; i < Types::SIGMA_NUM; i++)
   {  // iterate over sigma points
-    x_ = x_ + weights_(i) * x_sig_pred_.col(i);
+    *x += weights_(i) * x_sig_pred->col(i);
   }
 
-  while (x_(3) > M_PI)
-    x_(3) -= 2. * M_PI;
-  while (x_(3) < -M_PI)
-    x_(3) += 2. * M_PI;
+  while ((*x)(3) > M_PI)
+    (*x)(3) -= 2. * M_PI;
+  while ((*x)(3) < -M_PI)
+    (*x)(3) += 2. * M_PI;
   // predicted state covariance matrix
-  p_.fill(0.0);
-  for (int i = 0; i < 2 * n_aug_ + 1; i++)
+  p->setZero();
+  for (int i = 0; i < Types::SIGMA_NUM; i++)
   {  // iterate over sigma points
     // state difference
-    Eigen::VectorXd x_diff = x_sig_pred_.col(i) - x_;
+    StateVector x_diff = x_sig_pred->col(i) - *x;
     // angle normalization
     while (x_diff(3) > M_PI)
       x_diff(3) -= 2. * M_PI;
     while (x_diff(3) < -M_PI)
       x_diff(3) += 2. * M_PI;
-    p_ = p_ + weights_(i) * x_diff * x_diff.transpose();
-  }
-
-  /*****************************************************************************
-  *  Update model parameters
-  ****************************************************************************/
-  if (model_ind == 0)
-  {
-    x_cv_.col(0) = x_;
-    p_cv_ = p_;
-    x_sig_pred_cv_ = x_sig_pred_;
-  }
-  else if (model_ind == 1)
-  {
-    x_ctrv_.col(0) = x_;
-    p_ctrv_ = p_;
-    x_sig_pred_ctrv_ = x_sig_pred_;
-  }
-  else
-  {
-    x_rm_.col(0) = x_;
-    p_rm_ = p_;
-    x_sig_pred_rm_ = x_sig_pred_;
+    *p += weights_(i) * x_diff * x_diff.transpose();
   }
 }
 
@@ -583,118 +556,70 @@ void UKF::updateLidar(const int model_ind)
   /*****************************************************************************
  *  Initialize model parameters
  ****************************************************************************/
-  Eigen::VectorXd x(x_cv_.rows());
-  Eigen::MatrixXd P(p_cv_.rows(), p_cv_.cols());
-  Eigen::MatrixXd x_sig_pred(x_sig_pred_cv_.rows(), x_sig_pred_cv_.cols());
+  // the predicted measurement, its covariance and the Kalman gain are written in place
+  const StateVector* x;
+  const SigmaPoints* x_sig_pred;
+  MeasVector* z_pred;
+  MeasCovariance* S;
+  KalmanGain* K;
   if (model_ind == 0)
   {
-    x = x_cv_.col(0);
-    P = p_cv_;
-    x_sig_pred = x_sig_pred_cv_;
+    x = &x_cv_;
+    x_sig_pred = &x_sig_pred_cv_;
+    z_pred = &z_pred_cv_;
+    S = &s_cv_;
+    K = &k_cv_;
   }
   else if (model_ind == 1)
   {
-    x = x_ctrv_.col(0);
-    P = p_ctrv_;
-    x_sig_pred = x_sig_pred_ctrv_;
+    x = &x_ctrv_;
+    x_sig_pred = &x_sig_pred_ctrv_;
+    z_pred = &z_pred_ctrv_;
+    S = &s_ctrv_;
+    K = &k_ctrv_;
   }
   else
   {
-    x = x_rm_.col(0);
-    P = p_rm_;
-    x_sig_pred = x_sig_pred_rm_;
+    x = &x_rm_;
+    x_sig_pred = &x_sig_pred_rm_;
+    z_pred = &z_pred_rm_;
+    S = &s_rm_;
+    K = &k_rm_;
   }
 
-  // set measurement dimension, lidar can measure p_x and p_y
-  int n_z = 2;
-
-  // create matrix for sigma points in measurement space
-  Eigen::MatrixXd z_sig = Eigen::MatrixXd(n_z, 2 * n_aug_ + 1);
-
-  // transform sigma points into measurement space
-  for (int i = 0; i < 2 * n_aug_ + 1; i++)
-  {  // 2n+1 simga points
-    // extract values for better readibility
-    double p_x = x_sig_pred(0, i);
-    double p_y = x_sig_pred(1, i);
-
-    // measurement model
-    z_sig(0, i) = p_x;
-    z_sig(1, i) = p_y;
-  }
+  // transform sigma points into measurement space, lidar can measure p_x and p_y
+  z_sig_ = x_sig_pred->topRows<Types::MEAS_DIM>();
 
   // mean predicted measurement
-  Eigen::VectorXd z_pred = Eigen::VectorXd(n_z);
-  z_pred.fill(0.0);
-  for (int i = 0; i < 2 * n_aug_ + 1; i++)
+  z_pred->setZero();
+  for (int i = 0; i < Types::SIGMA_NUM; i++)
   {
-    z_pred = z_pred + weights_(i) * z_sig.col(i);
-  }
-
-  // measurement covariance matrix S
-  Eigen::MatrixXd S = Eigen::MatrixXd(n_z, n_z);
-  S.fill(0.0);
-  for (int i = 0; i < 2 * n_aug_ + 1; i++)
-  {  // 2n+1 simga points
-    // residual
-    Eigen::VectorXd z_diff = z_sig.col(i) - z_pred;
-    S = S + weights_(i) * z_diff * z_diff.transpose();
+    *z_pred += weights_(i) * z_sig_.col(i);
   }
 
-  // add measurement noise covariance matrix
-  Eigen::MatrixXd R = Eigen::MatrixXd(n_z, n_z);
-  R << std_laspx_ * std_laspx_, 0, 0, std_laspy_ * std_laspy_;
-  S = S + R;
-
-  // create matrix for cross correlation Tc
-  Eigen::MatrixXd Tc = Eigen::MatrixXd(n_x_, n_z);
+  // measurement covariance matrix S and cross correlation matrix Tc
+  S->setZero();
+  KalmanGain Tc;
+  Tc.setZero();
 
   /*****************************************************************************
   *  UKF Update for Lidar
   ****************************************************************************/
-  // calculate cross correlation matrix
-  Tc.fill(0.0);
-  for (int i = 0; i < 2 * n_aug_ + 1; i++)
+  for (int i = 0; i < Types::SIGMA_NUM; i++)
   {  // 2n+1 simga points
     // residual
-    Eigen::VectorXd z_diff = z_sig.col(i) - z_pred;
+    const MeasVector z_diff = z_sig_.col(i) - *z_pred;
     // state difference
-    Eigen::VectorXd x_diff = x_sig_pred.col(i) - x;
+    const StateVector x_diff = x_sig_pred->col(i) - *x;
 
-    Tc = Tc + weights_(i) * x_diff * z_diff.transpose();
+    *S += weights_(i) * z_diff * z_diff.transpose();
+    Tc += weights_(i) * x_diff * z_diff.transpose();
   }
 
-  // Kalman gain K;
-  Eigen::MatrixXd K = Tc * S.inverse();
+  // add measurement noise covariance matrix
+  (*S)(0, 0) += std_laspx_ * std_laspx_;
+  (*S)(1, 1) += std_laspy_ * std_laspy_;
 
-  /*****************************************************************************
-  *  Update model parameters
-  ****************************************************************************/
-  if (model_ind == 0)
-  {
-    x_cv_.col(0) = x;
-    p_cv_ = P;
-    x_sig_pred_cv_ = x_sig_pred;
-    z_pred_cv_ = z_pred;
-    s_cv_ = S;
-    k_cv_ = K;
-  }
-  else if (model_ind == 1)
-  {
-    x_ctrv_.col(0) = x;
-    p_ctrv_ = P;
-    x_sig_pred_ctrv_ = x_sig_pred;
-    z_pred_ctrv_ = z_pred;
-    s_ctrv_ = S;
-    k_ctrv_ = K;
-  }
-  else
-  {
-    x_rm_.col(0) = x;
-    p_rm_ = P;
-    x_sig_pred_rm_ = x_sig_pred;
-    z_pred_rm_ = z_pred;
-    s_rm_ = S;
-    k_rm_ = K;
-  }
+  // Kalman gain K;
+  *K = Tc * S->inverse();
 }
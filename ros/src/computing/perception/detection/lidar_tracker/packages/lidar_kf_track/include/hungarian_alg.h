@@ -29,6 +29,10 @@ private:
 	// Computes a suboptimal solution. Good for cases with many forbidden assignments.
 	// --------------------------------------------------------------------------
 	void assignmentsuboptimal2(std::vector<int>& assignment, float& cost, const std::vector<float>& distMatrixIn, size_t nOfRows, size_t nOfColumns);
+	// --------------------------------------------------------------------------
+	// Shortest augmenting path assignment of one connected component of the sparse problem.
+	// --------------------------------------------------------------------------
+	void assignmentsparsecomponent(std::vector<int>& assignment, float& cost, const std::vector<int>& componentRows, const std::vector<int>& componentColumns, const std::vector<size_t>& rowEdgesStart, const std::vector<int>& edgeColumns, const std::vector<float>& edgeCosts, std::vector<int>& localColumn);
 
 public:
 	enum TMethod
@@ -38,7 +42,21 @@ public:
 		without_forbidden_assignments
 	};
 
+	// Feasible (row, column) pair of a sparse assignment problem, the cost must not be negative
+	struct TPair
+	{
+		int row;
+		int column;
+		float cost;
+	};
+
 	AssignmentProblemSolver();
 	~AssignmentProblemSolver();
 	float Solve(const std::vector<float>& distMatrixIn, size_t nOfRows, size_t nOfColumns, std::vector<int>& assignment, TMethod Method = optimal);
+	// --------------------------------------------------------------------------
+	// Computes a maximum cardinality assignment of minimum overall cost among the feasible pairs only.
+	// Rows and columns without any feasible pair stay unassigned (-1). The problem is split into the
+	// connected components of the pairs, so the cost grows with the pairs instead of nOfRows * nOfColumns.
+	// --------------------------------------------------------------------------
+	float SolveSparse(const std::vector<TPair>& pairs, size_t nOfRows, size_t nOfColumns, std::vector<int>& assignment);
 };
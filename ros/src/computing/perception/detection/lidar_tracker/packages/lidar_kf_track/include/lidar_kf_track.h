@@ -99,6 +99,14 @@ class KfLidarTracker {
   size_t maximum_track_id_;
 
   bool pose_estimation_;
+
+  // axis aligned box of a cluster hull and centroid, used to gate track/detection pairs
+  struct GatingBox {
+    float min_x, min_y, max_x, max_y;
+  };
+  GatingBox GetGatingBox(const autoware_msgs::CloudCluster &in_cluster);
+  void GatePairs(const autoware_msgs::CloudClusterArray &in_cloud_cluster_array,
+                 std::vector<AssignmentProblemSolver::TPair> &out_pairs);
   void CheckTrackerMerge(size_t in_tracker_id, std::vector<CTrack> &in_trackers,
                          std::vector<bool> &in_out_visited_trackers,
                          std::vector<size_t> &out_merge_indices,
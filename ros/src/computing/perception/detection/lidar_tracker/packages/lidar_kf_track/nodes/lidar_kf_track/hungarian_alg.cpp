@@ -1,5 +1,8 @@
 #include "hungarian_alg.h"
+#include <algorithm>
+#include <functional>
 #include <limits>
+#include <queue>
 
 AssignmentProblemSolver::AssignmentProblemSolver()
 {
@@ -710,3 +713,242 @@ void AssignmentProblemSolver::assignmentsuboptimal1(std::vector<int>& assignment
 	//free(nOfValidTracks);
 	//free(distMatrix);
 }
+
+// --------------------------------------------------------------------------
+// Sparse assignment over the feasible pairs, one connected component at a time.
+// Every component is solved with successive shortest augmenting paths (Dijkstra
+// on reduced costs) until no augmenting path remains.
+// --------------------------------------------------------------------------
+static int findcomponentroot(std::vector<int>& parents, int node)
+{
+	while (parents[node] != node)
+	{
+		parents[node] = parents[parents[node]];
+		node = parents[node];
+	}
+	return node;
+}
+
+float AssignmentProblemSolver::SolveSparse(const std::vector<TPair>& pairs, size_t nOfRows, size_t nOfColumns, std::vector<int>& assignment)
+{
+	assignment.assign(nOfRows, -1);
+	float cost = 0;
+
+	/* pairs grouped by row */
+	std::vector<size_t> rowEdgesStart(nOfRows + 1, 0);
+	for (size_t i = 0; i < pairs.size(); i++)
+	{
+		rowEdgesStart[pairs[i].row + 1]++;
+	}
+	for (size_t row = 0; row < nOfRows; row++)
+	{
+		rowEdgesStart[row + 1] += rowEdgesStart[row];
+	}
+	std::vector<int> edgeColumns(pairs.size());
+	std::vector<float> edgeCosts(pairs.size());
+	std::vector<size_t> rowFill(rowEdgesStart.begin(), rowEdgesStart.end() - 1);
+	for (size_t i = 0; i < pairs.size(); i++)
+	{
+		size_t edge = rowFill[pairs[i].row]++;
+		edgeColumns[edge] = pairs[i].column;
+		edgeCosts[edge] = pairs[i].cost;
+	}
+
+	/* connected components, rows are nodes 0..nOfRows-1 and columns follow them */
+	std::vector<int> parents(nOfRows + nOfColumns);
+	for (size_t node = 0; node < parents.size(); node++)
+	{
+		parents[node] = static_cast<int>(node);
+	}
+	for (size_t i = 0; i < pairs.size(); i++)
+	{
+		int rootRow = findcomponentroot(parents, pairs[i].row);
+		int rootColumn = findcomponentroot(parents, static_cast<int>(nOfRows) + pairs[i].column);
+		if (rootRow != rootColumn)
+		{
+			parents[std::max(rootRow, rootColumn)] = std::min(rootRow, rootColumn);
+		}
+	}
+
+	/* rows and columns of every component with at least one pair, in index order */
+	std::vector<int> componentIndex(nOfRows + nOfColumns, -1);
+	std::vector< std::vector<int> > componentRows;
+	std::vector< std::vector<int> > componentColumns;
+	for (size_t node = 0; node < parents.size(); node++)
+	{
+		bool isRow = node < nOfRows;
+		int root = findcomponentroot(parents, static_cast<int>(node));
+		if (root == static_cast<int>(node) && (!isRow || rowEdgesStart[node] == rowEdgesStart[node + 1]))
+		{
+			continue; /* row or column without pairs */
+		}
+		if (componentIndex[root] < 0)
+		{
+			componentIndex[root] = static_cast<int>(componentRows.size());
+			componentRows.push_back(std::vector<int>());
+			componentColumns.push_back(std::vector<int>());
+		}
+		if (isRow)
+		{
+			componentRows[componentIndex[root]].push_back(static_cast<int>(node));
+		}
+		else
+		{
+			componentColumns[componentIndex[root]].push_back(static_cast<int>(node - nOfRows));
+		}
+	}
+
+	std::vector<int> localColumn(nOfColumns, -1);
+	for (size_t c = 0; c < componentRows.size(); c++)
+	{
+		assignmentsparsecomponent(assignment, cost, componentRows[c], componentColumns[c], rowEdgesStart, edgeColumns, edgeCosts, localColumn);
+	}
+
+	return cost;
+}
+
+void AssignmentProblemSolver::assignmentsparsecomponent(std::vector<int>& assignment, float& cost, const std::vector<int>& componentRows, const std::vector<int>& componentColumns, const std::vector<size_t>& rowEdgesStart, const std::vector<int>& edgeColumns, const std::vector<float>& edgeCosts, std::vector<int>& localColumn)
+{
+	/* single row, take its cheapest pair */
+	if (componentRows.size() == 1)
+	{
+		int row = componentRows[0];
+		size_t bestEdge = rowEdgesStart[row];
+		for (size_t edge = rowEdgesStart[row] + 1; edge < rowEdgesStart[row + 1]; edge++)
+		{
+			if (edgeCosts[edge] < edgeCosts[bestEdge])
+			{
+				bestEdge = edge;
+			}
+		}
+		assignment[row] = edgeColumns[bestEdge];
+		cost += edgeCosts[bestEdge];
+		return;
+	}
+
+	/* local numbering: rows 0..nRows-1, columns nRows..nRows+nColumns-1 */
+	const int nRows = static_cast<int>(componentRows.size());
+	const int nColumns = static_cast<int>(componentColumns.size());
+	const int nNodes = nRows + nColumns;
+	for (int j = 0; j < nColumns; j++)
+	{
+		localColumn[componentColumns[j]] = j;
+	}
+
+	std::vector<double> potentials(nNodes, 0.0);
+	std::vector<double> distances(nNodes);
+	std::vector<int> predecessors(nNodes);
+	std::vector<size_t> predecessorEdges(nColumns); /* pair that reached every column */
+	std::vector<bool> done(nNodes);
+	std::vector<float> rowCosts(nRows, 0.f); /* cost of the pair assigned to every row */
+	std::vector<int> rowMatch(nRows, -1);
+	std::vector<int> columnMatch(nColumns, -1);
+	const double infinity = std::numeric_limits<double>::infinity();
+
+	typedef std::pair<double, int> TQueueEntry;
+	for (int augmentations = 0; augmentations < std::min(nRows, nColumns); augmentations++)
+	{
+		/* Dijkstra on reduced costs from all unassigned rows at once */
+		std::priority_queue< TQueueEntry, std::vector<TQueueEntry>, std::greater<TQueueEntry> > queue;
+		for (int node = 0; node < nNodes; node++)
+		{
+			distances[node] = infinity;
+			predecessors[node] = -1;
+			done[node] = false;
+		}
+		for (int i = 0; i < nRows; i++)
+		{
+			if (rowMatch[i] < 0)
+			{
+				distances[i] = 0.0;
+				queue.push(TQueueEntry(0.0, i));
+			}
+		}
+		double maxDistance = 0.0;
+		while (!queue.empty())
+		{
+			TQueueEntry top = queue.top();
+			queue.pop();
+			int node = top.second;
+			if (done[node])
+			{
+				continue;
+			}
+			done[node] = true;
+			maxDistance = top.first;
+			if (node < nRows)
+			{
+				int row = componentRows[node];
+				for (size_t edge = rowEdgesStart[row]; edge < rowEdgesStart[row + 1]; edge++)
+				{
+					int column = nRows + localColumn[edgeColumns[edge]];
+					if (column - nRows == rowMatch[node])
+					{
+						continue; /* the assigned pair can only be walked backwards */
+					}
+					double reduced = std::max(0.0, edgeCosts[edge] + potentials[node] - potentials[column]);
+					if (top.first + reduced < distances[column])
+					{
+						distances[column] = top.first + reduced;
+						predecessors[column] = node;
+						predecessorEdges[column - nRows] = edge;
+						queue.push(TQueueEntry(distances[column], column));
+					}
+				}
+			}
+			else if (columnMatch[node - nRows] >= 0)
+			{
+				int matchedRow = columnMatch[node - nRows];
+				double reduced = std::max(0.0, -rowCosts[matchedRow] + potentials[node] - potentials[matchedRow]);
+				if (top.first + reduced < distances[matchedRow])
+				{
+					distances[matchedRow] = top.first + reduced;
+					predecessors[matchedRow] = node;
+					queue.push(TQueueEntry(distances[matchedRow], matchedRow));
+				}
+			}
+		}
+
+		/* unassigned column closest in true (not reduced) cost, lowest index on ties */
+		int sink = -1;
+		for (int j = 0; j < nColumns; j++)
+		{
+			int column = nRows + j;
+			if (columnMatch[j] < 0 && done[column] &&
+				(sink < 0 || distances[column] + potentials[column] < distances[sink] + potentials[sink]))
+			{
+				sink = column;
+			}
+		}
+		if (sink < 0)
+		{
+			break; /* no augmenting path left, the assignment has maximum cardinality */
+		}
+
+		for (int node = 0; node < nNodes; node++)
+		{
+			potentials[node] += done[node] ? distances[node] : maxDistance;
+		}
+
+		/* flip the pairs along the path */
+		int column = sink;
+		while (column >= 0)
+		{
+			int row = predecessors[column];
+			int previousColumn = predecessors[row];
+			rowMatch[row] = column - nRows;
+			columnMatch[column - nRows] = row;
+			rowCosts[row] = edgeCosts[predecessorEdges[column - nRows]];
+			column = previousColumn;
+		}
+	}
+
+	for (int i = 0; i < nRows; i++)
+	{
+		if (rowMatch[i] >= 0)
+		{
+			assignment[componentRows[i]] = componentColumns[rowMatch[i]];
+			cost += rowCosts[i];
+		}
+	}
+}
@@ -1,5 +1,9 @@
 #include "lidar_kf_track.h"
 
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+
 // ---------------------------------------------------------------------------
 // Tracker. Manage tracks. Create, remove, update.
 // ---------------------------------------------------------------------------
@@ -37,14 +41,148 @@ void KfLidarTracker::CreatePolygonFromPoints(const geometry_msgs::Polygon& in_po
 	boost::geometry::assign_points(out_polygon, hull_detection_points);
 }
 
+static uint64_t GetCellKey(int in_x, int in_y)
+{
+	return (static_cast<uint64_t>(static_cast<uint32_t>(in_x)) << 32) | static_cast<uint32_t>(in_y);
+}
+
+KfLidarTracker::GatingBox KfLidarTracker::GetGatingBox(const autoware_msgs::CloudCluster& in_cluster)
+{
+	GatingBox box;
+	box.min_x = box.max_x = in_cluster.centroid_point.point.x;
+	box.min_y = box.max_y = in_cluster.centroid_point.point.y;
+	const geometry_msgs::Polygon& hull = in_cluster.convex_hull.polygon;
+	for (size_t k=0; k < hull.points.size()/2; k++)
+	{
+		box.min_x = std::min(box.min_x, hull.points[k].x);
+		box.min_y = std::min(box.min_y, hull.points[k].y);
+		box.max_x = std::max(box.max_x, hull.points[k].x);
+		box.max_y = std::max(box.max_y, hull.points[k].y);
+	}
+	return box;
+}
+
+void KfLidarTracker::GatePairs(const autoware_msgs::CloudClusterArray& in_cloud_cluster_array,
+		std::vector<AssignmentProblemSolver::TPair>& out_pairs)
+{
+	//a track gates a detection when their hulls overlap or their centroids are closer than the distance threshold,
+	//both imply that the detection box meets the track box grown by the threshold. Tracks are put in the grid cell
+	//of their centroid, so the detection box is also grown by the largest track box extent the grid accepts
+	const size_t num_tracks = tracks_.size();
+	const size_t num_detections = in_cloud_cluster_array.clusters.size();
+	const float cell_size = std::max(2 * distance_threshold_, 4.0f);
+	const float max_track_extent = cell_size;
+	const float max_cell_index = 1 << 30;
+
+	//hull polygons are only built for pairs too far apart to be gated by distance
+	std::vector<boost_polygon> track_polygons(num_tracks);
+	std::vector<bool> track_polygons_built(num_tracks, false);
+	std::vector< std::pair<uint64_t, int> > track_cells;	//(cell key, track), sorted
+	std::vector<int> unbounded_tracks;						//tracks too large or far for the grid, checked against all detections
+	track_cells.reserve(num_tracks);
+	for (size_t j = 0; j < num_tracks; j++)
+	{
+		const geometry_msgs::Point& centroid = tracks_[j].cluster.centroid_point.point;
+		GatingBox box = GetGatingBox(tracks_[j].cluster);
+		float extent = std::max(std::max(centroid.x - box.min_x, box.max_x - centroid.x),
+								std::max(centroid.y - box.min_y, box.max_y - centroid.y));
+		float x = std::floor(centroid.x / cell_size);
+		float y = std::floor(centroid.y / cell_size);
+		if (!(extent <= max_track_extent) || !(std::max(std::fabs(x), std::fabs(y)) < max_cell_index))
+		{
+			unbounded_tracks.push_back(j);
+			continue;
+		}
+		track_cells.push_back(std::make_pair(GetCellKey(x, y), static_cast<int>(j)));
+	}
+	std::sort(track_cells.begin(), track_cells.end());
+
+	std::vector<int> candidate_tracks;
+	std::vector<int> candidate_detection(num_tracks, -1);	//last detection that listed every track, to list it once
+	for (size_t i = 0; i < num_detections; i++)
+	{
+		const autoware_msgs::CloudCluster& detection = in_cloud_cluster_array.clusters[i];
+
+		boost_polygon hull_detection_polygon;
+		bool detection_polygon_built = false;
+
+		candidate_tracks = unbounded_tracks;
+		GatingBox box = GetGatingBox(detection);
+		const float margin = distance_threshold_ + max_track_extent;
+		float min_x = std::floor((box.min_x - margin) / cell_size);
+		float min_y = std::floor((box.min_y - margin) / cell_size);
+		float max_x = std::floor((box.max_x + margin) / cell_size);
+		float max_y = std::floor((box.max_y + margin) / cell_size);
+		if (!(std::max(std::max(std::fabs(min_x), std::fabs(max_x)), std::max(std::fabs(min_y), std::fabs(max_y))) < max_cell_index)
+			|| (max_x - min_x + 1) * (max_y - min_y + 1) > static_cast<float>(track_cells.size()))
+		{
+			//too large or far for the grid, check all the tracks
+			candidate_tracks.clear();
+			for (size_t j = 0; j < num_tracks; j++)
+				candidate_tracks.push_back(j);
+		}
+		else
+		{
+			for (int x = min_x; x <= max_x; x++)
+			{
+				for (int y = min_y; y <= max_y; y++)
+				{
+					uint64_t key = GetCellKey(x, y);
+					std::vector< std::pair<uint64_t, int> >::const_iterator it =
+							std::lower_bound(track_cells.begin(), track_cells.end(), std::make_pair(key, -1));
+					for (; it != track_cells.end() && it->first == key; ++it)
+					{
+						if (candidate_detection[it->second] != static_cast<int>(i))
+						{
+							candidate_detection[it->second] = i;
+							candidate_tracks.push_back(it->second);
+						}
+					}
+				}
+			}
+			std::sort(candidate_tracks.begin(), candidate_tracks.end());
+		}
+
+		for (size_t k = 0; k < candidate_tracks.size(); k++)
+		{
+			int j = candidate_tracks[k];
+			const autoware_msgs::CloudCluster& track_cluster = tracks_[j].cluster;	//GetCluster() would copy it
+			float current_distance = sqrt(
+											pow(track_cluster.centroid_point.point.x - detection.centroid_point.point.x, 2) +
+											pow(track_cluster.centroid_point.point.y - detection.centroid_point.point.y, 2)
+									);
+			bool gated = current_distance < distance_threshold_;
+			if (!gated)
+			{
+				if (!detection_polygon_built)
+				{
+					CreatePolygonFromPoints(detection.convex_hull.polygon, hull_detection_polygon);
+					detection_polygon_built = true;
+				}
+				if (!track_polygons_built[j])
+				{
+					CreatePolygonFromPoints(track_cluster.convex_hull.polygon, track_polygons[j]);
+					track_polygons_built[j] = true;
+				}
+				gated = !boost::geometry::disjoint(hull_detection_polygon, track_polygons[j]);
+			}
+			if (gated)
+			{
+				AssignmentProblemSolver::TPair pair;
+				pair.row = j;
+				pair.column = i;
+				pair.cost = current_distance;
+				out_pairs.push_back(pair);
+			}
+		}
+	}
+}
+
 void KfLidarTracker::Update(const autoware_msgs::CloudClusterArray& in_cloud_cluster_array, DistType in_match_method)
 {
 	size_t num_detections = in_cloud_cluster_array.clusters.size();
 	size_t num_tracks = tracks_.size();
 
-	std::vector<size_t> detections_assignments;
-	std::vector<double> detections_areas(num_detections, 0.0f);
-
 	std::vector< CTrack > final_tracks;
 
 	// If no trackers, new track for each detection
@@ -69,40 +207,19 @@ void KfLidarTracker::Update(const autoware_msgs::CloudClusterArray& in_cloud_clu
 	{
 		//std::cout << "Trying to match " << num_tracks << " tracks with " << num_detections << std::endl;
 
-		//calculate distances between objects
-		for (size_t i = 0; i < num_detections; i++)
-		{
-
-			float current_distance_threshold = distance_threshold_;
+		//gate the track/detection pairs, then assign detections to tracks one to one over the feasible pairs only
+		std::vector<AssignmentProblemSolver::TPair> feasible_pairs;
+		GatePairs(in_cloud_cluster_array, feasible_pairs);
 
-			//detection polygon
-			boost_polygon hull_detection_polygon;
-			CreatePolygonFromPoints(in_cloud_cluster_array.clusters[i].convex_hull.polygon, hull_detection_polygon);
-			detections_areas[i] = boost::geometry::area(hull_detection_polygon);
+		AssignmentProblemSolver assignment_solver;
+		assignment_solver.SolveSparse(feasible_pairs, num_tracks, num_detections, track_assignments);
 
-			for (size_t j = 0; j < num_tracks; j++)
-			{
-				//float current_distance = tracks_[j].CalculateDistance(cv::Point2f(in_cloud_cluster_array.clusters[i].centroid_point.point.x, in_cloud_cluster_array.clusters[i].centroid_point.point.y));
-				float current_distance = sqrt(
-												pow(tracks_[j].GetCluster().centroid_point.point.x - in_cloud_cluster_array.clusters[i].centroid_point.point.x, 2) +
-												pow(tracks_[j].GetCluster().centroid_point.point.y - in_cloud_cluster_array.clusters[i].centroid_point.point.y, 2)
-										);
-
-				//tracker polygon
-				boost_polygon hull_track_polygon;
-				CreatePolygonFromPoints(tracks_[j].GetCluster().convex_hull.polygon, hull_track_polygon);
-
-				//if(current_distance < current_distance_threshold)
-				if (!boost::geometry::disjoint(hull_detection_polygon, hull_track_polygon)
-					||  (current_distance < current_distance_threshold)
-					)
-				{//assign the closest detection or overlapping
-					current_distance_threshold = current_distance;
-					track_assignments[j] = i;//assign detection i to track j
-					track_assignments_vector[j].push_back(i);//add current detection as a match
-					detections_assignments.push_back(j);///////////////////////////////////////
-				}
-			}
+		//a detection gated by any track is not a new object, even if it was not assigned to it
+		std::vector<bool> detections_gated(num_detections, false);
+		for (size_t i = 0; i < feasible_pairs.size(); i++)
+		{
+			track_assignments_vector[feasible_pairs[i].row].push_back(feasible_pairs[i].column);
+			detections_gated[feasible_pairs[i].column] = true;
 		}
 
 		//check assignmets
@@ -162,8 +279,7 @@ void KfLidarTracker::Update(const autoware_msgs::CloudClusterArray& in_cloud_clu
 		int una = 0;
 		for (size_t i = 0; i < num_detections; ++i)
 		{
-			std::vector<size_t>::iterator it = find(detections_assignments.begin(), detections_assignments.end(), i);
-			if (it == detections_assignments.end())//if detection not found in the already assigned ones, add new tracker
+			if (!detections_gated[i])//if detection not found in the already assigned ones, add new tracker
 			{
 				tracks_.push_back(CTrack(in_cloud_cluster_array.clusters[i],
 										time_delta_,
@@ -14,6 +14,7 @@
 #include <vector>
 
 #include "rect_class_score.h"
+#include "image_ingest.h"
 
 namespace Ssd
 {
@@ -45,6 +46,7 @@ private:
 	cv::Size input_geometry_;
 	int num_channels_;
 	cv::Scalar mean_;
+	ImageIngest image_ingest_;
 };
 
 #endif //SSD_DETECTOR_H
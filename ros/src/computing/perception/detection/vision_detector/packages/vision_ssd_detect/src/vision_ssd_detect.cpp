@@ -67,10 +67,19 @@ std::vector <  RectClassScore<float>  > SsdDetector::Detect(const cv::Mat& img)
 	/* Forward dimension change to all layers. */
 	net_->Reshape();
 
-	std::vector<cv::Mat> input_channels;
-	WrapInputLayer(&input_channels);
+	if (img.type() == CV_8UC3 && num_channels_ == 3)
+	{
+		//resize, mean subtraction and channel split in one pass, written straight into the input layer
+		image_ingest_.SetOutput(input_layer->mutable_cpu_data(), input_geometry_, mean_, 1, false, false);
+		image_ingest_.Ingest(img.data, img.cols, img.rows, img.step);
+	}
+	else
+	{
+		std::vector<cv::Mat> input_channels;
+		WrapInputLayer(&input_channels);
 
-	Preprocess(img, &input_channels);
+		Preprocess(img, &input_channels);
+	}
 
 	net_->Forward();
 
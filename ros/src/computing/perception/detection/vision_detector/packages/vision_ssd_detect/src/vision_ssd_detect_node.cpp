@@ -109,7 +109,8 @@ class RosSsdApp
 	void image_callback(const sensor_msgs::Image& image_source)
 	{
 		//Receive Image, convert it to OpenCV Mat
-		cv_bridge::CvImagePtr cv_image = cv_bridge::toCvCopy(image_source, "bgr8");//toCvCopy(image_source, sensor_msgs::image_encodings::BGR8);
+		//shares the message data when it is already bgr8, the detector only reads it
+		cv_bridge::CvImageConstPtr cv_image = cv_bridge::toCvShare(image_source, boost::shared_ptr<void const>(), "bgr8");
 		cv::Mat image = cv_image->image;
 
 		//Detect Object in image
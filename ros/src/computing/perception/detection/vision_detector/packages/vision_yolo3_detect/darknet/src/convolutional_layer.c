@@ -382,6 +382,7 @@ void resize_convolutional_layer(convolutional_layer *l, int w, int h)
 
     l->output = realloc(l->output, l->batch*l->outputs*sizeof(float));
     l->delta  = realloc(l->delta,  l->batch*l->outputs*sizeof(float));
+    if(l->input_int8) l->input_int8 = realloc(l->input_int8, l->batch*l->inputs*sizeof(signed char));
     if(l->batch_normalize){
         l->x = realloc(l->x, l->batch*l->outputs*sizeof(float));
         l->x_norm  = realloc(l->x_norm, l->batch*l->outputs*sizeof(float));
@@ -442,10 +443,132 @@ void backward_bias(float *bias_updates, float *delta, int batch, int n, int size
     }
 }
 
+/*
+ * Inference forward pass. The batch normalization is folded into a scale and bias per filter that the gemm
+ * applies with the activation to each output tile while it is in cache, so the output is written once
+ * instead of going through separate batchnorm, bias and activation passes.
+ */
+static void forward_convolutional_layer_inference(convolutional_layer l, network net)
+{
+    int i, j;
+    int m = l.n/l.groups;
+    int k = l.size*l.size*l.c/l.groups;
+    int n = l.out_w*l.out_h;
+
+    float *scales = 0;
+    float *biases = l.biases;
+    if(l.batch_normalize){
+        scales = calloc(l.n, sizeof(float));
+        biases = calloc(l.n, sizeof(float));
+        for(i = 0; i < l.n; ++i){
+            scales[i] = l.scales[i]/(sqrt(l.rolling_variance[i]) + .000001f);
+            biases[i] = l.biases[i] - l.rolling_mean[i]*scales[i];
+        }
+    }
+
+    for(i = 0; i < l.batch; ++i){
+        for(j = 0; j < l.groups; ++j){
+            float *a = l.weights + j*l.nweights/l.groups;
+            float *b = net.workspace;
+            float *c = l.output + (i*l.groups + j)*n*m;
+            float *im = net.input + (i*l.groups + j)*l.c/l.groups*l.h*l.w;
+
+            if(l.size == 1 && l.stride == 1 && l.pad == 0){
+                b = im;
+            } else {
+                im2col_cpu(im, l.c/l.groups, l.h, l.w, l.size, l.stride, l.pad, b);
+            }
+            gemm_bias_activate(m,n,k,a,k,b,n,c,n, scales ? scales + j*m : 0, biases + j*m, l.activation);
+        }
+    }
+
+    if(l.batch_normalize){
+        free(scales);
+        free(biases);
+    }
+}
+
+/*
+ * Folds the batch normalization into the weights and quantizes them to int8 with a scale per filter.
+ * Inputs are quantized with one scale from the calibrated range of their absolute values.
+ */
+void quantize_convolutional_layer(convolutional_layer *l, float input_range)
+{
+    int i, j;
+    int size = l->nweights/l->n;
+
+    l->weights_int8 = calloc(l->nweights, sizeof(signed char));
+    l->input_int8 = calloc(l->batch*l->inputs, sizeof(signed char));
+    l->int8_scales = calloc(l->n, sizeof(float));
+    l->int8_biases = calloc(l->n, sizeof(float));
+    l->int8_input_scale = input_range/127;
+
+    for(i = 0; i < l->n; ++i){
+        float scale = 1;
+        float bias = l->biases[i];
+        if(l->batch_normalize){
+            scale = l->scales[i]/(sqrt(l->rolling_variance[i]) + .000001f);
+            bias = l->biases[i] - l->rolling_mean[i]*scale;
+        }
+        float *w = l->weights + i*size;
+        float max = 0;
+        for(j = 0; j < size; ++j){
+            if(fabs(w[j]*scale) > max) max = fabs(w[j]*scale);
+        }
+        float weight_scale = (max > 0) ? max/127 : 1;
+        for(j = 0; j < size; ++j){
+            l->weights_int8[i*size + j] = (signed char)roundf(w[j]*scale/weight_scale);
+        }
+        l->int8_scales[i] = weight_scale*l->int8_input_scale;
+        l->int8_biases[i] = bias;
+    }
+}
+
+static void forward_convolutional_layer_int8(convolutional_layer l, network net)
+{
+    int i, j;
+    int m = l.n/l.groups;
+    int k = l.size*l.size*l.c/l.groups;
+    int n = l.out_w*l.out_h;
+
+    float inverse_scale = 1/l.int8_input_scale;
+    #pragma omp parallel for
+    for(i = 0; i < l.batch*l.inputs; ++i){
+        float q = net.input[i]*inverse_scale;
+        q = (q > 127) ? 127 : (q < -127) ? -127 : q;
+        l.input_int8[i] = (signed char)lrintf(q);
+    }
+
+    for(i = 0; i < l.batch; ++i){
+        for(j = 0; j < l.groups; ++j){
+            signed char *a = l.weights_int8 + j*l.nweights/l.groups;
+            signed char *b = (signed char *)net.workspace;
+            float *c = l.output + (i*l.groups + j)*n*m;
+            signed char *im = l.input_int8 + (i*l.groups + j)*l.c/l.groups*l.h*l.w;
+
+            if(l.size == 1 && l.stride == 1 && l.pad == 0){
+                b = im;
+            } else {
+                im2col_cpu_int8(im, l.c/l.groups, l.h, l.w, l.size, l.stride, l.pad, b);
+            }
+            gemm_int8_bias_activate(m,n,k,a,k,b,n,c,n, l.int8_scales + j*m, l.int8_biases + j*m, l.activation);
+        }
+    }
+}
+
 void forward_convolutional_layer(convolutional_layer l, network net)
 {
     int i, j;
 
+    if(!net.train && l.weights_int8){
+        forward_convolutional_layer_int8(l, net);
+        return;
+    }
+    if(!net.train && !l.xnor){
+        forward_convolutional_layer_inference(l, net);
+        return;
+    }
+
     fill_cpu(l.outputs*l.batch, 0, l.output, 1);
 
     if(l.xnor){
@@ -228,6 +228,12 @@ struct layer{
 
     float * binary_weights;
 
+    signed char * weights_int8;
+    signed char * input_int8;
+    float * int8_scales;
+    float * int8_biases;
+    float int8_input_scale;
+
     float * biases;
     float * bias_updates;
 
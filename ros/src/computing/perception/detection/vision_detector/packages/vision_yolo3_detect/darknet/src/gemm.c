@@ -1,9 +1,16 @@
 #include "gemm.h"
 #include "utils.h"
 #include "cuda.h"
+#include "activations.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GEMM_X86
+#include <immintrin.h>
+#endif
 
 void gemm_bin(int M, int N, int K, float ALPHA, 
         char  *A, int lda, 
@@ -142,6 +149,410 @@ void gemm_tt(int M, int N, int K, float ALPHA,
 }
 
 
+/*
+ * Packed gemm. B is packed in GEMM_KC x GEMM_NC panels of GEMM_NR wide column slivers and A in
+ * GEMM_MC x GEMM_KC blocks of GEMM_MR tall row slivers, so the micro kernel reads both operands
+ * contiguously and keeps a GEMM_MR x GEMM_NR tile of C in registers for the whole GEMM_KC depth.
+ */
+#define GEMM_MR 6
+#define GEMM_NR 16
+#define GEMM_MC 144
+#define GEMM_KC 256
+#define GEMM_NC 3072
+
+typedef void (*gemm_kernel)(int kc, const float *a, const float *b, float *c, int ldc, int first);
+
+static void gemm_pack_a(int mc, int kc, float ALPHA, const float *A, int rs, int cs, float *packed)
+{
+    int i, k, r;
+    for(i = 0; i < mc; i += GEMM_MR){
+        int mr = (mc - i < GEMM_MR) ? mc - i : GEMM_MR;
+        const float *a = A + i*rs;
+        for(k = 0; k < kc; ++k){
+            for(r = 0; r < mr; ++r) packed[r] = ALPHA*a[r*rs + k*cs];
+            for(; r < GEMM_MR; ++r) packed[r] = 0;
+            packed += GEMM_MR;
+        }
+    }
+}
+
+static void gemm_pack_b(int kc, int nc, const float *B, int rs, int cs, float *packed)
+{
+    int j;
+    #pragma omp parallel for
+    for(j = 0; j < nc; j += GEMM_NR){
+        int nr = (nc - j < GEMM_NR) ? nc - j : GEMM_NR;
+        const float *b = B + j*cs;
+        float *p = packed + j*kc;
+        int k, c;
+        for(k = 0; k < kc; ++k){
+            for(c = 0; c < nr; ++c) p[c] = b[k*rs + c*cs];
+            for(; c < GEMM_NR; ++c) p[c] = 0;
+            p += GEMM_NR;
+        }
+    }
+}
+
+static void gemm_kernel_generic(int kc, const float *a, const float *b, float *c, int ldc, int first)
+{
+    int k, r, j;
+    //one row at a time so the accumulators fit the vector registers of any target
+    for(r = 0; r < GEMM_MR; ++r){
+        float acc[GEMM_NR] = {0};
+        for(k = 0; k < kc; ++k){
+            float a_part = a[k*GEMM_MR + r];
+            for(j = 0; j < GEMM_NR; ++j){
+                acc[j] += a_part*b[k*GEMM_NR + j];
+            }
+        }
+        for(j = 0; j < GEMM_NR; ++j){
+            c[r*ldc + j] = first ? acc[j] : c[r*ldc + j] + acc[j];
+        }
+    }
+}
+
+#ifdef GEMM_X86
+#define GEMM_AVX2_ROW(r) \
+    a_part = _mm256_broadcast_ss(a + r); \
+    c##r##0 = _mm256_fmadd_ps(a_part, b0, c##r##0); \
+    c##r##1 = _mm256_fmadd_ps(a_part, b1, c##r##1);
+
+#define GEMM_AVX2_STORE(r) \
+    if(!first){ \
+        c##r##0 = _mm256_add_ps(c##r##0, _mm256_loadu_ps(c + r*ldc)); \
+        c##r##1 = _mm256_add_ps(c##r##1, _mm256_loadu_ps(c + r*ldc + 8)); \
+    } \
+    _mm256_storeu_ps(c + r*ldc, c##r##0); \
+    _mm256_storeu_ps(c + r*ldc + 8, c##r##1);
+
+__attribute__((target("avx2,fma")))
+static void gemm_kernel_avx2(int kc, const float *a, const float *b, float *c, int ldc, int first)
+{
+    __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+    __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+    __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+    __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+    __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+    __m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+    __m256 a_part, b0, b1;
+    int k;
+    for(k = 0; k < kc; ++k){
+        b0 = _mm256_loadu_ps(b);
+        b1 = _mm256_loadu_ps(b + 8);
+        GEMM_AVX2_ROW(0)
+        GEMM_AVX2_ROW(1)
+        GEMM_AVX2_ROW(2)
+        GEMM_AVX2_ROW(3)
+        GEMM_AVX2_ROW(4)
+        GEMM_AVX2_ROW(5)
+        a += GEMM_MR;
+        b += GEMM_NR;
+    }
+    GEMM_AVX2_STORE(0)
+    GEMM_AVX2_STORE(1)
+    GEMM_AVX2_STORE(2)
+    GEMM_AVX2_STORE(3)
+    GEMM_AVX2_STORE(4)
+    GEMM_AVX2_STORE(5)
+}
+#endif
+
+static gemm_kernel get_gemm_kernel()
+{
+    static gemm_kernel kernel = 0;
+    if(!kernel){
+        kernel = gemm_kernel_generic;
+#ifdef GEMM_X86
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) kernel = gemm_kernel_avx2;
+#endif
+    }
+    return kernel;
+}
+
+static void gemm_epilogue(int mr, int nr, float *c, int ldc, const float *scales, const float *biases, ACTIVATION a)
+{
+    int r, j;
+    for(r = 0; r < mr; ++r){
+        float *row = c + r*ldc;
+        float scale = scales ? scales[r] : 1;
+        float bias = biases[r];
+        for(j = 0; j < nr; ++j){
+            row[j] = row[j]*scale + bias;
+        }
+        if(a == LEAKY){
+            for(j = 0; j < nr; ++j){
+                row[j] = leaky_activate(row[j]);
+            }
+        } else if(a != LINEAR){
+            activate_array(row, nr, a);
+        }
+    }
+}
+
+static void gemm_macro_kernel(int mc, int nc, int kc,
+        const float *packed_a, const float *packed_b,
+        float *C, int ldc, int first,
+        const float *scales, const float *biases, ACTIVATION a)
+{
+    gemm_kernel kernel = get_gemm_kernel();
+    int jr;
+    #pragma omp parallel for
+    for(jr = 0; jr < nc; jr += GEMM_NR){
+        float tile[GEMM_MR*GEMM_NR];
+        int nr = (nc - jr < GEMM_NR) ? nc - jr : GEMM_NR;
+        int ir, r, j;
+        for(ir = 0; ir < mc; ir += GEMM_MR){
+            int mr = (mc - ir < GEMM_MR) ? mc - ir : GEMM_MR;
+            float *c = C + ir*ldc + jr;
+            if(mr == GEMM_MR && nr == GEMM_NR){
+                kernel(kc, packed_a + ir*kc, packed_b + jr*kc, c, ldc, first);
+            } else {
+                kernel(kc, packed_a + ir*kc, packed_b + jr*kc, tile, GEMM_NR, 1);
+                for(r = 0; r < mr; ++r){
+                    for(j = 0; j < nr; ++j){
+                        c[r*ldc + j] = first ? tile[r*GEMM_NR + j] : c[r*ldc + j] + tile[r*GEMM_NR + j];
+                    }
+                }
+            }
+            if(biases) gemm_epilogue(mr, nr, c, ldc, scales ? scales + ir : 0, biases + ir, a);
+        }
+    }
+}
+
+/* C (+)= ALPHA*op(A)*op(B). With biases, the rows of the result are then scaled, biased and
+ * activated while each tile is in cache. */
+static void gemm_packed(int TA, int TB, int M, int N, int K, float ALPHA,
+        float *A, int lda,
+        float *B, int ldb,
+        float *C, int ldc, int first,
+        float *scales, float *biases, ACTIVATION a)
+{
+    int a_rs = TA ? 1 : lda, a_cs = TA ? lda : 1;
+    int b_rs = TB ? 1 : ldb, b_cs = TB ? ldb : 1;
+    int max_nc = (N < GEMM_NC) ? N : GEMM_NC;
+    int max_kc = (K < GEMM_KC) ? K : GEMM_KC;
+    int max_mc = (M < GEMM_MC) ? M : GEMM_MC;
+    float *packed_a = calloc((max_mc + GEMM_MR - 1)/GEMM_MR*GEMM_MR*max_kc, sizeof(float));
+    float *packed_b = calloc((max_nc + GEMM_NR - 1)/GEMM_NR*GEMM_NR*max_kc, sizeof(float));
+    int jc, pc, ic;
+    for(jc = 0; jc < N; jc += GEMM_NC){
+        int nc = (N - jc < GEMM_NC) ? N - jc : GEMM_NC;
+        for(pc = 0; pc < K; pc += GEMM_KC){
+            int kc = (K - pc < GEMM_KC) ? K - pc : GEMM_KC;
+            int last = pc + kc == K;
+            gemm_pack_b(kc, nc, B + pc*b_rs + jc*b_cs, b_rs, b_cs, packed_b);
+            for(ic = 0; ic < M; ic += GEMM_MC){
+                int mc = (M - ic < GEMM_MC) ? M - ic : GEMM_MC;
+                gemm_pack_a(mc, kc, ALPHA, A + ic*a_rs + pc*a_cs, a_rs, a_cs, packed_a);
+                gemm_macro_kernel(mc, nc, kc, packed_a, packed_b, C + ic*ldc + jc, ldc, first && pc == 0,
+                        (last && scales) ? scales + ic : 0, (last && biases) ? biases + ic : 0, a);
+            }
+        }
+    }
+    free(packed_a);
+    free(packed_b);
+}
+
+void gemm_bias_activate(int M, int N, int K,
+        float *A, int lda,
+        float *B, int ldb,
+        float *C, int ldc,
+        float *scales, float *biases, ACTIVATION a)
+{
+    gemm_packed(0, 0, M, N, K, 1, A, lda, B, ldb, C, ldc, 1, scales, biases, a);
+}
+
+/*
+ * Int8 gemm with int32 accumulation. Both operands are packed as pairs of consecutive k widened to
+ * int16, so the micro kernel multiplies and adds two k at once with madd. The GEMM_INT8_KC deep
+ * partial sums of 8 bit values stay below 2^24 and are accumulated into C as exact floats.
+ */
+#define GEMM_INT8_KC 512
+
+typedef void (*gemm_int8_kernel)(int kp, const short *a, const short *b, float *c, int ldc, int first);
+
+static void gemm_int8_pack_a(int mc, int kc, const signed char *A, int lda, short *packed)
+{
+    int i, k, r;
+    for(i = 0; i < mc; i += GEMM_MR){
+        for(k = 0; k < kc; k += 2){
+            for(r = 0; r < GEMM_MR; ++r){
+                const signed char *a = A + (i + r)*lda + k;
+                packed[2*r] = (i + r < mc) ? a[0] : 0;
+                packed[2*r + 1] = (i + r < mc && k + 1 < kc) ? a[1] : 0;
+            }
+            packed += 2*GEMM_MR;
+        }
+    }
+}
+
+static void gemm_int8_pack_b(int kc, int nc, const signed char *B, int ldb, short *packed)
+{
+    int kp = (kc + 1)/2;
+    int j;
+    #pragma omp parallel for
+    for(j = 0; j < nc; j += GEMM_NR){
+        short *p = packed + 2*j*kp;
+        int k, c;
+        for(k = 0; k < kc; k += 2){
+            for(c = 0; c < GEMM_NR; ++c){
+                const signed char *b = B + k*ldb + j + c;
+                p[2*c] = (j + c < nc) ? b[0] : 0;
+                p[2*c + 1] = (j + c < nc && k + 1 < kc) ? b[ldb] : 0;
+            }
+            p += 2*GEMM_NR;
+        }
+    }
+}
+
+static void gemm_int8_kernel_generic(int kp, const short *a, const short *b, float *c, int ldc, int first)
+{
+    int k, r, j;
+    //even and odd k are summed in separate lanes, which keeps the inner loop a plain widening multiply-add
+    for(r = 0; r < GEMM_MR; ++r){
+        int acc[2*GEMM_NR] = {0};
+        for(k = 0; k < kp; ++k){
+            short a0 = a[k*2*GEMM_MR + 2*r];
+            short a1 = a[k*2*GEMM_MR + 2*r + 1];
+            const short *bk = b + k*2*GEMM_NR;
+            for(j = 0; j < 2*GEMM_NR; j += 2){
+                acc[j] += a0*bk[j];
+                acc[j + 1] += a1*bk[j + 1];
+            }
+        }
+        for(j = 0; j < GEMM_NR; ++j){
+            int sum = acc[2*j] + acc[2*j + 1];
+            c[r*ldc + j] = first ? sum : c[r*ldc + j] + sum;
+        }
+    }
+}
+
+#ifdef GEMM_X86
+#define GEMM_INT8_AVX2_ROW(r) \
+    memcpy(&a_pair, a + 2*r, sizeof(int)); \
+    a_part = _mm256_set1_epi32(a_pair); \
+    c##r##0 = _mm256_add_epi32(c##r##0, _mm256_madd_epi16(a_part, b0)); \
+    c##r##1 = _mm256_add_epi32(c##r##1, _mm256_madd_epi16(a_part, b1));
+
+#define GEMM_INT8_AVX2_STORE(r) \
+    f0 = _mm256_cvtepi32_ps(c##r##0); \
+    f1 = _mm256_cvtepi32_ps(c##r##1); \
+    if(!first){ \
+        f0 = _mm256_add_ps(f0, _mm256_loadu_ps(c + r*ldc)); \
+        f1 = _mm256_add_ps(f1, _mm256_loadu_ps(c + r*ldc + 8)); \
+    } \
+    _mm256_storeu_ps(c + r*ldc, f0); \
+    _mm256_storeu_ps(c + r*ldc + 8, f1);
+
+__attribute__((target("avx2")))
+static void gemm_int8_kernel_avx2(int kp, const short *a, const short *b, float *c, int ldc, int first)
+{
+    __m256i c00 = _mm256_setzero_si256(), c01 = _mm256_setzero_si256();
+    __m256i c10 = _mm256_setzero_si256(), c11 = _mm256_setzero_si256();
+    __m256i c20 = _mm256_setzero_si256(), c21 = _mm256_setzero_si256();
+    __m256i c30 = _mm256_setzero_si256(), c31 = _mm256_setzero_si256();
+    __m256i c40 = _mm256_setzero_si256(), c41 = _mm256_setzero_si256();
+    __m256i c50 = _mm256_setzero_si256(), c51 = _mm256_setzero_si256();
+    __m256i a_part, b0, b1;
+    __m256 f0, f1;
+    int a_pair;
+    int k;
+    for(k = 0; k < kp; ++k){
+        b0 = _mm256_loadu_si256((const __m256i *)b);
+        b1 = _mm256_loadu_si256((const __m256i *)(b + 16));
+        GEMM_INT8_AVX2_ROW(0)
+        GEMM_INT8_AVX2_ROW(1)
+        GEMM_INT8_AVX2_ROW(2)
+        GEMM_INT8_AVX2_ROW(3)
+        GEMM_INT8_AVX2_ROW(4)
+        GEMM_INT8_AVX2_ROW(5)
+        a += 2*GEMM_MR;
+        b += 2*GEMM_NR;
+    }
+    GEMM_INT8_AVX2_STORE(0)
+    GEMM_INT8_AVX2_STORE(1)
+    GEMM_INT8_AVX2_STORE(2)
+    GEMM_INT8_AVX2_STORE(3)
+    GEMM_INT8_AVX2_STORE(4)
+    GEMM_INT8_AVX2_STORE(5)
+}
+#endif
+
+static gemm_int8_kernel get_gemm_int8_kernel()
+{
+    static gemm_int8_kernel kernel = 0;
+    if(!kernel){
+        kernel = gemm_int8_kernel_generic;
+#ifdef GEMM_X86
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2")) kernel = gemm_int8_kernel_avx2;
+#endif
+    }
+    return kernel;
+}
+
+static void gemm_int8_macro_kernel(int mc, int nc, int kc,
+        const short *packed_a, const short *packed_b,
+        float *C, int ldc, int first,
+        const float *scales, const float *biases, ACTIVATION a)
+{
+    gemm_int8_kernel kernel = get_gemm_int8_kernel();
+    int kp = (kc + 1)/2;
+    int jr;
+    #pragma omp parallel for
+    for(jr = 0; jr < nc; jr += GEMM_NR){
+        float tile[GEMM_MR*GEMM_NR];
+        int nr = (nc - jr < GEMM_NR) ? nc - jr : GEMM_NR;
+        int ir, r, j;
+        for(ir = 0; ir < mc; ir += GEMM_MR){
+            int mr = (mc - ir < GEMM_MR) ? mc - ir : GEMM_MR;
+            float *c = C + ir*ldc + jr;
+            if(mr == GEMM_MR && nr == GEMM_NR){
+                kernel(kp, packed_a + 2*ir*kp, packed_b + 2*jr*kp, c, ldc, first);
+            } else {
+                kernel(kp, packed_a + 2*ir*kp, packed_b + 2*jr*kp, tile, GEMM_NR, 1);
+                for(r = 0; r < mr; ++r){
+                    for(j = 0; j < nr; ++j){
+                        c[r*ldc + j] = first ? tile[r*GEMM_NR + j] : c[r*ldc + j] + tile[r*GEMM_NR + j];
+                    }
+                }
+            }
+            if(biases) gemm_epilogue(mr, nr, c, ldc, scales + ir, biases + ir, a);
+        }
+    }
+}
+
+void gemm_int8_bias_activate(int M, int N, int K,
+        signed char *A, int lda,
+        signed char *B, int ldb,
+        float *C, int ldc,
+        float *scales, float *biases, ACTIVATION a)
+{
+    int max_nc = (N < GEMM_NC) ? N : GEMM_NC;
+    int max_kp = ((K < GEMM_INT8_KC) ? K + 1 : GEMM_INT8_KC)/2;
+    int max_mc = (M < GEMM_MC) ? M : GEMM_MC;
+    short *packed_a = calloc(2*((max_mc + GEMM_MR - 1)/GEMM_MR*GEMM_MR)*max_kp, sizeof(short));
+    short *packed_b = calloc(2*((max_nc + GEMM_NR - 1)/GEMM_NR*GEMM_NR)*max_kp, sizeof(short));
+    int jc, pc, ic;
+    for(jc = 0; jc < N; jc += GEMM_NC){
+        int nc = (N - jc < GEMM_NC) ? N - jc : GEMM_NC;
+        for(pc = 0; pc < K; pc += GEMM_INT8_KC){
+            int kc = (K - pc < GEMM_INT8_KC) ? K - pc : GEMM_INT8_KC;
+            int last = pc + kc == K;
+            gemm_int8_pack_b(kc, nc, B + pc*ldb + jc, ldb, packed_b);
+            for(ic = 0; ic < M; ic += GEMM_MC){
+                int mc = (M - ic < GEMM_MC) ? M - ic : GEMM_MC;
+                gemm_int8_pack_a(mc, kc, A + ic*lda + pc, lda, packed_a);
+                gemm_int8_macro_kernel(mc, nc, kc, packed_a, packed_b, C + ic*ldc + jc, ldc, pc == 0,
+                        scales + ic, last ? biases + ic : 0, a);
+            }
+        }
+    }
+    free(packed_a);
+    free(packed_b);
+}
+
 void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA, 
         float *A, int lda, 
         float *B, int ldb,
@@ -155,7 +566,10 @@ void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA,
             C[i*ldc + j] *= BETA;
         }
     }
-    if(!TA && !TB)
+    //packing only pays off once the operands are reused enough
+    if((double)M*N*K >= 64.*64.*64.)
+        gemm_packed(TA, TB, M, N, K, ALPHA, A, lda, B, ldb, C, ldc, 0, 0, 0, LINEAR);
+    else if(!TA && !TB)
         gemm_nn(M, N, K, ALPHA,A,lda, B, ldb,C,ldc);
     else if(TA && !TB)
         gemm_tn(M, N, K, ALPHA,A,lda, B, ldb,C,ldc);
@@ -1,5 +1,6 @@
 #ifndef GEMM_H
 #define GEMM_H
+#include "darknet.h"
 
 void gemm_bin(int M, int N, int K, float ALPHA, 
         char  *A, int lda, 
@@ -18,6 +19,20 @@ void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA,
         float BETA,
         float *C, int ldc);
 
+/* C = activation(scales[i]*(A*B)[i][j] + biases[i]), scales may be NULL */
+void gemm_bias_activate(int M, int N, int K,
+        float *A, int lda,
+        float *B, int ldb,
+        float *C, int ldc,
+        float *scales, float *biases, ACTIVATION a);
+
+/* C = activation(scales[i]*(A*B)[i][j] + biases[i]) for int8 A and B in [-127, 127] */
+void gemm_int8_bias_activate(int M, int N, int K,
+        signed char *A, int lda,
+        signed char *B, int ldb,
+        float *C, int ldc,
+        float *scales, float *biases, ACTIVATION a);
+
 #ifdef GPU
 void gemm_gpu(int TA, int TB, int M, int N, int K, float ALPHA, 
         float *A_gpu, int lda, 
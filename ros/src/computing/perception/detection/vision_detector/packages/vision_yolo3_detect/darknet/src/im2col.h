@@ -5,6 +5,10 @@ void im2col_cpu(float* data_im,
         int channels, int height, int width,
         int ksize, int stride, int pad, float* data_col);
 
+void im2col_cpu_int8(signed char* data_im,
+        int channels, int height, int width,
+        int ksize, int stride, int pad, signed char* data_col);
+
 #ifdef GPU
 
 void im2col_gpu(float *im,
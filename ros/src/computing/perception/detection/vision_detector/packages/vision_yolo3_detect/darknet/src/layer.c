@@ -27,6 +27,10 @@ void free_layer(layer l)
     if(l.concat)             free(l.concat);
     if(l.concat_delta)       free(l.concat_delta);
     if(l.binary_weights)     free(l.binary_weights);
+    if(l.weights_int8)       free(l.weights_int8);
+    if(l.input_int8)         free(l.input_int8);
+    if(l.int8_scales)        free(l.int8_scales);
+    if(l.int8_biases)        free(l.int8_biases);
     if(l.biases)             free(l.biases);
     if(l.bias_updates)       free(l.bias_updates);
     if(l.scales)             free(l.scales);
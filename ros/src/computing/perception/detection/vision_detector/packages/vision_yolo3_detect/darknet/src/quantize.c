@@ -0,0 +1,79 @@
+#include "quantize.h"
+#include "convolutional_layer.h"
+#include "blas.h"
+#include "utils.h"
+#include <stdio.h>
+#include <math.h>
+
+/* Runs the network on input and stores the largest absolute input of every convolutional layer in ranges */
+void get_network_input_ranges(network *net, float *input, float *ranges)
+{
+    network orig = *net;
+    net->input = input;
+    net->truth = 0;
+    net->train = 0;
+    net->delta = 0;
+    network n = *net;
+    int i, j;
+    for(i = 0; i < n.n; ++i){
+        n.index = i;
+        layer l = n.layers[i];
+        ranges[i] = 0;
+        if(l.type == CONVOLUTIONAL){
+            for(j = 0; j < l.inputs*l.batch; ++j){
+                if(fabs(n.input[j]) > ranges[i]) ranges[i] = fabs(n.input[j]);
+            }
+        }
+        if(l.delta){
+            fill_cpu(l.outputs * l.batch, 0, l.delta, 1);
+        }
+        l.forward(l, n);
+        n.input = l.output;
+    }
+    *net = orig;
+}
+
+/*
+ * Writes the input range of every convolutional layer. The first layer, which sees the image, and the
+ * layers producing the yolo outputs are written with a range of 0 to keep them in fp32.
+ * Returns -1 if the file cannot be written.
+ */
+int save_quantization(network *net, float *ranges, char *filename)
+{
+    FILE *fp = fopen(filename, "w");
+    if(!fp) return -1;
+    fprintf(fp, "# layer input_range, layers with a range of 0 run in fp32\n");
+    int i;
+    for(i = 0; i < net->n; ++i){
+        if(net->layers[i].type != CONVOLUTIONAL) continue;
+        int sensitive = i == 0 || (i + 1 < net->n && net->layers[i + 1].type == YOLO);
+        fprintf(fp, "%d %g\n", i, sensitive ? 0 : ranges[i]);
+    }
+    fclose(fp);
+    return 0;
+}
+
+/*
+ * Quantizes the convolutional layers listed with a positive range, returns how many were quantized.
+ * Returns -1 without touching the network if the file cannot be opened.
+ */
+int quantize_network(network *net, char *filename)
+{
+    FILE *fp = fopen(filename, "r");
+    if(!fp) return -1;
+    char *line;
+    int count = 0;
+    while((line = fgetl(fp)) != 0){
+        int index;
+        float range;
+        if(line[0] != '#' && sscanf(line, "%d %f", &index, &range) == 2
+                && index >= 0 && index < net->n && range > 0
+                && net->layers[index].type == CONVOLUTIONAL && !net->layers[index].weights_int8){
+            quantize_convolutional_layer(net->layers + index, range);
+            ++count;
+        }
+        free(line);
+    }
+    fclose(fp);
+    return count;
+}
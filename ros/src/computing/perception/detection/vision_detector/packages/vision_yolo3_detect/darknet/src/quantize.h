@@ -0,0 +1,9 @@
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+#include "darknet.h"
+
+void get_network_input_ranges(network *net, float *input, float *ranges);
+int save_quantization(network *net, float *ranges, char *filename);
+int quantize_network(network *net, char *filename);
+
+#endif
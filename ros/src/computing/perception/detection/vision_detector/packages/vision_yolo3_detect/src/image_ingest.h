@@ -0,0 +1,181 @@
+#ifndef IMAGE_INGEST_H_
+#define IMAGE_INGEST_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+/*
+ * Writes packed 8 bit BGR images into the planar float input of a network in a single pass.
+ * The image is resized with bilinear interpolation, sampled as cv::resize INTER_LINEAR does,
+ * into a region of the input, normalized as (value - mean) * scale and written per channel.
+ * The sampling tables and the border outside the region are only computed again when the
+ * image or input geometry changes.
+ */
+class ImageIngest
+{
+	float* 				output_;
+	cv::Size 			output_size_;
+	float 				mean_[3];
+	float 				scale_;
+	bool 				rgb_;
+	bool 				letterbox_;
+
+	cv::Size 			input_size_;
+	cv::Rect 			roi_;
+	std::vector<int> 	x_offsets_;	//byte offset of the left sample of every roi column, and of the right one
+	std::vector<float> 	x_weights_;
+	std::vector<int> 	y_rows_;	//top and bottom rows sampled by every roi row
+	std::vector<float> 	y_weights_;
+
+	void UpdateGeometry(int in_width, int in_height)
+	{
+		input_size_ = cv::Size(in_width, in_height);
+		if (letterbox_)
+		{
+			double ratio = std::min((double) output_size_.width / in_width, (double) output_size_.height / in_height);
+			roi_.width = std::min(output_size_.width, (int) std::round(in_width * ratio));
+			roi_.height = std::min(output_size_.height, (int) std::round(in_height * ratio));
+			roi_.x = (output_size_.width - roi_.width) / 2;
+			roi_.y = (output_size_.height - roi_.height) / 2;
+		}
+		else
+			roi_ = cv::Rect(0, 0, output_size_.width, output_size_.height);
+
+		x_offsets_.resize(2 * roi_.width);
+		x_weights_.resize(roi_.width);
+		for (int x = 0; x < roi_.width; x++)
+		{
+			float source = (x + 0.5f) * in_width / roi_.width - 0.5f;
+			int left = (int) std::floor(source);
+			float weight = source - left;
+			if (left < 0)
+			{
+				left = 0;
+				weight = 0;
+			}
+			int right = std::min(left + 1, in_width - 1);
+			if (left >= in_width - 1)
+			{
+				left = in_width - 1;
+				weight = 0;
+			}
+			x_offsets_[2 * x] = 3 * left;
+			x_offsets_[2 * x + 1] = 3 * right;
+			x_weights_[x] = weight;
+		}
+
+		y_rows_.resize(2 * roi_.height);
+		y_weights_.resize(roi_.height);
+		for (int y = 0; y < roi_.height; y++)
+		{
+			float source = (y + 0.5f) * in_height / roi_.height - 0.5f;
+			int top = (int) std::floor(source);
+			float weight = source - top;
+			if (top < 0)
+			{
+				top = 0;
+				weight = 0;
+			}
+			int bottom = std::min(top + 1, in_height - 1);
+			if (top >= in_height - 1)
+			{
+				top = in_height - 1;
+				weight = 0;
+			}
+			y_rows_[2 * y] = top;
+			y_rows_[2 * y + 1] = bottom;
+			y_weights_[y] = weight;
+		}
+
+		//the border is the normalized value of a black pixel
+		int plane_size = output_size_.area();
+		for (int c = 0; c < 3; c++)
+		{
+			float* plane = output_ + (rgb_ ? 2 - c : c) * plane_size;
+			std::fill(plane, plane + plane_size, -mean_[c] * scale_);
+		}
+	}
+
+public:
+	ImageIngest() :
+			output_(NULL), scale_(1), rgb_(false), letterbox_(false)
+	{
+		mean_[0] = mean_[1] = mean_[2] = 0;
+	}
+
+	/* \brief Sets the network input written by Ingest
+	 * \param[in] in_output 	planar float input of 3 channels, kept by the caller
+	 * \param[in] in_size 		size of every channel
+	 * \param[in] in_mean 		value subtracted from the B, G and R channels before scaling
+	 * \param[in] in_scale 		scale applied after subtracting the mean
+	 * \param[in] in_rgb 		true to write the channels in RGB order, BGR otherwise
+	 * \param[in] in_letterbox 	true to keep the aspect ratio and center the image, false to stretch it
+	 */
+	void SetOutput(float* in_output, const cv::Size& in_size, const cv::Scalar& in_mean, float in_scale,
+	               bool in_rgb, bool in_letterbox)
+	{
+		if (in_output == output_ && in_size == output_size_ && in_mean[0] == mean_[0] && in_mean[1] == mean_[1]
+		    && in_mean[2] == mean_[2] && in_scale == scale_ && in_rgb == rgb_ && in_letterbox == letterbox_)
+			return;
+		output_ = in_output;
+		output_size_ = in_size;
+		for (int c = 0; c < 3; c++)
+			mean_[c] = in_mean[c];
+		scale_ = in_scale;
+		rgb_ = in_rgb;
+		letterbox_ = in_letterbox;
+		input_size_ = cv::Size();
+	}
+
+	/* \brief Resizes, normalizes and writes a BGR8 image into the output
+	 * \param[in] in_data 	first pixel of the image
+	 * \param[in] in_width 	image width
+	 * \param[in] in_height image height
+	 * \param[in] in_step 	bytes per image row
+	 */
+	void Ingest(const uint8_t* in_data, int in_width, int in_height, int in_step)
+	{
+		if (in_width != input_size_.width || in_height != input_size_.height)
+			UpdateGeometry(in_width, in_height);
+
+		int plane_size = output_size_.area();
+		float* planes[3];
+		for (int c = 0; c < 3; c++)
+			planes[c] = output_ + (rgb_ ? 2 - c : c) * plane_size;
+
+#pragma omp parallel for
+		for (int y = 0; y < roi_.height; y++)
+		{
+			const uint8_t* top = in_data + (size_t) y_rows_[2 * y] * in_step;
+			const uint8_t* bottom = in_data + (size_t) y_rows_[2 * y + 1] * in_step;
+			float weight_y = y_weights_[y];
+			int row_offset = (roi_.y + y) * output_size_.width + roi_.x;
+			for (int c = 0; c < 3; c++)
+			{
+				float* out = planes[c] + row_offset;
+				float mean = mean_[c];
+				for (int x = 0; x < roi_.width; x++)
+				{
+					int left = x_offsets_[2 * x] + c;
+					int right = x_offsets_[2 * x + 1] + c;
+					float weight_x = x_weights_[x];
+					float upper = top[left] + weight_x * (top[right] - top[left]);
+					float lower = bottom[left] + weight_x * (bottom[right] - bottom[left]);
+					out[x] = (upper + weight_y * (lower - upper) - mean) * scale_;
+				}
+			}
+		}
+	}
+
+	/* \brief Region of the output the last image was written to */
+	const cv::Rect& GetRoi() const
+	{
+		return roi_;
+	}
+};
+
+#endif /* IMAGE_INGEST_H_ */
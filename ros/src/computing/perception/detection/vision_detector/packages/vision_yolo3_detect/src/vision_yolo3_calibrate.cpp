@@ -0,0 +1,309 @@
+/*
+ *  Copyright (c) 2018, Nagoya University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of Autoware nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ********************
+ *
+ * vision_yolo3_calibrate.cpp
+ *
+ * Offline int8 calibration for vision_yolo3_detect. Runs the fp32 network on a folder of sample images,
+ * writes the input range of every convolutional layer to the calibration file read by the node's
+ * calibration_file parameter, then runs both networks on the images and reports their mAP and speed.
+ *
+ * Usage: vision_yolo3_calibrate <network cfg> <weights> <image folder> <calibration file> [max images]
+ *
+ * Images with a darknet label file next to them (same name, .txt, one "class x y w h" line per object in
+ * relative coordinates) are evaluated against the labels. Without labels for every image, the int8
+ * detections are evaluated against the fp32 detections scoring at least 0.5.
+ */
+
+#include <dirent.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+#undef __cplusplus
+#include "box.h"
+#include "image.h"
+#include "network.h"
+#include "parser.h"
+#include "quantize.h"
+#include "utils.h"
+#define __cplusplus
+}
+
+namespace
+{
+    struct Detection
+    {
+        int image;
+        int class_id;
+        float score;
+        box bbox;
+    };
+
+    const float kDetectionThreshold = .005f;
+    const float kNmsThreshold = .45f;
+    const float kReferenceScore = .5f;
+    const float kMatchIou = .5f;
+
+    network* load_network(const std::string& in_cfg, const std::string& in_weights)
+    {
+        network* net = parse_network_cfg(const_cast<char*>(in_cfg.c_str()));
+        load_weights(net, const_cast<char*>(in_weights.c_str()));
+        set_batch_network(net, 1);
+        return net;
+    }
+
+    std::vector<std::string> list_images(const std::string& in_folder)
+    {
+        std::vector<std::string> images;
+        DIR* dir = opendir(in_folder.c_str());
+        if (dir == NULL)
+            return images;
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            std::string name = entry->d_name;
+            std::string::size_type dot = name.rfind('.');
+            if (dot == std::string::npos)
+                continue;
+            std::string extension = name.substr(dot + 1);
+            std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+            if (extension == "jpg" || extension == "jpeg" || extension == "png" || extension == "bmp")
+                images.push_back(in_folder + "/" + name);
+        }
+        closedir(dir);
+        std::sort(images.begin(), images.end());
+        return images;
+    }
+
+    bool load_labels(const std::string& in_image_path, int in_image, std::vector<Detection>& out_labels)
+    {
+        std::string path = in_image_path.substr(0, in_image_path.rfind('.')) + ".txt";
+        FILE* fp = fopen(path.c_str(), "r");
+        if (fp == NULL)
+            return false;
+        Detection label;
+        label.image = in_image;
+        label.score = 1;
+        while (fscanf(fp, "%d %f %f %f %f", &label.class_id,
+                      &label.bbox.x, &label.bbox.y, &label.bbox.w, &label.bbox.h) == 5)
+        {
+            out_labels.push_back(label);
+        }
+        fclose(fp);
+        return true;
+    }
+
+    /* Runs the network on the letterboxed image and appends its detections, in coordinates relative to the image */
+    double detect(network* in_net, const image& in_image, const image& in_boxed, int in_image_index,
+                  std::vector<Detection>& out_detections)
+    {
+        auto start = std::chrono::steady_clock::now();
+        network_predict(in_net, in_boxed.data);
+        double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        layer output_layer = in_net->layers[in_net->n - 1];
+        int nboxes = 0;
+        detection* dets = get_network_boxes(in_net, in_image.w, in_image.h, kDetectionThreshold, .5, NULL, 1, &nboxes);
+        do_nms_sort(dets, nboxes, output_layer.classes, kNmsThreshold);
+        for (int i = 0; i < nboxes; i++)
+        {
+            for (int j = 0; j < dets[i].classes; j++)
+            {
+                if (dets[i].prob[j] <= 0)
+                    continue;
+                Detection detection;
+                detection.image = in_image_index;
+                detection.class_id = j;
+                detection.score = dets[i].prob[j];
+                detection.bbox = dets[i].bbox;
+                out_detections.push_back(detection);
+            }
+        }
+        free_detections(dets, nboxes);
+        return elapsed;
+    }
+
+    /* Mean over the classes with ground truth of the all-point interpolated average precision at kMatchIou */
+    double mean_average_precision(std::vector<Detection> in_detections, const std::vector<Detection>& in_ground_truth,
+                                  int in_classes)
+    {
+        std::sort(in_detections.begin(), in_detections.end(),
+                  [](const Detection& a, const Detection& b) { return a.score > b.score; });
+
+        double ap_sum = 0;
+        int classes_with_truth = 0;
+        for (int class_id = 0; class_id < in_classes; class_id++)
+        {
+            std::vector<bool> matched(in_ground_truth.size(), false);
+            int truth_count = 0;
+            for (const Detection& truth : in_ground_truth)
+                truth_count += truth.class_id == class_id;
+            if (truth_count == 0)
+                continue;
+
+            std::vector<double> precision, recall;
+            int true_positives = 0, count = 0;
+            for (const Detection& detection : in_detections)
+            {
+                if (detection.class_id != class_id)
+                    continue;
+                count++;
+                int best = -1;
+                float best_iou = kMatchIou;
+                for (size_t t = 0; t < in_ground_truth.size(); t++)
+                {
+                    const Detection& truth = in_ground_truth[t];
+                    if (matched[t] || truth.image != detection.image || truth.class_id != class_id)
+                        continue;
+                    float iou = box_iou(detection.bbox, truth.bbox);
+                    if (iou >= best_iou)
+                    {
+                        best_iou = iou;
+                        best = t;
+                    }
+                }
+                if (best >= 0)
+                {
+                    matched[best] = true;
+                    true_positives++;
+                }
+                precision.push_back((double) true_positives / count);
+                recall.push_back((double) true_positives / truth_count);
+            }
+
+            double ap = 0, previous_recall = 0;
+            for (size_t i = 0; i < precision.size(); i++)
+            {
+                double max_precision = *std::max_element(precision.begin() + i, precision.end());
+                ap += (recall[i] - previous_recall) * max_precision;
+                previous_recall = recall[i];
+            }
+            ap_sum += ap;
+            classes_with_truth++;
+        }
+        return classes_with_truth ? ap_sum / classes_with_truth : 0;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 5)
+    {
+        fprintf(stderr, "usage: %s <network cfg> <weights> <image folder> <calibration file> [max images]\n", argv[0]);
+        return 1;
+    }
+    std::string cfg_file = argv[1];
+    std::string weights_file = argv[2];
+    std::string calibration_file = argv[4];
+    size_t max_images = (argc > 5) ? atoi(argv[5]) : 0;
+
+    std::vector<std::string> images = list_images(argv[3]);
+    if (max_images > 0 && images.size() > max_images)
+        images.resize(max_images);
+    if (images.empty())
+    {
+        fprintf(stderr, "No images found in %s\n", argv[3]);
+        return 1;
+    }
+
+    //the int8 layers only exist on the CPU
+    gpu_index = -1;
+    network* net = load_network(cfg_file, weights_file);
+
+    //the range of a layer is the mean over the images of its largest absolute input
+    std::vector<float> ranges(net->n, 0), image_ranges(net->n);
+    for (size_t i = 0; i < images.size(); i++)
+    {
+        image im = load_image_color(const_cast<char*>(images[i].c_str()), 0, 0);
+        image boxed = letterbox_image(im, net->w, net->h);
+        get_network_input_ranges(net, boxed.data, image_ranges.data());
+        for (int l = 0; l < net->n; l++)
+            ranges[l] += image_ranges[l] / images.size();
+        free_image(boxed);
+        free_image(im);
+    }
+    if (save_quantization(net, ranges.data(), const_cast<char*>(calibration_file.c_str())) < 0)
+    {
+        fprintf(stderr, "Could not write %s\n", calibration_file.c_str());
+        free_network(net);
+        return 1;
+    }
+
+    network* int8_net = load_network(cfg_file, weights_file);
+    int quantized = quantize_network(int8_net, const_cast<char*>(calibration_file.c_str()));
+    printf("Calibrated %zu images, %d convolutional layers run in int8, written to %s\n",
+           images.size(), quantized, calibration_file.c_str());
+
+    std::vector<Detection> labels, fp32_detections, int8_detections;
+    bool labeled = true;
+    double fp32_ms = 0, int8_ms = 0;
+    for (size_t i = 0; i < images.size(); i++)
+    {
+        image im = load_image_color(const_cast<char*>(images[i].c_str()), 0, 0);
+        image boxed = letterbox_image(im, net->w, net->h);
+        labeled = load_labels(images[i], i, labels) && labeled;
+        fp32_ms += detect(net, im, boxed, i, fp32_detections);
+        int8_ms += detect(int8_net, im, boxed, i, int8_detections);
+        free_image(boxed);
+        free_image(im);
+    }
+
+    int classes = net->layers[net->n - 1].classes;
+    printf("Forward time per image: fp32 %.1f ms, int8 %.1f ms (%.2fx)\n",
+           fp32_ms / images.size(), int8_ms / images.size(), fp32_ms / int8_ms);
+    if (labeled)
+    {
+        double fp32_map = mean_average_precision(fp32_detections, labels, classes);
+        double int8_map = mean_average_precision(int8_detections, labels, classes);
+        printf("mAP@%.2f on the labels: fp32 %.4f, int8 %.4f, delta %+.4f\n",
+               kMatchIou, fp32_map, int8_map, int8_map - fp32_map);
+    }
+    else
+    {
+        std::vector<Detection> reference;
+        for (const Detection& detection : fp32_detections)
+        {
+            if (detection.score >= kReferenceScore)
+                reference.push_back(detection);
+        }
+        printf("Not every image has labels, mAP@%.2f of int8 against the fp32 detections: %.4f\n",
+               kMatchIou, mean_average_precision(int8_detections, reference, classes));
+    }
+
+    free_network(int8_net);
+    free_network(net);
+    return 0;
+}
@@ -45,62 +45,83 @@ namespace darknet
     {
         return darknet_network_->w;
     }
-    void Yolo3Detector::load(std::string& in_model_file, std::string& in_trained_file, double in_min_confidence, double in_nms_threshold)
+    void Yolo3Detector::load(std::string& in_model_file, std::string& in_trained_file, double in_min_confidence, double in_nms_threshold, bool in_use_gpu, int in_gpu_device_id, const std::string& in_calibration_file)
     {
         min_confidence_ = in_min_confidence;
         nms_threshold_ = in_nms_threshold;
+        //the layers are created for the device selected here, a negative index runs darknet on the CPU
+#ifdef GPU
+        gpu_index = in_use_gpu ? in_gpu_device_id : -1;
+        if (gpu_index >= 0)
+            cuda_set_device(gpu_index);
+#else
+        gpu_index = -1;
+#endif
         darknet_network_ = parse_network_cfg(&in_model_file[0]);
         load_weights(darknet_network_, &in_trained_file[0]);
         set_batch_network(darknet_network_, 1);
 
+        //convolutional layers calibrated by vision_yolo3_calibrate run in int8 on the CPU
+        if (!in_calibration_file.empty())
+        {
+            if (gpu_index < 0)
+            {
+                int quantized = quantize_network(darknet_network_, const_cast<char*>(in_calibration_file.c_str()));
+                if (quantized < 0)
+                {
+                    ROS_ERROR("Could not open the int8 calibration file %s, running in fp32", in_calibration_file.c_str());
+                }
+                else
+                {
+                    ROS_INFO("%d convolutional layers run in int8", quantized);
+                }
+            }
+            else
+            {
+                ROS_WARN("The int8 calibration file is only used on the CPU, ignoring %s", in_calibration_file.c_str());
+            }
+        }
+
         layer output_layer = darknet_network_->layers[darknet_network_->n - 1];
         darknet_boxes_.resize(output_layer.w * output_layer.h * output_layer.n);
+
+        //images are letterboxed into the input as RGB in [0, 1]
+        input_image_ = make_image(darknet_network_->w, darknet_network_->h, 3);
+        image_ingest_.SetOutput(input_image_.data, cv::Size(input_image_.w, input_image_.h), cv::Scalar(0, 0, 0),
+                                1 / 255.f, true, true);
     }
 
     Yolo3Detector::~Yolo3Detector()
     {
+        free_image(input_image_);
         free_network(darknet_network_);
     }
 
-    std::vector< RectClassScore<float> > Yolo3Detector::detect(image& in_darknet_image)
+    std::vector< RectClassScore<float> > Yolo3Detector::detect(const image& in_darknet_image)
     {
         return forward(in_darknet_image);
     }
 
-    image Yolo3Detector::convert_image(const sensor_msgs::ImageConstPtr& msg)
+    const image& Yolo3Detector::convert_image(const sensor_msgs::ImageConstPtr& msg)
     {
-        if (msg->encoding != sensor_msgs::image_encodings::BGR8)
+        if (msg->encoding == sensor_msgs::image_encodings::BGR8)
         {
-            ROS_ERROR("Unsupported encoding");
-            exit(-1);
+            image_ingest_.Ingest(msg->data.data(), msg->width, msg->height, msg->step);
         }
-
-        auto data = msg->data;
-        uint32_t height = msg->height, width = msg->width, offset = msg->step - 3 * width;
-        uint32_t i = 0, j = 0;
-        image im = make_image(width, height, 3);
-
-        for (uint32_t line = height; line; line--)
+        else
         {
-            for (uint32_t column = width; column; column--)
-            {
-                for (uint32_t channel = 0; channel < 3; channel++)
-                    im.data[i + width * height * channel] = data[j++] / 255.;
-                i++;
-            }
-            j += offset;
+            cv_bridge::CvImageConstPtr cv_image = cv_bridge::toCvShare(msg, sensor_msgs::image_encodings::BGR8);
+            image_ingest_.Ingest(cv_image->image.data, cv_image->image.cols, cv_image->image.rows, cv_image->image.step);
         }
+        return input_image_;
+    }
 
-        if (darknet_network_->w == (int) width && darknet_network_->h == (int) height)
-        {
-            return im;
-        }
-        image resized = resize_image(im, darknet_network_->w, darknet_network_->h);
-        free_image(im);
-        return resized;
+    const cv::Rect& Yolo3Detector::get_input_roi() const
+    {
+        return image_ingest_.GetRoi();
     }
 
-    std::vector< RectClassScore<float> > Yolo3Detector::forward(image& in_darknet_image)
+    std::vector< RectClassScore<float> > Yolo3Detector::forward(const image& in_darknet_image)
     {
         float * in_data = in_darknet_image.data;
         float *prediction = network_predict(darknet_network_, in_data);
@@ -196,78 +217,17 @@ void Yolo3DetectorNode::convert_rect_to_image_obj(std::vector< RectClassScore<fl
     }
 }
 
-void Yolo3DetectorNode::rgbgr_image(image& im)
-{
-    int i;
-    for(i = 0; i < im.w*im.h; ++i)
-    {
-        float swap = im.data[i];
-        im.data[i] = im.data[i+im.w*im.h*2];
-        im.data[i+im.w*im.h*2] = swap;
-    }
-}
-
-image Yolo3DetectorNode::convert_ipl_to_image(const sensor_msgs::ImageConstPtr& msg)
-{
-    cv_bridge::CvImagePtr cv_image = cv_bridge::toCvCopy(msg, "bgr8");//toCvCopy(image_source, sensor_msgs::image_encodings::BGR8);
-    cv::Mat mat_image = cv_image->image;
-
-    uint32_t network_input_width = yolo_detector_.get_network_width();
-    uint32_t network_input_height = yolo_detector_.get_network_height();
-
-    uint32_t image_height = msg->height,
-            image_width = msg->width;
-
-    IplImage ipl_image;
-    cv::Mat final_mat;
-
-    if (network_input_width!=image_width
-        || network_input_height != image_height)
-    {
-        //final_mat = cv::Mat(network_input_width, network_input_height, CV_8UC3, cv::Scalar(0,0,0));
-        image_ratio_ = (double ) network_input_width /  (double)mat_image.cols;
-
-        cv::resize(mat_image, final_mat, cv::Size(), image_ratio_, image_ratio_);
-        image_top_bottom_border_ = abs(final_mat.rows-network_input_height)/2;
-        image_left_right_border_ = abs(final_mat.cols-network_input_width)/2;
-        cv::copyMakeBorder(final_mat, final_mat,
-                           image_top_bottom_border_, image_top_bottom_border_,
-                           image_left_right_border_, image_left_right_border_,
-                           cv::BORDER_CONSTANT, cv::Scalar(0,0,0));
-
-    }
-    else
-        final_mat = mat_image;
-
-    ipl_image = final_mat;
-
-    unsigned char *data = (unsigned char *)ipl_image.imageData;
-    int h = ipl_image.height;
-    int w = ipl_image.width;
-    int c = ipl_image.nChannels;
-    int step = ipl_image.widthStep;
-    int i, j, k;
-
-    image darknet_image = make_image(w, h, c);
-
-    for(i = 0; i < h; ++i){
-        for(k= 0; k < c; ++k){
-            for(j = 0; j < w; ++j){
-                darknet_image.data[k*w*h + i*w + j] = data[i*step + j*c + k]/255.;
-            }
-        }
-    }
-    rgbgr_image(darknet_image);
-    return darknet_image;
-}
-
 void Yolo3DetectorNode::image_callback(const sensor_msgs::ImageConstPtr& in_image_message)
 {
     std::vector< RectClassScore<float> > detections;
 
-    darknet_image_ = convert_ipl_to_image(in_image_message);
+    const image& darknet_image = yolo_detector_.convert_image(in_image_message);
+    const cv::Rect& input_roi = yolo_detector_.get_input_roi();
+    image_ratio_ = (double) input_roi.width / in_image_message->width;
+    image_left_right_border_ = input_roi.x;
+    image_top_bottom_border_ = input_roi.y;
 
-    detections = yolo_detector_.detect(darknet_image_);
+    detections = yolo_detector_.detect(darknet_image);
 
     //Prepare Output message
     autoware_msgs::image_obj output_car_message;
@@ -283,8 +243,6 @@ void Yolo3DetectorNode::image_callback(const sensor_msgs::ImageConstPtr& in_imag
 
     publisher_car_objects_.publish(output_car_message);
     publisher_person_objects_.publish(output_person_message);
-
-    free(darknet_image_.data);
 }
 
 void Yolo3DetectorNode::config_cb(const autoware_msgs::ConfigSsd::ConstPtr& param)
@@ -337,9 +295,17 @@ void Yolo3DetectorNode::Run()
     private_node_handle.param<float>("nms_threshold", nms_threshold_, 0.45);
     ROS_INFO("[%s] nms_threshold: %f",__APP_NAME__, nms_threshold_);
 
+    private_node_handle.param<bool>("use_gpu", use_gpu_, true);
+    ROS_INFO("[%s] use_gpu: %d",__APP_NAME__, use_gpu_);
+
+    private_node_handle.param<int>("gpu_device_id", gpu_device_id_, 0);
+    ROS_INFO("[%s] gpu_device_id: %d",__APP_NAME__, gpu_device_id_);
+
+    private_node_handle.param<std::string>("calibration_file", calibration_file_, "");
+    ROS_INFO("[%s] calibration_file: %s",__APP_NAME__, calibration_file_.c_str());
 
     ROS_INFO("Initializing Yolo3 on Darknet...");
-    yolo_detector_.load(network_definition_file, pretrained_model_file, score_threshold_, nms_threshold_);
+    yolo_detector_.load(network_definition_file, pretrained_model_file, score_threshold_, nms_threshold_, use_gpu_, gpu_device_id_, calibration_file_);
     ROS_INFO("Initialization complete.");
 
     publisher_car_objects_ = node_handle_.advertise<autoware_msgs::image_obj>("/obj_car/image_obj", 1);
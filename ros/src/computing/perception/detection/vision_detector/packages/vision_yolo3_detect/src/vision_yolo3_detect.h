@@ -52,6 +52,7 @@
 #include <autoware_msgs/image_obj.h>
 
 #include <rect_class_score.h>
+#include "image_ingest.h"
 
 #include <opencv2/opencv.hpp>
 
@@ -63,6 +64,7 @@ extern "C"
 #include "network.h"
 #include "detection_layer.h"
 #include "parser.h"
+#include "quantize.h"
 #include "region_layer.h"
 #include "utils.h"
 #include "image.h"
@@ -90,18 +92,23 @@ namespace darknet {
         double min_confidence_, nms_threshold_;
         network* darknet_network_;
         std::vector<box> darknet_boxes_;
-        std::vector<RectClassScore<float> > forward(image &in_darknet_image);
+        image input_image_ = {};//network input, written in place by image_ingest_
+        ImageIngest image_ingest_;
+        std::vector<RectClassScore<float> > forward(const image &in_darknet_image);
     public:
         Yolo3Detector() {}
 
         void load(std::string &in_model_file, std::string &in_trained_file, double in_min_confidence,
-                  double in_nms_threshold);
+                  double in_nms_threshold, bool in_use_gpu, int in_gpu_device_id,
+                  const std::string &in_calibration_file);
 
         ~Yolo3Detector();
 
-        image convert_image(const sensor_msgs::ImageConstPtr &in_image_msg);
+        const image& convert_image(const sensor_msgs::ImageConstPtr &in_image_msg);
 
-        std::vector<RectClassScore<float> > detect(image &in_darknet_image);
+        const cv::Rect& get_input_roi() const;
+
+        std::vector<RectClassScore<float> > detect(const image &in_darknet_image);
 
         uint32_t get_network_width();
 
@@ -120,17 +127,16 @@ class Yolo3DetectorNode {
 
     darknet::Yolo3Detector yolo_detector_;
 
-    image darknet_image_ = {};
-
     float score_threshold_;
     float nms_threshold_;
+    bool use_gpu_;
+    int gpu_device_id_;
+    std::string calibration_file_;
     double image_ratio_;//resdize ratio used to fit input image to network input size
     uint32_t image_top_bottom_border_;//black strips added to the input image to maintain aspect ratio while resizing it to fit the network input size
     uint32_t image_left_right_border_;
 
     void convert_rect_to_image_obj(std::vector< RectClassScore<float> >& in_objects, autoware_msgs::image_obj& out_message, std::string in_class);
-    void rgbgr_image(image& im);
-    image convert_ipl_to_image(const sensor_msgs::ImageConstPtr& msg);
     void image_callback(const sensor_msgs::ImageConstPtr& in_image_message);
     void config_cb(const autoware_msgs::ConfigSsd::ConstPtr& param);
 public:
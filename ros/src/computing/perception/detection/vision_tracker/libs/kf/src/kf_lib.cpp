@@ -55,6 +55,7 @@
 
 #include <sstream>
 #include <algorithm>
+#include <cmath>
 #include <iterator>
 
 #define SSTR( x ) dynamic_cast< std::ostringstream & >( \
@@ -94,14 +95,31 @@ static bool 		track_ready_;
 static bool 		detect_ready_;
 static autoware_msgs::image_obj_tracked kf_objects_msg_;
 
+//Constant velocity Kalman filter of a box. Its x, y, width and height share the motion model and the noises, so the
+//8 state filter splits in four (position, velocity) filters with one common 2x2 covariance
+struct kfilter
+{
+	float	position[4];//x, y, width, height
+	float	velocity[4];
+	float	covariance[3];//position variance, position-velocity covariance, velocity variance
+};
+
+//Image of an object for template matching, with the data crossCorr needs about it computed only once
+struct match_image
+{
+	cv::Mat	image;
+	cv::Mat	sqsum;//integral of the squared pixel values summed over the channels
+	double	norm;//square root of the sum of the squared pixel values
+};
+
 struct kstate
 {
-	cv::KalmanFilter	KF;//KalmanFilter for this object
+	kfilter			KF;//KalmanFilter for this object
 	cv::Rect		pos;//position of the object centerx, centery, width, height
 	float			score;//DPM score
 	bool			active;//if too old (lifespan) don't use
 	unsigned int		id;//id of this tracked object
-	cv::Mat			image;//image containing the detected and tracked object
+	match_image		image;//image containing the detected and tracked object
 	int			lifespan;//remaining lifespan before deprecate
 	//ObjectDetection_ obj;//currently not used
 	cv::Scalar	color;
@@ -247,79 +265,95 @@ void getRectFromPoints(std::vector< cv::Point2f > corners, cv::Rect& outBounding
 	return false;
 }*/
 
+void computeMatchImage(const cv::Mat& in_image, match_image& out_match_image)
+{
+	out_match_image.image = in_image;
+	out_match_image.norm = 0;
+	if (in_image.rows <= 0 || in_image.cols <= 0)
+		return;
+
+	cv::Mat squared;
+	in_image.convertTo(squared, CV_64F);
+	squared = squared.mul(squared);
+	if (squared.channels() > 1)
+	{
+		cv::Mat channels_sum;
+		cv::transform(squared, channels_sum, cv::Mat::ones(1, squared.channels(), CV_64F));
+		squared = channels_sum;
+	}
+
+	cv::integral(squared, out_match_image.sqsum, CV_64F);
+	out_match_image.norm = std::sqrt(cv::sum(squared)[0]);
+}
+
 ///Returns true if an im1 is contained in im2 or viceversa
-bool crossCorr(cv::Mat im1, cv::Mat im2)
+bool crossCorr(const match_image& im1, const match_image& im2)
 {
 	//im1 roi from the previous frame
 	//im2 roi fromcurrent frame
-	if (im1.rows <= 0 || im1.cols <= 0 || im2.rows <= 0 || im2.cols <= 0)
+	if (im1.image.rows <= 0 || im1.image.cols <= 0 || im2.image.rows <= 0 || im2.image.cols <= 0)
 		return false;
 
-	cv::Mat result, larger_im, smaller_im;
-
-	/// Create the result matrix
-	int result_cols;
-	int result_rows;
-
 	//select largest image
-	if (im2.cols > im1.cols)
+	const match_image* larger_im;
+	const match_image* smaller_im;
+	if (im2.image.cols > im1.image.cols)
 	{
-		larger_im = im2;
-		smaller_im = im1;
+		larger_im = &im2;
+		smaller_im = &im1;
 	}
 	else
 	{
-		larger_im = im1;
-		smaller_im = im2;
+		larger_im = &im1;
+		smaller_im = &im2;
 	}
+
+	//the size must be consistent, which needs no matching
+	int thresWidth = (larger_im->image.cols)*.7;
+	if (smaller_im->image.cols <= thresWidth)
+		return false;
+
 	//check rows to be also larger otherwise crop the smaller to remove extra rows
-	if (larger_im.rows < smaller_im.rows)
+	match_image padded_im;
+	if (larger_im->image.rows < smaller_im->image.rows)
 	{
 		//add rows to match sizes
-		cv::Mat rows = cv::Mat::ones(smaller_im.rows - larger_im.rows, larger_im.cols, larger_im.type());
-		larger_im.push_back(rows);
+		cv::Mat padded = larger_im->image.clone();
+		cv::Mat rows = cv::Mat::ones(smaller_im->image.rows - padded.rows, padded.cols, padded.type());
+		padded.push_back(rows);
+		computeMatchImage(padded, padded_im);
+		larger_im = &padded_im;
 	}
 
-	result_cols = larger_im.cols - smaller_im.cols + 1;
-	result_rows = larger_im.rows - smaller_im.rows + 1;
-	result.create(result_cols, result_rows, CV_32FC1);
-
-	/// Do the Matching and Normalize
-	matchTemplate(larger_im, smaller_im, result, CV_TM_CCORR_NORMED);
-	//normalize(result, result, 0, 1, NORM_MINMAX, -1, cv::Mat());
-
-	/// Localizing the best match with minMaxLoc
-	double minVal; double maxVal; cv::Point minLoc; cv::Point maxLoc;
-	cv::Point matchLoc;
+	/// Do the Matching, then Normalize it as CV_TM_CCORR_NORMED with the cached squared sums
+	cv::Mat result;
+	matchTemplate(larger_im->image, smaller_im->image, result, CV_TM_CCORR);
 
-	minMaxLoc(result, &minVal, &maxVal, &minLoc, &maxLoc, cv::Mat());
-
-	matchLoc = maxLoc;
-
-	/// Show me what you got
-	cv::Mat scene = larger_im.clone();
-	rectangle(scene, matchLoc, cv::Point(matchLoc.x + smaller_im.cols, matchLoc.y + smaller_im.rows), cv::Scalar(0, 0, 255), 2, 8, 0);
-	//imshow(image_window, scene);
-	//imshow(result_window, result);
-
-	//if (maxVal>0.89 && minVal <0.3)
-	bool ret;
-	int thresWidth = (larger_im.cols)*.7;
-	if ( (maxVal > 0.5) && (smaller_im.cols > thresWidth) )//good threshold and consistent size
+	const int templ_rows = smaller_im->image.rows;
+	const int templ_cols = smaller_im->image.cols;
+	double maxVal = -1;
+	for (int y = 0; y < result.rows; y++)
 	{
-
-		//std::cout << "matched" << endl;
-		ret = true;
-	}
-	else
-	{
-		//std::cout << "non matched" << endl;
-		ret = false;
+		const double* q0 = larger_im->sqsum.ptr<double>(y);
+		const double* q2 = larger_im->sqsum.ptr<double>(y + templ_rows);
+		float* row = result.ptr<float>(y);
+		for (int x = 0; x < result.cols; x++)
+		{
+			double window_sum2 = q0[x] - q0[x + templ_cols] - q2[x] + q2[x + templ_cols];
+			double num = row[x];
+			double t = std::sqrt(std::max(window_sum2, 0.0)) * smaller_im->norm;
+			if (fabs(num) < t)
+				num /= t;
+			else if (fabs(num) < t*1.125)
+				num = num > 0 ? 1 : -1;
+			else
+				num = 0;
+			maxVal = std::max(maxVal, num);
+		}
 	}
-	//cv::imshow("match1", scene);
-	//cv::imshow("match2", smaller_im);
 
-	return ret;
+	//if (maxVal>0.89 && minVal <0.3)
+	return maxVal > 0.5;//good threshold, the size was checked before
 }
 
 void posScaleToBbox(std::vector<kstate> kstates, std::vector<kstate>& trackedDetections)
@@ -375,48 +409,59 @@ int getAvailableIndex(std::vector<kstate>& kstates)
 	return cur_size;
 }
 
+//transition [1 1; 0 1] for every (position, velocity) pair, process noise in_process_noise*I
+void predictKalmanFilter(kfilter& io_filter, float in_process_noise)
+{
+	float* c = io_filter.covariance;
+	for (int d = 0; d < 4; d++)
+		io_filter.position[d] += io_filter.velocity[d];
+
+	float c00 = c[0] + 2*c[1] + c[2] + in_process_noise;
+	float c01 = c[1] + c[2];
+	float c11 = c[2] + in_process_noise;
+	c[0] = c00;
+	c[1] = c01;
+	c[2] = c11;
+}
+
+//measurement of the positions only, measurement noise in_measurement_noise*I
+void correctKalmanFilter(kfilter& io_filter, const float in_measurement[4], float in_measurement_noise)
+{
+	float* c = io_filter.covariance;
+	float innovation_cov = c[0] + in_measurement_noise;
+	float gain_position = c[0] / innovation_cov;
+	float gain_velocity = c[1] / innovation_cov;
+	for (int d = 0; d < 4; d++)
+	{
+		float innovation = in_measurement[d] - io_filter.position[d];
+		io_filter.position[d] += gain_position * innovation;
+		io_filter.velocity[d] += gain_velocity * innovation;
+	}
+
+	//(I - K H) P written without the cancellation of c[0] - gain_position * c[0] when the gain is close to 1
+	float c11 = c[2] - gain_velocity * c[1];
+	c[0] = c[0] * in_measurement_noise / innovation_cov;
+	c[1] = c[1] * in_measurement_noise / innovation_cov;
+	c[2] = c11;
+}
+
 void initTracking(ObjectDetection_ object, std::vector<kstate>& kstates,
 		  ObjectDetection_ detection,
 		  cv::Mat& image, std::vector<cv::Scalar> colors, float range)
 {
 	kstate new_state;
-	//cv::KalmanFilter KF(4, 2, 0);//XY Only
-	cv::KalmanFilter KF(8, 4, 0);
-
-	/*cv::Mat_<float> measurement = (cv::Mat_<float>(2, 1) << object.rect.x,//XY Only
-		object.rect.y);*/
-	cv::Mat_<float> measurement = (cv::Mat_<float>(4, 1) << object.rect.x,
-		object.rect.y, object.rect.width, object.rect.height);
-
-	/*KF.transitioncv::Matrix = (cv::Mat_<float>(4, 4) << 1, 0, 1, 0,//XY Only
-												0, 1, 0, 1,
-												0, 0, 1, 0,
-												0, 0, 0, 1);*/
-	KF.transitionMatrix = (cv::Mat_<float>(8, 8)
-	<<	1, 0, 0, 0, 1, 0, 0, 0,
-		0, 1, 0, 0, 0, 1, 0, 0,
-		0, 0, 1, 0, 0, 0, 1, 0,
-		0, 0, 0, 1, 0, 0, 0, 1,
-		0, 0, 0, 0, 1, 0, 0, 0,
-		0, 0, 0, 0, 0, 1, 0, 0,
-		0, 0, 0, 0, 0, 0, 1, 0,
-		0, 0, 0, 0, 0, 0, 0, 1);
-
-	//init pre
-	KF.statePre.at<float>(0) = object.rect.x;
-	KF.statePre.at<float>(1) = object.rect.y;
-	KF.statePre.at<float>(2) = object.rect.width;//XY Only
-	KF.statePre.at<float>(3) = object.rect.height;//XY Only
-	//init post
-	KF.statePost.at<float>(0) = object.rect.x;
-	KF.statePost.at<float>(1) = object.rect.y;
-	KF.statePost.at<float>(2) = object.rect.width;//XY Only
-	KF.statePost.at<float>(3) = object.rect.height;//XY Only
-
-	cv::setIdentity(KF.measurementMatrix);
-	cv::setIdentity(KF.processNoiseCov, cv:: Scalar::all(NOISE_COV));//1e-4
-	cv::setIdentity(KF.measurementNoiseCov, cv::Scalar::all(MEAS_NOISE_COV));//1e-3
-	cv::setIdentity(KF.errorCovPost, cv::Scalar::all(ERROR_ESTIMATE_COV));//100
+	kfilter KF;
+
+	//init post, at rest
+	KF.position[0] = object.rect.x;
+	KF.position[1] = object.rect.y;
+	KF.position[2] = object.rect.width;
+	KF.position[3] = object.rect.height;
+	for (int d = 0; d < 4; d++)
+		KF.velocity[d] = 0;
+	KF.covariance[0] = ERROR_ESTIMATE_COV;//100
+	KF.covariance[1] = 0;
+	KF.covariance[2] = ERROR_ESTIMATE_COV;
 
 	//clip detection
 	//check that predicted positions are inside the image
@@ -435,10 +480,10 @@ void initTracking(ObjectDetection_ object, std::vector<kstate>& kstates,
 
 	//save data to kstate
 	new_state.active = true;
-	new_state.image = image(cv::Rect(detection.rect.x,
+	computeMatchImage(image(cv::Rect(detection.rect.x,
 		detection.rect.y,
 		detection.rect.width,
-		detection.rect.height)).clone();//Crop image and obtain only object (ROI)
+		detection.rect.height)).clone(), new_state.image);//Crop image and obtain only object (ROI)
 	new_state.KF = KF;
 	new_state.lifespan = INITIAL_LIFESPAN;//start only with 1
 	new_state.pos = object.rect;
@@ -601,59 +646,59 @@ void doTracking(std::vector<ObjectDetection_>& detections, int frameNumber,
 	//Convert Bounding box coordinates from (x1,y1,w,h) to (BoxCenterX, BoxCenterY, width, height)
 	objects = detections;//bboxToPosScale(detections);
 
-	std::vector<int> already_matched;
-	//compare detections from this frame with tracked objects
-	for (unsigned int j = 0; j < detections.size(); j++)
+	//compare detections from this frame with tracked objects. A detection is matched to the first active object
+	//whose image it matches, which does not depend on the other detections, so they are compared in parallel
+	//and their crops and squared sums are computed only once
+	std::vector<int> detection_matches(detections.size(), -1);
+#pragma omp parallel for schedule(dynamic)
+	for (int j = 0; j < static_cast<int>(detections.size()); j++)
 	{
-		for (unsigned int i = 0; i < kstates.size(); i++)
-		{
-			//compare only to active tracked objects(not too old)
-			if (kstates[i].active)
-			{
-				//extend the roi 20%
-				int new_x = (detections[j].rect.x - detections[j].rect.width*.1);
-				int new_y = (detections[j].rect.y - detections[j].rect.height*.1);
-
-				if (new_x < 0)			new_x = 0;
-				if (new_x > image.cols)	new_x = image.cols;
-				if (new_y < 0)			new_y = 0;
-				if (new_y > image.rows) new_y = image.rows;
+		//extend the roi 20%
+		int new_x = (detections[j].rect.x - detections[j].rect.width*.1);
+		int new_y = (detections[j].rect.y - detections[j].rect.height*.1);
 
-				int new_width = detections[j].rect.width*1.2;
-				int new_height = detections[j].rect.height*1.2;
+		if (new_x < 0)			new_x = 0;
+		if (new_x > image.cols)	new_x = image.cols;
+		if (new_y < 0)			new_y = 0;
+		if (new_y > image.rows) new_y = image.rows;
 
-				if (new_width  + new_x > image.cols)	new_width  = image.cols - new_x;
-				if (new_height + new_y > image.rows)	new_height = image.rows - new_y;
+		int new_width = detections[j].rect.width*1.2;
+		int new_height = detections[j].rect.height*1.2;
 
-				cv::Rect roi_20(new_x, new_y, new_width, new_height);
-				//cv::Rect roi(detections[j].rect);
-				cv::Rect roi(roi_20);
-				cv::Mat currentObjectROI = image(roi).clone();//Crop image and obtain only object (ROI)
+		if (new_width  + new_x > image.cols)	new_width  = image.cols - new_x;
+		if (new_height + new_y > image.rows)	new_height = image.rows - new_y;
 
-				//cv::Rect intersect = detections[j].rect & kstates[i].pos;//check overlapping
+		cv::Rect roi_20(new_x, new_y, new_width, new_height);
+		//cv::Rect roi(detections[j].rect);
+		cv::Rect roi(roi_20);
+		match_image currentObjectROI;
+		computeMatchImage(image(roi), currentObjectROI);//Crop image and obtain only object (ROI)
 
-				cv::Rect boundingbox;
-				bool matched = false;
-				//try to match with previous frame
-				//if ( !USE_ORB )
-					matched = ( !alreadyMatched(j, already_matched) && crossCorr(kstates[i].image, currentObjectROI));
-				//else
-				//	matched = (!alreadyMatched(j, already_matched) && orbMatch(currentObjectROI, kstates[i].image, boundingbox, ORB_MIN_MATCHES, ORB_KNN_RATIO));
-
-				if(matched)
-				{
-					correct_indices[i] = true;//if ROI on this frame is matched to a previous object, correct
-					correct_detection_indices[i] = j;//store the index of the detection corresponding to matched kstate
-					add_as_new_indices[j] = false;//if matched do not add as new
-					//kstates[i].image = currentObjectROI;//update image with current frame data
-					kstates[i].score = detections[j].score;
-					kstates[i].range = _ranges[j];
-					already_matched.push_back(j);
-				}//crossCorr
+		for (unsigned int i = 0; i < kstates.size(); i++)
+		{
+			//compare only to active tracked objects(not too old)
+			//try to match with previous frame
+			if (kstates[i].active && crossCorr(kstates[i].image, currentObjectROI))
+			{
+				detection_matches[j] = i;
+				break;
+			}
+		}
+	}
 
-			}//kstates[i].active
-		}//for (int i = 0; i < kstates.size(); i++)
-	}//for (int j = 0; j < detections.size(); j++)
+	for (unsigned int j = 0; j < detections.size(); j++)
+	{
+		int i = detection_matches[j];
+		if (i >= 0)
+		{
+			correct_indices[i] = true;//if ROI on this frame is matched to a previous object, correct
+			correct_detection_indices[i] = j;//store the index of the detection corresponding to matched kstate
+			add_as_new_indices[j] = false;//if matched do not add as new
+			//kstates[i].image = currentObjectROI;//update image with current frame data
+			kstates[i].score = detections[j].score;
+			kstates[i].range = _ranges[j];
+		}
+	}
 
 
 	//do prediction and correction for the marked states
@@ -662,17 +707,16 @@ void doTracking(std::vector<ObjectDetection_>& detections, int frameNumber,
 		if (kstates[i].active)//predict and correct only active states
 		{
 			//update params before predicting
-			cv::setIdentity(kstates[i].KF.measurementMatrix);
-			cv::setIdentity(kstates[i].KF.processNoiseCov, cv::Scalar::all(NOISE_COV));//1e-4
-			cv::setIdentity(kstates[i].KF.measurementNoiseCov, cv::Scalar::all(MEAS_NOISE_COV));//1e-3
-			cv::setIdentity(kstates[i].KF.errorCovPost, cv::Scalar::all(ERROR_ESTIMATE_COV));//100
-
-			cv::Mat prediction = kstates[i].KF.predict();
-			cv::Mat correction;
-			kstates[i].pos.x = prediction.at<float>(0);
-			kstates[i].pos.y = prediction.at<float>(1);
-			kstates[i].pos.width = prediction.at<float>(2);
-			kstates[i].pos.height = prediction.at<float>(3);
+			kfilter& KF = kstates[i].KF;
+			KF.covariance[0] = ERROR_ESTIMATE_COV;//100
+			KF.covariance[1] = 0;
+			KF.covariance[2] = ERROR_ESTIMATE_COV;
+
+			predictKalmanFilter(KF, NOISE_COV);//1e-4
+			kstates[i].pos.x = KF.position[0];
+			kstates[i].pos.y = KF.position[1];
+			kstates[i].pos.width = KF.position[2];
+			kstates[i].pos.height = KF.position[3];
 			kstates[i].real_data = 0;
 			kstates[i].range = 0.0f;//fixed to zero temporarily as this is not real_data
 			kstates[i].min_height = 0.0f;//fixed to zero temporarily as this is not real_data
@@ -684,14 +728,12 @@ void doTracking(std::vector<ObjectDetection_>& detections, int frameNumber,
 				//a match was found hence update KF measurement
 				int j = correct_detection_indices[i];//obtain the index of the detection
 
-				//cv::Mat_<float> measurement = (cv::Mat_<float>(2, 1) << objects[j].rect.x, //XY ONLY
-				//												objects[j].rect.y);
-				cv::Mat_<float> measurement = (cv::Mat_<float>(4, 1) << objects[j].rect.x,
-					objects[j].rect.y,
-					objects[j].rect.width,
-					objects[j].rect.height);
+				float measurement[4] = { static_cast<float>(objects[j].rect.x),
+										static_cast<float>(objects[j].rect.y),
+										static_cast<float>(objects[j].rect.width),
+										static_cast<float>(objects[j].rect.height) };
 
-				correction = kstates[i].KF.correct(measurement);//UPDATE KF with new info
+				correctKalmanFilter(KF, measurement, MEAS_NOISE_COV);//UPDATE KF with new info, 1e-3
 				kstates[i].lifespan = DEFAULT_LIFESPAN; //RESET Lifespan of object
 
 				//kstates[i].pos.width = objects[j].rect.width;//XY ONLY
@@ -0,0 +1,67 @@
+#include "LkBatchTracker.hpp"
+
+LkBatchTracker::LkBatchTracker()
+{
+	//same flow parameters the trackers used for their own calcOpticalFlowPyrLK calls
+	max_level_ 		= 3;
+	term_criteria_ 	= cv::TermCriteria(CV_TERMCRIT_ITER|CV_TERMCRIT_EPS, 20, 0.03);
+	window_size_ 	= cv::Size(31, 31);
+}
+
+void LkBatchTracker::Track(const cv::Mat& in_image,
+							const std::vector<LkTracker*>& in_trackers,
+							const std::vector<ObjectDetection>& in_detections,
+							const std::vector<bool>& in_updates)
+{
+	cv::cvtColor(in_image, gray_image_, cv::COLOR_BGR2GRAY);
+
+	//updated trackers finish here, the others hand their points to the batch
+	flow_trackers_.clear();
+	flow_offsets_.clear();
+	prev_points_.clear();
+	for (size_t i = 0; i < in_trackers.size(); i++)
+	{
+		if (in_trackers[i]->BeginTrack(gray_image_, in_detections[i], in_updates[i]))
+		{
+			const std::vector<cv::Point2f>& points = in_trackers[i]->GetPreviousPoints();
+			flow_trackers_.push_back(i);
+			flow_offsets_.push_back(prev_points_.size());
+			prev_points_.insert(prev_points_.end(), points.begin(), points.end());
+		}
+	}
+	flow_offsets_.push_back(prev_points_.size());
+
+	cv::buildOpticalFlowPyramid(gray_image_, current_pyramid_, window_size_, max_level_);
+
+	if (!prev_points_.empty())
+	{
+		if (!prev_pyramid_.empty())
+		{
+			cv::calcOpticalFlowPyrLK(prev_pyramid_, 		//previous frame pyramid
+									current_pyramid_, 		//current frame pyramid
+									prev_points_, 			//previous corner points of all the trackers
+									current_points_, 		//current corner points (tracked)
+									status_,
+									err_,
+									window_size_,
+									max_level_,
+									term_criteria_,
+									0,
+									0.001);
+		}
+		else
+		{
+			//trackers only follow points after a tracked frame, so there is always a previous pyramid
+			current_points_ = prev_points_;
+			status_.assign(prev_points_.size(), 0);
+		}
+
+		for (size_t k = 0; k < flow_trackers_.size(); k++)
+		{
+			size_t offset = flow_offsets_[k];
+			in_trackers[flow_trackers_[k]]->EndTrack(&current_points_[offset], &status_[offset]);
+		}
+	}
+
+	std::swap(prev_pyramid_, current_pyramid_);
+}
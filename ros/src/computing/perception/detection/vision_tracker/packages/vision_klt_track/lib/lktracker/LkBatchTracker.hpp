@@ -0,0 +1,48 @@
+#ifndef LKBATCHTRACKER_HPP_
+#define LKBATCHTRACKER_HPP_
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/video/tracking.hpp>
+
+#include "LkTracker.hpp"
+
+/*
+ * Runs a set of LkTrackers on a frame. The grayscale image and its optical flow pyramid
+ * are built once per frame and kept for the next one, and the points of all the trackers
+ * that follow their previous points are tracked in a single calcOpticalFlowPyrLK call.
+ */
+class LkBatchTracker
+{
+	int 					max_level_;
+	cv::TermCriteria 		term_criteria_;
+	cv::Size 				window_size_;
+
+	cv::Mat 				gray_image_;
+	std::vector<cv::Mat> 	prev_pyramid_;
+	std::vector<cv::Mat> 	current_pyramid_;
+
+	std::vector<size_t> 	flow_trackers_;	//trackers following their points in the current frame
+	std::vector<size_t> 	flow_offsets_;	//first point of every flow tracker in the batch, plus the end
+	std::vector<cv::Point2f> prev_points_;
+	std::vector<cv::Point2f> current_points_;
+	std::vector<uchar> 		status_;
+	std::vector<float> 		err_;
+public:
+	LkBatchTracker();
+
+	/* \brief Tracks every tracker on a new frame
+	 * \param[in] in_image 		BGR frame
+	 * \param[in] in_trackers 	trackers to run
+	 * \param[in] in_detections detection matched to every tracker, used when its in_updates entry is true
+	 * \param[in] in_updates 	whether every tracker is updated with its detection
+	 */
+	void Track(const cv::Mat& in_image,
+				const std::vector<LkTracker*>& in_trackers,
+				const std::vector<ObjectDetection>& in_detections,
+				const std::vector<bool>& in_updates);
+};
+
+#endif /* LKBATCHTRACKER_HPP_ */
@@ -16,6 +16,7 @@ LkTracker::LkTracker(int in_id, float in_min_height, float in_max_height, float
 	window_size_ 			= cv::Size(corner_window_size_, corner_window_size_);
 
 	frame_count_			= 0;
+	has_previous_frame_		= false;
 
 	current_centroid_x_		= 0;
 	current_centroid_y_		= 0;
@@ -90,131 +91,146 @@ unsigned long int LkTracker::GetFrameCount()
 	return frame_count_;
 }
 
-cv::Mat LkTracker::Track(cv::Mat in_image, ObjectDetection in_detection, bool in_update)
+void LkTracker::DetectFeatures(const cv::Mat& in_gray_image)
 {
-	cv::Mat gray_image;
-	//cv::cvtColor(in_image, in_image, cv::COLOR_RGB2BGR);
-	cv::cvtColor(in_image, gray_image, cv::COLOR_BGR2GRAY);
-	cv::Mat mask(gray_image.size(), CV_8UC1);
-	//cv::TickMeter timer;
-
-	//timer.start();
+	//corners only depend on a few pixels around them, so the detector runs on the detection grown by a border
+	//instead of on the whole frame masked to the detection
+	const int border = 4;
+	cv::Rect roi(matched_detection_.rect.x - border,
+				matched_detection_.rect.y - border,
+				matched_detection_.rect.width + 2*border,
+				matched_detection_.rect.height + 2*border);
+	roi &= cv::Rect(0, 0, in_gray_image.cols, in_gray_image.rows);
+
+	cv::Mat mask = cv::Mat::zeros(roi.size(), CV_8UC1);
+	mask(matched_detection_.rect - roi.tl()) = 1;					//fill with ones only the detection
+
+	cv::goodFeaturesToTrack(in_gray_image(roi),	//input to extract corners
+							current_points_,	//out array with corners in the image
+							max_point_count_,	//maximum number of corner points to obtain
+							0.01,				//quality level
+							10,					//minimum distance between corner points
+							mask,//mask ROI
+							3,					//block size
+							true,				//true to use harris corner detector, otherwise use tomasi
+							0.04);				//harris detector free parameter
+
+	const cv::Point2f offset(roi.x, roi.y);
+	for (std::size_t i = 0; i < current_points_.size(); i++)
+	{
+		current_points_[i] += offset;
+	}
+}
 
+bool LkTracker::BeginTrack(const cv::Mat& in_gray_image, ObjectDetection in_detection, bool in_update)
+{
 	if (in_update && in_detection.rect.width > 0)
 	{
 		//MATCH
 		matched_detection_ = in_detection;
 		if (matched_detection_.rect.x < 0) matched_detection_.rect.x = 0;
 		if (matched_detection_.rect.y < 0) matched_detection_.rect.y = 0;
-		if (matched_detection_.rect.x + matched_detection_.rect.width > in_image.cols) matched_detection_.rect.width = in_image.cols - matched_detection_.rect.x;
-		if (matched_detection_.rect.y + matched_detection_.rect.height > in_image.rows) matched_detection_.rect.height = in_image.rows - matched_detection_.rect.y;
-
-		mask.setTo(cv::Scalar::all(0));
-		mask(matched_detection_.rect) = 1;							//fill with ones only the ROI
+		if (matched_detection_.rect.x + matched_detection_.rect.width > in_gray_image.cols) matched_detection_.rect.width = in_gray_image.cols - matched_detection_.rect.x;
+		if (matched_detection_.rect.y + matched_detection_.rect.height > in_gray_image.rows) matched_detection_.rect.height = in_gray_image.rows - matched_detection_.rect.y;
 
 		lifespan_ = DEFAULT_LIFESPAN_;
 	}
-	int sum_x = 0;
-	int sum_y = 0;
-	std::vector<cv::Point2f> valid_points;
 
 	lifespan_--;
-	if ( ( in_update || prev_image_.empty() ) &&
+	if ( ( in_update || !has_previous_frame_ ) &&
 		 ( matched_detection_.rect.width>0 && matched_detection_.rect.height >0 )
 		)																//add as new object
 	{
-		cv::goodFeaturesToTrack(gray_image,			//input to extract corners
-								current_points_,	//out array with corners in the image
-								max_point_count_,	//maximum number of corner points to obtain
-								0.01,				//quality level
-								10,					//minimum distance between corner points
-								mask,//mask ROI
-								3,					//block size
-								true,				//true to use harris corner detector, otherwise use tomasi
-								0.04);				//harris detector free parameter
+		DetectFeatures(in_gray_image);
 		if (current_points_.size()<=0)
 		{
+			prev_points_.clear();
+			has_previous_frame_ = false;
 			ObjectDetection tmp_det; tmp_det.rect = cv::Rect(0,0,0,0); tmp_det.score=0;
 			current_rect_ = tmp_det;
-			return in_image;
+			return false;
 		}
-		cv::cornerSubPix(gray_image,
+		cv::cornerSubPix(in_gray_image,
 					current_points_,
 					sub_pixel_window_size_,
 					cv::Size(-1,-1),
 					term_criteria_);
-		//frame_count_ = 0;
 		current_centroid_x_ = 0;
 		current_centroid_y_ = 0;
-		//current_points_.push_back(cv::Point(matched_detection_.x, matched_detection_.y));
 
+		std::vector<cv::Point2f> valid_points;
 		for (std::size_t i = 0; i < current_points_.size(); i++)
 		{
-			//cv::circle(in_image, current_points_[i], 3 , cv::Scalar(0,255,0), 2);
 			current_centroid_x_+= current_points_[i].x;
 			current_centroid_y_+= current_points_[i].y;
 			valid_points.push_back(current_points_[i]);
 		}
-		//std::cout << "CENTROID" << current_centroid_x_ <<","<< current_centroid_y_<< std::endl << std::endl;
-
+		UpdateTrackedObject(valid_points, 0, 0);
+		return false;
 	}
-	else if ( !prev_points_.empty() )//try to match current object
+
+	if (prev_points_.empty())
 	{
-		std::vector<uchar> status;
-		std::vector<float> err;
-		if(prev_image_.empty())
-			in_image.copyTo(prev_image_);
-		cv::calcOpticalFlowPyrLK(prev_image_, 			//previous image frame
-								gray_image, 			//current image frame
-								prev_points_, 			//previous corner points
-								current_points_, 		//current corner points (tracked)
-								status,
-								err,
-								window_size_,
-								3,
-								term_criteria_,
-								0,
-								0.001);
-		std::size_t i = 0, k = 0;
+		ObjectDetection tmp_det; tmp_det.rect = cv::Rect(0,0,0,0); tmp_det.score=0;
+		current_rect_ = tmp_det;
+		return false;
+	}
+	return true;														//try to match current object
+}
 
-		current_centroid_x_ = 0;
-		current_centroid_y_ = 0;
+const std::vector<cv::Point2f>& LkTracker::GetPreviousPoints() const
+{
+	return prev_points_;
+}
+
+void LkTracker::EndTrack(const cv::Point2f* in_current_points, const uchar* in_status)
+{
+	int sum_x = 0;
+	int sum_y = 0;
+	std::vector<cv::Point2f> valid_points;
+
+	current_centroid_x_ = 0;
+	current_centroid_y_ = 0;
 
-		//process points
-		for (i=0, k=0 ; i < prev_points_.size(); i++)
+	//process points
+	for (std::size_t i = 0; i < prev_points_.size(); i++)
+	{
+		if( !in_status[i] )
 		{
-			if( !status[i] )
-			{
-				continue;
-			}
-			cv::Point2f p,q;
-			p.x = (int)prev_points_[i].x;		p.y = (int)prev_points_[i].y;
-			q.x = (int)current_points_[i].x;	q.y = (int)current_points_[i].y;
+			continue;
+		}
+		cv::Point2f p,q;
+		p.x = (int)prev_points_[i].x;		p.y = (int)prev_points_[i].y;
+		q.x = (int)in_current_points[i].x;	q.y = (int)in_current_points[i].y;
 
-			sum_y = p.y-q.y;
-			sum_x = p.x -q.x;
+		sum_y = p.y-q.y;
+		sum_x = p.x -q.x;
 
-			current_centroid_x_+= current_points_[i].x;
-			current_centroid_y_+= current_points_[i].y;
+		current_centroid_x_+= in_current_points[i].x;
+		current_centroid_y_+= in_current_points[i].y;
 
-			current_points_[k++] = current_points_[i];
-			valid_points.push_back(current_points_[i]);
-			//cv::circle(in_image, current_points_[i], 3 , cv::Scalar(0,255,0), 2);
-		}
+		valid_points.push_back(in_current_points[i]);
 	}
-	if (valid_points.size()<=2)
+	UpdateTrackedObject(valid_points, sum_x, sum_y);
+}
+
+void LkTracker::UpdateTrackedObject(std::vector<cv::Point2f>& in_valid_points, int in_sum_x, int in_sum_y)
+{
+	if (in_valid_points.size()<=2)
 	{
+		//the points kept so far belong to an older frame than the batch pyramid, drop them
+		prev_points_.clear();
+		has_previous_frame_ = false;
 		ObjectDetection tmp_det; tmp_det.rect = cv::Rect(0,0,0,0); tmp_det.score=0;
 		current_rect_ = tmp_det;
-		
-		return in_image;
+		return;
 	}
 	frame_count_++;
 
 	cv::Mat labels;
 	cv::Mat centers;
 
-	cv::kmeans(valid_points,
+	cv::kmeans(in_valid_points,
 					2,
 					labels,
 					cv::TermCriteria( CV_TERMCRIT_EPS+CV_TERMCRIT_ITER, 10, 1.0),
@@ -225,7 +241,7 @@ cv::Mat LkTracker::Track(cv::Mat in_image, ObjectDetection in_detection, bool in
 	cv::Point2f center1 = centers.at<cv::Point2f>(0);
 	cv::Point2f center2 = centers.at<cv::Point2f>(1);
 
-	cv::Point centroid(current_centroid_x_/valid_points.size(), current_centroid_y_/valid_points.size());
+	cv::Point centroid(current_centroid_x_/in_valid_points.size(), current_centroid_y_/in_valid_points.size());
 
 	int cluster_nums[2] = {0,0};
 	std::vector<cv::Scalar> colors(2);
@@ -246,17 +262,17 @@ cv::Mat LkTracker::Track(cv::Mat in_image, ObjectDetection in_detection, bool in
 	std::vector<cv::Point2f> points_clusters[2];
 	std::vector<cv::Point2f> close_points;
 	//count points for each cluster
-	for (std::size_t i = 0; i < valid_points.size(); i++)
+	for (std::size_t i = 0; i < in_valid_points.size(); i++)
 	{
 		int cluster_index = labels.at<int>(i);
 		cluster_nums[cluster_index]++;
-		points_clusters[cluster_index].push_back(valid_points[i]);
-		if (cv::norm(valid_points[i] - center1) < matched_detection_.rect.width*0.8 &&
-				cv::norm(valid_points[i] - center2) < matched_detection_.rect.width*0.8) //distance between point and cluster centroid
+		points_clusters[cluster_index].push_back(in_valid_points[i]);
+		if (cv::norm(in_valid_points[i] - center1) < matched_detection_.rect.width*0.8 &&
+				cv::norm(in_valid_points[i] - center2) < matched_detection_.rect.width*0.8) //distance between point and cluster centroid
 		{
-			close_points.push_back(valid_points[i]);
+			close_points.push_back(in_valid_points[i]);
 		}
-		//cv::circle(in_image, valid_points[i], 2, colors[cluster_index], 2);
+		//cv::circle(in_image, in_valid_points[i], 2, colors[cluster_index], 2);
 	}
 
 	std::vector<cv::Point2f> final_points;
@@ -286,7 +302,7 @@ cv::Mat LkTracker::Track(cv::Mat in_image, ObjectDetection in_detection, bool in
 		current_points_.clear();
 		ObjectDetection tmp_det; tmp_det.rect = cv::Rect(0,0,0,0); tmp_det.score=0;
 		current_rect_ = tmp_det;
-		return in_image;
+		return;
 	}
 
 	//cv::rectangle(in_image, current_rect_, cv::Scalar(0,0,255), 2);
@@ -295,7 +311,7 @@ cv::Mat LkTracker::Track(cv::Mat in_image, ObjectDetection in_detection, bool in
 	{
 		cv::Point center_point = cv::Point(current_rect_.rect.x + current_rect_.rect.width/2, current_rect_.rect.y + current_rect_.rect.height/2);
 		cv::Point direction_point;
-		float sum_angle = atan2(sum_y, sum_x);
+		float sum_angle = atan2(in_sum_y, in_sum_x);
 
 		direction_point.x = (center_point.x - 100 * cos(sum_angle));
 		direction_point.y = (center_point.y - 100 * sin(sum_angle));
@@ -308,19 +324,13 @@ cv::Mat LkTracker::Track(cv::Mat in_image, ObjectDetection in_detection, bool in
 
 	//finally store current state into previous
 	std::swap(final_points, prev_points_);
-	cv::swap(prev_image_, gray_image);
+	has_previous_frame_ = true;
 
 	if (current_centroid_x_ > 0 && current_centroid_y_ > 0)
 	{
 		previous_centroid_x_ = current_centroid_x_;
 		previous_centroid_y_ = current_centroid_y_;
 	}
-
-	//timer.stop();
-
-	//std::cout << timer.getTimeMilli() << std::endl;
-
-	return in_image;
 }
 
 void LkTracker::GetRectFromPoints(std::vector< cv::Point2f > in_corners_points, cv::Rect& out_boundingbox)
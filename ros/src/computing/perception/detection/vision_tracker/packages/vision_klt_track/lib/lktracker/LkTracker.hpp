@@ -40,8 +40,7 @@ class LkTracker
 	unsigned long int 		frame_count_;
 	unsigned int 			lifespan_;
 
-	cv::Mat 				prev_image_;
-	cv::Mat 				current_image_;
+	bool 					has_previous_frame_;//true when the last frame was tracked, prev_points_ then belong to the previous frame
 	cv::TermCriteria 		term_criteria_;
 	cv::Size 				sub_pixel_window_size_;
 	cv::Size 				window_size_;
@@ -59,6 +58,8 @@ class LkTracker
 
 	std::vector<cv::Point2f> prev_points_;
 	std::vector<cv::Point2f> current_points_;
+	void 					DetectFeatures(const cv::Mat& in_gray_image);
+	void 					UpdateTrackedObject(std::vector<cv::Point2f>& in_valid_points, int in_sum_x, int in_sum_y);
 	void 					GetRectFromPoints(std::vector< cv::Point2f > in_corners_points, cv::Rect& out_boundingbox);
 	void 					ArrowedLine(cv::Mat& in_image, cv::Point in_point1, cv::Point in_point2, const cv::Scalar& in_color,
 								int in_thickness=1, int in_line_type=8, int in_shift=0, double in_tip_length=0.1);
@@ -71,7 +72,12 @@ public:
 
 
 	LkTracker(int in_id, float in_min_height, float in_max_height, float in_range);
-	cv::Mat 								Track(cv::Mat image, ObjectDetection in_detections, bool in_update);
+	/* Starts tracking on a new frame. Updated trackers detect new feature points and finish here,
+	 * returns true when the points in GetPreviousPoints() must be followed by optical flow and
+	 * the result given to EndTrack(), which LkBatchTracker does for all the trackers at once */
+	bool 									BeginTrack(const cv::Mat& in_gray_image, ObjectDetection in_detection, bool in_update);
+	const std::vector<cv::Point2f>& 		GetPreviousPoints() const;
+	void 									EndTrack(const cv::Point2f* in_current_points, const uchar* in_status);
 	ObjectDetection	GetTrackedObject();
 	unsigned int							GetRemainingLifespan();
 	void 									NullifyLifespan();
@@ -52,6 +52,7 @@
 #include <opencv2/objdetect/objdetect.hpp>
 #include <opencv2/video/tracking.hpp>
 
+#include <LkBatchTracker.hpp>
 #include <LkTracker.hpp>
 
 #include <iostream>
@@ -83,6 +84,10 @@ class RosTrackerApp {
   std::vector<LkTracker *> obj_trackers_;
   std::vector<ObjectDetection> obj_detections_;
 
+  LkBatchTracker batch_tracker_;
+  std::vector<ObjectDetection> tracker_detections_;
+  std::vector<bool> tracker_updates_;
+
   std::vector<float> ranges_;
   std::vector<float> min_heights_;
   std::vector<float> max_heights_;
@@ -91,17 +96,10 @@ class RosTrackerApp {
 
   void Sort(const std::vector<float> in_scores,
             std::vector<unsigned int> &in_out_indices) {
-    for (unsigned int i = 0; i < in_scores.size(); i++)
-      for (unsigned int j = i + 1; j < in_scores.size(); j++) {
-        if (in_scores[in_out_indices[j]] > in_scores[in_out_indices[i]]) {
-          // float x_tmp = x[i];
-          int index_tmp = in_out_indices[i];
-          // x[i] = x[j];
-          in_out_indices[i] = in_out_indices[j];
-          // x[j] = x_tmp;
-          in_out_indices[j] = index_tmp;
-        }
-      }
+    std::stable_sort(in_out_indices.begin(), in_out_indices.end(),
+                     [&in_scores](unsigned int a, unsigned int b) {
+                       return in_scores[a] > in_scores[b];
+                     });
   }
 
   void ApplyNonMaximumSuppresion(std::vector<LkTracker *> &in_out_source,
@@ -139,10 +137,16 @@ class RosTrackerApp {
 
     Sort(area, indices); // returns indices ordered based on scores
 
-    for (unsigned int i = 0; i < size; i++) {
-
+    // the overlaps do not depend on the suppressions, so they are found in
+    // parallel and the suppressions applied in order afterwards
+    std::vector<std::vector<unsigned int> > overlapping(size);
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < static_cast<int>(size); i++) {
+      overlapping[i].clear();
+      if (is_suppresed[indices[i]])
+        continue;
       for (unsigned int j = i + 1; j < size; j++) {
-        if (is_suppresed[indices[i]] || is_suppresed[indices[j]])
+        if (is_suppresed[indices[j]])
           continue;
         int x1_max = std::max(x1[indices[i]], x1[indices[j]]);
         int x2_min = std::min(x2[indices[i]], x2[indices[j]]);
@@ -153,15 +157,23 @@ class RosTrackerApp {
         if (overlap_width > 0 && overlap_height > 0) {
           float overlap_part =
               (overlap_width * overlap_height) / area[indices[j]];
-          if (overlap_part > in_nms_threshold) {
-            is_suppresed[indices[j]] = true;
-            in_out_source[indices[j]]->NullifyLifespan();
-            if (in_out_source[indices[j]]->GetFrameCount() >
-                in_out_source[indices[i]]->GetFrameCount()) {
-              in_out_source[indices[i]]->object_id =
-                  in_out_source[indices[j]]->object_id;
-            }
-          }
+          if (overlap_part > in_nms_threshold)
+            overlapping[i].push_back(j);
+        }
+      }
+    }
+
+    for (unsigned int i = 0; i < size; i++) {
+      for (unsigned int k = 0; k < overlapping[i].size(); k++) {
+        unsigned int j = overlapping[i][k];
+        if (is_suppresed[indices[i]] || is_suppresed[indices[j]])
+          continue;
+        is_suppresed[indices[j]] = true;
+        in_out_source[indices[j]]->NullifyLifespan();
+        if (in_out_source[indices[j]]->GetFrameCount() >
+            in_out_source[indices[i]]->GetFrameCount()) {
+          in_out_source[indices[i]]->object_id =
+              in_out_source[indices[j]]->object_id;
         }
       }
     }
@@ -187,36 +199,33 @@ public:
     empty_detection.score = 0;
     unsigned int i;
 
-    std::vector<bool> tracker_matched(obj_trackers_.size(), false);
     std::vector<bool> object_matched(obj_detections_.size(), false);
+    tracker_detections_.assign(obj_trackers_.size(), empty_detection);
+    tracker_updates_.assign(obj_trackers_.size(), false);
+
+    std::vector<cv::Rect> tracker_rects(obj_trackers_.size());
+    for (unsigned int j = 0; j < obj_trackers_.size(); j++)
+      tracker_rects[j] = obj_trackers_[j]->GetTrackedObject().rect;
 
     // check object detections vs current trackers
     for (i = 0; i < obj_detections_.size(); i++) {
+      const ObjectDetection &tmp_detection = obj_detections_[i];
+      int area = tmp_detection.rect.width * tmp_detection.rect.height;
       for (unsigned int j = 0; j < obj_trackers_.size(); j++) {
-        if (tracker_matched[j] || object_matched[i])
+        if (tracker_updates_[j])
           continue;
 
-        ObjectDetection tmp_detection = obj_detections_[i];
-        int area = tmp_detection.rect.width * tmp_detection.rect.height;
-        cv::Rect intersection =
-            tmp_detection.rect & obj_trackers_[j]->GetTrackedObject().rect;
+        cv::Rect intersection = tmp_detection.rect & tracker_rects[j];
         if ((intersection.width * intersection.height) > area * 0.3) {
-
-          obj_trackers_[j]->Track(image_track, obj_detections_[i], true);
-          tracker_matched[j] = true;
+          tracker_detections_[j] = tmp_detection;
+          tracker_updates_[j] = true;
           object_matched[i] = true;
           // std::cout << "matched " << i << " with " << j << std::endl;
+          break;
         }
       }
     }
 
-    // run the trackers not matched
-    for (i = 0; i < obj_trackers_.size(); i++) {
-      if (!tracker_matched[i]) {
-        obj_trackers_[i]->Track(image_track, empty_detection, false);
-      }
-    }
-
     // create trackers for those objects not being tracked yet
     for (unsigned int i = 0; i < obj_detections_.size(); i++) {
       if (!object_matched[i]) // if object wasn't matched by overlapping area,
@@ -226,19 +235,26 @@ public:
           num_trackers_ = 0;
         LkTracker *new_tracker = new LkTracker(++num_trackers_, min_heights_[i],
                                                max_heights_[i], ranges_[i]);
-        new_tracker->Track(image_track, obj_detections_[i], true);
+        tracker_detections_.push_back(obj_detections_[i]);
+        tracker_updates_.push_back(true);
 
         // std::cout << "added new tracker" << std::endl;
         obj_trackers_.push_back(new_tracker);
       }
     }
 
+    // run all the trackers, matched and new ones are updated with their
+    // detections, the others follow their points
+    batch_tracker_.Track(image_track, obj_trackers_, tracker_detections_,
+                         tracker_updates_);
+
     ApplyNonMaximumSuppresion(obj_trackers_, 0.3);
 
     // remove those trackers with its lifespan <=0
     std::vector<LkTracker *>::iterator it;
     for (it = obj_trackers_.begin(); it != obj_trackers_.end();) {
       if ((*it)->GetRemainingLifespan() <= 0) {
+        delete *it;
         it = obj_trackers_.erase(it);
         // std::cout << "deleted a tracker " << std::endl;
       } else
@@ -257,7 +273,7 @@ public:
         num, 0); // remaining lifespan of each rectranged
     for (i = 0; i < num; i++) {
       autoware_msgs::image_rect_ranged rect_ranged;
-      LkTracker tracker_tmp = *obj_trackers_[i];
+      LkTracker &tracker_tmp = *obj_trackers_[i];
       rect_ranged.rect.x = tracker_tmp.GetTrackedObject().rect.x;
       rect_ranged.rect.y = tracker_tmp.GetTrackedObject().rect.y;
       rect_ranged.rect.width = tracker_tmp.GetTrackedObject().rect.width;
@@ -324,6 +340,8 @@ public:
       // points are X,Y,W,H and repeat for each instance
       obj_detections_.clear();
       ranges_.clear();
+      min_heights_.clear();
+      max_heights_.clear();
 
       for (unsigned int i = 0; i < num; i++) {
         cv::Rect tmp;
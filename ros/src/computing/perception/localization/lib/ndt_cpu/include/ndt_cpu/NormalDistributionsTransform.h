@@ -36,6 +36,11 @@ public:
 	/* Compute and get fitness score */
 	double getFitnessScore(double max_range = DBL_MAX);
 
+	/* Approximate the fitness score from at most max_points evenly spaced points of the scan.
+	 * If tolerance > 0, the points are visited in interleaved rounds and the evaluation stops
+	 * once the running mean changes by less than tolerance (relative) between two rounds. */
+	double getFitnessScore(double max_range, int max_points, double tolerance = 0);
+
 	void updateVoxelGrid(typename pcl::PointCloud<PointTargetType>::Ptr new_cloud);
 
 protected:
@@ -100,14 +105,22 @@ private:
 					h_ang_e1_, h_ang_e2_, h_ang_e3_,
 					h_ang_f1_, h_ang_f2_, h_ang_f3_;
 
+	double evaluateFitnessScore(const typename pcl::PointCloud<PointSourceType> &trans_cloud, double max_range,
+								int max_points, double tolerance);
+
 	double step_size_;
 	float resolution_;
 	double trans_probability_;
 
 	int real_iterations_;
 
+	// Source cloud that trans_cloud_ was computed from by the last align
+	typename pcl::PointCloud<PointSourceType>::Ptr aligned_source_;
+
 
 	VoxelGrid<PointSourceType> voxel_grid_;
+
+	static const int FITNESS_ROUNDS_ = 8;
 };
 }
 
@@ -4,6 +4,7 @@
 #include <pcl/point_types.h>
 #include <pcl/point_cloud.h>
 #include <float.h>
+#include <algorithm>
 #include <vector>
 #include <eigen3/Eigen/Dense>
 #include <eigen3/Eigen/Geometry>
@@ -16,6 +17,14 @@ namespace cpu {
 template <typename PointSourceType>
 class VoxelGrid {
 public:
+	/* Per-thread scratch data for nearestNeighborDistance.
+	 * Holds the occupied voxels around the last visited voxel, so consecutive
+	 * queries falling into the same voxel do not collect them again. */
+	typedef struct {
+		int voxel_id;
+		std::vector<int> neighbor_ids;
+	} NearestNeighborCache;
+
 	VoxelGrid();
 
 	/* Set input points */
@@ -60,6 +69,12 @@ public:
 
 	double nearestNeighborDistance(PointSourceType query_point, float max_range);
 
+	/* Same as above, but the 3x3x3 block of voxels around the query point is checked first.
+	 * If a centroid closer than one leaf is found there, it is the exact nearest centroid and
+	 * the octree descent is skipped. Read-only, so it can be called concurrently as long as
+	 * every thread uses its own cache (voxel_id initialized to -1). */
+	double nearestNeighborDistance(PointSourceType query_point, float max_range, NearestNeighborCache &cache);
+
 	Eigen::Vector3d getCentroid(int voxel_id) const;
 	Eigen::Matrix3d getCovariance(int voxel_id) const;
 	Eigen::Matrix3d getInverseCovariance(int voxel_id) const;
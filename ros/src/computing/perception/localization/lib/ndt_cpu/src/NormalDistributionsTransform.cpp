@@ -31,6 +31,25 @@ NormalDistributionsTransform<PointSourceType, PointTargetType>::NormalDistributi
 	real_iterations_ = 0;
 }
 
+/* The voxel grid keeps its centroids, covariances and octree in shared pointers,
+ * so a copy shares the target map with the original and only owns its own
+ * source/transformed clouds. Copies can be aligned concurrently. */
+template <typename PointSourceType, typename PointTargetType>
+NormalDistributionsTransform<PointSourceType, PointTargetType>::NormalDistributionsTransform(const NormalDistributionsTransform &other):
+	Registration<PointSourceType, PointTargetType>(other)
+{
+	gauss_d1_ = other.gauss_d1_;
+	gauss_d2_ = other.gauss_d2_;
+	outlier_ratio_ = other.outlier_ratio_;
+	step_size_ = other.step_size_;
+	resolution_ = other.resolution_;
+	trans_probability_ = other.trans_probability_;
+	real_iterations_ = other.real_iterations_;
+	aligned_source_ = other.aligned_source_;
+
+	voxel_grid_ = other.voxel_grid_;
+}
+
 template <typename PointSourceType, typename PointTargetType>
 void NormalDistributionsTransform<PointSourceType, PointTargetType>::setStepSize(double step_size)
 {
@@ -153,6 +172,7 @@ void NormalDistributionsTransform<PointSourceType, PointTargetType>::computeTran
 		if (delta_p_norm == 0 || delta_p_norm != delta_p_norm) {
 			trans_probability_ = score / static_cast<double>(points_number);
 			converged_ = delta_p_norm == delta_p_norm;
+			aligned_source_ = source_cloud_;
 			return;
 		}
 
@@ -172,6 +192,9 @@ void NormalDistributionsTransform<PointSourceType, PointTargetType>::computeTran
 	if (source_cloud_->points.size() > 0) {
 		trans_probability_ = score / static_cast<double>(source_cloud_->points.size());
 	}
+
+	// trans_cloud_ now holds the source transformed by final_transformation_
+	aligned_source_ = source_cloud_;
 }
 
 template <typename PointSourceType, typename PointTargetType>
@@ -713,23 +736,68 @@ void NormalDistributionsTransform<PointSourceType, PointTargetType>::computeHess
 template <typename PointSourceType, typename PointTargetType>
 double NormalDistributionsTransform<PointSourceType, PointTargetType>::getFitnessScore(double max_range)
 {
-	double fitness_score = 0.0;
+	return getFitnessScore(max_range, 0, 0);
+}
+
+template <typename PointSourceType, typename PointTargetType>
+double NormalDistributionsTransform<PointSourceType, PointTargetType>::getFitnessScore(double max_range, int max_points, double tolerance)
+{
+	// Reuse the cloud transformed during the last iteration unless the source changed since
+	if (aligned_source_ == source_cloud_ && trans_cloud_.points.size() == source_cloud_->points.size()) {
+		return evaluateFitnessScore(trans_cloud_, max_range, max_points, tolerance);
+	}
 
 	typename pcl::PointCloud<PointSourceType> trans_cloud;
 
 	transformPointCloud(*source_cloud_, trans_cloud, final_transformation_);
 
-	double distance;
+	return evaluateFitnessScore(trans_cloud, max_range, max_points, tolerance);
+}
+
+template <typename PointSourceType, typename PointTargetType>
+double NormalDistributionsTransform<PointSourceType, PointTargetType>::evaluateFitnessScore(const typename pcl::PointCloud<PointSourceType> &trans_cloud,
+																							double max_range, int max_points, double tolerance)
+{
+	int points_number = trans_cloud.points.size();
+	int step = (max_points > 0 && points_number > max_points) ? (points_number + max_points - 1) / max_points : 1;
+	int sample_number = (points_number + step - 1) / step;
+	int rounds = (tolerance > 0) ? FITNESS_ROUNDS_ : 1;
+
+	double fitness_score = 0.0;
 	int nr = 0;
+	double previous_mean = -1;
+
+	for (int r = 0; r < rounds; r++) {
+		double round_score = 0.0;
+		int round_nr = 0;
+
+#pragma omp parallel reduction(+:round_score, round_nr)
+		{
+			typename VoxelGrid<PointSourceType>::NearestNeighborCache cache;
+			cache.voxel_id = -1;
 
-	for (int i = 0; i < trans_cloud.points.size(); i++) {
-		PointSourceType q = trans_cloud.points[i];
+#pragma omp for schedule(static)
+			for (int i = r; i < sample_number; i += rounds) {
+				double distance = voxel_grid_.nearestNeighborDistance(trans_cloud.points[i * step], max_range, cache);
 
-		distance = voxel_grid_.nearestNeighborDistance(q, max_range);
+				if (distance < max_range) {
+					round_score += distance;
+					round_nr++;
+				}
+			}
+		}
+
+		fitness_score += round_score;
+		nr += round_nr;
+
+		if (rounds > 1 && nr > 0) {
+			double mean = fitness_score / nr;
+
+			if (previous_mean >= 0 && std::fabs(mean - previous_mean) <= tolerance * previous_mean) {
+				break;
+			}
 
-		if (distance < max_range) {
-			fitness_score += distance;
-			nr++;
+			previous_mean = mean;
 		}
 	}
 
@@ -526,6 +526,10 @@ double VoxelGrid<PointSourceType>::nearestNeighborDistance(PointSourceType q, fl
 
 	int nn_vid = nearestVoxel(q, nn_node_bounds, max_range);
 
+	if (nn_vid < 0) {
+		return DBL_MAX;
+	}
+
 	Eigen::Vector3d c = (*centroid_)[nn_vid];
 	double min_dist = sqrt((q.x - c(0)) * (q.x - c(0)) + (q.y - c(1)) * (q.y - c(1)) + (q.z - c(2)) * (q.z - c(2)));
 
@@ -537,6 +541,53 @@ double VoxelGrid<PointSourceType>::nearestNeighborDistance(PointSourceType q, fl
 
 }
 
+template <typename PointSourceType>
+double VoxelGrid<PointSourceType>::nearestNeighborDistance(PointSourceType q, float max_range, NearestNeighborCache &cache)
+{
+	int idx = static_cast<int>(floor(q.x / voxel_x_));
+	int idy = static_cast<int>(floor(q.y / voxel_y_));
+	int idz = static_cast<int>(floor(q.z / voxel_z_));
+
+	if (idx >= real_min_bx_ && idx <= real_max_bx_ &&
+			idy >= real_min_by_ && idy <= real_max_by_ &&
+			idz >= real_min_bz_ && idz <= real_max_bz_) {
+		int vid = voxelId(idx, idy, idz, min_b_x_, min_b_y_, min_b_z_, vgrid_x_, vgrid_y_, vgrid_z_);
+
+		if (vid != cache.voxel_id) {
+			cache.voxel_id = vid;
+			cache.neighbor_ids.clear();
+
+			for (int i = std::max(idx - 1, real_min_bx_); i <= std::min(idx + 1, real_max_bx_); i++) {
+				for (int j = std::max(idy - 1, real_min_by_); j <= std::min(idy + 1, real_max_by_); j++) {
+					for (int k = std::max(idz - 1, real_min_bz_); k <= std::min(idz + 1, real_max_bz_); k++) {
+						int nid = voxelId(i, j, k, min_b_x_, min_b_y_, min_b_z_, vgrid_x_, vgrid_y_, vgrid_z_);
+
+						if ((*points_id_)[nid].size() > 0) {
+							cache.neighbor_ids.push_back(nid);
+						}
+					}
+				}
+			}
+		}
+
+		double min_dist = DBL_MAX;
+
+		for (int i = 0; i < cache.neighbor_ids.size(); i++) {
+			Eigen::Vector3d c = (*centroid_)[cache.neighbor_ids[i]];
+			double cur_dist = sqrt((q.x - c(0)) * (q.x - c(0)) + (q.y - c(1)) * (q.y - c(1)) + (q.z - c(2)) * (q.z - c(2)));
+
+			min_dist = (cur_dist < min_dist) ? cur_dist : min_dist;
+		}
+
+		// A centroid lies inside its voxel, so voxels outside of the block are at least one leaf away
+		if (min_dist <= std::min(voxel_x_, std::min(voxel_y_, voxel_z_))) {
+			return (min_dist >= max_range) ? DBL_MAX : min_dist;
+		}
+	}
+
+	return nearestNeighborDistance(q, max_range);
+}
+
 template <typename PointSourceType>
 void VoxelGrid<PointSourceType>::updateBoundaries(float max_x, float max_y, float max_z,
 													float min_x, float min_y, float min_z)
@@ -38,6 +38,7 @@
 
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <string>
 
@@ -72,6 +73,8 @@
 
 #include <time.h>
 
+#include "streaming_map.h"
+
 struct pose
 {
   double x;
@@ -162,6 +165,15 @@ static bool _imu_upside_down = false;
 
 static bool _incremental_voxel_update = false;
 
+// Streaming mode: only a sliding submap is kept in memory and used as the registration target
+static bool _use_streaming_map = false;
+static double _streaming_voxel_size = 0.2;
+static double _streaming_tile_size = 50.0;
+static double _streaming_active_radius = 100.0;
+static std::string _streaming_tile_directory = "ndt_mapping_tiles";
+static std::unique_ptr<StreamingMap> streaming_map;
+static pcl::PointCloud<pcl::PointXYZI>::Ptr submap_ptr(new pcl::PointCloud<pcl::PointXYZI>());
+
 static std::string _imu_topic = "/imu_raw";
 
 static double fitness_score;
@@ -199,6 +211,19 @@ static void output_callback(const autoware_msgs::ConfigNdtMappingOutput::ConstPt
   std::cout << "filter_res: " << filter_res << std::endl;
   std::cout << "filename: " << filename << std::endl;
 
+  if (_use_streaming_map == true)
+  {
+    // Finished regions are already on disk, write out the active ones as well.
+    streaming_map->saveAll();
+    std::cout << "Saved " << streaming_map->getTileNum() << " tiles to " << streaming_map->getTileDirectory() << "."
+              << std::endl;
+
+    sensor_msgs::PointCloud2::Ptr submap_msg_ptr(new sensor_msgs::PointCloud2);
+    pcl::toROSMsg(*submap_ptr, *submap_msg_ptr);
+    ndt_map_pub.publish(*submap_msg_ptr);
+    return;
+  }
+
   pcl::PointCloud<pcl::PointXYZI>::Ptr map_ptr(new pcl::PointCloud<pcl::PointXYZI>(map));
   pcl::PointCloud<pcl::PointXYZI>::Ptr map_filtered(new pcl::PointCloud<pcl::PointXYZI>());
   map_ptr->header.frame_id = "map";
@@ -495,7 +520,16 @@ static void points_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
   if (initial_scan_loaded == 0)
   {
     pcl::transformPointCloud(*scan_ptr, *transformed_scan_ptr, tf_btol);
-    map += *transformed_scan_ptr;
+    if (_use_streaming_map == true)
+    {
+      pcl::PointCloud<pcl::PointXYZI> added_points;
+      streaming_map->addPoints(*transformed_scan_ptr, added_points);
+      streaming_map->getActiveSubmap(*submap_ptr);
+    }
+    else
+    {
+      map += *transformed_scan_ptr;
+    }
     initial_scan_loaded = 1;
   }
 
@@ -505,7 +539,11 @@ static void points_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
   voxel_grid_filter.setInputCloud(scan_ptr);
   voxel_grid_filter.filter(*filtered_scan_ptr);
 
-  pcl::PointCloud<pcl::PointXYZI>::Ptr map_ptr(new pcl::PointCloud<pcl::PointXYZI>(map));
+  pcl::PointCloud<pcl::PointXYZI>::Ptr map_ptr;
+  if (_use_streaming_map == true)
+    map_ptr = submap_ptr;
+  else
+    map_ptr.reset(new pcl::PointCloud<pcl::PointXYZI>(map));
 
   if (_method_type == MethodType::PCL_GENERIC)
   {
@@ -755,7 +793,55 @@ static void points_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
 
   // Calculate the shift between added_pos and current_pos
   double shift = sqrt(pow(current_pose.x - added_pose.x, 2.0) + pow(current_pose.y - added_pose.y, 2.0));
-  if (shift >= min_add_scan_shift)
+  if (shift >= min_add_scan_shift && _use_streaming_map == true)
+  {
+    added_pose.x = current_pose.x;
+    added_pose.y = current_pose.y;
+    added_pose.z = current_pose.z;
+    added_pose.roll = current_pose.roll;
+    added_pose.pitch = current_pose.pitch;
+    added_pose.yaw = current_pose.yaw;
+
+    pcl::PointCloud<pcl::PointXYZI>::Ptr added_points_ptr(new pcl::PointCloud<pcl::PointXYZI>());
+    streaming_map->addPoints(*transformed_scan_ptr, *added_points_ptr);
+    bool region_changed = streaming_map->updateActiveRegion(current_pose.x, current_pose.y);
+
+    if (region_changed == true)
+    {
+      // Tiles were dropped or loaded, rebuild the target from the active submap
+      submap_ptr.reset(new pcl::PointCloud<pcl::PointXYZI>());
+      streaming_map->getActiveSubmap(*submap_ptr);
+    }
+    else if (_method_type != MethodType::PCL_ANH)
+    {
+      // Only voxel-deduplicated new points are appended to the bounded target
+      pcl::PointCloud<pcl::PointXYZI>::Ptr new_submap_ptr(new pcl::PointCloud<pcl::PointXYZI>(*submap_ptr));
+      *new_submap_ptr += *added_points_ptr;
+      submap_ptr = new_submap_ptr;
+    }
+
+    if (_method_type == MethodType::PCL_GENERIC)
+      ndt.setInputTarget(submap_ptr);
+    else if (_method_type == MethodType::PCL_ANH)
+    {
+      // The voxel grid of ndt_cpu appends the new points to submap_ptr itself
+      if (region_changed == true)
+        anh_ndt.setInputTarget(submap_ptr);
+      else
+        anh_ndt.updateVoxelGrid(added_points_ptr);
+    }
+#ifdef CUDA_FOUND
+    else if (_method_type == MethodType::PCL_ANH_GPU)
+      anh_gpu_ndt.setInputTarget(submap_ptr);
+#endif
+#ifdef USE_PCL_OPENMP
+    else if (_method_type == MethodType::PCL_OPENMP)
+      omp_ndt.setInputTarget(submap_ptr);
+#endif
+
+    map_ptr = submap_ptr;
+  }
+  else if (shift >= min_add_scan_shift)
   {
     map += *transformed_scan_ptr;
     added_pose.x = current_pose.x;
@@ -806,7 +892,16 @@ static void points_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
   std::cout << "Number of scan points: " << scan_ptr->size() << " points." << std::endl;
   std::cout << "Number of filtered scan points: " << filtered_scan_ptr->size() << " points." << std::endl;
   std::cout << "transformed_scan_ptr: " << transformed_scan_ptr->points.size() << " points." << std::endl;
-  std::cout << "map: " << map.points.size() << " points." << std::endl;
+  if (_use_streaming_map == true)
+  {
+    std::cout << "submap: " << streaming_map->getActivePointNum() << " points in "
+              << streaming_map->getActiveTileNum() << " tiles (" << streaming_map->getTileNum() << " tiles in total)."
+              << std::endl;
+  }
+  else
+  {
+    std::cout << "map: " << map.points.size() << " points." << std::endl;
+  }
   std::cout << "NDT has converged: " << has_converged << std::endl;
   std::cout << "Fitness score: " << fitness_score << std::endl;
   std::cout << "Number of iteration: " << final_num_iteration << std::endl;
@@ -901,6 +996,11 @@ int main(int argc, char** argv)
   private_nh.getParam("imu_upside_down", _imu_upside_down);
   private_nh.getParam("imu_topic", _imu_topic);
   private_nh.getParam("incremental_voxel_update", _incremental_voxel_update);
+  private_nh.getParam("use_streaming_map", _use_streaming_map);
+  private_nh.getParam("streaming_voxel_size", _streaming_voxel_size);
+  private_nh.getParam("streaming_tile_size", _streaming_tile_size);
+  private_nh.getParam("streaming_active_radius", _streaming_active_radius);
+  private_nh.getParam("streaming_tile_directory", _streaming_tile_directory);
 
   std::cout << "method_type: " << static_cast<int>(_method_type) << std::endl;
   std::cout << "use_odom: " << _use_odom << std::endl;
@@ -908,6 +1008,13 @@ int main(int argc, char** argv)
   std::cout << "imu_upside_down: " << _imu_upside_down << std::endl;
   std::cout << "imu_topic: " << _imu_topic << std::endl;
   std::cout << "incremental_voxel_update: " << _incremental_voxel_update << std::endl;
+  std::cout << "use_streaming_map: " << _use_streaming_map << std::endl;
+  if (_use_streaming_map == true)
+  {
+    std::cout << "(streaming_voxel_size,streaming_tile_size,streaming_active_radius): (" << _streaming_voxel_size
+              << ", " << _streaming_tile_size << ", " << _streaming_active_radius << ")" << std::endl;
+    std::cout << "streaming_tile_directory: " << _streaming_tile_directory << std::endl;
+  }
 
   if (nh.getParam("tf_x", _tf_x) == false)
   {
@@ -976,6 +1083,17 @@ int main(int argc, char** argv)
 
   map.header.frame_id = "map";
 
+  if (_use_streaming_map == true)
+  {
+    if (_streaming_voxel_size <= 0.0 || _streaming_tile_size <= 0.0)
+    {
+      std::cerr << "[ERROR]streaming_voxel_size and streaming_tile_size must be positive." << std::endl;
+      exit(1);
+    }
+    streaming_map.reset(new StreamingMap(_streaming_voxel_size, _streaming_tile_size, _streaming_active_radius,
+                                         _streaming_tile_directory));
+  }
+
   ndt_map_pub = nh.advertise<sensor_msgs::PointCloud2>("/ndt_map", 1000);
   current_pose_pub = nh.advertise<geometry_msgs::PoseStamped>("/current_pose", 1000);
 
@@ -0,0 +1,262 @@
+/*
+ *  Copyright (c) 2018, Nagoya University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of Autoware nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "streaming_map.h"
+
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <cmath>
+#include <iostream>
+#include <sstream>
+
+#include <pcl/io/pcd_io.h>
+
+// Voxel indexes are packed into 21 bits per axis
+static const int64_t VOXEL_KEY_OFFSET = 1 << 20;
+static const uint64_t VOXEL_KEY_MASK = (1 << 21) - 1;
+
+static void makeDirectories(const std::string& path)
+{
+  for (size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1))
+  {
+    const std::string sub_path = path.substr(0, pos);
+    if (mkdir(sub_path.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+      std::cerr << "Could not create " << sub_path << "." << std::endl;
+      return;
+    }
+    if (pos == std::string::npos)
+      break;
+  }
+}
+
+StreamingMap::StreamingMap(double voxel_size, double tile_size, double active_radius,
+                           const std::string& tile_directory)
+  : voxel_size_(voxel_size)
+  , tile_size_(tile_size)
+  , active_radius_(active_radius)
+  , tile_directory_(tile_directory)
+  , active_point_num_(0)
+{
+  makeDirectories(tile_directory_);
+}
+
+uint64_t StreamingMap::voxelKey(int vx, int vy, int vz) const
+{
+  return ((static_cast<uint64_t>(vx + VOXEL_KEY_OFFSET) & VOXEL_KEY_MASK) << 42) |
+         ((static_cast<uint64_t>(vy + VOXEL_KEY_OFFSET) & VOXEL_KEY_MASK) << 21) |
+         (static_cast<uint64_t>(vz + VOXEL_KEY_OFFSET) & VOXEL_KEY_MASK);
+}
+
+StreamingMap::TileIndex StreamingMap::tileIndex(int vx, int vy) const
+{
+  // Use the voxel center so that a voxel never straddles two tiles
+  return TileIndex(static_cast<int>(std::floor((vx + 0.5) * voxel_size_ / tile_size_)),
+                   static_cast<int>(std::floor((vy + 0.5) * voxel_size_ / tile_size_)));
+}
+
+std::string StreamingMap::tileFileName(const TileIndex& tile) const
+{
+  std::ostringstream file_name;
+  file_name << tile_directory_ << "/tile_" << tile.first << "_" << tile.second << ".pcd";
+  return file_name.str();
+}
+
+void StreamingMap::saveTile(const TileIndex& tile, const VoxelMap& voxels) const
+{
+  if (voxels.empty())
+    return;
+
+  pcl::PointCloud<pcl::PointXYZI> cloud;
+  cloud.reserve(voxels.size());
+  for (const auto& voxel : voxels)
+  {
+    cloud.push_back(voxel.second);
+  }
+  cloud.header.frame_id = "map";
+
+  pcl::io::savePCDFileBinary(tileFileName(tile), cloud);
+}
+
+void StreamingMap::loadTile(const TileIndex& tile)
+{
+  pcl::PointCloud<pcl::PointXYZI> cloud;
+  if (pcl::io::loadPCDFile(tileFileName(tile), cloud) == -1)
+  {
+    std::cerr << "Could not load " << tileFileName(tile) << "." << std::endl;
+    return;
+  }
+
+  VoxelMap& voxels = tiles_[tile];
+  voxels.reserve(voxels.size() + cloud.size());
+  for (const auto& p : cloud)
+  {
+    const uint64_t key = voxelKey(static_cast<int>(std::floor(p.x / voxel_size_)),
+                                  static_cast<int>(std::floor(p.y / voxel_size_)),
+                                  static_cast<int>(std::floor(p.z / voxel_size_)));
+    if (voxels.insert(std::make_pair(key, p)).second == true)
+      active_point_num_++;
+  }
+}
+
+StreamingMap::VoxelMap& StreamingMap::getTile(const TileIndex& tile)
+{
+  std::set<TileIndex>::iterator flushed = flushed_tiles_.find(tile);
+  if (flushed != flushed_tiles_.end())
+  {
+    flushed_tiles_.erase(flushed);
+    loadTile(tile);
+  }
+  return tiles_[tile];
+}
+
+void StreamingMap::addPoints(const pcl::PointCloud<pcl::PointXYZI>& cloud, pcl::PointCloud<pcl::PointXYZI>& added)
+{
+  added.clear();
+  added.reserve(cloud.size());
+
+  // Consecutive points usually fall into the same tile
+  TileIndex last_tile_index(0, 0);
+  VoxelMap* last_tile = NULL;
+
+  for (const auto& p : cloud)
+  {
+    const int vx = static_cast<int>(std::floor(p.x / voxel_size_));
+    const int vy = static_cast<int>(std::floor(p.y / voxel_size_));
+    const int vz = static_cast<int>(std::floor(p.z / voxel_size_));
+
+    const TileIndex tile_index = tileIndex(vx, vy);
+    if (last_tile == NULL || tile_index != last_tile_index)
+    {
+      last_tile = &getTile(tile_index);
+      last_tile_index = tile_index;
+    }
+
+    if (last_tile->insert(std::make_pair(voxelKey(vx, vy, vz), p)).second == true)
+    {
+      added.push_back(p);
+      active_point_num_++;
+    }
+  }
+
+  added.header.frame_id = "map";
+}
+
+bool StreamingMap::updateActiveRegion(double x, double y)
+{
+  bool changed = false;
+
+  // Flush tiles that left the active region. One tile of hysteresis keeps tiles
+  // on the border from being written and read back on every scan.
+  const double flush_radius = active_radius_ + tile_size_;
+  for (std::map<TileIndex, VoxelMap>::iterator tile = tiles_.begin(); tile != tiles_.end();)
+  {
+    const double dx = (tile->first.first + 0.5) * tile_size_ - x;
+    const double dy = (tile->first.second + 0.5) * tile_size_ - y;
+    if (std::sqrt(dx * dx + dy * dy) > flush_radius)
+    {
+      saveTile(tile->first, tile->second);
+      active_point_num_ -= tile->second.size();
+      flushed_tiles_.insert(tile->first);
+      tiles_.erase(tile++);
+      changed = true;
+    }
+    else
+    {
+      tile++;
+    }
+  }
+
+  // Bring back tiles flushed earlier that are inside the active region again
+  const int min_tx = static_cast<int>(std::floor((x - active_radius_) / tile_size_));
+  const int max_tx = static_cast<int>(std::floor((x + active_radius_) / tile_size_));
+  const int min_ty = static_cast<int>(std::floor((y - active_radius_) / tile_size_));
+  const int max_ty = static_cast<int>(std::floor((y + active_radius_) / tile_size_));
+  for (int tx = min_tx; tx <= max_tx && flushed_tiles_.empty() == false; tx++)
+  {
+    for (int ty = min_ty; ty <= max_ty; ty++)
+    {
+      const TileIndex tile(tx, ty);
+      const double dx = (tx + 0.5) * tile_size_ - x;
+      const double dy = (ty + 0.5) * tile_size_ - y;
+      if (std::sqrt(dx * dx + dy * dy) <= active_radius_ && flushed_tiles_.count(tile) > 0)
+      {
+        getTile(tile);
+        changed = true;
+      }
+    }
+  }
+
+  return changed;
+}
+
+void StreamingMap::getActiveSubmap(pcl::PointCloud<pcl::PointXYZI>& submap) const
+{
+  submap.clear();
+  submap.reserve(active_point_num_);
+  for (const auto& tile : tiles_)
+  {
+    for (const auto& voxel : tile.second)
+    {
+      submap.push_back(voxel.second);
+    }
+  }
+  submap.header.frame_id = "map";
+}
+
+void StreamingMap::saveAll()
+{
+  for (const auto& tile : tiles_)
+  {
+    saveTile(tile.first, tile.second);
+  }
+}
+
+size_t StreamingMap::getActivePointNum() const
+{
+  return active_point_num_;
+}
+
+size_t StreamingMap::getActiveTileNum() const
+{
+  return tiles_.size();
+}
+
+size_t StreamingMap::getTileNum() const
+{
+  return tiles_.size() + flushed_tiles_.size();
+}
+
+std::string StreamingMap::getTileDirectory() const
+{
+  return tile_directory_;
+}
@@ -0,0 +1,117 @@
+/*
+ *  Copyright (c) 2018, Nagoya University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of Autoware nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef NDT_MAPPING_STREAMING_MAP_H
+#define NDT_MAPPING_STREAMING_MAP_H
+
+#include <stdint.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+/*!
+ * Bounded-memory map for ndt_mapping.
+ * Points are deduplicated into a voxel hash as they arrive (one point per voxel) and
+ * grouped into square tiles on the xy plane. Only the tiles around the vehicle are
+ * kept in memory, the others are written to <tile_directory>/tile_<x>_<y>.pcd and
+ * loaded back if the vehicle returns.
+ */
+class StreamingMap
+{
+public:
+  /*!
+   * @param voxel_size edge length of the deduplication voxels [m]
+   * @param tile_size edge length of the tiles [m]
+   * @param active_radius tiles whose center is farther than this from the vehicle are flushed [m]
+   * @param tile_directory directory the tiles are written to, created if missing
+   */
+  StreamingMap(double voxel_size, double tile_size, double active_radius, const std::string& tile_directory);
+
+  /*!
+   * Inserts points given in the map frame
+   * @param cloud points to insert
+   * @param added receives the points that fell into previously empty voxels
+   */
+  void addPoints(const pcl::PointCloud<pcl::PointXYZI>& cloud, pcl::PointCloud<pcl::PointXYZI>& added);
+
+  /*!
+   * Moves the active region to the vehicle position, flushing the tiles that left it
+   * and loading previously flushed tiles that came back into it
+   * @return true if any tile was flushed or loaded
+   */
+  bool updateActiveRegion(double x, double y);
+
+  /*!
+   * @param submap receives all points of the tiles currently held in memory
+   */
+  void getActiveSubmap(pcl::PointCloud<pcl::PointXYZI>& submap) const;
+
+  /*!
+   * Writes every tile held in memory to disk without evicting it
+   */
+  void saveAll();
+
+  size_t getActivePointNum() const;
+  size_t getActiveTileNum() const;
+  size_t getTileNum() const;
+  std::string getTileDirectory() const;
+
+private:
+  typedef std::pair<int, int> TileIndex;
+  typedef std::unordered_map<uint64_t, pcl::PointXYZI> VoxelMap;
+
+  uint64_t voxelKey(int vx, int vy, int vz) const;
+  TileIndex tileIndex(int vx, int vy) const;
+  std::string tileFileName(const TileIndex& tile) const;
+
+  void saveTile(const TileIndex& tile, const VoxelMap& voxels) const;
+  void loadTile(const TileIndex& tile);
+
+  /*!
+   * Returns the tile, loading it from disk first if it was flushed before
+   */
+  VoxelMap& getTile(const TileIndex& tile);
+
+  double voxel_size_;
+  double tile_size_;
+  double active_radius_;
+  std::string tile_directory_;
+
+  std::map<TileIndex, VoxelMap> tiles_;
+  std::set<TileIndex> flushed_tiles_;
+  size_t active_point_num_;
+};
+
+#endif  // NDT_MAPPING_STREAMING_MAP_H
@@ -35,12 +35,14 @@
  */
 
 #include <pthread.h>
+#include <algorithm>
 #include <chrono>
 #include <fstream>
 #include <iostream>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include <nav_msgs/Odometry.h>
 #include <ros/ros.h>
@@ -81,6 +83,8 @@
 
 #include <autoware_msgs/ndt_stat.h>
 
+#include <latency_tracer/latency_tracer.h>
+
 #define PREDICT_POSE_THRESHOLD 0.5
 
 #define Wa 0.4
@@ -139,6 +143,25 @@ static float ndt_res = 1.0;      // Resolution
 static double step_size = 0.1;   // Step size
 static double trans_eps = 0.01;  // Transformation epsilon
 
+// Fitness score evaluation (pcl_anh only)
+static int _fitness_max_points = 0;       // Scan points used for the fitness score, 0 for all
+static double _fitness_tolerance = 0.0;  // Relative change that stops the evaluation early, 0 to disable
+
+// Global initialization (multi-hypothesis search around a coarse prior)
+static bool _use_global_init = false;
+static double _global_init_xy_range = 4.0;         // Half width of the position grid [m]
+static double _global_init_xy_step = 1.0;          // Position grid spacing [m]
+static double _global_init_yaw_range = M_PI;       // Half width of the yaw grid [rad]
+static double _global_init_yaw_step = M_PI / 8.0;  // Yaw grid spacing [rad]
+static int _global_init_coarse_iter = 3;           // NDT iterations per hypothesis
+static int _global_init_coarse_points = 500;       // Scan points used to evaluate a hypothesis
+static int _global_init_refine_num = 3;            // Hypotheses refined with the full scan
+static double _global_init_score_threshold = 500.0;  // Fitness score that triggers recovery
+
+static cpu::NormalDistributionsTransform<pcl::PointXYZ, pcl::PointXYZ> global_init_ndt;
+static bool global_init_requested = false;
+static pose global_init_prior;
+
 static ros::Publisher predict_pose_pub;
 static geometry_msgs::PoseStamped predict_pose_msg;
 
@@ -209,6 +232,8 @@ static std_msgs::Float32 time_ndt_matching;
 static int _queue_size = 1000;
 
 static ros::Publisher ndt_stat_pub;
+
+static std::unique_ptr<latency_tracer::LatencyTracer> tracer;
 static autoware_msgs::ndt_stat ndt_stat_msg;
 
 static double predict_pose_error = 0.0;
@@ -512,6 +537,30 @@ static void map_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
       pthread_mutex_unlock(&mutex);
     }
 #endif
+
+    // The global initialization always runs on the CPU implementation, whose copies
+    // share the voxel grid and can therefore be aligned concurrently.
+    if (_use_global_init == true)
+    {
+      if (_method_type == MethodType::PCL_ANH)
+      {
+        pthread_mutex_lock(&mutex);
+        global_init_ndt = anh_ndt;
+        pthread_mutex_unlock(&mutex);
+      }
+      else
+      {
+        cpu::NormalDistributionsTransform<pcl::PointXYZ, pcl::PointXYZ> new_global_init_ndt;
+        new_global_init_ndt.setResolution(ndt_res);
+        new_global_init_ndt.setInputTarget(map_ptr);
+        new_global_init_ndt.setStepSize(step_size);
+        new_global_init_ndt.setTransformationEpsilon(trans_eps);
+
+        pthread_mutex_lock(&mutex);
+        global_init_ndt = new_global_init_ndt;
+        pthread_mutex_unlock(&mutex);
+      }
+    }
     map_loaded = 1;
   }
 }
@@ -532,7 +581,13 @@ static void gnss_callback(const geometry_msgs::PoseStamped::ConstPtr& input)
   ros::Time current_gnss_time = input->header.stamp;
   static ros::Time previous_gnss_time = current_gnss_time;
 
-  if ((_use_gnss == 1 && init_pos_set == 0) || fitness_score >= 500.0)
+  if (_use_global_init == true && ((_use_gnss == 1 && init_pos_set == 0) || fitness_score >= _global_init_score_threshold))
+  {
+    global_init_prior = current_gnss_pose;
+    global_init_requested = true;
+    init_pos_set = 1;
+  }
+  else if ((_use_gnss == 1 && init_pos_set == 0) || fitness_score >= 500.0)
   {
     previous_pose.x = previous_gnss_pose.x;
     previous_pose.y = previous_gnss_pose.y;
@@ -711,6 +766,12 @@ static void initialpose_callback(const geometry_msgs::PoseWithCovarianceStamped:
   offset_imu_odom_pitch = 0.0;
   offset_imu_odom_yaw = 0.0;
 
+  if (_use_global_init == true)
+  {
+    global_init_prior = current_pose;
+    global_init_requested = true;
+  }
+
   init_pos_set = 1;
 }
 
@@ -935,11 +996,135 @@ static void imu_callback(const sensor_msgs::Imu::Ptr& input)
   previous_imu_yaw = imu_yaw;
 }
 
+struct global_init_hypothesis
+{
+  Eigen::Matrix4f guess;
+  Eigen::Matrix4f result;
+  double score;
+};
+
+static bool compareHypothesisScore(const global_init_hypothesis& lhs, const global_init_hypothesis& rhs)
+{
+  return lhs.score < rhs.score;
+}
+
+static void alignHypotheses(const pcl::PointCloud<pcl::PointXYZ>::Ptr& scan_ptr, const int iterations,
+                            std::vector<global_init_hypothesis>& hypotheses)
+{
+#pragma omp parallel for schedule(dynamic)
+  for (int i = 0; i < static_cast<int>(hypotheses.size()); i++)
+  {
+    // Copies share the voxel grid of global_init_ndt, only the source side is per hypothesis.
+    cpu::NormalDistributionsTransform<pcl::PointXYZ, pcl::PointXYZ> hypothesis_ndt(global_init_ndt);
+    hypothesis_ndt.setMaximumIterations(iterations);
+    hypothesis_ndt.setInputSource(scan_ptr);
+    hypothesis_ndt.align(hypotheses[i].guess);
+
+    hypotheses[i].result = hypothesis_ndt.getFinalTransformation();
+    hypotheses[i].score = hypothesis_ndt.getFitnessScore();
+  }
+}
+
+/*
+ * Scatter a grid of position/yaw hypotheses around a coarse prior, align all of them
+ * concurrently with a few NDT iterations on a subsampled scan, keep the best ones by
+ * fitness score and refine those with the full scan.
+ * Returns the base_link pose of the best hypothesis.
+ */
+static pose global_init_search(const pcl::PointCloud<pcl::PointXYZ>::Ptr& scan_ptr, const pose& prior)
+{
+  std::chrono::time_point<std::chrono::system_clock> search_start = std::chrono::system_clock::now();
+
+  pcl::PointCloud<pcl::PointXYZ>::Ptr coarse_scan_ptr(new pcl::PointCloud<pcl::PointXYZ>());
+  const size_t coarse_points = static_cast<size_t>(std::max(_global_init_coarse_points, 1));
+  const size_t stride = std::max(scan_ptr->size() / coarse_points, static_cast<size_t>(1));
+  coarse_scan_ptr->reserve(scan_ptr->size() / stride + 1);
+  for (size_t i = 0; i < scan_ptr->size(); i += stride)
+  {
+    coarse_scan_ptr->push_back(scan_ptr->points[i]);
+  }
+
+  const int xy_num = static_cast<int>(std::floor(_global_init_xy_range / _global_init_xy_step));
+  int yaw_num = static_cast<int>(std::floor(_global_init_yaw_range / _global_init_yaw_step));
+  // Do not evaluate the same heading twice when the yaw grid wraps around
+  const bool yaw_wraps = (2 * yaw_num + 1) * _global_init_yaw_step > 2.0 * M_PI - 1.0e-6;
+
+  std::vector<global_init_hypothesis> hypotheses;
+  for (int ix = -xy_num; ix <= xy_num; ix++)
+  {
+    for (int iy = -xy_num; iy <= xy_num; iy++)
+    {
+      for (int iyaw = -yaw_num; iyaw <= yaw_num; iyaw++)
+      {
+        if (yaw_wraps == true && iyaw == yaw_num)
+          continue;
+
+        Eigen::Translation3f translation(prior.x + ix * _global_init_xy_step, prior.y + iy * _global_init_xy_step,
+                                         prior.z);
+        Eigen::AngleAxisf rotation_x(prior.roll, Eigen::Vector3f::UnitX());
+        Eigen::AngleAxisf rotation_y(prior.pitch, Eigen::Vector3f::UnitY());
+        Eigen::AngleAxisf rotation_z(prior.yaw + iyaw * _global_init_yaw_step, Eigen::Vector3f::UnitZ());
+
+        global_init_hypothesis hypothesis;
+        hypothesis.guess = (translation * rotation_z * rotation_y * rotation_x) * tf_btol;
+        hypothesis.score = DBL_MAX;
+        hypotheses.push_back(hypothesis);
+      }
+    }
+  }
+
+  // Coarse stage
+  alignHypotheses(coarse_scan_ptr, _global_init_coarse_iter, hypotheses);
+
+  // Keep the best hypotheses and refine them starting from their coarse results
+  const size_t refine_num = std::min(static_cast<size_t>(std::max(_global_init_refine_num, 1)), hypotheses.size());
+  std::partial_sort(hypotheses.begin(), hypotheses.begin() + refine_num, hypotheses.end(), compareHypothesisScore);
+  hypotheses.resize(refine_num);
+  for (auto& hypothesis : hypotheses)
+  {
+    hypothesis.guess = hypothesis.result;
+  }
+
+  alignHypotheses(scan_ptr, max_iter, hypotheses);
+
+  const global_init_hypothesis& best = *std::min_element(hypotheses.begin(), hypotheses.end(), compareHypothesisScore);
+
+  Eigen::Matrix4f t2 = best.result * tf_btol.inverse();
+  tf::Matrix3x3 mat_b;
+  mat_b.setValue(static_cast<double>(t2(0, 0)), static_cast<double>(t2(0, 1)), static_cast<double>(t2(0, 2)),
+                 static_cast<double>(t2(1, 0)), static_cast<double>(t2(1, 1)), static_cast<double>(t2(1, 2)),
+                 static_cast<double>(t2(2, 0)), static_cast<double>(t2(2, 1)), static_cast<double>(t2(2, 2)));
+
+  pose result;
+  result.x = t2(0, 3);
+  result.y = t2(1, 3);
+  result.z = t2(2, 3);
+  mat_b.getRPY(result.roll, result.pitch, result.yaw, 1);
+
+  std::chrono::time_point<std::chrono::system_clock> search_end = std::chrono::system_clock::now();
+  std::cout << "-----------------------------------------------------------------" << std::endl;
+  std::cout << "Global initialization" << std::endl;
+  std::cout << "Prior (x,y,z,roll,pitch,yaw): (" << prior.x << ", " << prior.y << ", " << prior.z << ", " << prior.roll
+            << ", " << prior.pitch << ", " << prior.yaw << ")" << std::endl;
+  std::cout << "Hypotheses: " << (2 * xy_num + 1) * (2 * xy_num + 1) * (yaw_wraps ? 2 * yaw_num : 2 * yaw_num + 1)
+            << ", refined: " << refine_num << std::endl;
+  std::cout << "Best fitness score: " << best.score << std::endl;
+  std::cout << "Result (x,y,z,roll,pitch,yaw): (" << result.x << ", " << result.y << ", " << result.z << ", "
+            << result.roll << ", " << result.pitch << ", " << result.yaw << ")" << std::endl;
+  std::cout << "Search time: "
+            << std::chrono::duration_cast<std::chrono::microseconds>(search_end - search_start).count() / 1000.0
+            << " ms." << std::endl;
+  std::cout << "-----------------------------------------------------------------" << std::endl;
+
+  return result;
+}
+
 static void points_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
 {
   if (map_loaded == 1 && init_pos_set == 1)
   {
     matching_start = std::chrono::system_clock::now();
+    tracer->receive(input->header.stamp);
 
     static tf::TransformBroadcaster br;
     tf::Transform transform;
@@ -977,6 +1162,36 @@ static void points_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
       omp_ndt.setInputSource(filtered_scan_ptr);
 #endif
 
+    if (_use_global_init == true && global_init_requested == true)
+    {
+      previous_pose = global_init_search(filtered_scan_ptr, global_init_prior);
+      current_pose = current_pose_imu = current_pose_odom = current_pose_imu_odom = previous_pose;
+
+      current_velocity = 0.0;
+      current_velocity_x = 0.0;
+      current_velocity_y = 0.0;
+      current_velocity_z = 0.0;
+      angular_velocity = 0.0;
+
+      current_velocity_imu_x = 0.0;
+      current_velocity_imu_y = 0.0;
+      current_velocity_imu_z = 0.0;
+
+      current_accel = 0.0;
+      current_accel_x = 0.0;
+      current_accel_y = 0.0;
+      current_accel_z = 0.0;
+
+      offset_imu_x = offset_imu_y = offset_imu_z = 0.0;
+      offset_imu_roll = offset_imu_pitch = offset_imu_yaw = 0.0;
+      offset_odom_x = offset_odom_y = offset_odom_z = 0.0;
+      offset_odom_roll = offset_odom_pitch = offset_odom_yaw = 0.0;
+      offset_imu_odom_x = offset_imu_odom_y = offset_imu_odom_z = 0.0;
+      offset_imu_odom_roll = offset_imu_odom_pitch = offset_imu_odom_yaw = 0.0;
+
+      global_init_requested = false;
+    }
+
     // Guess the initial gross estimation of the transformation
     double diff_time = (current_scan_time - previous_scan_time).toSec();
 
@@ -1063,7 +1278,7 @@ static void points_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
       iteration = anh_ndt.getFinalNumIteration();
 
       getFitnessScore_start = std::chrono::system_clock::now();
-      fitness_score = anh_ndt.getFitnessScore();
+      fitness_score = anh_ndt.getFitnessScore(DBL_MAX, _fitness_max_points, _fitness_tolerance);
       getFitnessScore_end = std::chrono::system_clock::now();
 
       trans_probability = anh_ndt.getTransformationProbability();
@@ -1116,6 +1331,15 @@ static void points_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
 
     pthread_mutex_unlock(&mutex);
 
+    tracer->process(input->header.stamp);
+
+    // Matching diverged, search around the predicted pose on the next scan
+    if (_use_global_init == true && fitness_score >= _global_init_score_threshold)
+    {
+      global_init_prior = predict_pose_for_ndt;
+      global_init_requested = true;
+    }
+
     tf::Matrix3x3 mat_l;  // localizer
     mat_l.setValue(static_cast<double>(t(0, 0)), static_cast<double>(t(0, 1)), static_cast<double>(t(0, 2)),
                    static_cast<double>(t(1, 0)), static_cast<double>(t(1, 1)), static_cast<double>(t(1, 2)),
@@ -1358,6 +1582,7 @@ static void points_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
     // current_pose is published by vel_pose_mux
     //    current_pose_pub.publish(current_pose_msg);
     localizer_pose_pub.publish(localizer_pose_msg);
+    tracer->publish(input->header.stamp);
 
     // Send TF "/base_link" to "/map"
     transform.setOrigin(tf::Vector3(current_pose.x, current_pose.y, current_pose.z));
@@ -1539,6 +1764,17 @@ int main(int argc, char** argv)
   private_nh.getParam("use_odom", _use_odom);
   private_nh.getParam("imu_upside_down", _imu_upside_down);
   private_nh.getParam("imu_topic", _imu_topic);
+  private_nh.getParam("use_global_init", _use_global_init);
+  private_nh.getParam("global_init_xy_range", _global_init_xy_range);
+  private_nh.getParam("global_init_xy_step", _global_init_xy_step);
+  private_nh.getParam("global_init_yaw_range", _global_init_yaw_range);
+  private_nh.getParam("global_init_yaw_step", _global_init_yaw_step);
+  private_nh.getParam("global_init_coarse_iter", _global_init_coarse_iter);
+  private_nh.getParam("global_init_coarse_points", _global_init_coarse_points);
+  private_nh.getParam("global_init_refine_num", _global_init_refine_num);
+  private_nh.getParam("global_init_score_threshold", _global_init_score_threshold);
+  private_nh.getParam("fitness_max_points", _fitness_max_points);
+  private_nh.getParam("fitness_tolerance", _fitness_tolerance);
 
   if (nh.getParam("localizer", _localizer) == false)
   {
@@ -1588,6 +1824,22 @@ int main(int argc, char** argv)
   std::cout << "use_imu: " << _use_imu << std::endl;
   std::cout << "imu_upside_down: " << _imu_upside_down << std::endl;
   std::cout << "imu_topic: " << _imu_topic << std::endl;
+  std::cout << "use_global_init: " << _use_global_init << std::endl;
+  if (_use_global_init == true)
+  {
+    std::cout << "(global_init_xy_range,global_init_xy_step,global_init_yaw_range,global_init_yaw_step): ("
+              << _global_init_xy_range << ", " << _global_init_xy_step << ", " << _global_init_yaw_range << ", "
+              << _global_init_yaw_step << ")" << std::endl;
+    std::cout << "(global_init_coarse_iter,global_init_coarse_points,global_init_refine_num): ("
+              << _global_init_coarse_iter << ", " << _global_init_coarse_points << ", " << _global_init_refine_num
+              << ")" << std::endl;
+    std::cout << "global_init_score_threshold: " << _global_init_score_threshold << std::endl;
+  }
+  if (_method_type == MethodType::PCL_ANH)
+  {
+    std::cout << "(fitness_max_points,fitness_tolerance): (" << _fitness_max_points << ", " << _fitness_tolerance << ")"
+              << std::endl;
+  }
   std::cout << "localizer: " << _localizer << std::endl;
   std::cout << "(tf_x,tf_y,tf_z,tf_roll,tf_pitch,tf_yaw): (" << _tf_x << ", " << _tf_y << ", " << _tf_z << ", "
             << _tf_roll << ", " << _tf_pitch << ", " << _tf_yaw << ")" << std::endl;
@@ -1611,6 +1863,11 @@ int main(int argc, char** argv)
     exit(1);
   }
 #endif
+  if (_use_global_init == true && (_global_init_xy_step <= 0.0 || _global_init_yaw_step <= 0.0))
+  {
+    std::cerr << "[ERROR]global_init_xy_step and global_init_yaw_step must be positive." << std::endl;
+    exit(1);
+  }
 
   Eigen::Translation3f tl_btol(_tf_x, _tf_y, _tf_z);                 // tl: translation
   Eigen::AngleAxisf rot_x_btol(_tf_roll, Eigen::Vector3f::UnitX());  // rot: rotation
@@ -1626,6 +1883,8 @@ int main(int argc, char** argv)
   initial_pose.pitch = 0.0;
   initial_pose.yaw = 0.0;
 
+  tracer.reset(new latency_tracer::LatencyTracer(nh, private_nh));
+
   // Publishers
   predict_pose_pub = nh.advertise<geometry_msgs::PoseStamped>("/predict_pose", 10);
   predict_pose_imu_pub = nh.advertise<geometry_msgs::PoseStamped>("/predict_pose_imu", 10);
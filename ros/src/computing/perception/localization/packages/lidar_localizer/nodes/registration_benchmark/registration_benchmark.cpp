@@ -0,0 +1,868 @@
+/*
+ *  Copyright (c) 2018, Nagoya University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of Autoware nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ Registration backend benchmark
+
+ Replays recorded scans against a point cloud map through every registration
+ backend lidar_localizer offers and reports, per backend, the time per align,
+ the number of iterations, a common fitness score and the pose error against
+ a reference trajectory.
+
+ Usage:
+   registration_benchmark <map.pcd> <scans.csv> [options]
+
+ Each non-comment line of scans.csv is
+   scan.pcd,x,y,z,roll,pitch,yaw
+ where the pose is the reference base_link pose in the map frame (e.g. taken
+ from a converged ndt_matching run or from RTK). Relative scan paths are
+ resolved against the directory of scans.csv.
+*/
+
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <tf/tf.h>
+
+#include <pcl/common/transforms.h>
+#include <pcl/filters/voxel_grid.h>
+#include <pcl/io/pcd_io.h>
+#include <pcl/kdtree/kdtree_flann.h>
+#include <pcl/point_types.h>
+#include <pcl/registration/icp.h>
+
+#include <ndt_cpu/NormalDistributionsTransform.h>
+#include <pcl/registration/ndt.h>
+#ifdef CUDA_FOUND
+#include <ndt_gpu/NormalDistributionsTransform.h>
+#endif
+#ifdef USE_PCL_OPENMP
+#include <pcl_omp_registration/ndt.h>
+#endif
+
+#include "algebra.h"
+#include "ndt.h"
+
+#define G_MAP_X 2000
+#define G_MAP_Y 2000
+#define G_MAP_Z 200
+#define G_MAP_CELLSIZE 1.0
+#define TKU_MAX_SCAN_POINTS 130000
+
+// Globals required by ndt_tku (see ndt_matching_tku)
+NDMapPtr NDmap;
+NDPtr NDs;
+int NDs_num;
+Point scan_points[TKU_MAX_SCAN_POINTS];
+int scan_points_num;
+double scan_points_weight[TKU_MAX_SCAN_POINTS];
+double scan_points_totalweight;
+int layer_select = LAYER_NUM - 1;
+
+struct pose
+{
+  double x;
+  double y;
+  double z;
+  double roll;
+  double pitch;
+  double yaw;
+};
+
+struct scan_entry
+{
+  std::string path;
+  pose reference;
+};
+
+struct benchmark_config
+{
+  double resolution = 1.0;
+  double step_size = 0.1;
+  double trans_eps = 0.01;
+  int max_iter = 30;
+  double leaf_size = 0.0;
+  double icp_max_correspondence_distance = 1.0;
+  double icp_euclidean_fitness_epsilon = 0.1;
+  double icp_ransac_outlier_rejection_threshold = 1.0;
+  bool tracking = true;
+  pose guess_offset = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+  pose tf_btol = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+  std::string output_prefix;
+};
+
+struct align_result
+{
+  Eigen::Matrix4f transformation;
+  int iteration;
+  bool converged;
+};
+
+struct scan_result
+{
+  double align_time;  // [ms]
+  int iteration;
+  bool converged;
+  double fitness_score;
+  double trans_error;  // [m]
+  double yaw_error;    // [rad]
+  pose estimate;
+};
+
+static double wrapToPm(double a_num, const double a_max)
+{
+  if (a_num >= a_max)
+  {
+    a_num -= 2.0 * a_max;
+  }
+  else if (a_num < -a_max)
+  {
+    a_num += 2.0 * a_max;
+  }
+  return a_num;
+}
+
+static Eigen::Matrix4f poseToMatrix(const pose& p)
+{
+  Eigen::Translation3f tl(p.x, p.y, p.z);
+  Eigen::AngleAxisf rot_x(p.roll, Eigen::Vector3f::UnitX());
+  Eigen::AngleAxisf rot_y(p.pitch, Eigen::Vector3f::UnitY());
+  Eigen::AngleAxisf rot_z(p.yaw, Eigen::Vector3f::UnitZ());
+  return (tl * rot_z * rot_y * rot_x).matrix();
+}
+
+static pose matrixToPose(const Eigen::Matrix4f& t)
+{
+  tf::Matrix3x3 mat;
+  mat.setValue(static_cast<double>(t(0, 0)), static_cast<double>(t(0, 1)), static_cast<double>(t(0, 2)),
+               static_cast<double>(t(1, 0)), static_cast<double>(t(1, 1)), static_cast<double>(t(1, 2)),
+               static_cast<double>(t(2, 0)), static_cast<double>(t(2, 1)), static_cast<double>(t(2, 2)));
+
+  pose p;
+  p.x = t(0, 3);
+  p.y = t(1, 3);
+  p.z = t(2, 3);
+  mat.getRPY(p.roll, p.pitch, p.yaw, 1);
+  return p;
+}
+
+class RegistrationBackend
+{
+public:
+  virtual ~RegistrationBackend()
+  {
+  }
+
+  virtual std::string getName() const = 0;
+
+  // map_ptr and the scans passed to align() are expressed in the map and localizer frames respectively.
+  virtual void setInputTarget(const pcl::PointCloud<pcl::PointXYZ>::Ptr& map_ptr) = 0;
+
+  // guess and the returned transformation are localizer poses in the map frame.
+  virtual align_result align(const pcl::PointCloud<pcl::PointXYZ>::Ptr& scan_ptr, const Eigen::Matrix4f& guess) = 0;
+};
+
+// pcl::NormalDistributionsTransform and pcl_omp::NormalDistributionsTransform share the same interface.
+template <typename NDT>
+class PclNdtBackend : public RegistrationBackend
+{
+public:
+  PclNdtBackend(const std::string& name, const benchmark_config& config) : name_(name)
+  {
+    ndt_.setResolution(config.resolution);
+    ndt_.setStepSize(config.step_size);
+    ndt_.setTransformationEpsilon(config.trans_eps);
+    ndt_.setMaximumIterations(config.max_iter);
+  }
+
+  std::string getName() const
+  {
+    return name_;
+  }
+
+  void setInputTarget(const pcl::PointCloud<pcl::PointXYZ>::Ptr& map_ptr)
+  {
+    ndt_.setInputTarget(map_ptr);
+  }
+
+  align_result align(const pcl::PointCloud<pcl::PointXYZ>::Ptr& scan_ptr, const Eigen::Matrix4f& guess)
+  {
+    pcl::PointCloud<pcl::PointXYZ> output_cloud;
+    ndt_.setInputSource(scan_ptr);
+    ndt_.align(output_cloud, guess);
+
+    align_result result;
+    result.transformation = ndt_.getFinalTransformation();
+    result.iteration = ndt_.getFinalNumIteration();
+    result.converged = ndt_.hasConverged();
+    return result;
+  }
+
+private:
+  std::string name_;
+  NDT ndt_;
+};
+
+class AnhNdtBackend : public RegistrationBackend
+{
+public:
+  explicit AnhNdtBackend(const benchmark_config& config)
+  {
+    ndt_.setResolution(config.resolution);
+    ndt_.setStepSize(config.step_size);
+    ndt_.setTransformationEpsilon(config.trans_eps);
+    ndt_.setMaximumIterations(config.max_iter);
+  }
+
+  std::string getName() const
+  {
+    return "pcl_anh";
+  }
+
+  void setInputTarget(const pcl::PointCloud<pcl::PointXYZ>::Ptr& map_ptr)
+  {
+    ndt_.setInputTarget(map_ptr);
+  }
+
+  align_result align(const pcl::PointCloud<pcl::PointXYZ>::Ptr& scan_ptr, const Eigen::Matrix4f& guess)
+  {
+    ndt_.setInputSource(scan_ptr);
+    ndt_.align(guess);
+
+    align_result result;
+    result.transformation = ndt_.getFinalTransformation();
+    result.iteration = ndt_.getFinalNumIteration();
+    result.converged = ndt_.hasConverged();
+    return result;
+  }
+
+private:
+  cpu::NormalDistributionsTransform<pcl::PointXYZ, pcl::PointXYZ> ndt_;
+};
+
+#ifdef CUDA_FOUND
+class AnhGpuNdtBackend : public RegistrationBackend
+{
+public:
+  explicit AnhGpuNdtBackend(const benchmark_config& config)
+  {
+    ndt_.setResolution(config.resolution);
+    ndt_.setStepSize(config.step_size);
+    ndt_.setTransformationEpsilon(config.trans_eps);
+    ndt_.setMaximumIterations(config.max_iter);
+  }
+
+  std::string getName() const
+  {
+    return "pcl_anh_gpu";
+  }
+
+  void setInputTarget(const pcl::PointCloud<pcl::PointXYZ>::Ptr& map_ptr)
+  {
+    ndt_.setInputTarget(map_ptr);
+  }
+
+  align_result align(const pcl::PointCloud<pcl::PointXYZ>::Ptr& scan_ptr, const Eigen::Matrix4f& guess)
+  {
+    ndt_.setInputSource(scan_ptr);
+    ndt_.align(guess);
+
+    align_result result;
+    result.transformation = ndt_.getFinalTransformation();
+    result.iteration = ndt_.getFinalNumIteration();
+    result.converged = ndt_.hasConverged();
+    return result;
+  }
+
+private:
+  gpu::GNormalDistributionsTransform ndt_;
+};
+#endif
+
+// pcl::IterativeClosestPoint does not expose the number of iterations it ran.
+class CountingICP : public pcl::IterativeClosestPoint<pcl::PointXYZ, pcl::PointXYZ>
+{
+public:
+  int getFinalNumIteration() const
+  {
+    return nr_iterations_;
+  }
+};
+
+class IcpBackend : public RegistrationBackend
+{
+public:
+  explicit IcpBackend(const benchmark_config& config)
+  {
+    icp_.setMaximumIterations(config.max_iter);
+    icp_.setTransformationEpsilon(config.trans_eps);
+    icp_.setMaxCorrespondenceDistance(config.icp_max_correspondence_distance);
+    icp_.setEuclideanFitnessEpsilon(config.icp_euclidean_fitness_epsilon);
+    icp_.setRANSACOutlierRejectionThreshold(config.icp_ransac_outlier_rejection_threshold);
+  }
+
+  std::string getName() const
+  {
+    return "icp";
+  }
+
+  void setInputTarget(const pcl::PointCloud<pcl::PointXYZ>::Ptr& map_ptr)
+  {
+    icp_.setInputTarget(map_ptr);
+  }
+
+  align_result align(const pcl::PointCloud<pcl::PointXYZ>::Ptr& scan_ptr, const Eigen::Matrix4f& guess)
+  {
+    pcl::PointCloud<pcl::PointXYZ> output_cloud;
+    icp_.setInputSource(scan_ptr);
+    icp_.align(output_cloud, guess);
+
+    align_result result;
+    result.transformation = icp_.getFinalTransformation();
+    result.iteration = icp_.getFinalNumIteration();
+    result.converged = icp_.hasConverged();
+    return result;
+  }
+
+private:
+  CountingICP icp_;
+};
+
+// ndt_tku keeps its map and scan buffers in globals, so only one instance may exist.
+class TkuBackend : public RegistrationBackend
+{
+public:
+  explicit TkuBackend(const pose& map_center) : map_center_(map_center)
+  {
+    g_map_x = G_MAP_X;
+    g_map_y = G_MAP_Y;
+    g_map_z = G_MAP_Z;
+    g_map_cellsize = G_MAP_CELLSIZE;
+    NDmap = initialize_NDmap();
+  }
+
+  std::string getName() const
+  {
+    return "ndt_tku";
+  }
+
+  void setInputTarget(const pcl::PointCloud<pcl::PointXYZ>::Ptr& map_ptr)
+  {
+    Point p;
+    for (pcl::PointCloud<pcl::PointXYZ>::const_iterator item = map_ptr->begin(); item != map_ptr->end(); item++)
+    {
+      p.x = item->x - map_center_.x;
+      p.y = item->y - map_center_.y;
+      p.z = item->z - map_center_.z;
+      add_point_map(NDmap, &p);
+    }
+  }
+
+  align_result align(const pcl::PointCloud<pcl::PointXYZ>::Ptr& scan_ptr, const Eigen::Matrix4f& guess)
+  {
+    // Same scan preparation as ndt_matching_tku, minus the random jitter so runs are repeatable.
+    int j = 0;
+    for (int i = 0; i < (int)scan_ptr->points.size() && j < TKU_MAX_SCAN_POINTS; i++)
+    {
+      scan_points[j].x = scan_ptr->points[i].x;
+      scan_points[j].y = scan_ptr->points[i].y;
+      scan_points[j].z = scan_ptr->points[i].z;
+      double dist =
+          scan_points[j].x * scan_points[j].x + scan_points[j].y * scan_points[j].y + scan_points[j].z * scan_points[j].z;
+      if (dist < 3 * 3)
+        continue;
+      j++;
+    }
+    scan_points_num = j;
+
+    pose g = matrixToPose(guess);
+    Posture posture, bposture;
+    posture.x = g.x - map_center_.x;
+    posture.y = g.y - map_center_.y;
+    posture.z = g.z - map_center_.z;
+    posture.theta = g.roll;
+    posture.theta2 = g.pitch;
+    posture.theta3 = g.yaw;
+
+    align_result result;
+    result.iteration = 0;
+    result.converged = false;
+    for (layer_select = 1; layer_select >= 1; layer_select -= 1)
+    {
+      for (j = 0; j < 100; j++)
+      {
+        bposture = posture;
+        adjust3d(scan_points, scan_points_num, &posture, layer_select);
+        posture.theta3 = wrapToPm(posture.theta3, M_PI);
+
+        if ((bposture.x - posture.x) * (bposture.x - posture.x) + (bposture.y - posture.y) * (bposture.y - posture.y) +
+                (bposture.z - posture.z) * (bposture.z - posture.z) +
+                3 * (bposture.theta - posture.theta) * (bposture.theta - posture.theta) +
+                3 * (bposture.theta2 - posture.theta2) * (bposture.theta2 - posture.theta2) +
+                3 * (bposture.theta3 - posture.theta3) * (bposture.theta3 - posture.theta3) <
+            0.00001)
+        {
+          result.converged = true;
+          break;
+        }
+      }
+      result.iteration += j;
+    }
+
+    pose estimate;
+    estimate.x = posture.x + map_center_.x;
+    estimate.y = posture.y + map_center_.y;
+    estimate.z = posture.z + map_center_.z;
+    estimate.roll = posture.theta;
+    estimate.pitch = posture.theta2;
+    estimate.yaw = posture.theta3;
+    result.transformation = poseToMatrix(estimate);
+    return result;
+  }
+
+private:
+  pose map_center_;
+};
+
+// Fitness score as defined by pcl::Registration::getFitnessScore(), computed against one shared kd-tree so that
+// every backend is scored the same way.
+static double computeFitnessScore(const pcl::KdTreeFLANN<pcl::PointXYZ>& map_tree,
+                                  const pcl::PointCloud<pcl::PointXYZ>::Ptr& scan_ptr, const Eigen::Matrix4f& t)
+{
+  pcl::PointCloud<pcl::PointXYZ> transformed_scan;
+  pcl::transformPointCloud(*scan_ptr, transformed_scan, t);
+
+  std::vector<int> nn_indices(1);
+  std::vector<float> nn_dists(1);
+  double fitness_score = 0.0;
+  int nr = 0;
+  for (size_t i = 0; i < transformed_scan.points.size(); i++)
+  {
+    if (map_tree.nearestKSearch(transformed_scan.points[i], 1, nn_indices, nn_dists) > 0)
+    {
+      fitness_score += nn_dists[0];
+      nr++;
+    }
+  }
+
+  return (nr > 0) ? fitness_score / nr : std::numeric_limits<double>::max();
+}
+
+static bool parsePose(const std::string& str, pose& p)
+{
+  std::vector<double> values;
+  std::stringstream ss(str);
+  std::string item;
+  while (std::getline(ss, item, ','))
+  {
+    values.push_back(atof(item.c_str()));
+  }
+
+  if (values.size() == 6)
+  {
+    p = { values[0], values[1], values[2], values[3], values[4], values[5] };
+    return true;
+  }
+  if (values.size() == 3)
+  {
+    p = { values[0], values[1], 0.0, 0.0, 0.0, values[2] };
+    return true;
+  }
+  return false;
+}
+
+static bool loadScanList(const std::string& filename, std::vector<scan_entry>& scans)
+{
+  std::ifstream ifs(filename.c_str());
+  if (!ifs)
+  {
+    std::cerr << "Could not open " << filename << std::endl;
+    return false;
+  }
+
+  std::string directory;
+  std::string::size_type slash = filename.find_last_of('/');
+  if (slash != std::string::npos)
+  {
+    directory = filename.substr(0, slash + 1);
+  }
+
+  std::string line;
+  while (std::getline(ifs, line))
+  {
+    if (line.empty() || line[0] == '#')
+    {
+      continue;
+    }
+
+    std::string::size_type comma = line.find(',');
+    scan_entry entry;
+    if (comma == std::string::npos || !parsePose(line.substr(comma + 1), entry.reference))
+    {
+      std::cerr << "Skipping malformed line: " << line << std::endl;
+      continue;
+    }
+    entry.path = line.substr(0, comma);
+    if (!entry.path.empty() && entry.path[0] != '/')
+    {
+      entry.path = directory + entry.path;
+    }
+    scans.push_back(entry);
+  }
+
+  return !scans.empty();
+}
+
+static void usage(const char* program)
+{
+  std::cerr << "Usage: " << program << " <map.pcd> <scans.csv> [options]" << std::endl
+            << "  --methods m1,m2,...      pcl_generic,pcl_anh,pcl_anh_gpu,pcl_openmp,ndt_tku,icp (default: all built)"
+            << std::endl
+            << "  --tf x,y,z,roll,pitch,yaw  base_link to localizer transform" << std::endl
+            << "  --resolution r           NDT resolution (default: 1.0)" << std::endl
+            << "  --step_size s            NDT step size (default: 0.1)" << std::endl
+            << "  --trans_eps e            transformation epsilon (default: 0.01)" << std::endl
+            << "  --max_iter n             maximum iterations (default: 30)" << std::endl
+            << "  --leaf_size l            voxel filter applied to scans, 0 to disable (default: 0)" << std::endl
+            << "  --guess tracking|reference  initial guess from the previous estimate or the reference pose"
+            << std::endl
+            << "  --offset x,y,yaw         offset added to reference guesses" << std::endl
+            << "  --output prefix          write per-scan results to <prefix>_<method>.csv" << std::endl;
+}
+
+static std::vector<std::string> availableMethods()
+{
+  std::vector<std::string> methods;
+  methods.push_back("pcl_generic");
+  methods.push_back("pcl_anh");
+#ifdef CUDA_FOUND
+  methods.push_back("pcl_anh_gpu");
+#endif
+#ifdef USE_PCL_OPENMP
+  methods.push_back("pcl_openmp");
+#endif
+  methods.push_back("ndt_tku");
+  methods.push_back("icp");
+  return methods;
+}
+
+static std::unique_ptr<RegistrationBackend> createBackend(const std::string& method, const benchmark_config& config,
+                                                          const pose& map_center)
+{
+  std::unique_ptr<RegistrationBackend> backend;
+  if (method == "pcl_generic")
+  {
+    backend.reset(new PclNdtBackend<pcl::NormalDistributionsTransform<pcl::PointXYZ, pcl::PointXYZ> >(method, config));
+  }
+  else if (method == "pcl_anh")
+  {
+    backend.reset(new AnhNdtBackend(config));
+  }
+#ifdef CUDA_FOUND
+  else if (method == "pcl_anh_gpu")
+  {
+    backend.reset(new AnhGpuNdtBackend(config));
+  }
+#endif
+#ifdef USE_PCL_OPENMP
+  else if (method == "pcl_openmp")
+  {
+    backend.reset(
+        new PclNdtBackend<pcl_omp::NormalDistributionsTransform<pcl::PointXYZ, pcl::PointXYZ> >(method, config));
+  }
+#endif
+  else if (method == "ndt_tku")
+  {
+    backend.reset(new TkuBackend(map_center));
+  }
+  else if (method == "icp")
+  {
+    backend.reset(new IcpBackend(config));
+  }
+  return backend;
+}
+
+static double percentile(std::vector<double> values, double ratio)
+{
+  if (values.empty())
+  {
+    return 0.0;
+  }
+  size_t n = std::min(values.size() - 1, static_cast<size_t>(ratio * values.size()));
+  std::nth_element(values.begin(), values.begin() + n, values.end());
+  return values[n];
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 3)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  std::string map_file = argv[1];
+  std::string scan_list_file = argv[2];
+  std::vector<std::string> methods = availableMethods();
+  benchmark_config config;
+
+  for (int i = 3; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if (i + 1 >= argc)
+    {
+      usage(argv[0]);
+      return 1;
+    }
+    std::string value = argv[++i];
+
+    if (arg == "--methods")
+    {
+      methods.clear();
+      std::stringstream ss(value);
+      std::string item;
+      while (std::getline(ss, item, ','))
+      {
+        methods.push_back(item);
+      }
+    }
+    else if (arg == "--tf")
+    {
+      if (!parsePose(value, config.tf_btol))
+      {
+        usage(argv[0]);
+        return 1;
+      }
+    }
+    else if (arg == "--resolution")
+      config.resolution = atof(value.c_str());
+    else if (arg == "--step_size")
+      config.step_size = atof(value.c_str());
+    else if (arg == "--trans_eps")
+      config.trans_eps = atof(value.c_str());
+    else if (arg == "--max_iter")
+      config.max_iter = atoi(value.c_str());
+    else if (arg == "--leaf_size")
+      config.leaf_size = atof(value.c_str());
+    else if (arg == "--guess")
+      config.tracking = (value != "reference");
+    else if (arg == "--offset")
+    {
+      if (!parsePose(value, config.guess_offset))
+      {
+        usage(argv[0]);
+        return 1;
+      }
+    }
+    else if (arg == "--output")
+      config.output_prefix = value;
+    else
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  std::vector<scan_entry> scans;
+  if (!loadScanList(scan_list_file, scans))
+  {
+    std::cerr << "No scans to replay." << std::endl;
+    return 1;
+  }
+
+  pcl::PointCloud<pcl::PointXYZ>::Ptr map_ptr(new pcl::PointCloud<pcl::PointXYZ>);
+  if (pcl::io::loadPCDFile<pcl::PointXYZ>(map_file, *map_ptr) == -1)
+  {
+    std::cerr << "Could not load " << map_file << std::endl;
+    return 1;
+  }
+
+  // Load every scan up front so that disk I/O does not end up in the timings.
+  std::vector<pcl::PointCloud<pcl::PointXYZ>::Ptr> scan_clouds;
+  for (size_t i = 0; i < scans.size(); i++)
+  {
+    pcl::PointCloud<pcl::PointXYZ>::Ptr scan_ptr(new pcl::PointCloud<pcl::PointXYZ>);
+    if (pcl::io::loadPCDFile<pcl::PointXYZ>(scans[i].path, *scan_ptr) == -1)
+    {
+      std::cerr << "Could not load " << scans[i].path << std::endl;
+      return 1;
+    }
+
+    if (config.leaf_size > 0.0)
+    {
+      pcl::PointCloud<pcl::PointXYZ>::Ptr filtered_scan_ptr(new pcl::PointCloud<pcl::PointXYZ>);
+      pcl::VoxelGrid<pcl::PointXYZ> voxel_grid_filter;
+      voxel_grid_filter.setLeafSize(config.leaf_size, config.leaf_size, config.leaf_size);
+      voxel_grid_filter.setInputCloud(scan_ptr);
+      voxel_grid_filter.filter(*filtered_scan_ptr);
+      scan_ptr = filtered_scan_ptr;
+    }
+    scan_clouds.push_back(scan_ptr);
+  }
+
+  pcl::KdTreeFLANN<pcl::PointXYZ> map_tree;
+  map_tree.setInputCloud(map_ptr);
+
+  Eigen::Matrix4f tf_btol = poseToMatrix(config.tf_btol);
+  Eigen::Matrix4f tf_ltob = tf_btol.inverse();
+
+  std::cout << "-----------------------------------------------------------------" << std::endl;
+  std::cout << "Map: " << map_file << " (" << map_ptr->size() << " points)" << std::endl;
+  std::cout << "Scans: " << scan_list_file << " (" << scans.size() << " scans)" << std::endl;
+  std::cout << "resolution: " << config.resolution << ", step_size: " << config.step_size
+            << ", trans_eps: " << config.trans_eps << ", max_iter: " << config.max_iter
+            << ", leaf_size: " << config.leaf_size << std::endl;
+  std::cout << "guess: " << (config.tracking ? "tracking" : "reference") << std::endl;
+  std::cout << "-----------------------------------------------------------------" << std::endl;
+
+  std::cout << std::left << std::setw(14) << "method" << std::right << std::setw(10) << "target[s]"
+            << std::setw(10) << "mean[ms]" << std::setw(10) << "p95[ms]" << std::setw(8) << "iter" << std::setw(10)
+            << "fitness" << std::setw(12) << "trans[m]" << std::setw(12) << "yaw[deg]" << std::setw(8) << "conv"
+            << std::endl;
+
+  for (size_t m = 0; m < methods.size(); m++)
+  {
+    std::unique_ptr<RegistrationBackend> backend = createBackend(methods[m], config, scans[0].reference);
+    if (!backend)
+    {
+      std::cerr << "Unknown or unavailable method: " << methods[m] << std::endl;
+      continue;
+    }
+
+    std::chrono::time_point<std::chrono::system_clock> target_start = std::chrono::system_clock::now();
+    backend->setInputTarget(map_ptr);
+    std::chrono::time_point<std::chrono::system_clock> target_end = std::chrono::system_clock::now();
+    double target_time = std::chrono::duration_cast<std::chrono::microseconds>(target_end - target_start).count() /
+                         1000000.0;
+
+    std::vector<scan_result> results;
+    pose previous_pose = scans[0].reference;
+    pose previous_previous_pose = scans[0].reference;
+    for (size_t i = 0; i < scans.size(); i++)
+    {
+      const pose& reference = scans[i].reference;
+
+      pose guess_pose;
+      if (config.tracking && i > 0)
+      {
+        // Linear prediction, as ndt_matching does with _offset == "linear"
+        guess_pose = previous_pose;
+        guess_pose.x += previous_pose.x - previous_previous_pose.x;
+        guess_pose.y += previous_pose.y - previous_previous_pose.y;
+        guess_pose.z += previous_pose.z - previous_previous_pose.z;
+        guess_pose.yaw += wrapToPm(previous_pose.yaw - previous_previous_pose.yaw, M_PI);
+      }
+      else
+      {
+        guess_pose = reference;
+        guess_pose.x += config.guess_offset.x;
+        guess_pose.y += config.guess_offset.y;
+        guess_pose.z += config.guess_offset.z;
+        guess_pose.yaw += config.guess_offset.yaw;
+      }
+
+      Eigen::Matrix4f init_guess = poseToMatrix(guess_pose) * tf_btol;
+
+      std::chrono::time_point<std::chrono::system_clock> align_start = std::chrono::system_clock::now();
+      align_result aligned = backend->align(scan_clouds[i], init_guess);
+      std::chrono::time_point<std::chrono::system_clock> align_end = std::chrono::system_clock::now();
+
+      scan_result result;
+      result.align_time =
+          std::chrono::duration_cast<std::chrono::microseconds>(align_end - align_start).count() / 1000.0;
+      result.iteration = aligned.iteration;
+      result.converged = aligned.converged;
+      result.fitness_score = computeFitnessScore(map_tree, scan_clouds[i], aligned.transformation);
+      result.estimate = matrixToPose(aligned.transformation * tf_ltob);
+      result.trans_error = sqrt(pow(result.estimate.x - reference.x, 2.0) + pow(result.estimate.y - reference.y, 2.0) +
+                                pow(result.estimate.z - reference.z, 2.0));
+      result.yaw_error = fabs(wrapToPm(result.estimate.yaw - reference.yaw, M_PI));
+      results.push_back(result);
+
+      previous_previous_pose = previous_pose;
+      previous_pose = result.estimate;
+    }
+
+    std::vector<double> align_times, trans_errors;
+    double sum_time = 0.0, sum_iteration = 0.0, sum_fitness = 0.0, sum_yaw_error = 0.0;
+    int converged_num = 0;
+    for (size_t i = 0; i < results.size(); i++)
+    {
+      align_times.push_back(results[i].align_time);
+      trans_errors.push_back(results[i].trans_error);
+      sum_time += results[i].align_time;
+      sum_iteration += results[i].iteration;
+      sum_fitness += results[i].fitness_score;
+      sum_yaw_error += results[i].yaw_error;
+      if (results[i].converged)
+        converged_num++;
+    }
+    double n = static_cast<double>(results.size());
+
+    std::cout << std::left << std::setw(14) << backend->getName() << std::right << std::fixed << std::setprecision(3)
+              << std::setw(10) << target_time << std::setw(10) << sum_time / n << std::setw(10)
+              << percentile(align_times, 0.95) << std::setw(8) << std::setprecision(1) << sum_iteration / n
+              << std::setw(10) << std::setprecision(4) << sum_fitness / n << std::setw(12)
+              << percentile(trans_errors, 0.5) << std::setw(12) << std::setprecision(3)
+              << sum_yaw_error / n * 180.0 / M_PI << std::setw(8) << converged_num << std::endl;
+
+    if (!config.output_prefix.empty())
+    {
+      std::string filename = config.output_prefix + "_" + backend->getName() + ".csv";
+      std::ofstream ofs(filename.c_str());
+      ofs << "scan,align_time[ms],iteration,converged,fitness_score,trans_error[m],yaw_error[rad],x,y,z,roll,pitch,yaw"
+          << std::endl;
+      ofs << std::setprecision(9);
+      for (size_t i = 0; i < results.size(); i++)
+      {
+        const scan_result& r = results[i];
+        ofs << scans[i].path << "," << r.align_time << "," << r.iteration << "," << r.converged << ","
+            << r.fitness_score << "," << r.trans_error << "," << r.yaw_error << "," << r.estimate.x << ","
+            << r.estimate.y << "," << r.estimate.z << "," << r.estimate.roll << "," << r.estimate.pitch << ","
+            << r.estimate.yaw << std::endl;
+      }
+    }
+  }
+
+  std::cout << "-----------------------------------------------------------------" << std::endl;
+  std::cout << "trans[m] is the median translation error, yaw[deg] the mean yaw error." << std::endl;
+
+  return 0;
+}
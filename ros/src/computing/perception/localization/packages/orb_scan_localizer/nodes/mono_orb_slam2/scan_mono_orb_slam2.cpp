@@ -26,6 +26,7 @@
 
 #include <ros/ros.h>
 #include <cv_bridge/cv_bridge.h>
+#include <latency_tracer/latency_tracer.h>
 
 #include <opencv2/core/core.hpp>
 
@@ -37,11 +38,12 @@ static int sum_frame = 1;
 class ImageGrabber
 {
 public:
-    ImageGrabber(ORB_SLAM2::System* pSLAM):mpSLAM(pSLAM){}
+    ImageGrabber(ORB_SLAM2::System* pSLAM, latency_tracer::LatencyTracer* pTracer):mpSLAM(pSLAM),mpTracer(pTracer){}
 
     void GrabImage(const sensor_msgs::ImageConstPtr& msg);
 
     ORB_SLAM2::System* mpSLAM;
+    latency_tracer::LatencyTracer* mpTracer;
 };
 
 int main(int argc, char **argv)
@@ -62,7 +64,10 @@ int main(int argc, char **argv)
                            nodeHandler, false, false, true, true,
                            argv[3], ORB_SLAM2::System::MAPPING);
 
-    ImageGrabber igb(&SLAM);
+    ros::NodeHandle privateHandler("~");
+    latency_tracer::LatencyTracer tracer(nodeHandler, privateHandler);
+
+    ImageGrabber igb(&SLAM, &tracer);
 
     ros::Subscriber sub = nodeHandler.subscribe("/image_raw", 100, &ImageGrabber::GrabImage, &igb);
 
@@ -81,6 +86,8 @@ int main(int argc, char **argv)
 
 void ImageGrabber::GrabImage(const sensor_msgs::ImageConstPtr& msg)
 {
+    mpTracer->receive(msg->header.stamp);
+
     // Copy the ros image message to cv::Mat.
     cv_bridge::CvImageConstPtr cv_ptr;
     try
@@ -100,6 +107,7 @@ void ImageGrabber::GrabImage(const sensor_msgs::ImageConstPtr& msg)
     std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
 
     mpSLAM->TrackMonocular(cv_ptr->image,cv_ptr->header.stamp.toSec(), true);
+    mpTracer->publish(msg->header.stamp);
 
     std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
     double ttrack= std::chrono::duration_cast<std::chrono::duration<double> >(t2 - t1).count();
@@ -36,6 +36,9 @@
 #include <stdio.h>
 #include <pcap.h>
 #include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <vector>
 
 #include <ros/ros.h>
 #include <velodyne_msgs/VelodynePacket.h>
@@ -81,10 +84,30 @@ namespace velodyne_driver
                           const double time_offset);
     void setDeviceIP( const std::string& ip );
   private:
+    int waitForInput();
+    int getBatchedPacket(velodyne_msgs::VelodynePacket *pkt,
+                         const double time_offset);
 
   private:
     int sockfd_;
     in_addr devip_;
+
+    /** Batched receive ring, used when recv_batch > 1.
+     *
+     *  recvmmsg() fills up to recv_batch packets per system call;
+     *  getPacket() then hands them out one at a time, stamped with
+     *  the kernel receive time (SO_TIMESTAMPNS).
+     */
+    int recv_batch_;
+    std::vector<uint8_t> ring_data_;
+    std::vector<mmsghdr> ring_msgs_;
+    std::vector<iovec> ring_iov_;
+    std::vector<sockaddr_in> ring_addr_;
+    std::vector<char> ring_control_;
+    size_t control_size_;
+    int ring_head_;                     ///< next packet to return
+    int ring_count_;                    ///< packets in the ring
+    uint32_t dropped_;                  ///< kernel drop count (SO_RXQ_OVFL)
   };
 
 
@@ -119,6 +142,11 @@ namespace velodyne_driver
     bool read_once_;
     bool read_fast_;
     double repeat_delay_;
+
+    /** optional UDP replay of every packet read, for feeding a live
+     *  InputSocket from a dump file */
+    int replay_fd_;
+    sockaddr_in replay_addr_;
   };
 
 } // velodyne_driver namespace
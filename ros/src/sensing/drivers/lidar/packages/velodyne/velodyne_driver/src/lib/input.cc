@@ -31,6 +31,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/file.h>
+#include <time.h>
 #include <velodyne_driver/input.h>
 
 namespace velodyne_driver
@@ -70,6 +71,13 @@ namespace velodyne_driver
     Input(private_nh, port)
   {
     sockfd_ = -1;
+    ring_head_ = 0;
+    ring_count_ = 0;
+    dropped_ = 0;
+
+    private_nh.param("recv_batch", recv_batch_, 1);
+    int rcvbuf_size;
+    private_nh.param("rcvbuf_size", rcvbuf_size, 0);
     
     if (!devip_str_.empty()) {
       inet_aton(devip_str_.c_str(),&devip_);
@@ -102,6 +110,49 @@ namespace velodyne_driver
         return;
       }
 
+    // a larger kernel buffer rides out scheduling hiccups with several
+    // lidars on one host instead of dropping packets
+    if (rcvbuf_size > 0
+        && setsockopt(sockfd_, SOL_SOCKET, SO_RCVBUF,
+                      &rcvbuf_size, sizeof(rcvbuf_size)) < 0)
+      perror("rcvbuf");
+
+    if (recv_batch_ > 1)
+      {
+        ROS_INFO_STREAM("Receiving up to " << recv_batch_
+                        << " packets per system call");
+
+        int on = 1;
+        if (setsockopt(sockfd_, SOL_SOCKET, SO_TIMESTAMPNS,
+                       &on, sizeof(on)) < 0)
+          perror("timestamp");
+#ifdef SO_RXQ_OVFL
+        if (setsockopt(sockfd_, SOL_SOCKET, SO_RXQ_OVFL,
+                       &on, sizeof(on)) < 0)
+          perror("rxq_ovfl");
+#endif
+
+        control_size_ = CMSG_SPACE(sizeof(timespec))
+                      + CMSG_SPACE(sizeof(uint32_t));
+        ring_data_.resize(recv_batch_ * packet_size);
+        ring_msgs_.resize(recv_batch_);
+        ring_iov_.resize(recv_batch_);
+        ring_addr_.resize(recv_batch_);
+        ring_control_.resize(recv_batch_ * control_size_);
+
+        memset(&ring_msgs_[0], 0, recv_batch_ * sizeof(mmsghdr));
+        for (int i = 0; i < recv_batch_; ++i)
+          {
+            ring_iov_[i].iov_base = &ring_data_[i * packet_size];
+            ring_iov_[i].iov_len = packet_size;
+            msghdr &hdr = ring_msgs_[i].msg_hdr;
+            hdr.msg_iov = &ring_iov_[i];
+            hdr.msg_iovlen = 1;
+            hdr.msg_name = &ring_addr_[i];
+            hdr.msg_control = &ring_control_[i * control_size_];
+          }
+      }
+
     ROS_DEBUG("Velodyne socket fd is %d\n", sockfd_);
   }
 
@@ -111,61 +162,76 @@ namespace velodyne_driver
     (void) close(sockfd_);
   }
 
-  /** @brief Get one velodyne packet. */
-  int InputSocket::getPacket(velodyne_msgs::VelodynePacket *pkt, const double time_offset)
+  /** @brief Wait until the socket is readable.
+   *
+   *  @returns 0 if input is available, 1 on timeout or error
+   */
+  int InputSocket::waitForInput()
   {
-    double time1 = ros::Time::now().toSec();
-
     struct pollfd fds[1];
     fds[0].fd = sockfd_;
     fds[0].events = POLLIN;
     static const int POLL_TIMEOUT = 1000; // one second (in msec)
 
+    // Unfortunately, the Linux kernel recvfrom() implementation
+    // uses a non-interruptible sleep() when waiting for data,
+    // which would cause this method to hang if the device is not
+    // providing data.  We poll() the device first to make sure
+    // the recvfrom() will not block.
+    //
+    // Note, however, that there is a known Linux kernel bug:
+    //
+    //   Under Linux, select() may report a socket file descriptor
+    //   as "ready for reading", while nevertheless a subsequent
+    //   read blocks.  This could for example happen when data has
+    //   arrived but upon examination has wrong checksum and is
+    //   discarded.  There may be other circumstances in which a
+    //   file descriptor is spuriously reported as ready.  Thus it
+    //   may be safer to use O_NONBLOCK on sockets that should not
+    //   block.
+
+    // poll() until input available
+    do
+      {
+        int retval = poll(fds, 1, POLL_TIMEOUT);
+        if (retval < 0)             // poll() error?
+          {
+            if (errno != EINTR)
+              ROS_ERROR("poll() error: %s", strerror(errno));
+            return 1;
+          }
+        if (retval == 0)            // poll() timeout?
+          {
+            ROS_WARN("Velodyne poll() timeout");
+            return 1;
+          }
+        if ((fds[0].revents & POLLERR)
+            || (fds[0].revents & POLLHUP)
+            || (fds[0].revents & POLLNVAL)) // device error?
+          {
+            ROS_ERROR("poll() reports Velodyne error");
+            return 1;
+          }
+      } while ((fds[0].revents & POLLIN) == 0);
+
+    return 0;
+  }
+
+  /** @brief Get one velodyne packet. */
+  int InputSocket::getPacket(velodyne_msgs::VelodynePacket *pkt, const double time_offset)
+  {
+    if (recv_batch_ > 1)
+      return getBatchedPacket(pkt, time_offset);
+
+    double time1 = ros::Time::now().toSec();
+
     sockaddr_in sender_address;
     socklen_t sender_address_len = sizeof(sender_address);
 
     while (true)
       {
-        // Unfortunately, the Linux kernel recvfrom() implementation
-        // uses a non-interruptible sleep() when waiting for data,
-        // which would cause this method to hang if the device is not
-        // providing data.  We poll() the device first to make sure
-        // the recvfrom() will not block.
-        //
-        // Note, however, that there is a known Linux kernel bug:
-        //
-        //   Under Linux, select() may report a socket file descriptor
-        //   as "ready for reading", while nevertheless a subsequent
-        //   read blocks.  This could for example happen when data has
-        //   arrived but upon examination has wrong checksum and is
-        //   discarded.  There may be other circumstances in which a
-        //   file descriptor is spuriously reported as ready.  Thus it
-        //   may be safer to use O_NONBLOCK on sockets that should not
-        //   block.
-
-        // poll() until input available
-        do
-          {
-            int retval = poll(fds, 1, POLL_TIMEOUT);
-            if (retval < 0)             // poll() error?
-              {
-                if (errno != EINTR)
-                  ROS_ERROR("poll() error: %s", strerror(errno));
-                return 1;
-              }
-            if (retval == 0)            // poll() timeout?
-              {
-                ROS_WARN("Velodyne poll() timeout");
-                return 1;
-              }
-            if ((fds[0].revents & POLLERR)
-                || (fds[0].revents & POLLHUP)
-                || (fds[0].revents & POLLNVAL)) // device error?
-              {
-                ROS_ERROR("poll() reports Velodyne error");
-                return 1;
-              }
-          } while ((fds[0].revents & POLLIN) == 0);
+        if (waitForInput() != 0)
+          return 1;
 
         // Receive packets that should now be available from the
         // socket using a blocking read.
@@ -207,6 +273,98 @@ namespace velodyne_driver
     return 0;
   }
 
+  /** @brief Get one velodyne packet from the batched receive ring.
+   *
+   *  Refills the ring with a single recvmmsg() call when it is empty.
+   *  Packets are stamped with the kernel receive time plus time_offset.
+   */
+  int InputSocket::getBatchedPacket(velodyne_msgs::VelodynePacket *pkt,
+                                    const double time_offset)
+  {
+    while (true)
+      {
+        if (ring_head_ == ring_count_)
+          {
+            if (waitForInput() != 0)
+              return 1;
+
+            for (int i = 0; i < recv_batch_; ++i)
+              {
+                ring_msgs_[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+                ring_msgs_[i].msg_hdr.msg_controllen = control_size_;
+                ring_msgs_[i].msg_len = 0;
+              }
+
+            int npackets = recvmmsg(sockfd_, &ring_msgs_[0], recv_batch_,
+                                    MSG_DONTWAIT, NULL);
+            if (npackets < 0)
+              {
+                if (errno != EWOULDBLOCK && errno != EINTR)
+                  {
+                    perror("recvfail");
+                    ROS_INFO("recvfail");
+                    return 1;
+                  }
+                continue;
+              }
+
+            ring_head_ = 0;
+            ring_count_ = npackets;
+            continue;
+          }
+
+        const int index = ring_head_++;
+        mmsghdr &msg = ring_msgs_[index];
+
+        if (msg.msg_len != packet_size)
+          {
+            ROS_DEBUG_STREAM("incomplete Velodyne packet read: "
+                             << msg.msg_len << " bytes");
+            continue;
+          }
+
+        // if packet is not from the lidar scanner we selected by IP,
+        // continue otherwise we are done
+        if (devip_str_ != ""
+            && ring_addr_[index].sin_addr.s_addr != devip_.s_addr)
+          continue;
+
+        memcpy(&pkt->data[0], &ring_data_[index * packet_size], packet_size);
+
+        ros::Time stamp;
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg.msg_hdr); cmsg != NULL;
+             cmsg = CMSG_NXTHDR(&msg.msg_hdr, cmsg))
+          {
+            if (cmsg->cmsg_level != SOL_SOCKET)
+              continue;
+            if (cmsg->cmsg_type == SCM_TIMESTAMPNS)
+              {
+                timespec ts;
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                stamp = ros::Time(ts.tv_sec, ts.tv_nsec);
+              }
+#ifdef SO_RXQ_OVFL
+            else if (cmsg->cmsg_type == SO_RXQ_OVFL)
+              {
+                uint32_t dropped;
+                memcpy(&dropped, CMSG_DATA(cmsg), sizeof(dropped));
+                if (dropped != dropped_)
+                  ROS_WARN_THROTTLE(1.0, "Velodyne socket dropped %u packets",
+                                    dropped - dropped_);
+                dropped_ = dropped;
+              }
+#endif
+          }
+
+        // no kernel stamp (e.g. option refused): fall back to now
+        if (stamp.isZero())
+          stamp = ros::Time::now();
+
+        pkt->stamp = ros::Time(stamp.toSec() + time_offset);
+        return 0;
+      }
+  }
+
   ////////////////////////////////////////////////////////////////////////
   // InputPCAP class implementation
   ////////////////////////////////////////////////////////////////////////
@@ -227,6 +385,7 @@ namespace velodyne_driver
   {
     pcap_ = NULL;  
     empty_ = true;
+    replay_fd_ = -1;
 
     // get parameters using private node handle
     private_nh.param("read_once", read_once_, false);
@@ -257,12 +416,41 @@ namespace velodyne_driver
     filter << "udp dst port " << port;
     pcap_compile(pcap_, &pcap_packet_filter_,
                  filter.str().c_str(), 1, PCAP_NETMASK_UNKNOWN);
+
+    // optionally re-send every packet read to a local UDP port, so a
+    // live InputSocket (e.g. in batched mode) can be tested from a dump
+    int replay_port;
+    std::string replay_address;
+    private_nh.param("replay_port", replay_port, 0);
+    private_nh.param("replay_address", replay_address,
+                     std::string("127.0.0.1"));
+    if (replay_port > 0)
+      {
+        memset(&replay_addr_, 0, sizeof(replay_addr_));
+        replay_addr_.sin_family = AF_INET;
+        replay_addr_.sin_port = htons(replay_port);
+        if (inet_aton(replay_address.c_str(), &replay_addr_.sin_addr) == 0)
+          {
+            ROS_ERROR_STREAM("Invalid replay address: " << replay_address);
+            return;
+          }
+        replay_fd_ = socket(PF_INET, SOCK_DGRAM, 0);
+        if (replay_fd_ == -1)
+          {
+            perror("socket");
+            return;
+          }
+        ROS_INFO_STREAM("Replaying packets to " << replay_address
+                        << ":" << replay_port);
+      }
   }
 
   /** destructor */
   InputPCAP::~InputPCAP(void)
   {
     pcap_close(pcap_);
+    if (replay_fd_ != -1)
+      (void) close(replay_fd_);
   }
 
   /** @brief Get one velodyne packet. */
@@ -288,6 +476,12 @@ namespace velodyne_driver
               packet_rate_.sleep();
             
             memcpy(&pkt->data[0], pkt_data+42, packet_size);
+            if (replay_fd_ != -1
+                && sendto(replay_fd_, &pkt->data[0], packet_size, 0,
+                          (sockaddr*) &replay_addr_,
+                          sizeof(replay_addr_)) < 0)
+              ROS_WARN_THROTTLE(1.0, "replay sendto() error: %s",
+                                strerror(errno));
             pkt->stamp = ros::Time::now(); // time_offset not considered here, as no synchronization required
             empty_ = false;
             return 0;                   // success
@@ -28,6 +28,7 @@
 
 #include <ros/ros.h>
 #include <pcl_ros/point_cloud.h>
+#include <sensor_msgs/PointCloud2.h>
 #include <velodyne_msgs/VelodyneScan.h>
 #include <velodyne_pointcloud/point_types.h>
 #include <velodyne_pointcloud/calibration.h>
@@ -93,6 +94,9 @@ namespace velodyne_rawdata
   static const int PACKET_STATUS_SIZE = 4;
   static const int SCANS_PER_PACKET = (SCANS_PER_BLOCK * BLOCKS_PER_PACKET);
 
+  /** maximum number of lasers described by a calibration file */
+  static const int MAX_LASERS = 64;
+
   /** \brief Raw Velodyne packet.
    *
    *  revolution is described in the device manual as incrementing
@@ -147,6 +151,21 @@ namespace velodyne_rawdata
     int setupOffline(std::string calibration_file, double max_range_, double min_range_);
 
     void unpack(const velodyne_msgs::VelodynePacket &pkt, VPointCloud &pc, int packets_num);
+
+    /** \brief Convert a whole scan into a PointCloud2 message.
+     *
+     *  The output buffer is sized once for every return in the scan
+     *  and points are written into it directly, using the same
+     *  memory layout as VPointCloud (x, y, z, intensity, ring).
+     *
+     *  @param scan raw packets of one revolution
+     *  @param cloud output message (fields and data are replaced,
+     *               header is left to the caller)
+     *  @param organized if true, lay out the cloud as rings x firings
+     *                   and fill filtered returns with NaN
+     */
+    void unpack(const velodyne_msgs::VelodyneScan &scan,
+                sensor_msgs::PointCloud2 &cloud, bool organized = false);
     
     void setParameters(double min_range, double max_range, double view_direction,
                        double view_width);
@@ -172,9 +191,66 @@ namespace velodyne_rawdata
     velodyne_pointcloud::Calibration calibration_;
     float sin_rot_table_[ROTATION_MAX_UNITS];
     float cos_rot_table_[ROTATION_MAX_UNITS];
-    
-    /** add private function to handle the VLP16 **/ 
-    void unpack_vlp16(const velodyne_msgs::VelodynePacket &pkt, VPointCloud &pc);
+
+    /** Per-laser corrections laid out structure-of-arrays, indexed by
+     *  laser number, so one block of returns is corrected in a single
+     *  vectorizable pass.  Two-point corrections are folded into a
+     *  slope and intercept which are zero for lasers without them.
+     */
+    typedef struct {
+      float dist_correction[MAX_LASERS];
+      float cos_vert[MAX_LASERS];
+      float sin_vert[MAX_LASERS];
+      float cos_rot[MAX_LASERS];
+      float sin_rot[MAX_LASERS];
+      float horiz_offset[MAX_LASERS];
+      float vert_offset[MAX_LASERS];
+      float corr_x_slope[MAX_LASERS];
+      float corr_x_offset[MAX_LASERS];
+      float corr_y_slope[MAX_LASERS];
+      float corr_y_offset[MAX_LASERS];
+      float focal_offset[MAX_LASERS];
+      float focal_slope[MAX_LASERS];
+      float min_intensity[MAX_LASERS];
+      float max_intensity[MAX_LASERS];
+      uint16_t ring[MAX_LASERS];
+    } LaserTable;
+    LaserTable lasers_;
+
+    /** Raw returns of one block, gathered for the correction kernel. */
+    typedef struct {
+      float distance[SCANS_PER_BLOCK];     ///< raw distance [m]
+      float intensity[SCANS_PER_BLOCK];    ///< raw intensity
+      float focal_scale[SCANS_PER_BLOCK];  ///< 1 - distance/max distance
+      float cos_azimuth[SCANS_PER_BLOCK];
+      float sin_azimuth[SCANS_PER_BLOCK];
+      uint32_t in_view;                    ///< bit per return inside the view
+    } BlockInput;
+
+    /** Corrected returns of one block, in the ROS coordinate system. */
+    typedef struct {
+      float x[SCANS_PER_BLOCK];
+      float y[SCANS_PER_BLOCK];
+      float z[SCANS_PER_BLOCK];
+      float intensity[SCANS_PER_BLOCK];
+      uint32_t valid;                      ///< bit per return to publish
+    } BlockOutput;
+
+    void setupLaserTable();
+    void correctBlock(const BlockInput &in, int laser_origin, BlockOutput &out);
+    size_t unpackPacket(const velodyne_msgs::VelodynePacket &pkt, int packets_num,
+                        VPoint *points, int grid_width, int grid_column);
+
+    /** in-line test whether a rotation is inside the configured view */
+    bool angleInView(int rotation)
+    {
+      return ((rotation >= config_.min_angle
+               && rotation <= config_.max_angle
+               && config_.min_angle < config_.max_angle)
+              || (config_.min_angle > config_.max_angle
+                  && (rotation <= config_.max_angle
+                      || rotation >= config_.min_angle)));
+    }
 
     /** in-line test whether a point is in range */
     bool pointInRange(float range)
@@ -51,6 +51,7 @@ namespace velodyne_pointcloud
     /// configuration parameters
     typedef struct {
       int npackets;                    ///< number of packets to combine
+      bool organize_cloud;             ///< publish rings x firings layout
     } Config;
     Config config_;
   };
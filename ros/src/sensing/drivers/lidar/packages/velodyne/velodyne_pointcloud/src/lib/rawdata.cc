@@ -25,8 +25,15 @@
  *  HDL-64E S2 calibration support provided by Nick Hillier
  */
 
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
 #include <fstream>
+#include <limits>
 #include <math.h>
+#ifdef __SSE2__
+#include <xmmintrin.h>
+#endif
 
 #include <ros/ros.h>
 #include <ros/package.h>
@@ -103,6 +110,7 @@ namespace velodyne_rawdata
       cos_rot_table_[rot_index] = cosf(rotation);
       sin_rot_table_[rot_index] = sinf(rotation);
     }
+    setupLaserTable();
    return 0;
   }
 
@@ -134,10 +142,64 @@ namespace velodyne_rawdata
 	  cos_rot_table_[rot_index] = cosf(rotation);
 	  sin_rot_table_[rot_index] = sinf(rotation);
       }
+      setupLaserTable();
       return 0;
   }
 
 
+  /** Build the structure-of-arrays laser table used by correctBlock() */
+  void RawData::setupLaserTable()
+  {
+    memset(&lasers_, 0, sizeof(lasers_));
+
+    for (int laser = 0; laser < MAX_LASERS; ++laser) {
+      // the VLP16 fires its 16 lasers twice in each block
+      int laser_id = laser;
+      if (calibration_.num_lasers == 16)
+        laser_id = laser % VLP16_SCANS_PER_FIRING;
+
+      std::map<int, velodyne_pointcloud::LaserCorrection>::const_iterator it =
+        calibration_.laser_corrections.find(laser_id);
+      if (it == calibration_.laser_corrections.end())
+        continue;
+      const velodyne_pointcloud::LaserCorrection &corrections = it->second;
+
+      lasers_.dist_correction[laser] = corrections.dist_correction;
+      lasers_.cos_vert[laser] = corrections.cos_vert_correction;
+      lasers_.sin_vert[laser] = corrections.sin_vert_correction;
+      lasers_.cos_rot[laser] = corrections.cos_rot_correction;
+      lasers_.sin_rot[laser] = corrections.sin_rot_correction;
+      lasers_.horiz_offset[laser] = corrections.horiz_offset_correction;
+      lasers_.vert_offset[laser] = corrections.vert_offset_correction;
+
+      // Get 2points calibration values,Linear interpolation to get distance
+      // correction for X and Y, that means distance correction use
+      // different value at different distance
+      if (corrections.two_pt_correction_available) {
+        lasers_.corr_x_slope[laser] =
+          (corrections.dist_correction - corrections.dist_correction_x)
+            / (25.04 - 2.4);
+        lasers_.corr_x_offset[laser] =
+          corrections.dist_correction_x - corrections.dist_correction
+            - 2.4 * lasers_.corr_x_slope[laser];
+        lasers_.corr_y_slope[laser] =
+          (corrections.dist_correction - corrections.dist_correction_y)
+            / (25.04 - 1.93);
+        lasers_.corr_y_offset[laser] =
+          corrections.dist_correction_y - corrections.dist_correction
+            - 1.93 * lasers_.corr_y_slope[laser];
+      }
+
+      lasers_.focal_offset[laser] = 256
+                                  * (1 - corrections.focal_distance / 13100)
+                                  * (1 - corrections.focal_distance / 13100);
+      lasers_.focal_slope[laser] = corrections.focal_slope;
+      lasers_.min_intensity[laser] = corrections.min_intensity;
+      lasers_.max_intensity[laser] = corrections.max_intensity;
+      lasers_.ring[laser] = corrections.laser_ring;
+    }
+  }
+
   /** @brief convert raw packet to point cloud
    *
    *  @param pkt raw packet to unpack
@@ -147,349 +209,349 @@ namespace velodyne_rawdata
                        VPointCloud &pc, int packets_num)
   {
     ROS_DEBUG_STREAM("Received packet, time: " << pkt.stamp);
-    
-    /** special parsing for the VLP16 **/
-    if (calibration_.num_lasers == 16)
-    {
-      unpack_vlp16(pkt, pc);
-      return;
-    }
-    
-    const raw_packet_t *raw = (const raw_packet_t *) &pkt.data[0];
 
-    for (int i = 0; i < BLOCKS_PER_PACKET; i++) {
+    size_t first = pc.points.size();
+    pc.points.resize(first + SCANS_PER_PACKET);
+    size_t count = unpackPacket(pkt, packets_num, &pc.points[first], 0, 0);
+    pc.points.resize(first + count);
+    pc.width += count;
+  }
 
-      // upper bank lasers are numbered [0..31]
-      // NOTE: this is a change from the old velodyne_common implementation
-      int bank_origin = 0;
-      if (raw->blocks[i].header == LOWER_BANK) {
-        // lower bank lasers are [32..63]
-        bank_origin = 32;
+  /** @brief convert a raw scan to a PointCloud2 message
+   *
+   *  @param scan raw packets of one revolution
+   *  @param cloud output message, its header is not modified
+   *  @param organized lay out the cloud as rings x firings
+   */
+  void RawData::unpack(const velodyne_msgs::VelodyneScan &scan,
+                       sensor_msgs::PointCloud2 &cloud, bool organized)
+  {
+    const int packets_num = scan.packets.size();
+    const size_t max_points = (size_t) packets_num * SCANS_PER_PACKET;
+
+    // same field layout as VPointCloud, so subscribers converting back
+    // to PCL get a plain memory copy
+    static const char *names[] = {"x", "y", "z", "intensity", "ring"};
+    static const uint32_t offsets[] = {offsetof(VPoint, x), offsetof(VPoint, y),
+                                       offsetof(VPoint, z),
+                                       offsetof(VPoint, intensity),
+                                       offsetof(VPoint, ring)};
+    cloud.fields.resize(5);
+    for (size_t i = 0; i < cloud.fields.size(); ++i) {
+      cloud.fields[i].name = names[i];
+      cloud.fields[i].offset = offsets[i];
+      cloud.fields[i].datatype = sensor_msgs::PointField::FLOAT32;
+      cloud.fields[i].count = 1;
+    }
+    cloud.fields[4].datatype = sensor_msgs::PointField::UINT16;
+    cloud.is_bigendian = false;
+    cloud.point_step = sizeof(VPoint);
+
+    // one allocation for the whole revolution
+    cloud.data.resize(max_points * sizeof(VPoint));
+    VPoint *points = max_points ? reinterpret_cast<VPoint *>(&cloud.data[0]) : NULL;
+
+    if (organized) {
+      const int rows = calibration_.num_lasers;
+      const int columns_per_packet = SCANS_PER_PACKET / rows;
+      const int width = packets_num * columns_per_packet;
+
+      VPoint nan_point;
+      nan_point.x = nan_point.y = nan_point.z =
+        std::numeric_limits<float>::quiet_NaN();
+      nan_point.data[3] = 1.0f;
+      nan_point.intensity = 0.0f;
+      for (int row = 0; row < rows; ++row) {
+        nan_point.ring = row;
+        std::fill(points + row * width, points + (row + 1) * width, nan_point);
       }
 
-      for (int j = 0, k = 0; j < SCANS_PER_BLOCK; j++, k += RAW_SCAN_SIZE) {
-        
-        float x, y, z;
-        float intensity;
-        uint8_t laser_number;       ///< hardware laser number
-
-        laser_number = j + bank_origin;
-        velodyne_pointcloud::LaserCorrection &corrections = 
-          calibration_.laser_corrections[laser_number];
-
-        /** Position Calculation */
-
-        union two_bytes tmp;
-        tmp.bytes[0] = raw->blocks[i].data[k];
-        tmp.bytes[1] = raw->blocks[i].data[k+1];
-        /*condition added to avoid calculating points which are not
-          in the interesting defined area (min_angle < area < max_angle)*/
-        if ((raw->blocks[i].rotation >= config_.min_angle 
-             && raw->blocks[i].rotation <= config_.max_angle 
-             && config_.min_angle < config_.max_angle)
-             ||(config_.min_angle > config_.max_angle 
-             && (raw->blocks[i].rotation <= config_.max_angle 
-             || raw->blocks[i].rotation >= config_.min_angle))){
-
-          float distance;
-          if (packets_num==(int) ceil(1507.0 / 10))
-            distance = tmp.uint * DISTANCE_RESOLUTION * 2;
-          else
-            distance = tmp.uint * DISTANCE_RESOLUTION;
-
-          distance += corrections.dist_correction;
-  
-          float cos_vert_angle = corrections.cos_vert_correction;
-          float sin_vert_angle = corrections.sin_vert_correction;
-          float cos_rot_correction = corrections.cos_rot_correction;
-          float sin_rot_correction = corrections.sin_rot_correction;
-  
-          // cos(a-b) = cos(a)*cos(b) + sin(a)*sin(b)
-          // sin(a-b) = sin(a)*cos(b) - cos(a)*sin(b)
-          float cos_rot_angle = 
-            cos_rot_table_[raw->blocks[i].rotation] * cos_rot_correction + 
-            sin_rot_table_[raw->blocks[i].rotation] * sin_rot_correction;
-          float sin_rot_angle = 
-            sin_rot_table_[raw->blocks[i].rotation] * cos_rot_correction - 
-            cos_rot_table_[raw->blocks[i].rotation] * sin_rot_correction;
-  
-          float horiz_offset = corrections.horiz_offset_correction;
-          float vert_offset = corrections.vert_offset_correction;
-  
-          // Compute the distance in the xy plane (w/o accounting for rotation)
-          /**the new term of 'vert_offset * sin_vert_angle'
-           * was added to the expression due to the mathemathical
-           * model we used.
-           */
-          float xy_distance = distance * cos_vert_angle - vert_offset * sin_vert_angle;
-  
-          // Calculate temporal X, use absolute value.
-          float xx = xy_distance * sin_rot_angle - horiz_offset * cos_rot_angle;
-          // Calculate temporal Y, use absolute value
-          float yy = xy_distance * cos_rot_angle + horiz_offset * sin_rot_angle;
-          if (xx < 0) xx=-xx;
-          if (yy < 0) yy=-yy;
-    
-          // Get 2points calibration values,Linear interpolation to get distance
-          // correction for X and Y, that means distance correction use
-          // different value at different distance
-          float distance_corr_x = 0;
-          float distance_corr_y = 0;
-          if (corrections.two_pt_correction_available) {
-            distance_corr_x = 
-              (corrections.dist_correction - corrections.dist_correction_x)
-                * (xx - 2.4) / (25.04 - 2.4) 
-              + corrections.dist_correction_x;
-            distance_corr_x -= corrections.dist_correction;
-            distance_corr_y = 
-              (corrections.dist_correction - corrections.dist_correction_y)
-                * (yy - 1.93) / (25.04 - 1.93)
-              + corrections.dist_correction_y;
-            distance_corr_y -= corrections.dist_correction;
-          }
-  
-          float distance_x = distance + distance_corr_x;
-          /**the new term of 'vert_offset * sin_vert_angle'
-           * was added to the expression due to the mathemathical
-           * model we used.
-           */
-          xy_distance = distance_x * cos_vert_angle - vert_offset * sin_vert_angle ;
-          ///the expression wiht '-' is proved to be better than the one with '+'
-          x = xy_distance * sin_rot_angle - horiz_offset * cos_rot_angle;
-  
-          float distance_y = distance + distance_corr_y;
-          xy_distance = distance_y * cos_vert_angle - vert_offset * sin_vert_angle ;
-          /**the new term of 'vert_offset * sin_vert_angle'
-           * was added to the expression due to the mathemathical
-           * model we used.
-           */
-          y = xy_distance * cos_rot_angle + horiz_offset * sin_rot_angle;
-  
-          // Using distance_y is not symmetric, but the velodyne manual
-          // does this.
-          /**the new term of 'vert_offset * cos_vert_angle'
-           * was added to the expression due to the mathemathical
-           * model we used.
-           */
-          z = distance_y * sin_vert_angle + vert_offset*cos_vert_angle;
-  
-          /** Use standard ROS coordinate system (right-hand rule) */
-          float x_coord = y;
-          float y_coord = -x;
-          float z_coord = z;
-  
-          /** Intensity Calculation */
-  
-          float min_intensity = corrections.min_intensity;
-          float max_intensity = corrections.max_intensity;
-  
-          intensity = raw->blocks[i].data[k+2];
-  
-          float focal_offset = 256 
-                             * (1 - corrections.focal_distance / 13100) 
-                             * (1 - corrections.focal_distance / 13100);
-          float focal_slope = corrections.focal_slope;
-          intensity += focal_slope * (std::abs(focal_offset - 256 * 
-            (1 - static_cast<float>(tmp.uint)/65535)*(1 - static_cast<float>(tmp.uint)/65535)));
-          intensity = (intensity < min_intensity) ? min_intensity : intensity;
-          intensity = (intensity > max_intensity) ? max_intensity : intensity;
-  
-          if (pointInRange(distance)) {
-  
-            // convert polar coordinates to Euclidean XYZ
-            VPoint point;
-            point.ring = corrections.laser_ring;
-            point.x = x_coord;
-            point.y = y_coord;
-            point.z = z_coord;
-            point.intensity = intensity;
-  
-            // append this point to the cloud
-            pc.points.push_back(point);
-            ++pc.width;
-          }
-        }
-      }
+      for (int i = 0; i < packets_num; ++i)
+        unpackPacket(scan.packets[i], packets_num, points, width,
+                     i * columns_per_packet);
+
+      cloud.height = rows;
+      cloud.width = width;
+      cloud.is_dense = false;
+    } else {
+      size_t count = 0;
+      for (int i = 0; i < packets_num; ++i)
+        count += unpackPacket(scan.packets[i], packets_num, points + count, 0, 0);
+
+      cloud.data.resize(count * sizeof(VPoint));
+      cloud.height = 1;
+      cloud.width = count;
+      cloud.is_dense = true;
     }
+    cloud.row_step = cloud.point_step * cloud.width;
   }
-  
-  /** @brief convert raw VLP16 packet to point cloud
+
+  /** @brief convert one raw packet into preallocated points
    *
    *  @param pkt raw packet to unpack
-   *  @param pc shared pointer to point cloud (points are appended)
+   *  @param packets_num number of packets in the scan
+   *  @param points output buffer, room for SCANS_PER_PACKET points
+   *         when appending, or the whole grid when organized
+   *  @param grid_width organized cloud width, 0 to append points
+   *  @param grid_column organized column of the packet's first firing
+   *  @returns number of points written
    */
-  void RawData::unpack_vlp16(const velodyne_msgs::VelodynePacket &pkt,
-                             VPointCloud &pc)
+  size_t RawData::unpackPacket(const velodyne_msgs::VelodynePacket &pkt,
+                               int packets_num, VPoint *points,
+                               int grid_width, int grid_column)
   {
-    float azimuth;
-    float azimuth_diff;
-    float last_azimuth_diff=0;
-    float azimuth_corrected_f;
-    int azimuth_corrected;
-    float x, y, z;
-    float intensity;
-
     const raw_packet_t *raw = (const raw_packet_t *) &pkt.data[0];
+    const bool vlp16 = (calibration_.num_lasers == 16);
+
+    float distance_resolution = DISTANCE_RESOLUTION;
+    if (!vlp16 && packets_num == (int) ceil(1507.0 / 10))
+      distance_resolution *= 2;
+
+    float last_azimuth_diff = 0;
+    size_t count = 0;
+    BlockInput in;
+    BlockOutput out;
 
     for (int block = 0; block < BLOCKS_PER_PACKET; block++) {
+      const raw_block_t &raw_block = raw->blocks[block];
+
+      // upper bank lasers are numbered [0..31]
+      // NOTE: this is a change from the old velodyne_common implementation
+      int laser_origin = 0;
+
+      if (vlp16) {
+        // ignore packets with mangled or otherwise different contents
+        if (UPPER_BANK != raw_block.header) {
+          // Do not flood the log with messages, only issue at most one
+          // of these warnings per minute.
+          ROS_WARN_STREAM_THROTTLE(60, "skipping invalid VLP-16 packet: block "
+                                   << block << " header value is "
+                                   << raw_block.header);
+          return count;                 // bad packet: skip the rest
+        }
+
+        // Calculate difference between current and next block's azimuth angle.
+        float azimuth = (float)(raw_block.rotation);
+        float azimuth_diff;
+        if (block < (BLOCKS_PER_PACKET-1)){
+          azimuth_diff = (float)((36000 + raw->blocks[block+1].rotation - raw_block.rotation)%36000);
+          last_azimuth_diff = azimuth_diff;
+        }else{
+          azimuth_diff = last_azimuth_diff;
+        }
+
+        in.in_view = 0;
+        for (int firing=0, j=0; firing < VLP16_FIRINGS_PER_BLOCK; firing++){
+          for (int dsr=0; dsr < VLP16_SCANS_PER_FIRING; dsr++, j++){
+            /** correct for the laser rotation as a function of timing during the firings **/
+            float azimuth_corrected_f = azimuth + (azimuth_diff * ((dsr*VLP16_DSR_TOFFSET) + (firing*VLP16_FIRING_TOFFSET)) / VLP16_BLOCK_TDURATION);
+            int azimuth_corrected = ((int)round(azimuth_corrected_f)) % 36000;
+
+            in.cos_azimuth[j] = cos_rot_table_[azimuth_corrected];
+            in.sin_azimuth[j] = sin_rot_table_[azimuth_corrected];
+            if (angleInView(azimuth_corrected))
+              in.in_view |= 1u << j;
+          }
+        }
+      } else {
+        if (raw_block.header == LOWER_BANK) {
+          // lower bank lasers are [32..63]
+          laser_origin = 32;
+        }
 
-      // ignore packets with mangled or otherwise different contents
-      if (UPPER_BANK != raw->blocks[block].header) {
-        // Do not flood the log with messages, only issue at most one
-        // of these warnings per minute.
-        ROS_WARN_STREAM_THROTTLE(60, "skipping invalid VLP-16 packet: block "
-                                 << block << " header value is "
-                                 << raw->blocks[block].header);
-        return;                         // bad packet: skip the rest
+        /*condition added to avoid calculating points which are not
+          in the interesting defined area (min_angle < area < max_angle)*/
+        if (!angleInView(raw_block.rotation))
+          continue;
+
+        std::fill(in.cos_azimuth, in.cos_azimuth + SCANS_PER_BLOCK,
+                  cos_rot_table_[raw_block.rotation]);
+        std::fill(in.sin_azimuth, in.sin_azimuth + SCANS_PER_BLOCK,
+                  sin_rot_table_[raw_block.rotation]);
+        in.in_view = ~0u;
       }
 
-      // Calculate difference between current and next block's azimuth angle.
-      azimuth = (float)(raw->blocks[block].rotation);
-      if (block < (BLOCKS_PER_PACKET-1)){
-        azimuth_diff = (float)((36000 + raw->blocks[block+1].rotation - raw->blocks[block].rotation)%36000);
-        last_azimuth_diff = azimuth_diff;
-      }else{
-        azimuth_diff = last_azimuth_diff;
+      if (in.in_view == 0)
+        continue;
+
+      for (int j = 0, k = 0; j < SCANS_PER_BLOCK; j++, k += RAW_SCAN_SIZE) {
+        union two_bytes tmp;
+        tmp.bytes[0] = raw_block.data[k];
+        tmp.bytes[1] = raw_block.data[k+1];
+
+        in.distance[j] = tmp.uint * distance_resolution;
+        in.intensity[j] = raw_block.data[k+2];
+        // the VLP16 conversion has always used integer division here
+        if (vlp16)
+          in.focal_scale[j] = 1 - tmp.uint/65535;
+        else
+          in.focal_scale[j] = 1 - static_cast<float>(tmp.uint)/65535;
       }
 
-      for (int firing=0, k=0; firing < VLP16_FIRINGS_PER_BLOCK; firing++){
-        for (int dsr=0; dsr < VLP16_SCANS_PER_FIRING; dsr++, k+=RAW_SCAN_SIZE){
-          velodyne_pointcloud::LaserCorrection &corrections = 
-            calibration_.laser_corrections[dsr];
-
-          /** Position Calculation */
-          union two_bytes tmp;
-          tmp.bytes[0] = raw->blocks[block].data[k];
-          tmp.bytes[1] = raw->blocks[block].data[k+1];
-          
-          /** correct for the laser rotation as a function of timing during the firings **/
-          azimuth_corrected_f = azimuth + (azimuth_diff * ((dsr*VLP16_DSR_TOFFSET) + (firing*VLP16_FIRING_TOFFSET)) / VLP16_BLOCK_TDURATION);
-          azimuth_corrected = ((int)round(azimuth_corrected_f)) % 36000;
-          
-          /*condition added to avoid calculating points which are not
-            in the interesting defined area (min_angle < area < max_angle)*/
-          if ((azimuth_corrected >= config_.min_angle 
-               && azimuth_corrected <= config_.max_angle 
-               && config_.min_angle < config_.max_angle)
-               ||(config_.min_angle > config_.max_angle 
-               && (azimuth_corrected <= config_.max_angle 
-               || azimuth_corrected >= config_.min_angle))){
-
-            // convert polar coordinates to Euclidean XYZ
-            float distance = tmp.uint * DISTANCE_RESOLUTION;
-            distance += corrections.dist_correction;
-            
-            float cos_vert_angle = corrections.cos_vert_correction;
-            float sin_vert_angle = corrections.sin_vert_correction;
-            float cos_rot_correction = corrections.cos_rot_correction;
-            float sin_rot_correction = corrections.sin_rot_correction;
-    
-            // cos(a-b) = cos(a)*cos(b) + sin(a)*sin(b)
-            // sin(a-b) = sin(a)*cos(b) - cos(a)*sin(b)
-            float cos_rot_angle = 
-              cos_rot_table_[azimuth_corrected] * cos_rot_correction + 
-              sin_rot_table_[azimuth_corrected] * sin_rot_correction;
-            float sin_rot_angle = 
-              sin_rot_table_[azimuth_corrected] * cos_rot_correction - 
-              cos_rot_table_[azimuth_corrected] * sin_rot_correction;
-    
-            float horiz_offset = corrections.horiz_offset_correction;
-            float vert_offset = corrections.vert_offset_correction;
-    
-            // Compute the distance in the xy plane (w/o accounting for rotation)
-            /**the new term of 'vert_offset * sin_vert_angle'
-             * was added to the expression due to the mathemathical
-             * model we used.
-             */
-            float xy_distance = distance * cos_vert_angle - vert_offset * sin_vert_angle;
-    
-            // Calculate temporal X, use absolute value.
-            float xx = xy_distance * sin_rot_angle - horiz_offset * cos_rot_angle;
-            // Calculate temporal Y, use absolute value
-            float yy = xy_distance * cos_rot_angle + horiz_offset * sin_rot_angle;
-            if (xx < 0) xx=-xx;
-            if (yy < 0) yy=-yy;
-      
-            // Get 2points calibration values,Linear interpolation to get distance
-            // correction for X and Y, that means distance correction use
-            // different value at different distance
-            float distance_corr_x = 0;
-            float distance_corr_y = 0;
-            if (corrections.two_pt_correction_available) {
-              distance_corr_x = 
-                (corrections.dist_correction - corrections.dist_correction_x)
-                  * (xx - 2.4) / (25.04 - 2.4) 
-                + corrections.dist_correction_x;
-              distance_corr_x -= corrections.dist_correction;
-              distance_corr_y = 
-                (corrections.dist_correction - corrections.dist_correction_y)
-                  * (yy - 1.93) / (25.04 - 1.93)
-                + corrections.dist_correction_y;
-              distance_corr_y -= corrections.dist_correction;
-            }
-    
-            float distance_x = distance + distance_corr_x;
-            /**the new term of 'vert_offset * sin_vert_angle'
-             * was added to the expression due to the mathemathical
-             * model we used.
-             */
-            xy_distance = distance_x * cos_vert_angle - vert_offset * sin_vert_angle ;
-            x = xy_distance * sin_rot_angle - horiz_offset * cos_rot_angle;
-    
-            float distance_y = distance + distance_corr_y;
-            /**the new term of 'vert_offset * sin_vert_angle'
-             * was added to the expression due to the mathemathical
-             * model we used.
-             */
-            xy_distance = distance_y * cos_vert_angle - vert_offset * sin_vert_angle ;
-            y = xy_distance * cos_rot_angle + horiz_offset * sin_rot_angle;
-    
-            // Using distance_y is not symmetric, but the velodyne manual
-            // does this.
-            /**the new term of 'vert_offset * cos_vert_angle'
-             * was added to the expression due to the mathemathical
-             * model we used.
-             */
-            z = distance_y * sin_vert_angle + vert_offset*cos_vert_angle;
-  
-    
-            /** Use standard ROS coordinate system (right-hand rule) */
-            float x_coord = y;
-            float y_coord = -x;
-            float z_coord = z;
-    
-            /** Intensity Calculation */
-            float min_intensity = corrections.min_intensity;
-            float max_intensity = corrections.max_intensity;
-    
-            intensity = raw->blocks[block].data[k+2];
-    
-            float focal_offset = 256 
-                               * (1 - corrections.focal_distance / 13100) 
-                               * (1 - corrections.focal_distance / 13100);
-            float focal_slope = corrections.focal_slope;
-            intensity += focal_slope * (std::abs(focal_offset - 256 * 
-              (1 - tmp.uint/65535)*(1 - tmp.uint/65535)));
-            intensity = (intensity < min_intensity) ? min_intensity : intensity;
-            intensity = (intensity > max_intensity) ? max_intensity : intensity;
-    
-            if (pointInRange(distance)) {
-    
-              // append this point to the cloud
-              VPoint point;
-              point.ring = corrections.laser_ring;
-              point.x = x_coord;
-              point.y = y_coord;
-              point.z = z_coord;
-              point.intensity = intensity;
-
-              pc.points.push_back(point);
-              ++pc.width;
-            }
-          }
+      correctBlock(in, laser_origin, out);
+
+      for (int j = 0; j < SCANS_PER_BLOCK; j++) {
+        if (!(out.valid & (1u << j)))
+          continue;
+
+        const int laser = laser_origin + j;
+        VPoint *point;
+        if (grid_width > 0) {
+          int column = grid_column
+                     + (block * SCANS_PER_BLOCK + j) / calibration_.num_lasers;
+          point = &points[lasers_.ring[laser] * grid_width + column];
+        } else {
+          point = &points[count];
         }
+
+        point->x = out.x[j];
+        point->y = out.y[j];
+        point->z = out.z[j];
+        point->data[3] = 1.0f;
+        point->intensity = out.intensity[j];
+        point->ring = lasers_.ring[laser];
+        ++count;
       }
     }
-  }  
+
+    return count;
+  }
+
+  /** @brief correct the 32 returns of one block
+   *
+   *  @param in gathered raw returns and firing azimuths
+   *  @param laser_origin laser number of the first return
+   *  @param out corrected returns and the mask of points to publish
+   */
+  void RawData::correctBlock(const BlockInput &in, int laser_origin,
+                             BlockOutput &out)
+  {
+    const LaserTable &t = lasers_;
+    uint32_t in_range = 0;
+
+#ifdef __SSE2__
+    const __m128 sign_mask = _mm_set1_ps(-0.0f);
+    const __m128 focal_max = _mm_set1_ps(256.0f);
+    const __m128 min_range = _mm_set1_ps(config_.min_range);
+    const __m128 max_range = _mm_set1_ps(config_.max_range);
+
+    for (int j = 0; j < SCANS_PER_BLOCK; j += 4) {
+      const int l = laser_origin + j;
+
+      __m128 cos_vert_angle = _mm_loadu_ps(&t.cos_vert[l]);
+      __m128 sin_vert_angle = _mm_loadu_ps(&t.sin_vert[l]);
+      __m128 cos_rot_correction = _mm_loadu_ps(&t.cos_rot[l]);
+      __m128 sin_rot_correction = _mm_loadu_ps(&t.sin_rot[l]);
+      __m128 horiz_offset = _mm_loadu_ps(&t.horiz_offset[l]);
+      __m128 vert_offset = _mm_loadu_ps(&t.vert_offset[l]);
+      __m128 cos_azimuth = _mm_loadu_ps(&in.cos_azimuth[j]);
+      __m128 sin_azimuth = _mm_loadu_ps(&in.sin_azimuth[j]);
+
+      __m128 distance = _mm_add_ps(_mm_loadu_ps(&in.distance[j]),
+                                   _mm_loadu_ps(&t.dist_correction[l]));
+
+      // cos(a-b) = cos(a)*cos(b) + sin(a)*sin(b)
+      // sin(a-b) = sin(a)*cos(b) - cos(a)*sin(b)
+      __m128 cos_rot_angle = _mm_add_ps(_mm_mul_ps(cos_azimuth, cos_rot_correction),
+                                        _mm_mul_ps(sin_azimuth, sin_rot_correction));
+      __m128 sin_rot_angle = _mm_sub_ps(_mm_mul_ps(sin_azimuth, cos_rot_correction),
+                                        _mm_mul_ps(cos_azimuth, sin_rot_correction));
+
+      __m128 vert_term = _mm_mul_ps(vert_offset, sin_vert_angle);
+      __m128 xy_distance = _mm_sub_ps(_mm_mul_ps(distance, cos_vert_angle), vert_term);
+
+      // temporal X and Y, absolute values
+      __m128 xx = _mm_andnot_ps(sign_mask,
+        _mm_sub_ps(_mm_mul_ps(xy_distance, sin_rot_angle),
+                   _mm_mul_ps(horiz_offset, cos_rot_angle)));
+      __m128 yy = _mm_andnot_ps(sign_mask,
+        _mm_add_ps(_mm_mul_ps(xy_distance, cos_rot_angle),
+                   _mm_mul_ps(horiz_offset, sin_rot_angle)));
+
+      __m128 distance_x = _mm_add_ps(distance,
+        _mm_add_ps(_mm_mul_ps(xx, _mm_loadu_ps(&t.corr_x_slope[l])),
+                   _mm_loadu_ps(&t.corr_x_offset[l])));
+      __m128 distance_y = _mm_add_ps(distance,
+        _mm_add_ps(_mm_mul_ps(yy, _mm_loadu_ps(&t.corr_y_slope[l])),
+                   _mm_loadu_ps(&t.corr_y_offset[l])));
+
+      xy_distance = _mm_sub_ps(_mm_mul_ps(distance_x, cos_vert_angle), vert_term);
+      __m128 x = _mm_sub_ps(_mm_mul_ps(xy_distance, sin_rot_angle),
+                            _mm_mul_ps(horiz_offset, cos_rot_angle));
+      xy_distance = _mm_sub_ps(_mm_mul_ps(distance_y, cos_vert_angle), vert_term);
+      __m128 y = _mm_add_ps(_mm_mul_ps(xy_distance, cos_rot_angle),
+                            _mm_mul_ps(horiz_offset, sin_rot_angle));
+      __m128 z = _mm_add_ps(_mm_mul_ps(distance_y, sin_vert_angle),
+                            _mm_mul_ps(vert_offset, cos_vert_angle));
+
+      /** Use standard ROS coordinate system (right-hand rule) */
+      _mm_storeu_ps(&out.x[j], y);
+      _mm_storeu_ps(&out.y[j], _mm_xor_ps(x, sign_mask));
+      _mm_storeu_ps(&out.z[j], z);
+
+      /** Intensity Calculation */
+      __m128 focal_scale = _mm_loadu_ps(&in.focal_scale[j]);
+      __m128 focal = _mm_andnot_ps(sign_mask,
+        _mm_sub_ps(_mm_loadu_ps(&t.focal_offset[l]),
+                   _mm_mul_ps(_mm_mul_ps(focal_max, focal_scale), focal_scale)));
+      __m128 intensity = _mm_add_ps(_mm_loadu_ps(&in.intensity[j]),
+                                    _mm_mul_ps(_mm_loadu_ps(&t.focal_slope[l]), focal));
+      intensity = _mm_max_ps(intensity, _mm_loadu_ps(&t.min_intensity[l]));
+      intensity = _mm_min_ps(intensity, _mm_loadu_ps(&t.max_intensity[l]));
+      _mm_storeu_ps(&out.intensity[j], intensity);
+
+      __m128 valid = _mm_and_ps(_mm_cmpge_ps(distance, min_range),
+                                _mm_cmple_ps(distance, max_range));
+      in_range |= (uint32_t) _mm_movemask_ps(valid) << j;
+    }
+#else
+    for (int j = 0; j < SCANS_PER_BLOCK; j++) {
+      const int l = laser_origin + j;
+
+      float distance = in.distance[j] + t.dist_correction[l];
+
+      // cos(a-b) = cos(a)*cos(b) + sin(a)*sin(b)
+      // sin(a-b) = sin(a)*cos(b) - cos(a)*sin(b)
+      float cos_rot_angle = in.cos_azimuth[j] * t.cos_rot[l]
+                          + in.sin_azimuth[j] * t.sin_rot[l];
+      float sin_rot_angle = in.sin_azimuth[j] * t.cos_rot[l]
+                          - in.cos_azimuth[j] * t.sin_rot[l];
+
+      float vert_term = t.vert_offset[l] * t.sin_vert[l];
+      float xy_distance = distance * t.cos_vert[l] - vert_term;
+
+      // temporal X and Y, absolute values
+      float xx = fabsf(xy_distance * sin_rot_angle - t.horiz_offset[l] * cos_rot_angle);
+      float yy = fabsf(xy_distance * cos_rot_angle + t.horiz_offset[l] * sin_rot_angle);
+
+      float distance_x = distance + xx * t.corr_x_slope[l] + t.corr_x_offset[l];
+      float distance_y = distance + yy * t.corr_y_slope[l] + t.corr_y_offset[l];
+
+      xy_distance = distance_x * t.cos_vert[l] - vert_term;
+      float x = xy_distance * sin_rot_angle - t.horiz_offset[l] * cos_rot_angle;
+      xy_distance = distance_y * t.cos_vert[l] - vert_term;
+      float y = xy_distance * cos_rot_angle + t.horiz_offset[l] * sin_rot_angle;
+      float z = distance_y * t.sin_vert[l] + t.vert_offset[l] * t.cos_vert[l];
+
+      /** Use standard ROS coordinate system (right-hand rule) */
+      out.x[j] = y;
+      out.y[j] = -x;
+      out.z[j] = z;
+
+      /** Intensity Calculation */
+      float focal_scale = in.focal_scale[j];
+      float intensity = in.intensity[j] + t.focal_slope[l]
+        * fabsf(t.focal_offset[l] - 256 * focal_scale * focal_scale);
+      intensity = (intensity < t.min_intensity[l]) ? t.min_intensity[l] : intensity;
+      intensity = (intensity > t.max_intensity[l]) ? t.max_intensity[l] : intensity;
+      out.intensity[j] = intensity;
+
+      if (pointInRange(distance))
+        in_range |= 1u << j;
+    }
+#endif
+
+    out.valid = in_range & in.in_view;
+  }
 
 } // namespace velodyne_rawdata
@@ -30,6 +30,7 @@
 // Created by amc on 2017-11-15.
 //
 */
+#include <algorithm>
 #include <string>
 #include <vector>
 #include <ros/ros.h>
@@ -38,12 +39,56 @@
 #include <sensor_msgs/image_encodings.h>
 #include <sensor_msgs/CameraInfo.h>
 
+#include "opencv2/core/core.hpp"
 #include "opencv2/highgui/highgui.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
 #include "opencv2/calib3d/calib3d.hpp"
 
 #define _NODE_NAME_ "image_rectifier"
 
+/*
+ * Remaps horizontal stripes of the output image with the fixed point tables,
+ * converting each stripe to grayscale while it is still in cache if requested.
+ */
+class RemapStripes : public cv::ParallelLoopBody
+{
+	const cv::Mat& source_;
+	cv::Mat& destination_;
+	const cv::Mat& map_xy_;
+	const cv::Mat& map_interpolation_;
+	int stripe_height_;
+	bool to_gray_;
+
+public:
+	RemapStripes(const cv::Mat& in_source, cv::Mat& out_destination, const cv::Mat& in_map_xy,
+	             const cv::Mat& in_map_interpolation, int in_stripe_height, bool in_to_gray) :
+		source_(in_source), destination_(out_destination), map_xy_(in_map_xy),
+		map_interpolation_(in_map_interpolation), stripe_height_(in_stripe_height), to_gray_(in_to_gray)
+	{
+	}
+
+	virtual void operator()(const cv::Range& in_range) const
+	{
+		for (int stripe = in_range.start; stripe < in_range.end; stripe++)
+		{
+			cv::Range rows(stripe * stripe_height_, std::min((stripe + 1) * stripe_height_, destination_.rows));
+			cv::Mat destination_rows = destination_.rowRange(rows);
+			if (to_gray_)
+			{
+				cv::Mat color_rows;
+				cv::remap(source_, color_rows, map_xy_.rowRange(rows), map_interpolation_.rowRange(rows),
+				          cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+				cv::cvtColor(color_rows, destination_rows, CV_BGR2GRAY);
+			}
+			else
+			{
+				cv::remap(source_, destination_rows, map_xy_.rowRange(rows), map_interpolation_.rowRange(rows),
+				          cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+			}
+		}
+	}
+};
+
 class RosImageRectifierApp
 
 {
@@ -56,48 +101,114 @@ class RosImageRectifierApp
 	cv::Mat             camera_instrinsics_;
 	cv::Mat             distortion_coefficients_;
 
+	// output options, fused into the remap tables (resize, crop) or the remap pass (grayscale)
+	cv::Size            output_size_;
+	cv::Rect            roi_;
+	bool                output_gray_;
+	int                 stripe_height_;
 
-	void ImageCallback(const sensor_msgs::Image& in_image_sensor)
+	// fixed point remap tables, rebuilt only when camera_info changes
+	cv::Mat             map_xy_;
+	cv::Mat             map_interpolation_;
+	cv::Size            map_input_size_;
+
+	/*!
+	 * Builds the remap tables from the current intrinsics. Every output pixel is mapped
+	 * straight to the raw image, so the ROI crop and the resize cost nothing per frame.
+	 */
+	void BuildMaps(const cv::Size& in_input_size)
+	{
+		cv::Rect roi = roi_;
+		if (roi.area() == 0)
+			{ roi = cv::Rect(0, 0, in_input_size.width, in_input_size.height); }
+		cv::Size output_size = output_size_;
+		if (output_size.area() == 0)
+			{ output_size = roi.size(); }
+
+		// same projection as cv::undistort, shifted to the ROI and scaled to the output size
+		double scale_x = static_cast<double>(output_size.width) / roi.width;
+		double scale_y = static_cast<double>(output_size.height) / roi.height;
+		cv::Mat new_intrinsics = camera_instrinsics_.clone();
+		new_intrinsics.at<double>(0, 0) *= scale_x;
+		new_intrinsics.at<double>(0, 2) = (new_intrinsics.at<double>(0, 2) - roi.x + 0.5) * scale_x - 0.5;
+		new_intrinsics.at<double>(1, 1) *= scale_y;
+		new_intrinsics.at<double>(1, 2) = (new_intrinsics.at<double>(1, 2) - roi.y + 0.5) * scale_y - 0.5;
+
+		cv::initUndistortRectifyMap(camera_instrinsics_, distortion_coefficients_, cv::Mat(), new_intrinsics,
+		                            output_size, CV_16SC2, map_xy_, map_interpolation_);
+		map_input_size_ = in_input_size;
+		ROS_INFO("[%s] Remap tables built for %dx%d -> %dx%d", _NODE_NAME_,
+		         in_input_size.width, in_input_size.height, output_size.width, output_size.height);
+	}
+
+	void ImageCallback(const sensor_msgs::ImageConstPtr& in_image_sensor)
 	{
-		//Receive Image, convert it to OpenCV Mat
-		cv_bridge::CvImagePtr cv_image = cv_bridge::toCvCopy(in_image_sensor, "bgr8");
-		cv::Mat tmp_image = cv_image->image;
-		cv::Mat image;
 		if (camera_instrinsics_.empty())
 		{
 			ROS_INFO("[%s] Make sure camera_info is being published in the specified topic", _NODE_NAME_);
-			image = tmp_image;
-		}
-		else
-		{
-			cv::undistort(tmp_image, image, camera_instrinsics_, distortion_coefficients_);
+			cv_bridge::CvImageConstPtr cv_image = cv_bridge::toCvShare(in_image_sensor, "bgr8");
+			publisher_image_rectified_.publish(cv_image->toImageMsg());
+			return;
 		}
 
-		cv_bridge::CvImage out_msg;
-		out_msg.header   = in_image_sensor.header; // Same timestamp and tf frame as input image
-		out_msg.encoding = sensor_msgs::image_encodings::BGR8;
-		out_msg.image    = image; // Your cv::Mat
+		// a mono input is remapped as is when the output is grayscale, anything else as bgr8
+		bool input_gray = output_gray_ && in_image_sensor->encoding == sensor_msgs::image_encodings::MONO8;
+		cv_bridge::CvImageConstPtr cv_image = cv_bridge::toCvShare(in_image_sensor,
+		                                                           input_gray ? "mono8" : "bgr8");
+		const cv::Mat& source = cv_image->image;
+
+		if (map_xy_.empty() || source.size() != map_input_size_)
+			{ BuildMaps(source.size()); }
+
+		// remap straight into the data of the outgoing message
+		sensor_msgs::ImagePtr out_msg(new sensor_msgs::Image);
+		out_msg->header   = in_image_sensor->header; // Same timestamp and tf frame as input image
+		out_msg->encoding = output_gray_ ? sensor_msgs::image_encodings::MONO8 : sensor_msgs::image_encodings::BGR8;
+		out_msg->height   = map_xy_.rows;
+		out_msg->width    = map_xy_.cols;
+		out_msg->is_bigendian = false;
+		out_msg->step     = map_xy_.cols * (output_gray_ ? 1 : 3);
+		out_msg->data.resize(out_msg->step * out_msg->height);
+		cv::Mat image(map_xy_.rows, map_xy_.cols, output_gray_ ? CV_8UC1 : CV_8UC3, &out_msg->data[0], out_msg->step);
 
-		publisher_image_rectified_.publish(out_msg.toImageMsg());
+		int stripes = (image.rows + stripe_height_ - 1) / stripe_height_;
+		cv::parallel_for_(cv::Range(0, stripes),
+		                  RemapStripes(source, image, map_xy_, map_interpolation_, stripe_height_,
+		                               output_gray_ && !input_gray));
 
+		publisher_image_rectified_.publish(out_msg);
 	}
 
 	void IntrinsicsCallback(const sensor_msgs::CameraInfo& in_message)
 	{
-		image_size_.height = in_message.height;
-		image_size_.width = in_message.width;
-
-		camera_instrinsics_ = cv::Mat(3,3, CV_64F);
+		cv::Mat camera_instrinsics(3,3, CV_64F);
 		for (int row=0; row<3; row++) {
 			for (int col=0; col<3; col++) {
-				camera_instrinsics_.at<double>(row, col) = in_message.K[row * 3 + col];
+				camera_instrinsics.at<double>(row, col) = in_message.K[row * 3 + col];
 			}
 		}
 
-		distortion_coefficients_ = cv::Mat(1,5,CV_64F);
-		for (int col=0; col<5; col++) {
-			distortion_coefficients_.at<double>(col) = in_message.D[col];
+		cv::Mat distortion_coefficients(1, in_message.D.size(), CV_64F);
+		for (size_t col=0; col<in_message.D.size(); col++) {
+			distortion_coefficients.at<double>(col) = in_message.D[col];
 		}
+
+		// camera_info usually comes with every frame, keep the tables unless it changed
+		bool changed = camera_instrinsics_.empty()
+		               || image_size_ != cv::Size(in_message.width, in_message.height)
+		               || cv::norm(camera_instrinsics, camera_instrinsics_, cv::NORM_INF) != 0.0
+		               || distortion_coefficients.size() != distortion_coefficients_.size()
+		               || (!distortion_coefficients.empty()
+		                   && cv::norm(distortion_coefficients, distortion_coefficients_, cv::NORM_INF) != 0.0);
+		if (!changed)
+			{ return; }
+
+		image_size_.height = in_message.height;
+		image_size_.width = in_message.width;
+		camera_instrinsics_ = camera_instrinsics;
+		distortion_coefficients_ = distortion_coefficients;
+		map_xy_.release();
+		map_interpolation_.release();
 	}
 
 public:
@@ -112,6 +223,22 @@ public:
 
 		node_handle.param<std::string>("camera_info_src", camera_info_topic_str, "/camera_info");
 
+		int output_width, output_height, roi_x, roi_y, roi_width, roi_height, num_threads;
+		node_handle.param("output_width", output_width, 0);
+		node_handle.param("output_height", output_height, 0);
+		node_handle.param("roi_x", roi_x, 0);
+		node_handle.param("roi_y", roi_y, 0);
+		node_handle.param("roi_width", roi_width, 0);
+		node_handle.param("roi_height", roi_height, 0);
+		node_handle.param("grayscale", output_gray_, false);
+		node_handle.param("stripe_height", stripe_height_, 64);
+		node_handle.param("num_threads", num_threads, -1);
+		output_size_ = cv::Size(std::max(output_width, 0), std::max(output_height, 0));
+		roi_ = cv::Rect(roi_x, roi_y, std::max(roi_width, 0), std::max(roi_height, 0));
+		stripe_height_ = std::max(stripe_height_, 1);
+		if (num_threads >= 0)
+			{ cv::setNumThreads(num_threads); }
+
 		if (name_space_str != "/") {
 			if (name_space_str.substr(0, 2) == "//") {
 				/* if name space obtained by ros::this::node::getNamespace()
@@ -144,7 +271,8 @@ public:
 	{
 	}
 
-	RosImageRectifierApp()
+	RosImageRectifierApp() :
+		output_gray_(false), stripe_height_(64)
 	{
 	}
 };
@@ -1,36 +1,351 @@
 #ifndef POINTS_DOWNSAMPLER_H
 #define POINTS_DOWNSAMPLER_H
 
-static pcl::PointCloud<pcl::PointXYZI> removePointsByRange(pcl::PointCloud<pcl::PointXYZI> scan, double min_range, double max_range)
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/*
+ * Voxel grid downsampler shared by the points_downsampler nodes.
+ *
+ * Points are bucketed with an open-addressing hash table in a single pass
+ * instead of pcl::VoxelGrid's sort, range cropping is done in the same pass,
+ * and all buffers are kept between scans. Each voxel is reduced to the
+ * centroid of its points (as pcl::VoxelGrid) or to the first point that fell
+ * into it. With more than one thread the scan is partitioned by voxel hash, so
+ * every voxel is owned by exactly one thread.
+ *
+ * A leaf size of 0 disables downsampling and only crops by range.
+ */
+class VoxelDownsampler
 {
-  pcl::PointCloud<pcl::PointXYZI> narrowed_scan;
-  narrowed_scan.header = scan.header;
+public:
+  enum Mode
+  {
+    CENTROID,
+    FIRST_POINT
+  };
+
+  VoxelDownsampler()
+    : leaf_size_(0.0), min_range_(0.0), max_range_(-1.0), mode_(CENTROID), num_threads_(1)
+  {
+  }
+
+  void setLeafSize(double leaf_size)
+  {
+    leaf_size_ = leaf_size;
+  }
+
+  // Keep points with min_range <= sqrt(x^2 + y^2) <= max_range. A negative
+  // max_range disables cropping.
+  void setRange(double min_range, double max_range)
+  {
+    min_range_ = min_range;
+    max_range_ = max_range;
+  }
+
+  void setMode(Mode mode)
+  {
+    mode_ = mode;
+  }
 
-#if 1     //  This error handling should be detemind.
-  if( min_range>=max_range ) {
-    ROS_ERROR_ONCE("min_range>=max_range @(%lf, %lf)", min_range, max_range );
-    return scan;
+  bool setMode(const std::string& mode)
+  {
+    if (mode == "centroid")
+      mode_ = CENTROID;
+    else if (mode == "first_point")
+      mode_ = FIRST_POINT;
+    else
+      return false;
+    return true;
   }
+
+  void setNumThreads(int num_threads)
+  {
+    num_threads_ = (num_threads > 0) ? num_threads : 1;
+  }
+
+  // Downsample input into output (which may be the same cloud).
+  // Returns the number of input points inside the range.
+  size_t filter(const pcl::PointCloud<pcl::PointXYZI>& input, pcl::PointCloud<pcl::PointXYZI>& output)
+  {
+    const size_t n = input.points.size();
+    int num_threads = num_threads_;
+#ifndef _OPENMP
+    num_threads = 1;
 #endif
 
-  double square_min_range = min_range * min_range;
-  double square_max_range = max_range * max_range;
+    bool crop = (max_range_ >= 0.0);
+    if (crop && min_range_ >= max_range_)
+    {
+      ROS_ERROR_ONCE("min_range>=max_range @(%lf, %lf)", min_range_, max_range_);
+      crop = false;
+    }
+    const float square_min_range = min_range_ * min_range_;
+    const float square_max_range = max_range_ * max_range_;
+
+    output.header = input.header;
+
+    if (leaf_size_ <= 0.0)
+    {
+      // crop only, compacting in place when output is input
+      size_t count = 0;
+      if (&output != &input)
+        output.points.resize(n);
+      for (size_t i = 0; i < n; ++i)
+      {
+        const pcl::PointXYZI& p = input.points[i];
+        float square_distance = p.x * p.x + p.y * p.y;
+        if (crop && !(square_min_range <= square_distance && square_distance <= square_max_range))
+          continue;
+        output.points[count++] = p;
+      }
+      output.points.resize(count);
+      finishCloud(output, input.is_dense);
+      return count;
+    }
+
+    // pass 1: voxel key of every point, INVALID_KEY if cropped
+    const float inverse_leaf_size = 1.0 / leaf_size_;
+    keys_.resize(n);
+    size_t in_range = 0;
+#pragma omp parallel for num_threads(num_threads) reduction(+ : in_range)
+    for (size_t i = 0; i < n; ++i)
+    {
+      const pcl::PointXYZI& p = input.points[i];
+      float square_distance = p.x * p.x + p.y * p.y;
+      if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z) ||
+          (crop && !(square_min_range <= square_distance && square_distance <= square_max_range)))
+      {
+        keys_[i] = INVALID_KEY;
+        continue;
+      }
+      keys_[i] = voxelKey(p, inverse_leaf_size);
+      ++in_range;
+    }
+
+    // pass 2: split point indices by voxel hash, keeping scan order
+    const int num_partitions = num_threads;
+    partitions_.resize(num_partitions);
+    order_.resize(in_range);
+    if (num_partitions == 1)
+    {
+      size_t count = 0;
+      for (size_t i = 0; i < n; ++i)
+        if (keys_[i] != INVALID_KEY)
+          order_[count++] = i;
+      partitions_[0].begin = 0;
+      partitions_[0].end = count;
+    }
+    else
+    {
+      partitionPoints(num_partitions);
+    }
+
+    // pass 3: one hash table per partition
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic)
+    for (int i = 0; i < num_partitions; ++i)
+      partitions_[i].build(input, keys_, order_, mode_);
+
+    // pass 4: write one point per voxel
+    size_t total = 0;
+    std::vector<size_t> offsets(num_partitions);
+    for (int i = 0; i < num_partitions; ++i)
+    {
+      offsets[i] = total;
+      total += partitions_[i].voxels.size();
+    }
+    output.points.resize(total);
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic)
+    for (int i = 0; i < num_partitions; ++i)
+    {
+      const std::vector<Voxel>& voxels = partitions_[i].voxels;
+      pcl::PointXYZI* out = &output.points[offsets[i]];
+      for (size_t v = 0; v < voxels.size(); ++v)
+      {
+        const Voxel& voxel = voxels[v];
+        const float scale = (mode_ == CENTROID) ? 1.0f / voxel.count : 1.0f;
+        out[v].x = voxel.x * scale;
+        out[v].y = voxel.y * scale;
+        out[v].z = voxel.z * scale;
+        out[v].intensity = voxel.intensity * scale;
+      }
+    }
+    finishCloud(output, true);
+
+    return in_range;
+  }
+
+private:
+  static const uint64_t INVALID_KEY = ~0ULL;
+  static const int KEY_BITS = 21;
+
+  struct Voxel
+  {
+    float x, y, z, intensity;
+    uint32_t count;
+  };
+
+  // Open-addressing table from voxel key to voxel, cleared between scans by
+  // bumping the epoch instead of touching every slot.
+  struct Partition
+  {
+    size_t begin, end;  // range in order_
+    std::vector<uint64_t> slot_keys;
+    std::vector<uint32_t> slot_voxels;
+    std::vector<uint32_t> slot_epochs;
+    uint32_t epoch;
+    int bits;
+    std::vector<Voxel> voxels;
+
+    Partition() : begin(0), end(0), epoch(0), bits(0)
+    {
+    }
+
+    void build(const pcl::PointCloud<pcl::PointXYZI>& input, const std::vector<uint64_t>& keys,
+               const std::vector<uint32_t>& order, Mode mode)
+    {
+      const size_t count = end - begin;
+      voxels.clear();
+
+      // keep the load factor at or below 1/2
+      int needed_bits = 4;
+      while ((size_t(1) << needed_bits) < 2 * count)
+        ++needed_bits;
+      if (needed_bits > bits)
+      {
+        bits = needed_bits;
+        slot_keys.assign(size_t(1) << bits, 0);
+        slot_voxels.assign(size_t(1) << bits, 0);
+        slot_epochs.assign(size_t(1) << bits, 0);
+        epoch = 0;
+      }
+      if (++epoch == 0)
+      {
+        std::fill(slot_epochs.begin(), slot_epochs.end(), 0);
+        epoch = 1;
+      }
+
+      const uint64_t mask = (uint64_t(1) << bits) - 1;
+      for (size_t k = begin; k < end; ++k)
+      {
+        const uint32_t index = order[k];
+        const uint64_t key = keys[index];
+        const pcl::PointXYZI& p = input.points[index];
+
+        uint64_t slot = hashKey(key) >> (64 - bits);
+        while (slot_epochs[slot] == epoch && slot_keys[slot] != key)
+          slot = (slot + 1) & mask;
+
+        if (slot_epochs[slot] != epoch)
+        {
+          slot_epochs[slot] = epoch;
+          slot_keys[slot] = key;
+          slot_voxels[slot] = voxels.size();
+          Voxel voxel = { p.x, p.y, p.z, p.intensity, 1 };
+          voxels.push_back(voxel);
+        }
+        else if (mode == CENTROID)
+        {
+          Voxel& voxel = voxels[slot_voxels[slot]];
+          voxel.x += p.x;
+          voxel.y += p.y;
+          voxel.z += p.z;
+          voxel.intensity += p.intensity;
+          ++voxel.count;
+        }
+      }
+    }
+  };
 
-  for(pcl::PointCloud<pcl::PointXYZI>::const_iterator iter = scan.begin(); iter != scan.end(); ++iter)
+  static uint64_t voxelKey(const pcl::PointXYZI& p, float inverse_leaf_size)
   {
-    const pcl::PointXYZI &p = *iter;
-//    p.x = iter->x;
-//    p.y = iter->y;
-//    p.z = iter->z;
-//    p.intensity = iter->intensity;
-    double square_distance = p.x * p.x + p.y * p.y;
+    const int64_t offset = int64_t(1) << (KEY_BITS - 1);
+    const uint64_t mask = (uint64_t(1) << KEY_BITS) - 1;
+    uint64_t ix = (static_cast<int64_t>(std::floor(p.x * inverse_leaf_size)) + offset) & mask;
+    uint64_t iy = (static_cast<int64_t>(std::floor(p.y * inverse_leaf_size)) + offset) & mask;
+    uint64_t iz = (static_cast<int64_t>(std::floor(p.z * inverse_leaf_size)) + offset) & mask;
+    return (ix << (2 * KEY_BITS)) | (iy << KEY_BITS) | iz;
+  }
+
+  static uint64_t hashKey(uint64_t key)
+  {
+    return key * 0x9E3779B97F4A7C15ULL;
+  }
+
+  static int partitionOf(uint64_t key, int num_partitions)
+  {
+    return static_cast<uint32_t>(hashKey(key) >> 16) % num_partitions;
+  }
+
+  // Counting sort of point indices by partition. Each thread counts and then
+  // scatters its own contiguous chunk, so scan order is kept within a partition.
+  void partitionPoints(int num_partitions)
+  {
+    const size_t n = keys_.size();
+    const int num_chunks = num_partitions;
+    chunk_counts_.assign(num_chunks * num_partitions, 0);
 
-    if(square_min_range <= square_distance && square_distance <= square_max_range){
-      narrowed_scan.points.push_back(p);
+#pragma omp parallel for num_threads(num_chunks)
+    for (int c = 0; c < num_chunks; ++c)
+    {
+      size_t* counts = &chunk_counts_[c * num_partitions];
+      for (size_t i = n * c / num_chunks; i < n * (c + 1) / num_chunks; ++i)
+        if (keys_[i] != INVALID_KEY)
+          ++counts[partitionOf(keys_[i], num_partitions)];
+    }
+
+    // turn counts into write positions, partition-major
+    size_t position = 0;
+    for (int p = 0; p < num_partitions; ++p)
+    {
+      partitions_[p].begin = position;
+      for (int c = 0; c < num_chunks; ++c)
+      {
+        size_t count = chunk_counts_[c * num_partitions + p];
+        chunk_counts_[c * num_partitions + p] = position;
+        position += count;
+      }
+      partitions_[p].end = position;
+    }
+
+#pragma omp parallel for num_threads(num_chunks)
+    for (int c = 0; c < num_chunks; ++c)
+    {
+      size_t* positions = &chunk_counts_[c * num_partitions];
+      for (size_t i = n * c / num_chunks; i < n * (c + 1) / num_chunks; ++i)
+        if (keys_[i] != INVALID_KEY)
+          order_[positions[partitionOf(keys_[i], num_partitions)]++] = i;
     }
   }
 
-  return narrowed_scan;
-}
+  static void finishCloud(pcl::PointCloud<pcl::PointXYZI>& cloud, bool is_dense)
+  {
+    cloud.width = cloud.points.size();
+    cloud.height = 1;
+    cloud.is_dense = is_dense;
+  }
+
+  double leaf_size_;
+  double min_range_;
+  double max_range_;
+  Mode mode_;
+  int num_threads_;
+
+  // kept between scans to avoid reallocating
+  std::vector<uint64_t> keys_;
+  std::vector<uint32_t> order_;
+  std::vector<size_t> chunk_counts_;
+  std::vector<Partition> partitions_;
+};
 
 #endif // POINTS_DOWNSAMPLER_H
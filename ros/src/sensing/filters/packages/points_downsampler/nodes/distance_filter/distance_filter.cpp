@@ -39,8 +39,11 @@
 
 #include <points_downsampler/PointsDownsamplerInfo.h>
 
+#include <latency_tracer/latency_tracer.h>
+
 #include <algorithm> // For std::min()
 #include <chrono>
+#include <memory>
 
 #include "points_downsampler.h"
 
@@ -62,6 +65,10 @@ static std::string filename;
 static std::string POINTS_TOPIC;
 static double measurement_range = MAX_MEASUREMENT_RANGE;
 
+static std::unique_ptr<latency_tracer::LatencyTracer> tracer;
+
+static VoxelDownsampler range_filter;
+
 static void config_callback(const autoware_msgs::ConfigDistanceFilter::ConstPtr& input)
 {
   sample_num = input->sample_num;
@@ -70,13 +77,16 @@ static void config_callback(const autoware_msgs::ConfigDistanceFilter::ConstPtr&
 
 static void scan_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
 {
+  tracer->receive(input->header.stamp);
+
   pcl::PointXYZI sampled_p;
   pcl::PointCloud<pcl::PointXYZI> scan;
 
   pcl::fromROSMsg(*input, scan);
 
   if(measurement_range != MAX_MEASUREMENT_RANGE){
-    scan = removePointsByRange(scan, 0, measurement_range);
+    range_filter.setRange(0, measurement_range);
+    range_filter.filter(scan, scan);
   }
 
   pcl::PointCloud<pcl::PointXYZI>::Ptr filtered_scan_ptr(new pcl::PointCloud<pcl::PointXYZI>());
@@ -116,9 +126,11 @@ static void scan_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
   pcl::toROSMsg(*filtered_scan_ptr, filtered_msg);
 
   filter_end = std::chrono::system_clock::now();
+  tracer->process(input->header.stamp);
 
   filtered_msg.header = input->header;
   filtered_points_pub.publish(filtered_msg);
+  tracer->publish(input->header.stamp);
 
   points_downsampler_info_msg.header = input->header;
   points_downsampler_info_msg.filter_name = "distance_filter";
@@ -167,6 +179,8 @@ int main(int argc, char** argv)
 	  ofs.open(filename.c_str(), std::ios::app);
   }
 
+  tracer.reset(new latency_tracer::LatencyTracer(nh, private_nh));
+
   // Publishers
   filtered_points_pub = nh.advertise<sensor_msgs::PointCloud2>("/filtered_points", 10);
   points_downsampler_info_pub = nh.advertise<points_downsampler::PointsDownsamplerInfo>("/points_downsampler_info", 1000);
@@ -33,13 +33,15 @@
 
 #include <pcl/point_types.h>
 #include <pcl_conversions/pcl_conversions.h>
-#include <pcl/filters/voxel_grid.h>
 
 #include "autoware_msgs/ConfigVoxelGridFilter.h"
 
 #include <points_downsampler/PointsDownsamplerInfo.h>
 
+#include <latency_tracer/latency_tracer.h>
+
 #include <chrono>
+#include <memory>
 
 #include "points_downsampler.h"
 
@@ -62,6 +64,11 @@ static std::string filename;
 static std::string POINTS_TOPIC;
 static double measurement_range = MAX_MEASUREMENT_RANGE;
 
+static std::unique_ptr<latency_tracer::LatencyTracer> tracer;
+
+static VoxelDownsampler downsampler;
+static pcl::PointCloud<pcl::PointXYZI> filtered_scan;
+
 static void config_callback(const autoware_msgs::ConfigVoxelGridFilter::ConstPtr& input)
 {
   voxel_leaf_size = input->voxel_leaf_size;
@@ -70,52 +77,33 @@ static void config_callback(const autoware_msgs::ConfigVoxelGridFilter::ConstPtr
 
 static void scan_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
 {
+  tracer->receive(input->header.stamp);
+
   pcl::PointCloud<pcl::PointXYZI> scan;
   pcl::fromROSMsg(*input, scan);
 
-  if(measurement_range != MAX_MEASUREMENT_RANGE){
-    scan = removePointsByRange(scan, 0, measurement_range);
-  }
-
-  pcl::PointCloud<pcl::PointXYZI>::Ptr scan_ptr(new pcl::PointCloud<pcl::PointXYZI>(scan));
-  pcl::PointCloud<pcl::PointXYZI>::Ptr filtered_scan_ptr(new pcl::PointCloud<pcl::PointXYZI>());
-
   sensor_msgs::PointCloud2 filtered_msg;
 
   filter_start = std::chrono::system_clock::now();
 
   // if voxel_leaf_size < 0.1 voxel_grid_filter cannot down sample (It is specification in PCL)
-  if (voxel_leaf_size >= 0.1)
-  {
-    // Downsampling the velodyne scan using VoxelGrid filter
-    pcl::VoxelGrid<pcl::PointXYZI> voxel_grid_filter;
-    voxel_grid_filter.setLeafSize(voxel_leaf_size, voxel_leaf_size, voxel_leaf_size);
-    voxel_grid_filter.setInputCloud(scan_ptr);
-    voxel_grid_filter.filter(*filtered_scan_ptr);
-    pcl::toROSMsg(*filtered_scan_ptr, filtered_msg);
-  }
-  else
-  {
-    pcl::toROSMsg(*scan_ptr, filtered_msg);
-  }
+  downsampler.setLeafSize(voxel_leaf_size >= 0.1 ? voxel_leaf_size : 0.0);
+  downsampler.setRange(0, measurement_range != MAX_MEASUREMENT_RANGE ? measurement_range : -1.0);
+  size_t scan_size = downsampler.filter(scan, filtered_scan);
+  pcl::toROSMsg(filtered_scan, filtered_msg);
 
   filter_end = std::chrono::system_clock::now();
+  tracer->process(input->header.stamp);
 
   filtered_msg.header = input->header;
   filtered_points_pub.publish(filtered_msg);
+  tracer->publish(input->header.stamp);
 
   points_downsampler_info_msg.header = input->header;
   points_downsampler_info_msg.filter_name = "voxel_grid_filter";
   points_downsampler_info_msg.measurement_range = measurement_range;
-  points_downsampler_info_msg.original_points_size = scan.size();
-  if (voxel_leaf_size >= 0.1)
-  {
-    points_downsampler_info_msg.filtered_points_size = filtered_scan_ptr->size();
-  }
-  else
-  {
-    points_downsampler_info_msg.filtered_points_size = scan_ptr->size();
-  }
+  points_downsampler_info_msg.original_points_size = scan_size;
+  points_downsampler_info_msg.filtered_points_size = filtered_scan.size();
   points_downsampler_info_msg.original_ring_size = 0;
   points_downsampler_info_msg.filtered_ring_size = 0;
   points_downsampler_info_msg.exe_time = std::chrono::duration_cast<std::chrono::microseconds>(filter_end - filter_start).count() / 1000.0;
@@ -158,6 +146,18 @@ int main(int argc, char** argv)
 	  ofs.open(filename.c_str(), std::ios::app);
   }
 
+  std::string downsample_mode = "centroid";
+  int downsample_threads = 1;
+  private_nh.getParam("downsample_mode", downsample_mode);
+  private_nh.getParam("downsample_threads", downsample_threads);
+  if (!downsampler.setMode(downsample_mode))
+  {
+    ROS_WARN("Unknown downsample_mode '%s', using centroid", downsample_mode.c_str());
+  }
+  downsampler.setNumThreads(downsample_threads);
+
+  tracer.reset(new latency_tracer::LatencyTracer(nh, private_nh));
+
   // Publishers
   filtered_points_pub = nh.advertise<sensor_msgs::PointCloud2>("/filtered_points", 10);
   points_downsampler_info_pub = nh.advertise<points_downsampler::PointsDownsamplerInfo>("/points_downsampler_info", 1000);
@@ -0,0 +1,307 @@
+#ifndef POINTS_FRAME_H
+#define POINTS_FRAME_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <ros/ros.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <tf/transform_listener.h>
+
+/*
+ * Gathers the clouds of several lidars into frames, shared by points_concat_filter
+ * and the points_pipeline nodelet.
+ *
+ * A frame holds at most one cloud of every input. It is handed to the frame callback
+ * as soon as every input has a cloud, when an input sends a second cloud, when a cloud
+ * is stamped more than the time window after the first one, or at the latest one time
+ * window after the first cloud was received, so a dropped lidar never stalls the
+ * output. The callback runs with the frame locked against the subscriptions. The
+ * callback then reads the clouds straight from their PointCloud2 data into the output
+ * frame: begin() looks up the transforms and gives every input a slot of the output,
+ * transform() fills the slots in parallel and end() packs them.
+ */
+class PointsFrame
+{
+public:
+  PointsFrame() : time_window_(0.05), frame_open_(false), tf_listener_(NULL)
+  {
+  }
+
+  // name prefixes the log messages, tf_listener must outlive the frame
+  void subscribe(ros::NodeHandle& node_handle, const std::vector<std::string>& topics, double time_window,
+                 tf::TransformListener& tf_listener, const boost::function<void()>& frame_callback,
+                 const std::string& name)
+  {
+    time_window_ = time_window;
+    tf_listener_ = &tf_listener;
+    frame_callback_ = frame_callback;
+    name_ = name;
+    timer_ = node_handle.createTimer(ros::Duration(time_window_), &PointsFrame::timer_callback, this, true, false);
+
+    inputs_.resize(topics.size());
+    for (size_t i = 0; i < inputs_.size(); ++i)
+    {
+      inputs_[i].topic = topics[i];
+      inputs_[i].subscriber = node_handle.subscribe<sensor_msgs::PointCloud2>(
+          topics[i], 1, boost::bind(&PointsFrame::input_callback, this, _1, i));
+    }
+  }
+
+  // frame of the output points; empty keeps the frame of the clouds
+  void setOutputFrame(const std::string& output_frame)
+  {
+    output_frame_ = output_frame;
+  }
+
+  // Looks up the transform of every cloud of the frame and assigns it a slot as large as the cloud.
+  // Returns false if no cloud can be used. header is the one of the first cloud, in the output frame,
+  // and total the number of points of all the slots.
+  bool begin(std_msgs::Header& header, size_t& total)
+  {
+    frame_open_ = false;
+    timer_.stop();
+
+    total = 0;
+    const sensor_msgs::PointCloud2* header_cloud = NULL;
+    for (size_t i = 0; i < inputs_.size(); ++i)
+    {
+      Input& input = inputs_[i];
+      input.offset = total;
+      input.count = 0;
+      if (!input.pending)
+      {
+        ROS_WARN_THROTTLE(1.0, "%s: no cloud from %s in this frame", name_.c_str(), input.topic.c_str());
+        continue;
+      }
+      if (!lookup_transform(input))
+      {
+        input.pending.reset();
+        continue;
+      }
+      if (header_cloud == NULL)
+      {
+        header_cloud = input.pending.get();
+      }
+      total += input.pending->width * input.pending->height;
+    }
+
+    if (header_cloud == NULL)
+    {
+      return false;
+    }
+    header = header_cloud->header;
+    if (!output_frame_.empty())
+    {
+      header.frame_id = output_frame_;
+    }
+    return true;
+  }
+
+  // Transforms the finite points of every cloud that pass keep(x, y, z) in the output frame and
+  // hands them to write(index, x, y, z, intensity), index counting from the slot of the cloud.
+  template <typename Keep, typename Write>
+  void transform(const Keep& keep, const Write& write)
+  {
+#pragma omp parallel for schedule(dynamic)
+    for (size_t i = 0; i < inputs_.size(); ++i)
+    {
+      Input& input = inputs_[i];
+      if (input.pending)
+      {
+        input.count = transform_cloud(*input.pending, input.transform, input.offset, keep, write);
+      }
+    }
+  }
+
+  // Packs the points written into the slots, of point_size bytes each, at the start of points
+  // and releases the clouds of the frame. Returns the number of points.
+  size_t end(uint8_t* points, size_t point_size)
+  {
+    size_t count = 0;
+    for (size_t i = 0; i < inputs_.size(); ++i)
+    {
+      Input& input = inputs_[i];
+      if (input.count > 0 && input.offset != count)
+      {
+        std::memmove(points + count * point_size, points + input.offset * point_size, input.count * point_size);
+      }
+      count += input.count;
+      input.pending.reset();
+    }
+    return count;
+  }
+
+private:
+  struct Input
+  {
+    std::string topic;
+    ros::Subscriber subscriber;
+    sensor_msgs::PointCloud2::ConstPtr pending;  // cloud waiting for the current frame
+    float transform[12];                         // row-major 3x4 into output_frame_
+    size_t offset, count;                        // slot of the cloud and points written into it
+  };
+
+  void input_callback(const sensor_msgs::PointCloud2::ConstPtr& cloud_msg, size_t index)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // a second cloud of the same input or a cloud past the window closes the frame with whatever arrived
+    if (frame_open_ &&
+        (inputs_[index].pending || (cloud_msg->header.stamp - frame_start_).toSec() > time_window_))
+    {
+      frame_callback_();
+    }
+    if (!frame_open_)
+    {
+      frame_open_ = true;
+      frame_start_ = cloud_msg->header.stamp;
+      frame_deadline_ = ros::Time::now() + ros::Duration(time_window_);
+      timer_.stop();
+      timer_.setPeriod(ros::Duration(time_window_));
+      timer_.start();
+    }
+
+    inputs_[index].pending = cloud_msg;
+
+    for (size_t i = 0; i < inputs_.size(); ++i)
+    {
+      if (!inputs_[i].pending)
+      {
+        return;
+      }
+    }
+    frame_callback_();
+  }
+
+  // closes the frame when the remaining inputs did not arrive within the window
+  void timer_callback(const ros::TimerEvent&)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // an event of an earlier frame can still be queued when the timer is rearmed
+    if (frame_open_ && frame_deadline_ <= ros::Time::now())
+    {
+      frame_callback_();
+    }
+  }
+
+  bool lookup_transform(Input& input)
+  {
+    const std::string& frame_id = input.pending->header.frame_id;
+    if (output_frame_.empty() || output_frame_ == frame_id)
+    {
+      const float identity[12] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0 };
+      std::memcpy(input.transform, identity, sizeof(identity));
+      return true;
+    }
+
+    try
+    {
+      tf::StampedTransform transform;
+      tf_listener_->waitForTransform(output_frame_, frame_id, ros::Time(0), ros::Duration(1.0));
+      tf_listener_->lookupTransform(output_frame_, frame_id, ros::Time(0), transform);
+      const tf::Matrix3x3& basis = transform.getBasis();
+      const tf::Vector3& origin = transform.getOrigin();
+      for (int r = 0; r < 3; ++r)
+      {
+        input.transform[r * 4 + 0] = basis[r][0];
+        input.transform[r * 4 + 1] = basis[r][1];
+        input.transform[r * 4 + 2] = basis[r][2];
+        input.transform[r * 4 + 3] = origin[r];
+      }
+    }
+    catch (tf::TransformException& ex)
+    {
+      ROS_ERROR("%s", ex.what());
+      return false;
+    }
+    return true;
+  }
+
+  template <typename Keep, typename Write>
+  size_t transform_cloud(const sensor_msgs::PointCloud2& cloud, const float* transform, size_t offset,
+                         const Keep& keep, const Write& write) const
+  {
+    int offset_x = -1, offset_y = -1, offset_z = -1, offset_intensity = -1;
+    uint8_t intensity_type = 0;
+    for (size_t i = 0; i < cloud.fields.size(); ++i)
+    {
+      const sensor_msgs::PointField& field = cloud.fields[i];
+      if (field.name == "x" && field.datatype == sensor_msgs::PointField::FLOAT32)
+        offset_x = field.offset;
+      else if (field.name == "y" && field.datatype == sensor_msgs::PointField::FLOAT32)
+        offset_y = field.offset;
+      else if (field.name == "z" && field.datatype == sensor_msgs::PointField::FLOAT32)
+        offset_z = field.offset;
+      else if (field.name == "intensity")
+      {
+        offset_intensity = field.offset;
+        intensity_type = field.datatype;
+      }
+    }
+    if (offset_x < 0 || offset_y < 0 || offset_z < 0 || cloud.is_bigendian)
+    {
+      ROS_ERROR_THROTTLE(1.0, "%s: unsupported cloud layout in frame %s", name_.c_str(),
+                         cloud.header.frame_id.c_str());
+      return 0;
+    }
+
+    size_t count = 0;
+    for (uint32_t row = 0; row < cloud.height; ++row)
+    {
+      const uint8_t* point = &cloud.data[row * cloud.row_step];
+      for (uint32_t col = 0; col < cloud.width; ++col, point += cloud.point_step)
+      {
+        float x, y, z;
+        std::memcpy(&x, point + offset_x, sizeof(float));
+        std::memcpy(&y, point + offset_y, sizeof(float));
+        std::memcpy(&z, point + offset_z, sizeof(float));
+        if (!std::isfinite(x) || !std::isfinite(y) || !std::isfinite(z))
+          continue;
+
+        const float out_x = transform[0] * x + transform[1] * y + transform[2] * z + transform[3];
+        const float out_y = transform[4] * x + transform[5] * y + transform[6] * z + transform[7];
+        const float out_z = transform[8] * x + transform[9] * y + transform[10] * z + transform[11];
+        if (!keep(out_x, out_y, out_z))
+          continue;
+
+        float intensity = 0.0f;
+        if (intensity_type == sensor_msgs::PointField::FLOAT32)
+          std::memcpy(&intensity, point + offset_intensity, sizeof(float));
+        else if (intensity_type == sensor_msgs::PointField::UINT8)
+          intensity = point[offset_intensity];
+        else if (intensity_type == sensor_msgs::PointField::UINT16)
+        {
+          uint16_t value;
+          std::memcpy(&value, point + offset_intensity, sizeof(value));
+          intensity = value;
+        }
+
+        write(offset + count, out_x, out_y, out_z, intensity);
+        ++count;
+      }
+    }
+    return count;
+  }
+
+  std::vector<Input> inputs_;
+  double time_window_;
+  bool frame_open_;
+  ros::Time frame_start_;     // stamp of the first cloud
+  ros::Time frame_deadline_;  // reception of the first cloud plus the time window
+  ros::Timer timer_;
+  std::mutex mutex_;
+  std::string output_frame_;
+  std::string name_;
+  boost::function<void()> frame_callback_;
+  tf::TransformListener* tf_listener_;
+};
+
+#endif  // POINTS_FRAME_H
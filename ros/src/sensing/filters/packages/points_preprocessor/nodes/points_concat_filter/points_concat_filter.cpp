@@ -5,6 +5,10 @@
  * Author       : Akihito OHSATO
  */
 
+#include <cstring>
+#include <string>
+#include <vector>
+
 #include <ros/ros.h>
 #include <sensor_msgs/PointCloud2.h>
 #include <message_filters/subscriber.h>
@@ -18,6 +22,7 @@
 #include <tf/tf.h>
 #include <tf/transform_listener.h>
 #include "autoware_msgs/ConfigPointsConcatFilter.h"
+#include "points_frame.h"
 
 class PointsConcatFilter
 {
@@ -38,27 +43,63 @@ private:
   tf::TransformListener tf_listener_;
   std::string output_frame_;
 
+  PointsFrame frame_;            // N-input mode
+  PointCloudMsgT output_cloud_;  // kept between frames to avoid reallocating
+
   void config_callback(const autoware_msgs::ConfigPointsConcatFilter::ConstPtr& config_msg);
   void pointcloud_callback(const PointCloudMsgT::ConstPtr& cloud_msg1, const PointCloudMsgT::ConstPtr& cloud_msg2);
+  void publish_frame();
 };
 
 PointsConcatFilter::PointsConcatFilter()
-  : node_handle_(), private_node_handle_("~"), tf_listener_(), output_frame_("lidar_frame")
+  : node_handle_()
+  , private_node_handle_("~")
+  , tf_listener_()
+  , output_frame_("lidar_frame")
 {
   private_node_handle_.param("output_frame", output_frame_, output_frame_);
   config_subscriber_ = node_handle_.subscribe<autoware_msgs::ConfigPointsConcatFilter>(
       "/config/points_concat_filter", 1, &PointsConcatFilter::config_callback, this);
+  cloud_publisher_ = node_handle_.advertise<PointCloudMsgT>("/points_concat", 1);
+
+  // N-input mode: any number of lidars, gathered by time window instead of ApproximateTime
+  std::vector<std::string> input_topics;
+  double time_window = 0.05;
+  private_node_handle_.param("input_topics", input_topics, input_topics);
+  private_node_handle_.param("time_window", time_window, time_window);
+  if (!input_topics.empty())
+  {
+    frame_.setOutputFrame(output_frame_);
+    frame_.subscribe(node_handle_, input_topics, time_window, tf_listener_,
+                     boost::bind(&PointsConcatFilter::publish_frame, this), "points_concat_filter");
+
+    sensor_msgs::PointField field;
+    field.datatype = sensor_msgs::PointField::FLOAT32;
+    field.count = 1;
+    const char* names[] = { "x", "y", "z", "intensity" };
+    for (int i = 0; i < 4; ++i)
+    {
+      field.name = names[i];
+      field.offset = i * sizeof(float);
+      output_cloud_.fields.push_back(field);
+    }
+    output_cloud_.point_step = 4 * sizeof(float);
+    output_cloud_.is_bigendian = false;
+    output_cloud_.is_dense = true;
+    return;
+  }
+
   cloud_subscriber1_ = new message_filters::Subscriber<PointCloudMsgT>(node_handle_, "/lidar0/points_raw", 1);
   cloud_subscriber2_ = new message_filters::Subscriber<PointCloudMsgT>(node_handle_, "/lidar1/points_raw", 1);
   cloud_synchronizer_ =
       new message_filters::Synchronizer<SyncPolicyT>(SyncPolicyT(10), *cloud_subscriber1_, *cloud_subscriber2_);
   cloud_synchronizer_->registerCallback(boost::bind(&PointsConcatFilter::pointcloud_callback, this, _1, _2));
-  cloud_publisher_ = node_handle_.advertise<PointCloudMsgT>("/points_concat", 1);
 }
 
 void PointsConcatFilter::config_callback(const autoware_msgs::ConfigPointsConcatFilter::ConstPtr& config_msg)
 {
   output_frame_ = config_msg->output_frame;
+  frame_.setOutputFrame(output_frame_);
 }
 
 void PointsConcatFilter::pointcloud_callback(const PointCloudMsgT::ConstPtr& cloud_msg1,
@@ -102,6 +143,36 @@ void PointsConcatFilter::pointcloud_callback(const PointCloudMsgT::ConstPtr& clo
   cloud_publisher_.publish(cloud_concatenated);
 }
 
+void PointsConcatFilter::publish_frame()
+{
+  std_msgs::Header header;
+  size_t total;
+  if (!frame_.begin(header, total))
+  {
+    return;
+  }
+
+  // every input writes its own slot, then the slots are packed
+  output_cloud_.data.resize(total * output_cloud_.point_step);
+  uint8_t* data = output_cloud_.data.data();
+  if (total > 0)
+  {
+    frame_.transform([](float, float, float) { return true; },
+                     [data](size_t index, float x, float y, float z, float intensity) {
+                       const float point[4] = { x, y, z, intensity };
+                       std::memcpy(data + index * sizeof(point), point, sizeof(point));
+                     });
+  }
+  size_t count = frame_.end(data, output_cloud_.point_step);
+
+  output_cloud_.data.resize(count * output_cloud_.point_step);
+  output_cloud_.header = header;
+  output_cloud_.width = count;
+  output_cloud_.height = 1;
+  output_cloud_.row_step = output_cloud_.data.size();
+  cloud_publisher_.publish(output_cloud_);
+}
+
 int main(int argc, char** argv)
 {
   ros::init(argc, argv, "points_concat_filter");
@@ -0,0 +1,216 @@
+/*
+ * points_pipeline_nodelet.cpp
+ *
+ * Concat, space filter, ray ground filter and voxel grid filter as a single
+ * nodelet. Clouds are received and published as shared pointers, so inside a
+ * nodelet manager (e.g. together with velodyne_pointcloud/CloudNodelet) no
+ * stage serializes or copies the cloud.
+ *
+ * The concat transform and the space filter crop are fused into the pass that
+ * reads the input clouds; ground removal and downsampling then run on the
+ * resulting PointCloud<PointXYZI> without any conversion in between.
+ */
+
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#include <ros/ros.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <pcl/point_types.h>
+#include <pcl_conversions/pcl_conversions.h>
+#include <tf/transform_listener.h>
+
+#include "ray_ground_filter.h"
+#include "points_downsampler.h"
+#include "points_frame.h"
+
+namespace points_preprocessor
+{
+class PointsPipelineNodelet : public nodelet::Nodelet
+{
+public:
+  PointsPipelineNodelet();
+
+private:
+  typedef pcl::PointXYZI PointT;
+  typedef pcl::PointCloud<PointT> PointCloudT;
+  typedef sensor_msgs::PointCloud2 PointCloudMsgT;
+
+  virtual void onInit();
+  void process_frame();
+  void publish_cloud(const ros::Publisher& publisher, const PointCloudT& cloud, const std_msgs::Header& header);
+
+  boost::shared_ptr<tf::TransformListener> tf_listener_;
+  ros::Publisher points_publisher_, ground_publisher_;
+  PointsFrame frame_;
+
+  // space filter
+  bool vertical_removal_, lateral_removal_;
+  double below_distance_, above_distance_, left_distance_, right_distance_;
+
+  // ray ground filter
+  bool ground_removal_;
+  boost::shared_ptr<RayGroundFilter> ground_filter_;
+
+  // voxel grid filter
+  double leaf_size_;
+  VoxelDownsampler downsampler_;
+
+  // kept between frames to avoid reallocating
+  PointCloudT cropped_cloud_, ground_cloud_, no_ground_cloud_, filtered_cloud_;
+};
+
+PointsPipelineNodelet::PointsPipelineNodelet()
+  : vertical_removal_(true)
+  , lateral_removal_(false)
+  , below_distance_(-1.5)
+  , above_distance_(0.5)
+  , left_distance_(5.0)
+  , right_distance_(5.0)
+  , ground_removal_(true)
+  , leaf_size_(0.0)
+{
+}
+
+void PointsPipelineNodelet::onInit()
+{
+  ros::NodeHandle& node_handle = getNodeHandle();
+  ros::NodeHandle& private_node_handle = getPrivateNodeHandle();
+
+  std::vector<std::string> input_topics;
+  std::string output_frame;
+  double time_window;
+  private_node_handle.param("input_topics", input_topics, input_topics);
+  if (input_topics.empty())
+  {
+    input_topics.push_back("/points_raw");
+  }
+  private_node_handle.param("output_frame", output_frame, std::string(""));
+  private_node_handle.param("time_window", time_window, 0.05);
+  if (input_topics.size() > 1 && output_frame.empty())
+  {
+    output_frame = "lidar_frame";
+    NODELET_WARN("points_pipeline: output_frame not set for %zu inputs, using %s", input_topics.size(),
+                 output_frame.c_str());
+  }
+
+  private_node_handle.param("vertical_removal", vertical_removal_, vertical_removal_);
+  private_node_handle.param("below_distance", below_distance_, below_distance_);
+  private_node_handle.param("above_distance", above_distance_, above_distance_);
+  private_node_handle.param("lateral_removal", lateral_removal_, lateral_removal_);
+  private_node_handle.param("left_distance", left_distance_, left_distance_);
+  private_node_handle.param("right_distance", right_distance_, right_distance_);
+
+  private_node_handle.param("ground_removal", ground_removal_, ground_removal_);
+  if (ground_removal_)
+  {
+    autoware_msgs::ConfigRayGroundFilter config;
+    private_node_handle.param("sensor_height", config.sensor_height, 1.7);
+    private_node_handle.param("general_max_slope", config.general_max_slope, 3.0);
+    private_node_handle.param("local_max_slope", config.local_max_slope, 5.0);
+    private_node_handle.param("radial_divider_angle", config.radial_divider_angle, 0.1);
+    private_node_handle.param("concentric_divider_distance", config.concentric_divider_distance, 0.01);
+    private_node_handle.param("min_height_threshold", config.min_height_threshold, 0.05);
+    private_node_handle.param("clipping_height", config.clipping_height, 0.2);
+    private_node_handle.param("min_point_distance", config.min_point_distance, 1.85);
+    private_node_handle.param("reclass_distance_threshold", config.reclass_distance_threshold, 0.2);
+    ground_filter_.reset(new RayGroundFilter);
+    ground_filter_->Configure(config);
+  }
+
+  std::string downsample_mode;
+  double measurement_range;
+  private_node_handle.param("leaf_size", leaf_size_, leaf_size_);
+  private_node_handle.param("downsample_mode", downsample_mode, std::string("centroid"));
+  private_node_handle.param("measurement_range", measurement_range, -1.0);
+  if (!downsampler_.setMode(downsample_mode))
+  {
+    NODELET_ERROR("points_pipeline: unknown downsample_mode %s, using centroid", downsample_mode.c_str());
+  }
+  downsampler_.setLeafSize(leaf_size_);
+  downsampler_.setRange(0.0, measurement_range);
+
+  points_publisher_ = node_handle.advertise<PointCloudMsgT>("/points_filtered", 1);
+  ground_publisher_ = node_handle.advertise<PointCloudMsgT>("/points_ground", 1);
+  tf_listener_.reset(new tf::TransformListener);
+
+  // a single input is processed as it arrives
+  frame_.setOutputFrame(output_frame);
+  frame_.subscribe(node_handle, input_topics, time_window, *tf_listener_,
+                   boost::bind(&PointsPipelineNodelet::process_frame, this), "points_pipeline");
+}
+
+void PointsPipelineNodelet::process_frame()
+{
+  std_msgs::Header header;
+  size_t total;
+  if (!frame_.begin(header, total))
+  {
+    return;
+  }
+
+  // concat + transform + space filter, one pass per input
+  const bool vertical_removal = vertical_removal_, lateral_removal = lateral_removal_;
+  const float below = below_distance_, above = above_distance_;
+  const float left = left_distance_, right = -right_distance_;
+  cropped_cloud_.points.resize(total);
+  PointT* points = cropped_cloud_.points.data();
+  if (total > 0)
+  {
+    frame_.transform(
+        [=](float x, float y, float z) {
+          return (!vertical_removal || (below <= z && z <= above)) && (!lateral_removal || (right <= y && y <= left));
+        },
+        [points](size_t index, float x, float y, float z, float intensity) {
+          PointT& p = points[index];
+          p.x = x;
+          p.y = y;
+          p.z = z;
+          p.intensity = intensity;
+        });
+  }
+  size_t count = frame_.end(reinterpret_cast<uint8_t*>(points), sizeof(PointT));
+  cropped_cloud_.points.resize(count);
+  cropped_cloud_.header = pcl_conversions::toPCL(header);
+  cropped_cloud_.width = count;
+  cropped_cloud_.height = 1;
+  cropped_cloud_.is_dense = true;
+
+  // ground removal
+  const PointCloudT* cloud = &cropped_cloud_;
+  if (ground_removal_)
+  {
+    ground_filter_->SegmentGround(cropped_cloud_, ground_cloud_, no_ground_cloud_);
+    cloud = &no_ground_cloud_;
+    if (ground_publisher_.getNumSubscribers() > 0)
+    {
+      publish_cloud(ground_publisher_, ground_cloud_, header);
+    }
+  }
+
+  // downsampling
+  if (leaf_size_ > 0.0)
+  {
+    downsampler_.filter(*cloud, filtered_cloud_);
+    cloud = &filtered_cloud_;
+  }
+
+  publish_cloud(points_publisher_, *cloud, header);
+}
+
+// Publishes through a shared pointer so nodelets in the same manager receive it without serialization
+void PointsPipelineNodelet::publish_cloud(const ros::Publisher& publisher, const PointCloudT& cloud,
+                                          const std_msgs::Header& header)
+{
+  sensor_msgs::PointCloud2Ptr cloud_msg(new sensor_msgs::PointCloud2);
+  pcl::toROSMsg(cloud, *cloud_msg);
+  cloud_msg->header = header;
+  publisher.publish(cloud_msg);
+}
+
+}  // namespace points_preprocessor
+
+PLUGINLIB_EXPORT_CLASS(points_preprocessor::PointsPipelineNodelet, nodelet::Nodelet)
@@ -34,6 +34,7 @@
 
 #include <iostream>
 #include <algorithm>
+#include <cstdint>
 #include <vector>
 #include <ros/ros.h>
 #include <sensor_msgs/PointCloud2.h>
@@ -75,6 +76,8 @@ private:
 	double              min_point_distance_;//minimum distance from the origin to consider a point as valid
 	double              reclass_distance_threshold_;//distance between points at which re classification will occur
 
+	bool                use_polar_grid_;//bin the points into rays with a counting sort and classify the rays in parallel
+
 	size_t              radial_dividers_num_;
 	size_t              concentric_dividers_num_;
 
@@ -99,6 +102,35 @@ private:
 	};
 	typedef std::vector<PointXYZIRTColor> PointCloudXYZIRTColor;
 
+	struct RayState
+	{
+		float prev_radius;
+		float prev_height;
+		bool  prev_ground;
+	};
+
+	struct GridPoint
+	{
+		float    radius;
+		float    height;
+		uint32_t index; //index of this point in the source pointcloud
+	};
+
+	enum GridLabel
+	{
+		GRID_FILTERED = 0,
+		GRID_GROUND,
+		GRID_NO_GROUND
+	};
+
+	//polar grid, kept between scans to avoid reallocating
+	std::vector<float>    grid_radius_;   //XY distance of every input point
+	std::vector<uint32_t> grid_ray_;      //ray of every input point, radial_dividers_num_ if the point was filtered out
+	std::vector<uint32_t> grid_ray_start_;//first slot of each ray in grid_points_, plus one end marker
+	std::vector<uint32_t> grid_ray_slot_; //next free slot of each ray while binning
+	std::vector<GridPoint> grid_points_;  //points grouped by ray, ordered by radius within each ray
+	std::vector<uint8_t>  grid_labels_;   //classification of every input point
+
 	void update_config_params(const autoware_msgs::ConfigRayGroundFilter::ConstPtr& param);
 
 	void publish_cloud(const ros::Publisher& in_publisher,
@@ -129,6 +161,33 @@ private:
 	                        pcl::PointIndices& out_no_ground_indices);
 	
 
+	/*!
+	 * Classifies the next point along a ray, walking outwards from the sensor
+	 * @param in_radius Distance of the point from the origin on the XY plane
+	 * @param in_height Height of the point
+	 * @param in_local_slope_tan Tangent of local_max_slope_
+	 * @param in_general_slope_tan Tangent of general_max_slope_
+	 * @param io_ray Previous point in the ray, updated with the current one
+	 * @return true if the point is ground
+	 */
+	bool ClassifyRayPoint(float in_radius,
+	                      float in_height,
+	                      double in_local_slope_tan,
+	                      double in_general_slope_tan,
+	                      RayState& io_ray) const;
+
+	/*!
+	 * Sort-free alternative to ClipCloud, RemovePointsUpTo, ConvertXYZIToRTZColor and ClassifyPointCloud.
+	 * Points are binned into rays with a counting sort over the preallocated polar grid, using the column of
+	 * organized clouds as azimuth, and the rays are then ordered and classified in parallel.
+	 * @param in_cloud Input PointCloud
+	 * @param out_ground_cloud Resulting PointCloud with the points classified as ground
+	 * @param out_no_ground_cloud Resulting PointCloud with the points classified as not ground
+	 */
+	void ClassifyPolarGrid(const pcl::PointCloud<pcl::PointXYZI>& in_cloud,
+	                       pcl::PointCloud<pcl::PointXYZI>& out_ground_cloud,
+	                       pcl::PointCloud<pcl::PointXYZI>& out_no_ground_cloud);
+
 	/*!
 	 * Removes the points higher than a threshold
 	 * @param in_cloud_ptr PointCloud to perform Clipping
@@ -169,6 +228,22 @@ friend class RayGroundFilter_clipCloud_Test;
 public:
 	RayGroundFilter();
   void Run();
+
+	/*!
+	 * Sets the filter parameters when the filter is used outside of its node
+	 * @param in_config Parameters, with the same meaning as the node ones
+	 */
+	void Configure(const autoware_msgs::ConfigRayGroundFilter& in_config);
+
+	/*!
+	 * Splits a PointCloud in ground and not ground using the polar grid, without going through ROS
+	 * @param in_cloud Input PointCloud
+	 * @param out_ground_cloud Resulting PointCloud with the points classified as ground
+	 * @param out_no_ground_cloud Resulting PointCloud with the points classified as not ground
+	 */
+	void SegmentGround(const pcl::PointCloud<pcl::PointXYZI>& in_cloud,
+	                   pcl::PointCloud<pcl::PointXYZI>& out_ground_cloud,
+	                   pcl::PointCloud<pcl::PointXYZI>& out_no_ground_cloud);
 };
 
 #endif  // RAY_GROUND_FILTER_H_
@@ -52,6 +52,25 @@
 
 #include "ray_ground_filter.h"
 
+/*!
+ * atan2 approximation, accurate to about 1e-5 rad, well below any useful radial_divider_angle
+ */
+static inline float FastAtan2(float y, float x)
+{
+  float abs_x = fabsf(x);
+  float abs_y = fabsf(y);
+  float max = std::max(abs_x, abs_y);
+  if (max == 0.f)
+  { return 0.f; }
+  float a = std::min(abs_x, abs_y) / max;
+  float s = a * a;
+  float r = ((((-0.0117212f * s + 0.05265332f) * s - 0.11643287f) * s + 0.19354346f) * s - 0.33262347f) * s * a + 0.99997726f * a;
+  if (abs_y > abs_x) { r = (float) M_PI_2 - r; }
+  if (x < 0) { r = (float) M_PI - r; }
+  if (y < 0) { r = -r; }
+  return r;
+}
+
 void RayGroundFilter::update_config_params(const autoware_msgs::ConfigRayGroundFilter::ConstPtr& param)
 {
   sensor_height_          = param->sensor_height;
@@ -145,74 +164,203 @@ void RayGroundFilter::ClassifyPointCloud(std::vector<PointCloudXYZIRTColor>& in_
 {
   out_ground_indices.indices.clear();
   out_no_ground_indices.indices.clear();
-#pragma omp for
+  const double local_slope_tan = tan(DEG2RAD(local_max_slope_));
+  const double general_slope_tan = tan(DEG2RAD(general_max_slope_));
   for (size_t i=0; i < in_radial_ordered_clouds.size(); i++)//sweep through each radial division
   {
-    float prev_radius = 0.f;
-    float prev_height = - sensor_height_;
-    bool prev_ground = false;
-    bool current_ground = false;
+    RayState ray = {0.f, (float) -sensor_height_, false};
     for (size_t j=0; j < in_radial_ordered_clouds[i].size(); j++)//loop through each point in the radial div
     {
-      float points_distance = in_radial_ordered_clouds[i][j].radius - prev_radius;
-      float height_threshold = tan(DEG2RAD(local_max_slope_)) * points_distance;
-      float current_height = in_radial_ordered_clouds[i][j].point.z;
-      float general_height_threshold = tan(DEG2RAD(general_max_slope_)) * in_radial_ordered_clouds[i][j].radius;
-
-      //for points which are very close causing the height threshold to be tiny, set a minimum value
-      if (points_distance > concentric_divider_distance_ && height_threshold < min_height_threshold_)
-      { height_threshold = min_height_threshold_; }
-
-      //check current point height against the LOCAL threshold (previous point)
-      if (current_height <= (prev_height + height_threshold)
-          && current_height >= (prev_height - height_threshold)
-         )
+      if (ClassifyRayPoint(in_radial_ordered_clouds[i][j].radius, in_radial_ordered_clouds[i][j].point.z,
+                           local_slope_tan, general_slope_tan, ray))
       {
-        //Check again using general geometry (radius from origin) if previous points wasn't ground
-        if (!prev_ground)
-        {
-          if(current_height <= (-sensor_height_ + general_height_threshold)
-              && current_height >= (-sensor_height_ - general_height_threshold))
-          {
-            current_ground = true;
-          }
-          else
-          {current_ground = false;}
-        }
-        else
-        {
-          current_ground = true;
-        }
+        out_ground_indices.indices.push_back(in_radial_ordered_clouds[i][j].original_index);
       }
       else
       {
-        //check if previous point is too far from previous one, if so classify again
-        if (points_distance > reclass_distance_threshold_ &&
-            (current_height <= (-sensor_height_ + height_threshold)
-             && current_height >= (-sensor_height_ - height_threshold))
-           )
-        {
-          current_ground = true;
-        }
-        else
-        {current_ground = false;}
+        out_no_ground_indices.indices.push_back(in_radial_ordered_clouds[i][j].original_index);
       }
+    }
+  }
+}
 
-      if (current_ground)
+bool RayGroundFilter::ClassifyRayPoint(float in_radius,
+    float in_height,
+    double in_local_slope_tan,
+    double in_general_slope_tan,
+    RayState& io_ray) const
+{
+  bool current_ground = false;
+  float points_distance = in_radius - io_ray.prev_radius;
+  float height_threshold = in_local_slope_tan * points_distance;
+  float current_height = in_height;
+  float general_height_threshold = in_general_slope_tan * in_radius;
+
+  //for points which are very close causing the height threshold to be tiny, set a minimum value
+  if (points_distance > concentric_divider_distance_ && height_threshold < min_height_threshold_)
+  { height_threshold = min_height_threshold_; }
+
+  //check current point height against the LOCAL threshold (previous point)
+  if (current_height <= (io_ray.prev_height + height_threshold)
+      && current_height >= (io_ray.prev_height - height_threshold)
+     )
+  {
+    //Check again using general geometry (radius from origin) if previous points wasn't ground
+    if (!io_ray.prev_ground)
+    {
+      if(current_height <= (-sensor_height_ + general_height_threshold)
+          && current_height >= (-sensor_height_ - general_height_threshold))
       {
-        out_ground_indices.indices.push_back(in_radial_ordered_clouds[i][j].original_index);
-        prev_ground=true;
+        current_ground = true;
       }
       else
+      {current_ground = false;}
+    }
+    else
+    {
+      current_ground = true;
+    }
+  }
+  else
+  {
+    //check if previous point is too far from previous one, if so classify again
+    if (points_distance > reclass_distance_threshold_ &&
+        (current_height <= (-sensor_height_ + height_threshold)
+         && current_height >= (-sensor_height_ - height_threshold))
+       )
+    {
+      current_ground = true;
+    }
+    else
+    {current_ground = false;}
+  }
+
+  io_ray.prev_ground = current_ground;
+  io_ray.prev_radius = in_radius;
+  io_ray.prev_height = in_height;
+  return current_ground;
+}
+
+void RayGroundFilter::ClassifyPolarGrid(const pcl::PointCloud<pcl::PointXYZI>& in_cloud,
+    pcl::PointCloud<pcl::PointXYZI>& out_ground_cloud,
+    pcl::PointCloud<pcl::PointXYZI>& out_no_ground_cloud)
+{
+  const size_t points_num = in_cloud.points.size();
+  const uint32_t rays_num = radial_dividers_num_;
+  const bool organized = in_cloud.height > 1 && in_cloud.width > 0;
+  const float rays_per_degree = 1.0 / radial_divider_angle_;
+
+  grid_radius_.resize(points_num);
+  grid_ray_.resize(points_num);
+  grid_labels_.assign(points_num, GRID_FILTERED);
+  grid_ray_start_.assign(rays_num + 1, 0);
+
+  //ray of every point, clipping and removing close points on the way
+#pragma omp parallel for
+  for (size_t i = 0; i < points_num; i++)
+  {
+    const pcl::PointXYZI& point = in_cloud.points[i];
+    float radius = sqrtf(point.x*point.x + point.y*point.y);
+    grid_radius_[i] = radius;
+    if (!std::isfinite(radius) || !std::isfinite(point.z)
+        || point.z > clipping_height_ || radius < min_point_distance_)
+    {
+      grid_ray_[i] = rays_num;
+      continue;
+    }
+
+    uint32_t ray;
+    if (organized)
+    {
+      //columns of an organized scan are already in azimuth order
+      ray = (uint64_t) (i % in_cloud.width) * rays_num / in_cloud.width;
+    }
+    else
+    {
+      float theta = FastAtan2(point.y, point.x) * (float) (180 / M_PI);
+      if (theta < 0){ theta+=360; }
+      ray = (uint32_t) (theta * rays_per_degree);
+    }
+    grid_ray_[i] = std::min(ray, rays_num - 1);
+  }
+
+  //counting sort by ray, keeping scan order within each ray
+  for (size_t i = 0; i < points_num; i++)
+  {
+    if (grid_ray_[i] < rays_num)
+    { grid_ray_start_[grid_ray_[i] + 1]++; }
+  }
+  for (uint32_t r = 0; r < rays_num; r++)
+  {
+    grid_ray_start_[r + 1] += grid_ray_start_[r];
+  }
+  grid_points_.resize(grid_ray_start_[rays_num]);
+  grid_ray_slot_.assign(grid_ray_start_.begin(), grid_ray_start_.end() - 1);
+  for (size_t i = 0; i < points_num; i++)
+  {
+    if (grid_ray_[i] < rays_num)
+    {
+      GridPoint& grid_point = grid_points_[grid_ray_slot_[grid_ray_[i]]++];
+      grid_point.radius = grid_radius_[i];
+      grid_point.height = in_cloud.points[i].z;
+      grid_point.index = i;
+    }
+  }
+
+  //order and classify each ray, rays only touch their own points
+  const double local_slope_tan = tan(DEG2RAD(local_max_slope_));
+  const double general_slope_tan = tan(DEG2RAD(general_max_slope_));
+#pragma omp parallel for schedule(dynamic, 64)
+  for (uint32_t r = 0; r < rays_num; r++)
+  {
+    GridPoint* begin = grid_points_.data() + grid_ray_start_[r];
+    GridPoint* end = grid_points_.data() + grid_ray_start_[r + 1];
+
+    //rays hold a few dozen points at the usual divider angles
+    if (end - begin <= 128)
+    {
+      for (GridPoint* p = begin + 1; p < end; p++)
       {
-        out_no_ground_indices.indices.push_back(in_radial_ordered_clouds[i][j].original_index);
-        prev_ground = false;
+        GridPoint grid_point = *p;
+        GridPoint* q = p;
+        for (; q > begin && (q - 1)->radius > grid_point.radius; q--)
+        { *q = *(q - 1); }
+        *q = grid_point;
       }
+    }
+    else
+    {
+      std::sort(begin, end,
+          [](const GridPoint& a, const GridPoint& b){ return a.radius < b.radius; });
+    }
 
-      prev_radius = in_radial_ordered_clouds[i][j].radius;
-      prev_height = in_radial_ordered_clouds[i][j].point.z;
+    RayState ray = {0.f, (float) -sensor_height_, false};
+    for (GridPoint* p = begin; p < end; p++)
+    {
+      bool ground = ClassifyRayPoint(p->radius, p->height, local_slope_tan, general_slope_tan, ray);
+      grid_labels_[p->index] = ground ? GRID_GROUND : GRID_NO_GROUND;
     }
   }
+
+  out_ground_cloud.points.clear();
+  out_no_ground_cloud.points.clear();
+  out_ground_cloud.points.reserve(points_num);
+  out_no_ground_cloud.points.reserve(points_num);
+  for (size_t i = 0; i < points_num; i++)
+  {
+    if (grid_labels_[i] == GRID_GROUND)
+    { out_ground_cloud.points.push_back(in_cloud.points[i]); }
+    else if (grid_labels_[i] == GRID_NO_GROUND)
+    { out_no_ground_cloud.points.push_back(in_cloud.points[i]); }
+  }
+  out_ground_cloud.header = in_cloud.header;
+  out_ground_cloud.width = out_ground_cloud.points.size();
+  out_ground_cloud.height = 1;
+  out_ground_cloud.is_dense = true;
+  out_no_ground_cloud.header = in_cloud.header;
+  out_no_ground_cloud.width = out_no_ground_cloud.points.size();
+  out_no_ground_cloud.height = 1;
+  out_no_ground_cloud.is_dense = true;
 }
 
 /*!
@@ -300,6 +448,20 @@ void RayGroundFilter::CloudCallback(const sensor_msgs::PointCloud2ConstPtr &in_s
   pcl::PointCloud<pcl::PointXYZI>::Ptr current_sensor_cloud_ptr(new pcl::PointCloud<pcl::PointXYZI>);
   pcl::fromROSMsg(*in_sensor_cloud, *current_sensor_cloud_ptr);
 
+  radial_dividers_num_ = ceil(360 / radial_divider_angle_);
+
+  if (use_polar_grid_)
+  {
+    pcl::PointCloud<pcl::PointXYZI>::Ptr ground_cloud_ptr(new pcl::PointCloud<pcl::PointXYZI>);
+    pcl::PointCloud<pcl::PointXYZI>::Ptr no_ground_cloud_ptr(new pcl::PointCloud<pcl::PointXYZI>);
+
+    ClassifyPolarGrid(*current_sensor_cloud_ptr, *ground_cloud_ptr, *no_ground_cloud_ptr);
+
+    publish_cloud(ground_points_pub_, ground_cloud_ptr, in_sensor_cloud->header);
+    publish_cloud(groundless_points_pub_, no_ground_cloud_ptr, in_sensor_cloud->header);
+    return;
+  }
+
   pcl::PointCloud<pcl::PointXYZI>::Ptr clipped_cloud_ptr(new pcl::PointCloud<pcl::PointXYZI>);
 
   //remove points above certain point
@@ -318,8 +480,6 @@ void RayGroundFilter::CloudCallback(const sensor_msgs::PointCloud2ConstPtr &in_s
   std::vector<pcl::PointIndices> closest_indices;
   std::vector<PointCloudXYZIRTColor> radial_ordered_clouds;
 
-  radial_dividers_num_ = ceil(360 / radial_divider_angle_);
-
   ConvertXYZIToRTZColor(filtered_cloud_ptr,
       organized_points,
       radial_division_indices,
@@ -339,8 +499,30 @@ void RayGroundFilter::CloudCallback(const sensor_msgs::PointCloud2ConstPtr &in_s
 
 }
 
-RayGroundFilter::RayGroundFilter():node_handle_("~")
+RayGroundFilter::RayGroundFilter():node_handle_("~"), use_polar_grid_(false)
+{
+}
+
+void RayGroundFilter::Configure(const autoware_msgs::ConfigRayGroundFilter& in_config)
 {
+  sensor_height_          = in_config.sensor_height;
+  general_max_slope_      = in_config.general_max_slope;
+  local_max_slope_        = in_config.local_max_slope;
+  radial_divider_angle_   = in_config.radial_divider_angle;
+  concentric_divider_distance_ = in_config.concentric_divider_distance;
+  min_height_threshold_   = in_config.min_height_threshold;
+  clipping_height_        = in_config.clipping_height;
+  min_point_distance_     = in_config.min_point_distance;
+  reclass_distance_threshold_ = in_config.reclass_distance_threshold;
+  use_polar_grid_ = true;
+}
+
+void RayGroundFilter::SegmentGround(const pcl::PointCloud<pcl::PointXYZI>& in_cloud,
+    pcl::PointCloud<pcl::PointXYZI>& out_ground_cloud,
+    pcl::PointCloud<pcl::PointXYZI>& out_no_ground_cloud)
+{
+  radial_dividers_num_ = ceil(360 / radial_divider_angle_);
+  ClassifyPolarGrid(in_cloud, out_ground_cloud, out_no_ground_cloud);
 }
 
 void RayGroundFilter::Run()
@@ -376,6 +558,8 @@ void RayGroundFilter::Run()
   ROS_INFO("min_point_distance[meters]: %f", min_point_distance_);
   node_handle_.param("reclass_distance_threshold", reclass_distance_threshold_, 0.2);//0.5 meters default
   ROS_INFO("reclass_distance_threshold[meters]: %f", reclass_distance_threshold_);
+  node_handle_.param("use_polar_grid", use_polar_grid_, false);
+  ROS_INFO("use_polar_grid: %d", use_polar_grid_);
 
 
 #if (CV_MAJOR_VERSION == 3)
@@ -642,8 +642,8 @@ void CalibrateCameraVelodyneChessboardBase::extractionResultSlot(pcl::PointCloud
 
 void CalibrateCameraVelodyneChessboardBase::projectPointsSlot()
 {
-    cv::Mat invR=cameraextrinsicmat(cv::Rect(0,0,3,3)).t();
-    cv::Mat invT=-invR*(cameraextrinsicmat(cv::Rect(3,0,1,3)));
+    PointsProjection projection;
+    projection.setMinDepth(0);
     int i,n=calibvelodynespoints.size();
     for(i=0;i<n;i++)
     {
@@ -652,28 +652,17 @@ void CalibrateCameraVelodyneChessboardBase::projectPointsSlot()
             continue;
         }
         cv::Mat tmpimage=calibimages[i].clone();
-        int j,m=calibvelodynespoints[i]->points.size();
-        cv::Mat camerapoints(m,3,CV_64F);
-        for(j=0;j<m;j++)
-        {
-            camerapoints.at<double>(j,0)=double(calibvelodynespoints[i]->points[j].x);
-            camerapoints.at<double>(j,1)=double(calibvelodynespoints[i]->points[j].y);
-            camerapoints.at<double>(j,2)=double(calibvelodynespoints[i]->points[j].z);
-        }
-        camerapoints=camerapoints*invR.t()+cv::Mat::ones(m,1,CV_64F)*invT.t();
-        std::vector<cv::Point2d> planepoints;
-        planepoints.resize(m);
+        projection.setCamera(cameraextrinsicmat,cameramat,distcoeff,cv::Size(tmpimage.cols,tmpimage.rows));
+        projection.project(calibvelodynespoints[i]->points.data(),calibvelodynespoints[i]->points.size(),sizeof(pcl::PointXYZI));
+        const std::vector<int32_t> & pixels=projection.pixels();
+        int j,m=pixels.size();
         for(j=0;j<m;j++)
         {
-            double tmpx=camerapoints.at<double>(j,0)/camerapoints.at<double>(j,2);
-            double tmpy=camerapoints.at<double>(j,1)/camerapoints.at<double>(j,2);
-            double r2=tmpx*tmpx+tmpy*tmpy;
-            double tmpdist=1+distcoeff.at<double>(0)*r2+distcoeff.at<double>(1)*r2*r2+distcoeff.at<double>(4)*r2*r2*r2;
-            planepoints[j].x=tmpx*tmpdist+2*distcoeff.at<double>(2)*tmpx*tmpy+distcoeff.at<double>(3)*(r2+2*tmpx*tmpx);
-            planepoints[j].y=tmpy*tmpdist+distcoeff.at<double>(2)*(r2+2*tmpy*tmpy)+2*distcoeff.at<double>(3)*tmpx*tmpy;
-            planepoints[j].x=cameramat.at<double>(0,0)*planepoints[j].x+cameramat.at<double>(0,2);
-            planepoints[j].y=cameramat.at<double>(1,1)*planepoints[j].y+cameramat.at<double>(1,2);
-            cv::circle(tmpimage,planepoints[j],2,cv::Scalar(0,0,255));
+            if(pixels[j]<0)
+            {
+                continue;
+            }
+            cv::circle(tmpimage,cv::Point(pixels[j]%tmpimage.cols,pixels[j]/tmpimage.cols),2,cv::Scalar(0,0,255));
         }
         if(tmpimage.type()==CV_8UC3)
         {
@@ -30,6 +30,7 @@
 #include<nlopt.hpp>
 
 #include<rosinterface/rosinterface.h>
+#include<points_image/points_projection.hpp>
 #include<glviewer/glviewer.h>
 
 #include"selectionwidget.h"
@@ -0,0 +1,130 @@
+#ifndef _POINTS_PROJECTION_H_
+#define _POINTS_PROJECTION_H_
+
+/*
+ *  Copyright (c) 2015, Nagoya University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of Autoware nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdint.h>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include <sensor_msgs/PointCloud2.h>
+#include "autoware_msgs/PointsImage.h"
+
+/*
+ * Projects lidar points into a camera image and keeps the nearest point of
+ * every pixel. The camera model is the one used by points2image: a pinhole
+ * with radial (k1, k2, k3) and tangential (p1, p2) distortion.
+ *
+ * Points are transformed with a precomputed float 3x4 matrix and projected in
+ * SIMD batches split across threads; the per-pixel buffers are kept between
+ * scans and only the pixels touched by the previous scan are cleared.
+ */
+class PointsProjection
+{
+public:
+  PointsProjection();
+
+  // cameraExtrinsicMat is the camera pose in the lidar frame, as stored in the calibration file
+  void setCamera(const cv::Mat& cameraExtrinsicMat, const cv::Mat& cameraMat, const cv::Mat& distCoeff,
+                 const cv::Size& imageSize);
+
+  // lidarToCamera is a row-major 3x4 transform from the lidar frame into the camera frame
+  void setCamera(const float lidarToCamera[12], const cv::Mat& cameraMat, const cv::Mat& distCoeff,
+                 const cv::Size& imageSize);
+
+  // points with camera depth at or below minDepth are not projected (default 1.0 m)
+  void setMinDepth(float minDepth);
+
+  // 0 uses the OpenMP default
+  void setNumThreads(int numThreads);
+
+  // Projects count points of pointStep bytes starting with float x, y, z.
+  // Returns the number of points that fall inside the image.
+  size_t project(const void* points, size_t count, size_t pointStep);
+
+  // Same for a PointCloud2 with contiguous float x, y, z fields.
+  size_t project(const sensor_msgs::PointCloud2& cloud);
+
+  // pixel (row * width + col) of every point of the last projection, -1 outside the image
+  const std::vector<int32_t>& pixels() const
+  {
+    return pixels_;
+  }
+
+  // camera depth of every point of the last projection
+  const std::vector<float>& depths() const
+  {
+    return depths_;
+  }
+
+  // index of the nearest point of every pixel, -1 for empty pixels
+  const std::vector<int32_t>& nearest() const
+  {
+    return nearest_;
+  }
+
+  // pixels with at least one point, in the order they were first hit
+  const std::vector<int32_t>& hitPixels() const
+  {
+    return hit_pixels_;
+  }
+
+  // CV_32FC1 depth of the nearest point of every pixel in meters, 0 for empty pixels
+  const cv::Mat& depthImage() const
+  {
+    return depth_image_;
+  }
+
+  // Fills a PointsImage from the last projection, which must be of cloud. Passing the
+  // same message every scan reuses its buffers and only clears the pixels set last time.
+  void toPointsImage(const sensor_msgs::PointCloud2& cloud, autoware_msgs::PointsImage& msg);
+
+private:
+  void projectRange(const uint8_t* points, size_t begin, size_t end, size_t pointStep);
+  void zBuffer();
+
+  float transform_[12];
+  float fx_, fy_, cx_, cy_;
+  float k1_, k2_, k3_, p1_, p2_;
+  int width_, height_;
+  float min_depth_;
+  int num_threads_;
+
+  std::vector<int32_t> pixels_;
+  std::vector<float> depths_;
+  std::vector<int32_t> nearest_;
+  std::vector<int32_t> hit_pixels_;
+  cv::Mat depth_image_;
+
+  const autoware_msgs::PointsImage* filled_msg_;
+  std::vector<int32_t> filled_pixels_;
+};
+
+#endif /* _POINTS_PROJECTION_H_ */
@@ -0,0 +1,355 @@
+/*
+ *  Copyright (c) 2015, Nagoya University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of Autoware nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+#include <cstring>
+#include <include/points_image/points_projection.hpp>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace
+{
+// points per thread work item
+const size_t BATCH_SIZE = 4096;
+}
+
+PointsProjection::PointsProjection()
+  : fx_(0), fy_(0), cx_(0), cy_(0), k1_(0), k2_(0), k3_(0), p1_(0), p2_(0), width_(0), height_(0), min_depth_(1.0f)
+  , num_threads_(0), filled_msg_(NULL)
+{
+  std::fill(transform_, transform_ + 12, 0.0f);
+}
+
+void PointsProjection::setCamera(const cv::Mat& cameraExtrinsicMat, const cv::Mat& cameraMat,
+                                 const cv::Mat& distCoeff, const cv::Size& imageSize)
+{
+  // the extrinsics hold the camera pose, points move into the camera frame by its inverse
+  cv::Mat invR = cameraExtrinsicMat(cv::Rect(0, 0, 3, 3)).t();
+  cv::Mat invT = -invR * (cameraExtrinsicMat(cv::Rect(3, 0, 1, 3)));
+  float lidarToCamera[12];
+  for (int row = 0; row < 3; row++)
+  {
+    for (int col = 0; col < 3; col++)
+    {
+      lidarToCamera[row * 4 + col] = invR.at<double>(row, col);
+    }
+    lidarToCamera[row * 4 + 3] = invT.at<double>(row);
+  }
+  setCamera(lidarToCamera, cameraMat, distCoeff, imageSize);
+}
+
+void PointsProjection::setCamera(const float lidarToCamera[12], const cv::Mat& cameraMat, const cv::Mat& distCoeff,
+                                 const cv::Size& imageSize)
+{
+  std::copy(lidarToCamera, lidarToCamera + 12, transform_);
+  fx_ = cameraMat.at<double>(0, 0);
+  fy_ = cameraMat.at<double>(1, 1);
+  cx_ = cameraMat.at<double>(0, 2);
+  cy_ = cameraMat.at<double>(1, 2);
+  k1_ = distCoeff.at<double>(0);
+  k2_ = distCoeff.at<double>(1);
+  p1_ = distCoeff.at<double>(2);
+  p2_ = distCoeff.at<double>(3);
+  k3_ = distCoeff.at<double>(4);
+
+  if (imageSize.width != width_ || imageSize.height != height_)
+  {
+    width_ = imageSize.width;
+    height_ = imageSize.height;
+    nearest_.assign(width_ * height_, -1);
+    hit_pixels_.clear();
+    depth_image_ = cv::Mat::zeros(height_, width_, CV_32FC1);
+  }
+}
+
+void PointsProjection::setMinDepth(float minDepth)
+{
+  min_depth_ = minDepth;
+}
+
+void PointsProjection::setNumThreads(int numThreads)
+{
+  num_threads_ = numThreads;
+}
+
+size_t PointsProjection::project(const sensor_msgs::PointCloud2& cloud)
+{
+  int x_offset = -1, y_offset = -1, z_offset = -1;
+  for (size_t i = 0; i < cloud.fields.size(); i++)
+  {
+    const sensor_msgs::PointField& field = cloud.fields[i];
+    if (field.datatype != sensor_msgs::PointField::FLOAT32)
+      continue;
+    if (field.name == "x")
+      x_offset = field.offset;
+    else if (field.name == "y")
+      y_offset = field.offset;
+    else if (field.name == "z")
+      z_offset = field.offset;
+  }
+  if (x_offset < 0 || y_offset != x_offset + 4 || z_offset != x_offset + 8 || cloud.is_bigendian)
+  {
+    return project(NULL, 0, 0);
+  }
+  return project(cloud.data.data() + x_offset, cloud.width * cloud.height, cloud.point_step);
+}
+
+size_t PointsProjection::project(const void* points, size_t count, size_t pointStep)
+{
+  pixels_.resize(count);
+  depths_.resize(count);
+
+  const uint8_t* data = static_cast<const uint8_t*>(points);
+  const long batches = (count + BATCH_SIZE - 1) / BATCH_SIZE;
+  int num_threads = num_threads_;
+#ifdef _OPENMP
+  if (num_threads <= 0)
+    num_threads = omp_get_max_threads();
+#endif
+#pragma omp parallel for num_threads(num_threads) schedule(static)
+  for (long batch = 0; batch < batches; batch++)
+  {
+    projectRange(data, batch * BATCH_SIZE, std::min(count, (batch + 1) * BATCH_SIZE), pointStep);
+  }
+
+  zBuffer();
+
+  size_t inside = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    inside += (pixels_[i] >= 0);
+  }
+  return inside;
+}
+
+void PointsProjection::projectRange(const uint8_t* points, size_t begin, size_t end, size_t pointStep)
+{
+  const float width = width_, height = height_;
+  size_t i = begin;
+
+#ifdef __SSE2__
+  const __m128 m0 = _mm_set1_ps(transform_[0]), m1 = _mm_set1_ps(transform_[1]), m2 = _mm_set1_ps(transform_[2]),
+               m3 = _mm_set1_ps(transform_[3]), m4 = _mm_set1_ps(transform_[4]), m5 = _mm_set1_ps(transform_[5]),
+               m6 = _mm_set1_ps(transform_[6]), m7 = _mm_set1_ps(transform_[7]), m8 = _mm_set1_ps(transform_[8]),
+               m9 = _mm_set1_ps(transform_[9]), m10 = _mm_set1_ps(transform_[10]), m11 = _mm_set1_ps(transform_[11]);
+  const __m128 fx = _mm_set1_ps(fx_), fy = _mm_set1_ps(fy_), cx = _mm_set1_ps(cx_ + 0.5f), cy = _mm_set1_ps(cy_ + 0.5f);
+  const __m128 k1 = _mm_set1_ps(k1_), k2 = _mm_set1_ps(k2_), k3 = _mm_set1_ps(k3_);
+  const __m128 p1 = _mm_set1_ps(p1_), p2 = _mm_set1_ps(p2_), two = _mm_set1_ps(2.0f), one = _mm_set1_ps(1.0f);
+  const __m128 min_depth = _mm_set1_ps(min_depth_), minus_one = _mm_set1_ps(-1.0f);
+  const __m128 max_u = _mm_set1_ps(width), max_v = _mm_set1_ps(height);
+  const __m128i stride = _mm_set1_epi32(width_), invalid = _mm_set1_epi32(-1);
+
+  for (; i + 4 <= end; i += 4)
+  {
+    float xs[4], ys[4], zs[4];
+    for (int k = 0; k < 4; k++)
+    {
+      const float* p = reinterpret_cast<const float*>(points + (i + k) * pointStep);
+      xs[k] = p[0];
+      ys[k] = p[1];
+      zs[k] = p[2];
+    }
+    __m128 x = _mm_loadu_ps(xs), y = _mm_loadu_ps(ys), z = _mm_loadu_ps(zs);
+
+    __m128 camera_x = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m0, x), _mm_mul_ps(m1, y)), _mm_add_ps(_mm_mul_ps(m2, z), m3));
+    __m128 camera_y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m4, x), _mm_mul_ps(m5, y)), _mm_add_ps(_mm_mul_ps(m6, z), m7));
+    __m128 camera_z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m8, x), _mm_mul_ps(m9, y)), _mm_add_ps(_mm_mul_ps(m10, z), m11));
+    _mm_storeu_ps(&depths_[i], camera_z);
+
+    __m128 tx = _mm_div_ps(camera_x, camera_z);
+    __m128 ty = _mm_div_ps(camera_y, camera_z);
+    __m128 txx = _mm_mul_ps(tx, tx), tyy = _mm_mul_ps(ty, ty), txy = _mm_mul_ps(tx, ty);
+    __m128 r2 = _mm_add_ps(txx, tyy);
+    __m128 radial = _mm_add_ps(one, _mm_mul_ps(r2, _mm_add_ps(k1, _mm_mul_ps(r2, _mm_add_ps(k2, _mm_mul_ps(r2, k3))))));
+    __m128 u = _mm_add_ps(_mm_mul_ps(tx, radial),
+                          _mm_add_ps(_mm_mul_ps(_mm_mul_ps(two, p1), txy),
+                                     _mm_mul_ps(p2, _mm_add_ps(r2, _mm_mul_ps(two, txx)))));
+    __m128 v = _mm_add_ps(_mm_mul_ps(ty, radial),
+                          _mm_add_ps(_mm_mul_ps(p1, _mm_add_ps(r2, _mm_mul_ps(two, tyy))),
+                                     _mm_mul_ps(_mm_mul_ps(two, p2), txy)));
+    u = _mm_add_ps(_mm_mul_ps(fx, u), cx);
+    v = _mm_add_ps(_mm_mul_ps(fy, v), cy);
+
+    // pixels are truncated after adding 0.5, so (-1, size) maps into the image
+    __m128 inside = _mm_and_ps(_mm_cmpgt_ps(camera_z, min_depth),
+                               _mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(u, minus_one), _mm_cmplt_ps(u, max_u)),
+                                          _mm_and_ps(_mm_cmpgt_ps(v, minus_one), _mm_cmplt_ps(v, max_v))));
+    __m128i px = _mm_cvttps_epi32(u), py = _mm_cvttps_epi32(v);
+    // rows and widths fit in 16 bits, so two 16 bit multiplies give the 32 bit product
+    __m128i pixel = _mm_add_epi32(_mm_or_si128(_mm_mullo_epi16(py, stride),
+                                               _mm_slli_epi32(_mm_mulhi_epu16(py, stride), 16)),
+                                  px);
+    __m128i mask = _mm_castps_si128(inside);
+    pixel = _mm_or_si128(_mm_and_si128(mask, pixel), _mm_andnot_si128(mask, invalid));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&pixels_[i]), pixel);
+  }
+#endif
+
+  for (; i < end; i++)
+  {
+    const float* p = reinterpret_cast<const float*>(points + i * pointStep);
+    float camera_x = transform_[0] * p[0] + transform_[1] * p[1] + transform_[2] * p[2] + transform_[3];
+    float camera_y = transform_[4] * p[0] + transform_[5] * p[1] + transform_[6] * p[2] + transform_[7];
+    float camera_z = transform_[8] * p[0] + transform_[9] * p[1] + transform_[10] * p[2] + transform_[11];
+    depths_[i] = camera_z;
+    pixels_[i] = -1;
+    if (!(camera_z > min_depth_))
+    {
+      continue;
+    }
+
+    float tx = camera_x / camera_z;
+    float ty = camera_y / camera_z;
+    float r2 = tx * tx + ty * ty;
+    float radial = 1 + r2 * (k1_ + r2 * (k2_ + r2 * k3_));
+    float u = tx * radial + 2 * p1_ * tx * ty + p2_ * (r2 + 2 * tx * tx);
+    float v = ty * radial + p1_ * (r2 + 2 * ty * ty) + 2 * p2_ * tx * ty;
+    u = fx_ * u + cx_ + 0.5f;
+    v = fy_ * v + cy_ + 0.5f;
+    if (u > -1.0f && u < width && v > -1.0f && v < height)
+    {
+      pixels_[i] = int(v) * width_ + int(u);
+    }
+  }
+}
+
+void PointsProjection::zBuffer()
+{
+  // clear what the previous scan wrote
+  for (size_t i = 0; i < hit_pixels_.size(); i++)
+  {
+    nearest_[hit_pixels_[i]] = -1;
+    depth_image_.ptr<float>()[hit_pixels_[i]] = 0.0f;
+  }
+  hit_pixels_.clear();
+
+  for (size_t i = 0; i < pixels_.size(); i++)
+  {
+    const int32_t pixel = pixels_[i];
+    if (pixel < 0)
+    {
+      continue;
+    }
+    int32_t& nearest = nearest_[pixel];
+    if (nearest < 0)
+    {
+      nearest = i;
+      hit_pixels_.push_back(pixel);
+    }
+    else if (depths_[i] < depths_[nearest])
+    {
+      nearest = i;
+    }
+  }
+
+  for (size_t i = 0; i < hit_pixels_.size(); i++)
+  {
+    depth_image_.ptr<float>()[hit_pixels_[i]] = depths_[nearest_[hit_pixels_[i]]];
+  }
+}
+
+void PointsProjection::toPointsImage(const sensor_msgs::PointCloud2& cloud, autoware_msgs::PointsImage& msg)
+{
+  const size_t size = width_ * height_;
+
+  msg.header = cloud.header;
+  if (&msg == filled_msg_ && msg.distance.size() == size && msg.intensity.size() == size &&
+      msg.min_height.size() == size && msg.max_height.size() == size)
+  {
+    // the message of the previous call, only its points need clearing
+    for (size_t i = 0; i < filled_pixels_.size(); i++)
+    {
+      const int32_t pixel = filled_pixels_[i];
+      msg.distance[pixel] = 0;
+      msg.intensity[pixel] = 0;
+      msg.min_height[pixel] = 0;
+      msg.max_height[pixel] = 0;
+    }
+  }
+  else
+  {
+    msg.intensity.assign(size, 0);
+    msg.distance.assign(size, 0);
+    msg.min_height.assign(size, 0);
+    msg.max_height.assign(size, 0);
+  }
+  filled_msg_ = &msg;
+  filled_pixels_ = hit_pixels_;
+
+  msg.max_y = -1;
+  msg.min_y = height_;
+  msg.image_height = height_;
+  msg.image_width = width_;
+
+  int z_offset = -1, intensity_offset = -1;
+  for (size_t i = 0; i < cloud.fields.size(); i++)
+  {
+    if (cloud.fields[i].datatype != sensor_msgs::PointField::FLOAT32)
+      continue;
+    if (cloud.fields[i].name == "z")
+      z_offset = cloud.fields[i].offset;
+    else if (cloud.fields[i].name == "intensity")
+      intensity_offset = cloud.fields[i].offset;
+  }
+
+  for (size_t i = 0; i < hit_pixels_.size(); i++)
+  {
+    const int32_t pixel = hit_pixels_[i];
+    const size_t index = nearest_[pixel];
+    const uint8_t* point = &cloud.data[index * cloud.point_step];
+    const int py = pixel / width_;
+
+    msg.distance[pixel] = depths_[index] * 100;
+    if (intensity_offset >= 0)
+    {
+      std::memcpy(&msg.intensity[pixel], point + intensity_offset, sizeof(float));
+    }
+    msg.max_y = std::max(msg.max_y, py);
+    msg.min_y = std::min(msg.min_y, py);
+
+    // two row clouds (vscan) carry the bottom and top of each column
+    if (cloud.height == 2 && index < cloud.width && z_offset >= 0)
+    {
+      std::memcpy(&msg.min_height[pixel], point + z_offset, sizeof(float));
+      std::memcpy(&msg.max_height[pixel], point + cloud.row_step + z_offset, sizeof(float));
+    }
+    else
+    {
+      msg.min_height[pixel] = -1.25;
+      msg.max_height[pixel] = 0;
+    }
+  }
+}
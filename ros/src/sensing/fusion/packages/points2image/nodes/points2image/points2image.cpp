@@ -35,7 +35,7 @@
 #include "autoware_msgs/projection_matrix.h"
 //#include "autoware_msgs/CameraExtrinsic.h"
 
-#include <include/points_image/points_image.hpp>
+#include <include/points_image/points_projection.hpp>
 
 #define CAMERAEXTRINSICMAT "CameraExtrinsicMat"
 #define CAMERAMAT "CameraMat"
@@ -49,6 +49,10 @@ static cv::Size imageSize;
 
 static ros::Publisher pub;
 
+static PointsProjection projection;
+static bool projection_ready = false;
+static autoware_msgs::PointsImage pub_msg;  // reused between scans
+
 static void projection_callback(const autoware_msgs::projection_matrix& msg)
 {
   cameraExtrinsicMat = cv::Mat(4, 4, CV_64F);
@@ -59,7 +63,7 @@ static void projection_callback(const autoware_msgs::projection_matrix& msg)
       cameraExtrinsicMat.at<double>(row, col) = msg.projection_matrix[row * 4 + col];
     }
   }
-  resetMatrix();
+  projection_ready = false;
 }
 
 static void intrinsic_callback(const sensor_msgs::CameraInfo& msg)
@@ -81,7 +85,7 @@ static void intrinsic_callback(const sensor_msgs::CameraInfo& msg)
   {
     distCoeff.at<double>(col) = msg.D[col];
   }
-  resetMatrix();
+  projection_ready = false;
 }
 
 static void callback(const sensor_msgs::PointCloud2ConstPtr& msg)
@@ -94,7 +98,14 @@ static void callback(const sensor_msgs::PointCloud2ConstPtr& msg)
     return;
   }
 
-  autoware_msgs::PointsImage pub_msg = pointcloud2_to_image(msg, cameraExtrinsicMat, cameraMat, distCoeff, imageSize);
+  if (!projection_ready)
+  {
+    projection.setCamera(cameraExtrinsicMat, cameraMat, distCoeff, imageSize);
+    projection_ready = true;
+  }
+
+  projection.project(*msg);
+  projection.toPointsImage(*msg, pub_msg);
   pub.publish(pub_msg);
 }
 